@@ -44,6 +44,13 @@ struct A1_chip {
 	int fail_count;
 	/* mark chip disabled, do not try to re-enable it */
 	bool disabled;
+
+	/* poll schedule, systime in ms */
+	int next_poll;
+	int last_done;
+	/* measured time of a nonce range, 0 until known */
+	int range_ms;
+	bool was_full;
 };
 
 struct A1_chain {
@@ -66,6 +73,11 @@ struct A1_chain {
 	bool disabled;
 	uint8_t temp;
 	int last_temp_time;
+
+	/* poll schedule stats */
+	uint64_t reg_polls;
+	uint64_t polls_skipped;
+	uint64_t idle_sleeps;
 };
 
 #define MAX_CHAINS_PER_BOARD	2
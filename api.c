@@ -31,7 +31,7 @@
 	defined(USE_KNC) || defined(USE_BAB) || defined(USE_DRILLBIT) || \
 	defined(USE_MINION) || defined(USE_COINTERRA) || defined(USE_BITMINE_A1) || \
 	defined(USE_ANT_S1) || defined(USE_ANT_S2) || defined(USE_SPONDOOLIES) || \
-	defined(USE_GRIDSEED) || defined(USE_ZEUS)
+	defined(USE_GRIDSEED) || defined(USE_ZEUS) || defined(USE_SIM)
 #define HAVE_AN_ASIC 1
 #endif
 
@@ -210,6 +210,9 @@ static const char *DEVICECODE = ""
 #ifdef USE_ZEUS
 			"ZUS "
 #endif
+#ifdef USE_SIM
+			"SIM "
+#endif
 
 			"";
 
@@ -2543,6 +2546,7 @@ static void pgaidentify(struct io_data *io_data, __maybe_unused SOCKETTYPE c, ch
 static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
 {
 	struct api_data *root = NULL;
+	double quota_total = 0, works_total = 0, diff_total = 0;
 	bool io_open = false;
 	char *status, *lp;
 	int i;
@@ -2554,6 +2558,16 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
 
 	message(io_data, MSG_POOL, 0, NULL, isjson);
 
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+
+		if (pool->removed)
+			continue;
+		quota_total += pool_strategy == POOL_BALANCE ? 1 : pool->quota;
+		works_total += pool->quota_used;
+		diff_total += pool->diff_accepted;
+	}
+
 	if (isjson)
 		io_open = io_add(io_data, COMSTR JSON_POOLS);
 
@@ -2591,6 +2605,16 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
 		root = api_add_string(root, "Status", status, false);
 		root = api_add_int(root, "Priority", &(pool->prio), false);
 		root = api_add_int(root, "Quota", &pool->quota, false);
+		double quotap = quota_total ? (pool_strategy == POOL_BALANCE ? 1 : pool->quota) / quota_total : 0;
+		root = api_add_percent(root, "Quota Share", &quotap, true);
+		root = api_add_double(root, "Quota Adjust", &(pool->quota_adjust), false);
+		double workp = works_total ? pool->quota_used / works_total : 0;
+		root = api_add_percent(root, "Work Share", &workp, true);
+		double diffp = diff_total ? pool->diff_accepted / diff_total : 0;
+		root = api_add_percent(root, "Diff Share", &diffp, true);
+		root = api_add_int(root, "Split Devices", &(pool->split_devs), false);
+		bool standby = pool_standby(pool);
+		root = api_add_bool(root, "Standby", &standby, true);
 		root = api_add_string(root, "Long Poll", lp, false);
 		root = api_add_uint(root, "Getworks", &(pool->getwork_requested), false);
 		root = api_add_int64(root, "Accepted", &(pool->accepted), false);
@@ -3266,6 +3290,7 @@ void dosave(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, b
 static int itemstats(struct io_data *io_data, int i, char *id, struct cgminer_stats *stats, struct cgminer_pool_stats *pool_stats, struct api_data *extra, struct cgpu_info *cgpu, bool isjson)
 {
 	struct api_data *root = NULL;
+	double latency, template_time;
 
 	root = api_add_int(root, "STATS", &i, false);
 	root = api_add_string(root, "ID", id, false);
@@ -3297,6 +3322,24 @@ static int itemstats(struct io_data *io_data, int i, char *id, struct cgminer_st
 		root = api_add_uint64(root, "Bytes Recv", &(pool_stats->bytes_received), false);
 		root = api_add_uint64(root, "Net Bytes Sent", &(pool_stats->net_bytes_sent), false);
 		root = api_add_uint64(root, "Net Bytes Recv", &(pool_stats->net_bytes_received), false);
+		root = api_add_uint64(root, "Share Results", &(pool_stats->share_results), false);
+		latency = pool_stats->share_results ?
+			  pool_stats->share_latency_total / pool_stats->share_results : 0;
+		root = api_add_double(root, "Share Latency Av", &latency, true);
+		root = api_add_double(root, "Share Latency Max", &(pool_stats->share_latency_max), false);
+		root = api_add_uint32(root, "Switches", &(pool_stats->switches), false);
+		latency = pool_stats->switches ?
+			  pool_stats->switch_latency_total / pool_stats->switches : 0;
+		root = api_add_double(root, "Switch Latency Av", &latency, true);
+		root = api_add_double(root, "Switch Latency Max", &(pool_stats->switch_latency_max), false);
+		root = api_add_int(root, "Submits In Flight", &(pool_stats->submits_inflight), false);
+		root = api_add_int(root, "Submits In Flight Max", &(pool_stats->submits_inflight_max), false);
+		root = api_add_uint32(root, "Templates", &(pool_stats->templates), false);
+		root = api_add_int(root, "Template Txns", &(pool_stats->template_txns), false);
+		template_time = pool_stats->templates ?
+				pool_stats->template_time_total / pool_stats->templates : 0;
+		root = api_add_double(root, "Template Time Av", &template_time, true);
+		root = api_add_double(root, "Template Time Max", &(pool_stats->template_time_max), false);
 	}
 
 	if (extra)
@@ -3400,6 +3443,21 @@ static void minerstats(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
 		i = itemstats(io_data, i, id, &(pool->cgminer_stats), &(pool->cgminer_pool_stats), NULL, NULL, isjson);
 	}
 
+	for (j = 0; j < total_gen_threads; j++) {
+		struct gen_thr *gen = &gen_thr[j];
+		double rate, batch;
+
+		rate = total_secs ? gen->works / total_secs : 0;
+		batch = gen->cgminer_stats.getwork_calls ?
+			(double)(gen->works) / gen->cgminer_stats.getwork_calls : 0;
+		extra = api_add_uint64(NULL, "Works", &(gen->works), false);
+		extra = api_add_double(extra, "Works/s", &rate, true);
+		extra = api_add_double(extra, "Avg Batch", &batch, true);
+
+		sprintf(id, "GEN%d", j);
+		i = itemstats(io_data, i, id, &(gen->cgminer_stats), NULL, extra, NULL, isjson);
+	}
+
 	if (isjson && io_open)
 		io_close(io_data);
 }
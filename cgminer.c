@@ -15,6 +15,7 @@
 #include <curses.h>
 #endif
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,8 @@
 
 #ifndef WIN32
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #else
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -146,12 +149,41 @@ enum benchwork {
 #ifdef HAVE_LIBCURL
 static char *opt_btc_address;
 static char *opt_btc_sig;
+static int opt_gbt_update = 60;
+static char *opt_gbt_benchmark;
+static int opt_roll_benchmark;
+static int opt_submit_conns = 4;
+#endif
+#if defined(USE_ANT_S1) || defined(USE_ANT_S2)
+static char *opt_bitmain_replay;
 #endif
 static char *opt_benchfile;
+static char *opt_benchfile_convert;
 static bool opt_benchfile_display;
-static FILE *benchfile_in;
 static int benchfile_line;
-static int benchfile_work;
+
+#define BENCHFILE_MAGIC "CGBENCH1"
+
+/* --benchfile-convert output, the header and entries are stored as is */
+struct benchfile_header {
+	char magic[8];
+	uint32_t count;
+	uint32_t entry_size;
+};
+
+struct benchfile_entry {
+	unsigned char data[80];
+	unsigned char midstate[32];
+};
+
+static struct benchfile_entry *benchfile_table;
+#ifndef WIN32
+static char *benchfile_map;
+#endif
+static int benchfile_count;
+static unsigned int benchfile_next;
+static unsigned int *benchfile_served;
+static uint64_t *benchfile_nonces;
 static bool opt_benchmark;
 bool have_longpoll;
 bool want_per_device_stats;
@@ -164,11 +196,18 @@ const int opt_cutofftemp = 95;
 int opt_log_interval = 5;
 int opt_queue = -1;
 static int max_queue = 1;
+static int opt_gen_threads = -1;
+int total_gen_threads;
+struct gen_thr *gen_thr;
 int opt_scantime = -1;
 int opt_expiry = 120;
 static const bool opt_time = true;
 unsigned long long global_hashrate;
 unsigned long global_quota_gcd = 1;
+bool opt_quota_adapt;
+bool opt_device_split;
+int opt_split_slice = 300;
+int opt_standby;
 time_t last_getwork;
 
 #if defined(USE_USBUTILS)
@@ -177,6 +216,7 @@ int nDevs;
 bool opt_sha256;
 #ifdef USE_SCRYPT
 bool opt_scrypt;
+static bool opt_scrypt_benchmark;
 #endif
 bool opt_restart = true;
 bool opt_nogpu;
@@ -223,6 +263,7 @@ static bool no_work;
 #ifdef USE_ICARUS
 char *opt_icarus_options = NULL;
 char *opt_icarus_timing = NULL;
+int opt_icarus_event_threads;
 float opt_anu_freq = 200;
 #endif
 bool opt_worktime;
@@ -247,6 +288,7 @@ char *opt_drillbit_auto = NULL;
 char *opt_bab_options = NULL;
 #ifdef USE_BITMINE_A1
 char *opt_bitmine_a1_options = NULL;
+char *opt_spi_emu = NULL;
 #endif
 #if defined(USE_ANT_S1) || defined(USE_ANT_S2)
 char *opt_bitmain_options;
@@ -264,6 +306,9 @@ char *opt_gridseed_options = NULL;
 char *opt_gridseed_freq = NULL;
 char *opt_gridseed_override = NULL;
 #endif
+#ifdef USE_SIM
+char *opt_sim_options = NULL;
+#endif
 #ifdef USE_ZEUS
 bool opt_zeus_debug;
 int opt_zeus_chips_count;
@@ -324,6 +369,14 @@ pthread_mutex_t lockstat_lock;
 
 pthread_mutex_t hash_lock;
 static pthread_mutex_t *stgd_lock;
+static pthread_mutex_t select_lock;
+/* Load balance schedule, protected by select_lock */
+#define QUOTA_SLOTS 1024
+static struct pool **quota_sched;
+static int quota_slots, quota_slot;
+static bool quota_rebuild = true;
+static bool split_rebuild = true;
+static enum pool_strategy quota_strategy;
 pthread_mutex_t console_lock;
 cglock_t ch_lock;
 static pthread_rwlock_t blk_lock;
@@ -620,13 +673,15 @@ static char *gbt_req = "{\"id\": 0, \"method\": \"getblocktemplate\", \"params\"
 static char *gbt_solo_req = "{\"id\": 0, \"method\": \"getblocktemplate\"}\n";
 
 /* Adjust all the pools' quota to the greatest common denominator after a pool
- * has been added or the quotas changed. */
+ * has been added or the quotas changed, and rebuild the load balance schedule
+ * on the next selection. */
 void adjust_quota_gcd(void)
 {
 	unsigned long gcd, lowest_quota = ~0UL, quota;
 	struct pool *pool;
 	int i;
 
+	mutex_lock(&select_lock);
 	for (i = 0; i < total_pools; i++) {
 		pool = pools[i];
 		quota = pool->quota;
@@ -649,14 +704,9 @@ void adjust_quota_gcd(void)
 	} else
 		gcd = 1;
 
-	for (i = 0; i < total_pools; i++) {
-		pool = pools[i];
-		pool->quota_used *= global_quota_gcd;
-		pool->quota_used /= gcd;
-		pool->quota_gcd = pool->quota / gcd;
-	}
-
 	global_quota_gcd = gcd;
+	quota_rebuild = split_rebuild = true;
+	mutex_unlock(&select_lock);
 	applog(LOG_DEBUG, "Global quota greatest common denominator set to %lu", gcd);
 }
 
@@ -685,6 +735,7 @@ struct pool *add_pool(void)
 	pool->rpc_req = getwork_req;
 	pool->rpc_proxy = NULL;
 	pool->quota = 1;
+	pool->quota_adjust = 1.0;
 	adjust_quota_gcd();
 
 	return pool;
@@ -1177,6 +1228,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--benchfile",
 			opt_set_charp, NULL, &opt_benchfile,
 			"Run cgminer in benchmark mode using a work file - produces no shares"),
+	OPT_WITH_ARG("--benchfile-convert",
+			opt_set_charp, NULL, &opt_benchfile_convert,
+			"Convert the --benchfile work file to a pre-decoded binary file and exit"),
 	OPT_WITHOUT_ARG("--benchfile-display",
 			opt_set_bool, &opt_benchfile_display,
 			"Display each benchfile nonce found"),
@@ -1208,6 +1262,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITHOUT_ARG("--bitmain-auto",
 			opt_set_bool, &opt_bitmain_auto,
 			"Adjust bitmain overclock frequency dynamically for best hashrate"),
+	OPT_WITH_ARG("--bitmain-capture",
+		     opt_set_charp, NULL, &opt_bitmain_capture,
+		     "Append raw data read from each bitmain device to file.<device id>"),
 	OPT_WITH_ARG("--bitmain-cutoff",
 		     set_int_0_to_100, opt_show_intval, &opt_bitmain_overheat,
 		     "Set bitmain overheat cut off temperature"),
@@ -1223,6 +1280,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--bitmain-options",
 		     opt_set_charp, NULL, &opt_bitmain_options,
 		     "Set bitmain options baud:miners:asic:timeout:freq"),
+	OPT_WITH_ARG("--bitmain-replay",
+		     opt_set_charp, NULL, &opt_bitmain_replay,
+		     "Decode a file saved with --bitmain-capture, report and exit"),
 	OPT_WITH_ARG("--bitmain-temp",
 		     set_int_0_to_100, opt_show_intval, &opt_bitmain_temp,
 		     "Set bitmain target temperature"),
@@ -1287,6 +1347,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITHOUT_ARG("--debug|-D",
 		     enable_debug, &opt_debug,
 		     "Enable debug output"),
+	OPT_WITHOUT_ARG("--device-split",
+			opt_set_bool, &opt_device_split,
+			"Split load-balance pools across devices instead of across each device's work"),
 	OPT_WITHOUT_ARG("--disable-rejecting",
 			opt_set_bool, &opt_disable_pool,
 			"Automatically disable pools that continually reject shares"),
@@ -1310,6 +1373,17 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITHOUT_ARG("--fix-protocol",
 			opt_set_bool, &opt_fix_protocol,
 			"Do not redirect to a different getwork protocol (eg. stratum)"),
+#ifdef HAVE_LIBCURL
+	OPT_WITH_ARG("--gbt-benchmark",
+		     opt_set_charp, NULL, &opt_gbt_benchmark,
+		     "Decode the GBT templates in the file in full and incrementally, report and exit"),
+	OPT_WITH_ARG("--gbt-update",
+		     set_int_1_to_65535, opt_show_intval, &opt_gbt_update,
+		     "Seconds between fetching a new GBT solo mining template"),
+#endif
+	OPT_WITH_ARG("--gen-threads",
+		     set_int_0_to_9999, opt_show_intval, &opt_gen_threads,
+		     "Number of threads generating stratum work as well as the main thread, -1 for cpus - 1"),
 #ifdef USE_GRIDSEED
 	OPT_WITH_ARG("--gridseed-options",
 			opt_set_charp, NULL, &opt_gridseed_options,
@@ -1371,6 +1445,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--icarus-timing",
 		     opt_set_charp, NULL, &opt_icarus_timing,
 		     opt_hidden),
+	OPT_WITH_ARG("--icarus-event-threads",
+		     set_int_0_to_100, opt_show_intval, &opt_icarus_event_threads,
+		     opt_hidden),
 #endif
 #if defined(HAVE_MODMINER)
 	OPT_WITH_ARG("--kernel-path|-K",
@@ -1455,6 +1532,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--quota|-U",
 		     set_quota, NULL, &opt_set_null,
 		     "quota;URL combination for server with load-balance strategy quotas"),
+	OPT_WITHOUT_ARG("--quota-adapt",
+			opt_set_bool, &opt_quota_adapt,
+			"Adapt load-balance weights so accepted difficulty, not work, follows the quotas"),
 	OPT_WITHOUT_ARG("--real-quiet",
 			opt_set_bool, &opt_realquiet,
 			"Disable all output"),
@@ -1464,6 +1544,11 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--retry-pause",
 		     set_null, NULL, &opt_set_null,
 		     opt_hidden),
+#ifdef HAVE_LIBCURL
+	OPT_WITH_ARG("--roll-benchmark",
+		     opt_set_intval, opt_show_intval, &opt_roll_benchmark,
+		     "Roll N getwork work items singly and in batches, report and exit"),
+#endif
 	OPT_WITH_ARG("--rotate",
 		     set_rotate, NULL, &opt_set_null,
 		     "Change multipool strategy from failover to regularly rotate at N minutes"),
@@ -1491,6 +1576,9 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITHOUT_ARG("--scrypt",
 		     opt_set_bool, &opt_scrypt,
 		     "Use the scrypt algorithm for mining"),
+	OPT_WITHOUT_ARG("--scrypt-benchmark",
+		     opt_set_bool, &opt_scrypt_benchmark,
+		     "Benchmark the single and multi lane cpu scrypt code and exit"),
 #endif
 	OPT_WITH_CBARG("--sharelog",
 		     set_sharelog, NULL, &opt_set_sharelog,
@@ -1498,9 +1586,30 @@ static struct opt_table opt_config_table[] = {
 	OPT_WITH_ARG("--shares",
 		     opt_set_intval, NULL, &opt_shares,
 		     "Quit after mining N shares (default: unlimited)"),
+#ifdef USE_SIM
+	OPT_WITH_ARG("--sim-options",
+		     opt_set_charp, NULL, &opt_sim_options,
+		     "Enable simulated devices with options chains:chips:chipghs:queue:noncerate:hwerr%:latencyms:diff:tmplrange"),
+#endif
 	OPT_WITH_ARG("--socks-proxy",
 		     opt_set_charp, NULL, &opt_socks_proxy,
 		     "Set socks4 proxy (host:port)"),
+#ifdef USE_BITMINE_A1
+	OPT_WITH_ARG("--spi-emu",
+		     opt_set_charp, NULL, &opt_spi_emu,
+		     "Emulate an A1 chip chain instead of using SPI with options chips:chipghs:latencyms:hwerr%:diff"),
+#endif
+	OPT_WITH_ARG("--split-slice",
+		     set_int_0_to_9999, opt_show_intval, &opt_split_slice,
+		     "Seconds between reassigning --device-split devices to pools, 0 only on pool changes"),
+	OPT_WITH_ARG("--standby",
+		     set_int_0_to_9999, opt_show_intval, &opt_standby,
+		     "Number of backup stratum pools to keep subscribed for instant failover"),
+#ifdef HAVE_LIBCURL
+	OPT_WITH_ARG("--submit-conns",
+		     set_int_1_to_1024, opt_show_intval, &opt_submit_conns,
+		     "Maximum concurrent keep-alive connections per getwork/GBT pool for share submission"),
+#endif
 #ifdef HAVE_SYSLOG_H
 	OPT_WITHOUT_ARG("--syslog",
 			opt_set_bool, &use_syslog,
@@ -1795,6 +1904,9 @@ static char *opt_verusage_and_exit(const char *extra)
 #ifdef USE_ZEUS
 		"Zeus "
 #endif
+#ifdef USE_SIM
+		"simulator "
+#endif
 #ifdef USE_SCRYPT
 		"scrypt "
 #endif
@@ -1863,17 +1975,22 @@ static bool jobj_binary(const json_t *obj, const char *key,
 }
 #endif
 
-static void calc_midstate(struct work *work)
+static void __calc_midstate(unsigned char *midstate, unsigned char *work_data)
 {
 	unsigned char data[64];
 	uint32_t *data32 = (uint32_t *)data;
 	sha256_ctx ctx;
 
-	flip64(data32, work->data);
+	flip64(data32, work_data);
 	sha256_init(&ctx);
 	sha256_update(&ctx, data, 64);
-	memcpy(work->midstate, ctx.h, 32);
-	endian_flip32(work->midstate, work->midstate);
+	memcpy(midstate, ctx.h, 32);
+	endian_flip32(midstate, midstate);
+}
+
+static void calc_midstate(struct work *work)
+{
+	__calc_midstate(work->midstate, work->data);
 }
 
 /* Returns the current value of total_work and increments it */
@@ -1900,6 +2017,34 @@ static struct work *make_work(void)
 	return work;
 }
 
+static struct gbt_template *new_gbt_template(void)
+{
+	struct gbt_template *tmpl = calloc(1, sizeof(*tmpl));
+
+	if (unlikely(!tmpl))
+		quithere(1, "Failed to calloc gbt template");
+	tmpl->refs = 1;
+	return tmpl;
+}
+
+static struct gbt_template *ref_gbt_template(struct gbt_template *tmpl)
+{
+	__sync_add_and_fetch(&tmpl->refs, 1);
+	return tmpl;
+}
+
+static void release_gbt_template(struct gbt_template *tmpl)
+{
+	if (__sync_sub_and_fetch(&tmpl->refs, 1))
+		return;
+
+	HASH_CLEAR(hh, tmpl->txn_index);
+	free(tmpl->coinbase);
+	free(tmpl->txn);
+	free(tmpl->txn_bin);
+	free(tmpl);
+}
+
 /* This is the central place all work that is about to be retired should be
  * cleaned to remove any dynamically allocated arrays within the struct */
 void clean_work(struct work *work)
@@ -1908,6 +2053,8 @@ void clean_work(struct work *work)
 	free(work->ntime);
 	free(work->coinbase);
 	free(work->nonce1);
+	if (work->gbt_tmpl)
+		release_gbt_template(work->gbt_tmpl);
 	memset(work, 0, sizeof(struct work));
 }
 
@@ -1924,18 +2071,31 @@ static void calc_diff(struct work *work, double known);
 char *workpadding = "000000800000000000000000000000000000000000000000000000000000000000000000000000000000000080020000";
 
 #ifdef HAVE_LIBCURL
-/* Process transactions with GBT by storing the binary value of the first
- * transaction, and the hashes of the remaining transactions since these
- * remain constant with an altered coinbase when generating work. Must be
- * entered under gbt_lock */
-static void gbt_merkle_bins(struct pool *pool, json_t *transaction_arr);
-
+/* Process transactions with GBT by storing them in binary with their txids
+ * and the merkle branch, which remain constant with an altered coinbase when
+ * generating work. */
+static bool gbt_merkle_bins(struct pool *pool, json_t *transaction_arr,
+			    struct gbt_template *tmpl, struct gbt_template *prev);
+
+/* Pooled GBT only needs the merkle branch, the template is kept to diff the
+ * next one against. Must be entered under gbt_lock */
 static void __build_gbt_txns(struct pool *pool, json_t *res_val)
 {
+	struct gbt_template *tmpl = new_gbt_template();
 	json_t *txn_array;
 
+	pool->transactions = 0;
+	pool->merkles = 0;
 	txn_array = json_object_get(res_val, "transactions");
-	gbt_merkle_bins(pool, txn_array);
+	if (gbt_merkle_bins(pool, txn_array, tmpl, pool->gbt_tmpl)) {
+		pool->transactions = tmpl->transactions;
+		pool->merkles = tmpl->merkles;
+		memcpy(pool->merklebin, tmpl->merklebin, tmpl->merkles * 32);
+		if (pool->gbt_tmpl)
+			release_gbt_template(pool->gbt_tmpl);
+		pool->gbt_tmpl = tmpl;
+	} else
+		release_gbt_template(tmpl);
 }
 
 static void __gbt_merkleroot(struct pool *pool, unsigned char *merkle_root)
@@ -2172,100 +2332,211 @@ static bool pool_localgen(struct pool *pool)
 	return (pool->has_stratum || pool->has_gbt || pool->gbt_solo);
 }
 
-static void gbt_merkle_bins(struct pool *pool, json_t *transaction_arr)
-{
-	unsigned char *hashbin;
-	json_t *arr_val;
-	int i, j, binleft, binlen;
+/* Below this many transactions per thread it isn't worth starting threads to
+ * decode and hash them */
+#define GBT_TXNS_PER_THREAD 256
 
-	free(pool->txn_data);
-	pool->txn_data = NULL;
-	pool->transactions = 0;
-	pool->merkles = 0;
-	pool->transactions = json_array_size(transaction_arr);
-	binlen = pool->transactions * 32 + 32;
-	hashbin = alloca(binlen + 32);
-	memset(hashbin, 0, 32);
-	binleft = binlen / 32;
-	if (pool->transactions) {
-		int len = 1, ofs = 0;
-		const char *txn;
-
-		for (i = 0; i < pool->transactions; i++) {
-			arr_val = json_array_get(transaction_arr, i);
-			txn = json_string_value(json_object_get(arr_val, "data"));
-			if (!txn) {
-				applog(LOG_ERR, "Pool %d json_string_value fail - cannot find transaction data",
-					pool->pool_no);
-				return;
-			}
-			len += strlen(txn);
-		}
+struct gbt_txn_job {
+	struct pool *pool;
+	json_t *transaction_arr;
+	struct gbt_template *tmpl;
+	struct gbt_template *prev;
+	int start;
+	int end;
+	int reused;
+	bool ok;
+	pthread_t pth;
+};
+
+/* Decode a range of transactions into their binary offsets in the template
+ * and store their txids. Transactions carried over from the previous template
+ * are copied from it rather than decoded, and only hashed if the pool didn't
+ * send their txids and they aren't in the same place as last time. */
+static void *gbt_txn_thread(void *userdata)
+{
+	struct gbt_txn_job *job = (struct gbt_txn_job *)userdata;
+	struct gbt_template *tmpl = job->tmpl, *prev = job->prev;
+	int i;
 
-		pool->txn_data = malloc(len + 1);
-		if (unlikely(!pool->txn_data))
-			quit(1, "Failed to calloc txn_data in gbt_merkle_bins");
-		pool->txn_data[len] = '\0';
+	for (i = job->start; i < job->end; i++) {
+		struct gbt_txn *txn = &tmpl->txn[i], *old = NULL;
+		unsigned char *txn_bin = tmpl->txn_bin + txn->ofs;
+		unsigned char binswap[32];
+		const char *data, *hash;
+		json_t *arr_val;
 
-		for (i = 0; i < pool->transactions; i++) {
-			unsigned char binswap[32];
-			const char *hash;
+		arr_val = json_array_get(job->transaction_arr, i);
+		data = json_string_value(json_object_get(arr_val, "data"));
 
-			arr_val = json_array_get(transaction_arr, i);
+		/* Segwit templates have both and only txid is in the merkle
+		 * tree */
+		hash = json_string_value(json_object_get(arr_val, "txid"));
+		if (!hash)
 			hash = json_string_value(json_object_get(arr_val, "hash"));
-			txn = json_string_value(json_object_get(arr_val, "data"));
-			len = strlen(txn);
-			memcpy(pool->txn_data + ofs, txn, len);
-			ofs += len;
-			if (!hash) {
-				unsigned char *txn_bin;
-				int txn_len;
-
-				txn_len = len / 2;
-				txn_bin = malloc(txn_len);
-				if (!txn_bin)
-					quit(1, "Failed to malloc txn_bin in gbt_merkle_bins");
-				hex2bin(txn_bin, txn, txn_len);
-				/* This is needed for pooled mining since only
-				 * transaction data and not hashes are sent */
-				gen_hash(txn_bin, hashbin + 32 + 32 * i, txn_len);
+		if (hash) {
+			if (unlikely(!hex2bin(binswap, hash, 32))) {
+				applog(LOG_ERR, "Failed to hex2bin hash in gbt_merkle_bins");
+				return NULL;
+			}
+			swab256(txn->txid, binswap);
+			if (prev)
+				HASH_FIND(hh, prev->txn_index, txn->txid, 32, old);
+			if (old && old->len == txn->len) {
+				memcpy(txn_bin, prev->txn_bin + old->ofs, txn->len);
+				job->reused++;
 				continue;
 			}
-			if (!hex2bin(binswap, hash, 32)) {
-				applog(LOG_ERR, "Failed to hex2bin hash in gbt_merkle_bins");
-				return;
+		}
+
+		if (unlikely(!hex2bin(txn_bin, data, txn->len))) {
+			applog(LOG_ERR, "Pool %d failed to hex2bin transaction %d data",
+			       job->pool->pool_no, i);
+			return NULL;
+		}
+		if (hash)
+			continue;
+
+		/* This is needed for pooled mining since only transaction
+		 * data and not hashes are sent */
+		if (prev && i < prev->transactions) {
+			old = &prev->txn[i];
+			if (old->len == txn->len && !memcmp(txn_bin, prev->txn_bin + old->ofs, txn->len)) {
+				memcpy(txn->txid, old->txid, 32);
+				job->reused++;
+				continue;
 			}
-			swab256(hashbin + 32 + 32 * i, binswap);
 		}
+		gen_hash(txn_bin, txn->txid, txn->len);
 	}
-	if (binleft > 1) {
-		while (42) {
-			if (binleft == 1)
-				break;
-			memcpy(pool->merklebin + (pool->merkles * 32), hashbin + 32, 32);
-			pool->merkles++;
-			if (binleft % 2) {
-				memcpy(hashbin + binlen, hashbin + binlen - 32, 32);
-				binlen += 32;
-				binleft++;
-			}
-			for (i = 32, j = 64; j < binlen; i += 32, j += 64) {
-				gen_hash(hashbin + j, hashbin + i, 64);
-			}
-			binleft /= 2;
-			binlen = binleft * 32;
+	job->ok = true;
+
+	return NULL;
+}
+
+/* Build the merkle branch from the txids in a scratch copy with the
+ * coinbase's slot left empty, the branch being the hash beside it on each
+ * level */
+static void gbt_merkle_tree(struct gbt_template *tmpl)
+{
+	unsigned char *hashbin;
+	int count, i;
+
+	count = tmpl->transactions + 1;
+	hashbin = calloc(count + 1, 32);
+	if (unlikely(!hashbin))
+		quithere(1, "Failed to calloc merkle hashbin");
+	for (i = 0; i < tmpl->transactions; i++)
+		memcpy(hashbin + (i + 1) * 32, tmpl->txn[i].txid, 32);
+
+	tmpl->merkles = 0;
+	while (count > 1) {
+		memcpy(tmpl->merklebin + tmpl->merkles * 32, hashbin + 32, 32);
+		tmpl->merkles++;
+		if (count % 2) {
+			memcpy(hashbin + count * 32, hashbin + (count - 1) * 32, 32);
+			count++;
+		}
+		count /= 2;
+		for (i = 1; i < count; i++)
+			gen_hash(hashbin + i * 64, hashbin + i * 32, 64);
+	}
+	free(hashbin);
+}
+
+/* Decodes the template's transactions, diffing them against the previous
+ * template from the pool if there is one */
+static bool gbt_merkle_bins(struct pool *pool, json_t *transaction_arr,
+			    struct gbt_template *tmpl, struct gbt_template *prev)
+{
+	struct gbt_txn_job *jobs;
+	int i, threads;
+	bool ret = true;
+
+	tmpl->transactions = json_array_size(transaction_arr);
+	if (unlikely(tmpl->transactions > 65535)) {
+		applog(LOG_ERR, "Pool %d sent too many transactions (%d)", pool->pool_no,
+		       tmpl->transactions);
+		return false;
+	}
+	if (tmpl->transactions) {
+		tmpl->txn = calloc(tmpl->transactions, sizeof(struct gbt_txn));
+		if (unlikely(!tmpl->txn))
+			quithere(1, "Failed to calloc txns");
+	}
+
+	tmpl->txn_len = 0;
+	for (i = 0; i < tmpl->transactions; i++) {
+		json_t *arr_val = json_array_get(transaction_arr, i);
+		const char *txn = json_string_value(json_object_get(arr_val, "data"));
+
+		if (!txn) {
+			applog(LOG_ERR, "Pool %d json_string_value fail - cannot find transaction data",
+				pool->pool_no);
+			return false;
+		}
+		tmpl->txn[i].ofs = tmpl->txn_len;
+		tmpl->txn[i].len = strlen(txn) / 2;
+		tmpl->txn_len += tmpl->txn[i].len;
+	}
+
+	if (tmpl->transactions) {
+		tmpl->txn_bin = malloc(tmpl->txn_len);
+		if (unlikely(!tmpl->txn_bin))
+			quithere(1, "Failed to malloc txn_bin in gbt_merkle_bins");
+
+		threads = MIN(num_processors, tmpl->transactions / GBT_TXNS_PER_THREAD);
+		if (threads < 1)
+			threads = 1;
+		jobs = calloc(threads, sizeof(*jobs));
+		if (unlikely(!jobs))
+			quithere(1, "Failed to calloc txn jobs");
+		for (i = 0; i < threads; i++) {
+			jobs[i].pool = pool;
+			jobs[i].transaction_arr = transaction_arr;
+			jobs[i].tmpl = tmpl;
+			jobs[i].prev = prev;
+			jobs[i].start = tmpl->transactions * i / threads;
+			jobs[i].end = tmpl->transactions * (i + 1) / threads;
+			if (i && unlikely(pthread_create(&jobs[i].pth, NULL, gbt_txn_thread, &jobs[i])))
+				quithere(1, "Failed to create gbt txn thread");
+		}
+		gbt_txn_thread(&jobs[0]);
+		for (i = 0; i < threads; i++) {
+			if (i)
+				pthread_join(jobs[i].pth, NULL);
+			if (!jobs[i].ok)
+				ret = false;
+			tmpl->reused += jobs[i].reused;
+		}
+		free(jobs);
+		if (!ret)
+			return false;
+
+		for (i = 0; i < tmpl->transactions; i++) {
+			struct gbt_txn *txn = &tmpl->txn[i], *dup;
+
+			/* Templates shouldn't have duplicates but if they do
+			 * keep the first for lookups */
+			HASH_FIND(hh, tmpl->txn_index, txn->txid, 32, dup);
+			if (likely(!dup))
+				HASH_ADD(hh, tmpl->txn_index, txid, 32, txn);
 		}
 	}
+
+	gbt_merkle_tree(tmpl);
+
 	if (opt_debug) {
 		char hashhex[68];
 
-		for (i = 0; i < pool->merkles; i++) {
-			__bin2hex(hashhex, pool->merklebin + i * 32, 32);
+		for (i = 0; i < tmpl->merkles; i++) {
+			__bin2hex(hashhex, tmpl->merklebin + i * 32, 32);
 			applog(LOG_DEBUG, "MH%d %s",i, hashhex);
 		}
 	}
-	applog(LOG_INFO, "Stored %d transactions from pool %d", pool->transactions,
-		pool->pool_no);
+	applog(LOG_INFO, "Stored %d transactions from pool %d, %d reused",
+	       tmpl->transactions, pool->pool_no, tmpl->reused);
+
+	return true;
 }
 
 static double diff_from_target(void *target);
@@ -2276,7 +2547,9 @@ static unsigned char scriptsig_header_bin[41];
 static bool gbt_solo_decode(struct pool *pool, json_t *res_val)
 {
 	json_t *transaction_arr, *coinbase_aux;
+	struct gbt_template *tmpl, *old;
 	const char *previousblockhash;
+	bool ret;
 	unsigned char hash_swap[32];
 	struct timeval now;
 	const char *target;
@@ -2315,6 +2588,22 @@ static bool gbt_solo_decode(struct pool *pool, json_t *res_val)
 	applog(LOG_DEBUG, "height: %d", height);
 	applog(LOG_DEBUG, "flags: %s", flags);
 
+	/* Decode and hash the transactions before taking the lock */
+	cg_rlock(&pool->gbt_lock);
+	old = pool->gbt_tmpl;
+	if (old)
+		ref_gbt_template(old);
+	cg_runlock(&pool->gbt_lock);
+
+	tmpl = new_gbt_template();
+	ret = gbt_merkle_bins(pool, transaction_arr, tmpl, old);
+	if (old)
+		release_gbt_template(old);
+	if (unlikely(!ret)) {
+		release_gbt_template(tmpl);
+		return false;
+	}
+
 	cg_wlock(&pool->gbt_lock);
 	hex2bin(hash_swap, previousblockhash, 32);
 	swap256(pool->previousblockhash, hash_swap);
@@ -2331,7 +2620,8 @@ static bool gbt_solo_decode(struct pool *pool, json_t *res_val)
 	snprintf(pool->nbit, 9, "%s", bits);
 	pool->nValue = coinbasevalue;
 	hex2bin((unsigned char *)&pool->gbt_bits, bits, 4);
-	gbt_merkle_bins(pool, transaction_arr);
+	pool->transactions = tmpl->transactions;
+	pool->merkles = tmpl->merkles;
 	pool->height = height;
 
 	memset(pool->scriptsig_base, 0, 42);
@@ -2362,7 +2652,7 @@ static bool gbt_solo_decode(struct pool *pool, json_t *res_val)
 
 	/* Followed by extranonce size, fixed at 8 */
 	pool->scriptsig_base[ofs++] = 8;
-	pool->nonce2_offset = 41 + ofs;
+	tmpl->nonce2_offset = 41 + ofs;
 	ofs += 8;
 
 	if (opt_btc_sig) {
@@ -2384,22 +2674,30 @@ static bool gbt_solo_decode(struct pool *pool, json_t *res_val)
 		+ 8 // value
 		+ 1 + 25 // txout
 		+ 4; // lock
-	free(pool->coinbase);
-	pool->coinbase = calloc(len, 1);
-	if (unlikely(!pool->coinbase))
+	tmpl->coinbase = calloc(len, 1);
+	if (unlikely(!tmpl->coinbase))
 		quit(1, "Failed to calloc coinbase in gbt_solo_decode");
 
-	memcpy(pool->coinbase + 41, pool->scriptsig_base, ofs);
-	memcpy(pool->coinbase + 41 + ofs, "\xff\xff\xff\xff", 4);
-	pool->coinbase[41 + ofs + 4] = 1;
-	u64 = (uint64_t *)&(pool->coinbase[41 + ofs + 4 + 1]);
+	memcpy(tmpl->coinbase, scriptsig_header_bin, 41);
+	memcpy(tmpl->coinbase + 41, pool->scriptsig_base, ofs);
+	memcpy(tmpl->coinbase + 41 + ofs, "\xff\xff\xff\xff", 4);
+	tmpl->coinbase[41 + ofs + 4] = 1;
+	u64 = (uint64_t *)&(tmpl->coinbase[41 + ofs + 4 + 1]);
 	*u64 = htole64(coinbasevalue);
+	tmpl->coinbase[41 + ofs + 4 + 1 + 8] = 25;
+	memcpy(tmpl->coinbase + 41 + ofs + 4 + 1 + 8 + 1, pool->script_pubkey, 25);
 
 	pool->nonce2 = 0;
-	pool->n2size = 4;
-	pool->coinbase_len = 41 + ofs + 4 + 1 + 8 + 1 + 25 + 4;
+	pool->n2size = tmpl->n2size = 4;
+	pool->nonce2_offset = tmpl->nonce2_offset;
+	pool->coinbase_len = tmpl->coinbase_len = len;
+	old = pool->gbt_tmpl;
+	pool->gbt_tmpl = tmpl;
 	cg_wunlock(&pool->gbt_lock);
 
+	if (old)
+		release_gbt_template(old);
+
 	snprintf(header, 225, "%s%s%s%s%s%s%s",
 		 pool->bbversion,
 		 pool->prev_hash,
@@ -2414,9 +2712,121 @@ static bool gbt_solo_decode(struct pool *pool, json_t *res_val)
 	return true;
 }
 
+/* Account for the time taken to decode a GBT template and its transactions */
+static void gbt_template_time(struct pool *pool, struct timeval *tv_start)
+{
+	struct cgminer_pool_stats *pool_stats = &(pool->cgminer_pool_stats);
+	struct timeval now;
+	double secs;
+
+	cgtime(&now);
+	secs = tdiff(&now, tv_start);
+	mutex_lock(&stats_lock);
+	pool_stats->templates++;
+	pool_stats->template_txns = pool->transactions;
+	pool_stats->template_time_total += secs;
+	if (secs > pool_stats->template_time_max)
+		pool_stats->template_time_max = secs;
+	mutex_unlock(&stats_lock);
+
+	applog(LOG_INFO, "Pool %d GBT template with %d transactions processed in %.3fms",
+	       pool->pool_no, pool->transactions, secs * 1000.0);
+}
+
+/* Decode each template in the file, as getblocktemplate results or replies
+ * one after another, both from scratch and incrementally against the template
+ * before it to compare the cost of updating solo mining templates */
+static void gbt_benchmark(const char *filename)
+{
+	double parse_total = 0, full_total = 0, full_max = 0, incr_total = 0, incr_max = 0;
+	int templates = 0, txns = 0, reused = 0;
+	struct pool *full, *incr;
+	json_error_t err;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f)
+		early_quit(1, "Failed to open GBT benchmark file %s", filename);
+
+	full = calloc(1, sizeof(*full));
+	incr = calloc(1, sizeof(*incr));
+	if (unlikely(!full || !incr))
+		quit(1, "Failed to calloc benchmark pools");
+	cglock_init(&full->gbt_lock);
+	cglock_init(&incr->gbt_lock);
+
+	while (42) {
+		struct timeval tv_start, tv_end;
+		json_t *val, *res_val;
+		double secs;
+		int c;
+
+		do {
+			c = fgetc(f);
+		} while (isspace(c));
+		if (c == EOF)
+			break;
+		ungetc(c, f);
+
+		cgtime(&tv_start);
+		val = json_loadf(f, JSON_DISABLE_EOF_CHECK, &err);
+		cgtime(&tv_end);
+		if (!val)
+			early_quit(1, "Failed to parse template %d in %s: %s", templates, filename, err.text);
+		parse_total += tdiff(&tv_end, &tv_start);
+		res_val = json_object_get(val, "result");
+		if (!res_val)
+			res_val = val;
+
+		if (full->gbt_tmpl) {
+			release_gbt_template(full->gbt_tmpl);
+			full->gbt_tmpl = NULL;
+		}
+		cgtime(&tv_start);
+		if (!gbt_solo_decode(full, res_val))
+			early_quit(1, "Failed to decode template %d in %s", templates, filename);
+		cgtime(&tv_end);
+		secs = tdiff(&tv_end, &tv_start);
+		full_total += secs;
+		if (secs > full_max)
+			full_max = secs;
+
+		cgtime(&tv_start);
+		if (!gbt_solo_decode(incr, res_val))
+			early_quit(1, "Failed to decode template %d in %s", templates, filename);
+		cgtime(&tv_end);
+		secs = tdiff(&tv_end, &tv_start);
+		incr_total += secs;
+		if (secs > incr_max)
+			incr_max = secs;
+
+		if (memcmp(full->gbt_tmpl->merklebin, incr->gbt_tmpl->merklebin, full->gbt_tmpl->merkles * 32))
+			early_quit(1, "Incremental merkle branch mismatch on template %d", templates);
+
+		txns += incr->gbt_tmpl->transactions;
+		reused += incr->gbt_tmpl->reused;
+		templates++;
+		json_decref(val);
+	}
+	fclose(f);
+
+	if (!templates)
+		early_quit(1, "No templates found in %s", filename);
+
+	applog(LOG_WARNING, "GBT %d templates av %d txns, parse av %.3fms", templates,
+	       txns / templates, parse_total * 1000.0 / templates);
+	applog(LOG_WARNING, "GBT full decode av %.3fms max %.3fms",
+	       full_total * 1000.0 / templates, full_max * 1000.0);
+	applog(LOG_WARNING, "GBT incremental decode av %.3fms max %.3fms,"
+	       " %.1f%% txns reused (%.2fx)", incr_total * 1000.0 / templates, incr_max * 1000.0,
+	       txns ? reused * 100.0 / txns : 0.0,
+	       incr_total > 0 ? full_total / incr_total : 0.0);
+}
+
 static bool work_decode(struct pool *pool, struct work *work, json_t *val)
 {
 	json_t *res_val = json_object_get(val, "result");
+	struct timeval tv_start;
 	bool ret = false;
 
 	cgtime(&pool->tv_lastwork);
@@ -2426,13 +2836,17 @@ static bool work_decode(struct pool *pool, struct work *work, json_t *val)
 	}
 
 	if (pool->gbt_solo) {
+		cgtime(&tv_start);
 		if (unlikely(!gbt_solo_decode(pool, res_val)))
 			goto out;
+		gbt_template_time(pool, &tv_start);
 		ret = true;
 		goto out;
 	} else if (pool->has_gbt) {
+		cgtime(&tv_start);
 		if (unlikely(!gbt_decode(pool, res_val)))
 			goto out;
+		gbt_template_time(pool, &tv_start);
 		work->gbt = true;
 		ret = true;
 		goto out;
@@ -2650,6 +3064,11 @@ static bool shared_strategy(void)
 	return (pool_strategy == POOL_LOADBALANCE || pool_strategy == POOL_BALANCE);
 }
 
+static bool device_split(void)
+{
+	return opt_device_split && shared_strategy();
+}
+
 #ifdef HAVE_CURSES
 #define CURBUFSIZ 256
 #define cg_mvwprintw(win, y, x, fmt, ...) do { \
@@ -3004,6 +3423,7 @@ static void reject_pool(struct pool *pool)
 }
 
 static void restart_threads(void);
+static void restart_pool_threads(struct pool *pool);
 
 /* Theoretically threads could race when modifying accepted and
  * rejected values but the chance of two submits completing at the
@@ -3012,13 +3432,34 @@ static void
 share_result(json_t *val, json_t *res, json_t *err, const struct work *work,
 	     char *hashshow, bool resubmit, char *worktime)
 {
+	struct cgminer_pool_stats *pool_stats = &(work->pool->cgminer_pool_stats);
 	struct pool *pool = work->pool;
 	struct cgpu_info *cgpu;
+	struct timeval tv_result;
+	double latency;
 
 	cgpu = get_thr_cgpu(work->thr_id);
 
+	/* Time from the device finding the share to the pool's verdict */
+	cgtime(&tv_result);
+	latency = tdiff(&tv_result, (struct timeval *)&work->tv_work_found);
+	mutex_lock(&stats_lock);
+	pool_stats->share_results++;
+	pool_stats->share_latency_total += latency;
+	if (latency > pool_stats->share_latency_max)
+		pool_stats->share_latency_max = latency;
+	mutex_unlock(&stats_lock);
+
 	if (json_is_true(res) || (work->gbt && json_is_null(res))) {
 		mutex_lock(&stats_lock);
+		if (pool->switch_pending) {
+			latency = tdiff(&tv_result, &pool->tv_switch);
+			pool->switch_pending = false;
+			pool_stats->switches++;
+			pool_stats->switch_latency_total += latency;
+			if (latency > pool_stats->switch_latency_max)
+				pool_stats->switch_latency_max = latency;
+		}
 		cgpu->accepted++;
 		total_accepted++;
 		pool->accepted++;
@@ -3175,25 +3616,70 @@ static void print_status(int thr_id)
 		text_print_status(thr_id);
 }
 
-static bool submit_upstream_work(struct work *work, CURL *curl, bool resubmit)
+/* Serialise the hex block for a solved solo work item from its template */
+static char *gbt_solo_block(struct work *work)
 {
-	json_t *val, *res, *err;
-	char *s;
-	bool rc = false;
-	int thr_id = work->thr_id;
-	struct cgpu_info *cgpu;
-	struct pool *pool = work->pool;
-	int rolltime;
-	struct timeval tv_submit, tv_submit_reply;
-	char hashshow[64 + 4] = "";
-	char worktime[200] = "";
-	struct timeval now;
-	double dev_runtime;
+	struct gbt_template *tmpl = work->gbt_tmpl;
+	unsigned char data[80], varint[5], *coinbase;
+	uint64_t nonce2le;
+	int varlen;
+	char *block, *p;
+
+	flip80(data, work->data);
+	if (work->gbt_txns < 0xfd) {
+		varint[0] = work->gbt_txns;
+		varlen = 1;
+	} else if (work->gbt_txns <= 0xffff) {
+		uint16_t val16 = htole16(work->gbt_txns);
+
+		varint[0] = 0xfd;
+		memcpy(varint + 1, &val16, 2);
+		varlen = 3;
+	} else {
+		uint32_t val32 = htole32(work->gbt_txns);
 
-	cgpu = get_thr_cgpu(thr_id);
+		varint[0] = 0xfe;
+		memcpy(varint + 1, &val32, 4);
+		varlen = 5;
+	}
+
+	coinbase = alloca(tmpl->coinbase_len);
+	memcpy(coinbase, tmpl->coinbase, tmpl->coinbase_len);
+	nonce2le = htole64(work->nonce2);
+	memcpy(coinbase + tmpl->nonce2_offset, &nonce2le, tmpl->n2size);
+
+	block = malloc((80 + varlen + tmpl->coinbase_len + tmpl->txn_len) * 2 + 1);
+	if (unlikely(!block))
+		quithere(1, "Failed to malloc block");
+	p = block;
+	__bin2hex(p, data, 80);
+	p += 160;
+	__bin2hex(p, varint, varlen);
+	p += varlen * 2;
+	__bin2hex(p, coinbase, tmpl->coinbase_len);
+	p += tmpl->coinbase_len * 2;
+	if (tmpl->txn_len)
+		__bin2hex(p, tmpl->txn_bin, tmpl->txn_len);
+
+	return block;
+}
+
+/* Build the JSON-RPC submission for work once, so that retries send the
+ * same request */
+static char *submit_upstream_req(struct work *work)
+{
+	struct pool *pool = work->pool;
+	char *s;
 
 	/* build JSON-RPC request */
-	if (work->gbt) {
+	if (work->gbt_tmpl) {
+		char *block = gbt_solo_block(work);
+
+		s = strdup("{\"id\": 0, \"method\": \"submitblock\", \"params\": [\"");
+		s = realloc_strcat(s, block);
+		s = realloc_strcat(s, "\"]}");
+		free(block);
+	} else if (work->gbt) {
 		char gbt_block[1024], varint[12];
 		unsigned char data[80];
 
@@ -3220,15 +3706,8 @@ static bool submit_upstream_work(struct work *work, CURL *curl, bool resubmit)
 
 		s = malloc(1024);
 		if (unlikely(!s))
-			quit(1, "Failed to malloc s in submit_upstream_work");
+			quit(1, "Failed to malloc s in submit_upstream_req");
 		sprintf(s, "{\"id\": 0, \"method\": \"submitblock\", \"params\": [\"%s", gbt_block);
-		/* Has submit/coinbase support */
-		if (!pool->has_gbt) {
-			cg_rlock(&pool->gbt_lock);
-			if (pool->txn_data)
-				s = realloc_strcat(s, pool->txn_data);
-			cg_runlock(&pool->gbt_lock);
-		}
 		if (work->job_id) {
 			s = realloc_strcat(s, "\", {\"workid\": \"");
 			s = realloc_strcat(s, work->job_id);
@@ -3251,14 +3730,28 @@ static bool submit_upstream_work(struct work *work, CURL *curl, bool resubmit)
 	applog(LOG_DEBUG, "DBG: sending %s submit RPC call: %s", pool->rpc_url, s);
 	s = realloc_strcat(s, "\n");
 
-	cgtime(&tv_submit);
-	/* issue JSON-RPC request */
-	val = json_rpc_call(curl, pool->rpc_url, pool->rpc_userpass, s, false, false, &rolltime, pool, true);
-	cgtime(&tv_submit_reply);
-	free(s);
+	return s;
+}
+
+/* Process the pool's reply, val, to a submission of work. Returns false if
+ * there was no reply and the submission should be retried. */
+static bool submit_upstream_result(struct work *work, json_t *val, bool resubmit,
+				   struct timeval *tv_submit, struct timeval *tv_submit_reply)
+{
+	json_t *res, *err;
+	bool rc = false;
+	int thr_id = work->thr_id;
+	struct cgpu_info *cgpu;
+	struct pool *pool = work->pool;
+	char hashshow[64 + 4] = "";
+	char worktime[200] = "";
+	struct timeval now;
+	double dev_runtime;
+
+	cgpu = get_thr_cgpu(thr_id);
 
 	if (unlikely(!val)) {
-		applog(LOG_INFO, "submit_upstream_work json_rpc_call failed");
+		applog(LOG_INFO, "submit_upstream_result json_rpc_call failed");
 		if (!pool_tset(pool, &pool->submit_fail)) {
 			total_ro++;
 			pool->remotefail_occasions++;
@@ -3268,7 +3761,6 @@ static bool submit_upstream_work(struct work *work, CURL *curl, bool resubmit)
 			}
 			applog(LOG_WARNING, "Pool %d communication failure, caching submissions", pool->pool_no);
 		}
-		cgsleep_ms(5000);
 		goto out;
 	} else if (pool_tclear(pool, &pool->submit_fail))
 		applog(LOG_WARNING, "Pool %d communication resumed, submitting work", pool->pool_no);
@@ -3288,15 +3780,15 @@ static bool submit_upstream_work(struct work *work, CURL *curl, bool resubmit)
 							(struct timeval *)&(work->tv_getwork_reply));
 			double work_time = tdiff((struct timeval *)&(work->tv_work_found),
 							(struct timeval *)&(work->tv_work_start));
-			double work_to_submit = tdiff(&tv_submit,
+			double work_to_submit = tdiff(tv_submit,
 							(struct timeval *)&(work->tv_work_found));
-			double submit_time = tdiff(&tv_submit_reply, &tv_submit);
+			double submit_time = tdiff(tv_submit_reply, tv_submit);
 			int diffplaces = 3;
 
 			time_t tmp_time = work->tv_getwork.tv_sec;
 			tm = localtime(&tmp_time);
 			memcpy(&tm_getwork, tm, sizeof(struct tm));
-			tmp_time = tv_submit_reply.tv_sec;
+			tmp_time = tv_submit_reply->tv_sec;
 			tm = localtime(&tmp_time);
 			memcpy(&tm_submit_reply, tm, sizeof(struct tm));
 
@@ -3422,89 +3914,146 @@ static bool pool_unworkable(struct pool *pool)
 	return false;
 }
 
-/* In balanced mode, the amount of diff1 solutions per pool is monitored as a
- * rolling average per 10 minutes and if pools start getting more, it biases
- * away from them to distribute work evenly. The share count is reset to the
- * rolling average every 10 minutes to not send all work to one pool after it
- * has been disabled/out for an extended period. */
-static struct pool *select_balanced(struct pool *cp)
+static struct pool *priority_pool(int choice);
+static bool pool_unusable(struct pool *pool);
+
+/* The configured share of work for each pool. In balanced mode every pool has
+ * the same share and the weights are adapted to even out the diff1 solutions
+ * each pool gets. */
+static double quota_base(struct pool *pool)
 {
-	int i, lowest = cp->shares;
-	struct pool *ret = cp;
+	if (pool->removed)
+		return 0;
+	if (pool_strategy == POOL_BALANCE)
+		return 1;
+	return pool->quota;
+}
 
-	for (i = 0; i < total_pools; i++) {
-		struct pool *pool = pools[i];
+/* Both load balance strategies hand out work from a smooth weighted round
+ * robin schedule that is precalculated here, so selecting a pool is O(1). Each
+ * pool gets slots in proportion to its weight and they're interleaved, so
+ * quotas of 3:1 give A A B A rather than A A A B. Pools that aren't workable
+ * when it's built are left out, with failover-only giving their share to
+ * priority pool 0 in load balance mode. Called with select_lock held. */
+static void __build_quota_sched(void)
+{
+	unsigned long gcd = pool_strategy == POOL_BALANCE ? 1 : global_quota_gcd;
+	struct pool *pool, *best, *first = NULL;
+	double total = 0, fail_weight = 0;
+	int i, slot, slots = 0;
+	bool exact = true;
 
-		if (pool_unworkable(pool))
+	for (i = 0; i < total_pools; i++) {
+		pool = pools[i];
+		pool->quota_gcd = 0;
+		if (quota_base(pool) <= 0)
+			continue;
+		if (pool->quota_adjust != 1.0)
+			exact = false;
+		if (pool_unworkable(pool)) {
+			fail_weight += quota_base(pool) * pool->quota_adjust;
 			continue;
-		if (pool->shares < lowest) {
-			lowest = pool->shares;
-			ret = pool;
 		}
+		total += quota_base(pool) * pool->quota_adjust;
+	}
+	if (opt_fail_only && pool_strategy == POOL_LOADBALANCE && fail_weight > 0) {
+		first = priority_pool(0);
+		if (pool_unworkable(first))
+			first = NULL;
+		else
+			total += fail_weight;
 	}
 
-	ret->shares++;
-	return ret;
-}
+	for (i = 0; i < total_pools; i++) {
+		double weight;
 
-static struct pool *priority_pool(int choice);
-static bool pool_unusable(struct pool *pool);
+		pool = pools[i];
+		if (quota_base(pool) <= 0 || pool_unworkable(pool))
+			continue;
+		weight = quota_base(pool) * pool->quota_adjust;
+		if (pool == first)
+			weight += fail_weight;
+		/* Small integer ratios of plain quotas are kept exactly */
+		if (exact && !first && total / gcd <= QUOTA_SLOTS)
+			pool->quota_gcd = quota_base(pool) / gcd;
+		else
+			pool->quota_gcd = round(weight / total * QUOTA_SLOTS);
+		if (pool->quota_gcd < 1)
+			pool->quota_gcd = 1;
+		pool->quota_current = 0;
+		slots += pool->quota_gcd;
+	}
+
+	if (slots > quota_slots || !quota_sched) {
+		quota_sched = realloc(quota_sched, sizeof(struct pool *) * (slots + 1));
+		if (unlikely(!quota_sched))
+			quit(1, "Failed to realloc quota_sched");
+	}
+	for (slot = 0; slot < slots; slot++) {
+		best = NULL;
+		for (i = 0; i < total_pools; i++) {
+			pool = pools[i];
+			if (!pool->quota_gcd)
+				continue;
+			pool->quota_current += pool->quota_gcd;
+			if (!best || pool->quota_current > best->quota_current)
+				best = pool;
+		}
+		best->quota_current -= slots;
+		quota_sched[slot] = best;
+	}
+	quota_slots = slots;
+	if (quota_slot >= slots)
+		quota_slot = 0;
+	quota_strategy = pool_strategy;
+	/* Keep trying while no pools are workable */
+	quota_rebuild = !slots;
+	applog(LOG_DEBUG, "Load balance schedule rebuilt with %d slots", slots);
+}
 
-/* Select any active pool in a rotating fashion when loadbalance is chosen if
- * it has any quota left. */
-static inline struct pool *select_pool(bool lagging)
+/* Find the next active pool in the schedule when loadbalance or balance is
+ * chosen without using it up, returning the schedule slot to continue from
+ * in slot, or -1 when the current pool is chosen outside the schedule. */
+static struct pool *__next_pool(bool lagging, int *slot)
 {
-	static int rotating_pool = 0;
-	struct pool *pool, *cp;
-	bool avail = false;
+	struct pool *pool = NULL, *cp;
 	int tested, i;
 
 	cp = current_pool();
+	*slot = -1;
 
-	if (pool_strategy == POOL_BALANCE) {
-		pool = select_balanced(cp);
-		goto out;
-	}
+	if (pool_strategy != POOL_LOADBALANCE && pool_strategy != POOL_BALANCE &&
+	    (!lagging || opt_fail_only))
+		return cp;
 
-	if (pool_strategy != POOL_LOADBALANCE && (!lagging || opt_fail_only)) {
-		pool = cp;
-		goto out;
-	} else
-		pool = NULL;
+	if (quota_rebuild || quota_strategy != pool_strategy)
+		__build_quota_sched();
+	*slot = quota_slot;
 
-	for (i = 0; i < total_pools; i++) {
-		struct pool *tp = pools[i];
+	/* Skip any pools that have stopped being workable since the schedule
+	 * was built, and leave them out of it if more than a round of pools
+	 * had to be skipped. */
+	for (tested = 0; tested < quota_slots; tested++) {
+		struct pool *tp = quota_sched[*slot];
 
-		if (tp->quota_used < tp->quota_gcd) {
-			avail = true;
+		if (++*slot >= quota_slots)
+			*slot = 0;
+		if (!pool_unworkable(tp)) {
+			pool = tp;
 			break;
 		}
-	}
-
-	/* There are no pools with quota, so reset them. */
-	if (!avail) {
-		for (i = 0; i < total_pools; i++)
-			pools[i]->quota_used = 0;
-		if (++rotating_pool >= total_pools)
-			rotating_pool = 0;
-	}
-
-	/* Try to find the first pool in the rotation that is usable */
-	tested = 0;
-	while (!pool && tested++ < total_pools) {
-		pool = pools[rotating_pool];
-		if (pool->quota_used++ < pool->quota_gcd) {
-			if (!pool_unworkable(pool))
+		/* Failover-only flag for load-balance means distribute
+		 * unused quota to priority pool 0. */
+		if (opt_fail_only && pool_strategy == POOL_LOADBALANCE) {
+			tp = priority_pool(0);
+			if (!pool_unworkable(tp)) {
+				pool = tp;
 				break;
-			/* Failover-only flag for load-balance means distribute
-			 * unused quota to priority pool 0. */
-			if (opt_fail_only)
-				priority_pool(0)->quota_used--;
+			}
 		}
-		pool = NULL;
-		if (++rotating_pool >= total_pools)
-			rotating_pool = 0;
 	}
+	if (tested > total_pools)
+		quota_rebuild = true;
 
 	/* If there are no alive pools with quota, choose according to
 	 * priority. */
@@ -3522,11 +4071,37 @@ static inline struct pool *select_pool(bool lagging)
 	/* If still nothing is usable, use the current pool */
 	if (!pool)
 		pool = cp;
-out:
+	return pool;
+}
+
+/* Select the next active pool in the schedule when loadbalance or balance is
+ * chosen. */
+static struct pool *__select_pool(bool lagging)
+{
+	struct pool *pool;
+	int slot;
+
+	pool = __next_pool(lagging, &slot);
+	if (slot >= 0) {
+		quota_slot = slot;
+		pool->quota_used++;
+	}
 	applog(LOG_DEBUG, "Selecting pool %d for work", pool->pool_no);
 	return pool;
 }
 
+/* main() and the work generator threads all select pools */
+static struct pool *select_pool(bool lagging)
+{
+	struct pool *pool;
+
+	mutex_lock(&select_lock);
+	pool = __select_pool(lagging);
+	mutex_unlock(&select_lock);
+
+	return pool;
+}
+
 /* truediffone == 0x00000000FFFF0000000000000000000000000000000000000000000000000000
  * Generate a 256 bit binary LE target by cutting up diff into 64 bit sized
  * portions or vice versa. */
@@ -3645,123 +4220,192 @@ static void benchfile_dspwork(struct work *work, uint32_t nonce)
 
 }
 
-static bool benchfile_get_work(struct work *work)
+/* Decode one text benchfile line into entry, returns false for lines that
+ * are ignored */
+static bool benchfile_parse_line(char *buf, struct benchfile_entry *entry)
 {
-	char buf[1024];
+	char *commas[BENCHWORK_COUNT];
 	char item[1024];
-	bool got = false;
+	int i, j, len;
+	long nonce_time;
 
-	if (!benchfile_in) {
-		if (opt_benchfile)
-			benchfile_in = fopen(opt_benchfile, "r");
-		else
-			quit(1, "BENCHFILE Invalid benchfile NULL");
+	// Empty lines and lines starting with '#' or '/' are ignored
+	if (*buf == '\0' || *buf == '\n' || *buf == '\r' || *buf == '#' || *buf == '/')
+		return false;
 
-		if (!benchfile_in)
-			quit(1, "BENCHFILE Failed to open benchfile '%s'", opt_benchfile);
+	commas[0] = buf;
+	for (i = 1; i < BENCHWORK_COUNT; i++) {
+		commas[i] = strchr(commas[i-1], ',');
+		if (!commas[i]) {
+			early_quit(1, "BENCHFILE Invalid input file line %d"
+				" - field count is %d but should be %d",
+				benchfile_line, i, BENCHWORK_COUNT);
+		}
+		len = commas[i] - commas[i-1];
+		if (benchfile_data[i-1].length &&
+		    (len != benchfile_data[i-1].length)) {
+			early_quit(1, "BENCHFILE Invalid input file line %d "
+				"field %d (%s) length is %d but should be %d",
+				benchfile_line, i,
+				benchfile_data[i-1].name,
+				len, benchfile_data[i-1].length);
+		}
 
-		benchfile_line = 0;
+		*(commas[i]++) = '\0';
+	}
+
+	// NonceTime may have LF's etc
+	len = strlen(commas[BENCHWORK_NONCETIME]);
+	if (len < benchfile_data[BENCHWORK_NONCETIME].length) {
+		early_quit(1, "BENCHFILE Invalid input file line %d field %d"
+			" (%s) length is %d but should be least %d",
+			benchfile_line, BENCHWORK_NONCETIME+1,
+			benchfile_data[BENCHWORK_NONCETIME].name, len,
+			benchfile_data[BENCHWORK_NONCETIME].length);
+	}
 
-		if (!fgets(buf, 1024, benchfile_in))
-			quit(1, "BENCHFILE Failed to read benchfile '%s'", opt_benchfile);
+	sprintf(item, "0000000%c", commas[BENCHWORK_VERSION][0]);
 
-		got = true;
-		benchfile_work = 0;
+	j = strlen(item);
+	for (i = benchfile_data[BENCHWORK_PREVHASH].length-8; i >= 0; i -= 8) {
+		sprintf(&(item[j]), "%.8s", &commas[BENCHWORK_PREVHASH][i]);
+		j += 8;
 	}
 
-	if (!got) {
-		if (!fgets(buf, 1024, benchfile_in)) {
-			if (benchfile_work == 0)
-				quit(1, "BENCHFILE No work in benchfile '%s'", opt_benchfile);
-			fclose(benchfile_in);
-			benchfile_in = NULL;
-			return benchfile_get_work(work);
-		}
+	for (i = benchfile_data[BENCHWORK_MERKLEROOT].length-8; i >= 0; i -= 8) {
+		sprintf(&(item[j]), "%.8s", &commas[BENCHWORK_MERKLEROOT][i]);
+		j += 8;
 	}
 
-	do {
-		benchfile_line++;
+	nonce_time = atol(commas[BENCHWORK_NONCETIME]);
 
-		// Empty lines and lines starting with '#' or '/' are ignored
-		if (*buf != '\0' && *buf != '#' && *buf != '/') {
-			char *commas[BENCHWORK_COUNT];
-			int i, j, len;
-			long nonce_time;
-
-			commas[0] = buf;
-			for (i = 1; i < BENCHWORK_COUNT; i++) {
-				commas[i] = strchr(commas[i-1], ',');
-				if (!commas[i]) {
-					quit(1, "BENCHFILE Invalid input file line %d"
-						" - field count is %d but should be %d",
-						benchfile_line, i, BENCHWORK_COUNT);
-				}
-				len = commas[i] - commas[i-1];
-				if (benchfile_data[i-1].length &&
-				    (len != benchfile_data[i-1].length)) {
-					quit(1, "BENCHFILE Invalid input file line %d "
-						"field %d (%s) length is %d but should be %d",
-						benchfile_line, i,
-						benchfile_data[i-1].name,
-						len, benchfile_data[i-1].length);
-				}
+	sprintf(&(item[j]), "%08lx", nonce_time);
+	j += 8;
 
-				*(commas[i]++) = '\0';
-			}
+	strcpy(&(item[j]), commas[BENCHWORK_DIFFBITS]);
+	j += benchfile_data[BENCHWORK_DIFFBITS].length;
 
-			// NonceTime may have LF's etc
-			len = strlen(commas[BENCHWORK_NONCETIME]);
-			if (len < benchfile_data[BENCHWORK_NONCETIME].length) {
-				quit(1, "BENCHFILE Invalid input file line %d field %d"
-					" (%s) length is %d but should be least %d",
-					benchfile_line, BENCHWORK_NONCETIME+1,
-					benchfile_data[BENCHWORK_NONCETIME].name, len,
-					benchfile_data[BENCHWORK_NONCETIME].length);
-			}
+	memset(entry, 0, sizeof(*entry));
+	hex2bin(entry->data, item, j >> 1);
+	__calc_midstate(entry->midstate, entry->data);
 
-			sprintf(item, "0000000%c", commas[BENCHWORK_VERSION][0]);
+	return true;
+}
 
-			j = strlen(item);
-			for (i = benchfile_data[BENCHWORK_PREVHASH].length-8; i >= 0; i -= 8) {
-				sprintf(&(item[j]), "%.8s", &commas[BENCHWORK_PREVHASH][i]);
-				j += 8;
-			}
+static void benchfile_load_text(FILE *in)
+{
+	struct benchfile_entry *table = NULL;
+	int size = 0;
+	char buf[1024];
 
-			for (i = benchfile_data[BENCHWORK_MERKLEROOT].length-8; i >= 0; i -= 8) {
-				sprintf(&(item[j]), "%.8s", &commas[BENCHWORK_MERKLEROOT][i]);
-				j += 8;
-			}
+	benchfile_line = 0;
+	while (fgets(buf, sizeof(buf), in)) {
+		benchfile_line++;
+		if (benchfile_count >= size) {
+			size = size ? size * 2 : 64;
+			table = realloc(table, size * sizeof(*table));
+			if (unlikely(!table))
+				early_quit(1, "BENCHFILE Failed to realloc work table");
+		}
+		if (benchfile_parse_line(buf, &table[benchfile_count]))
+			benchfile_count++;
+	}
+	benchfile_table = table;
+}
+
+static void benchfile_load_binary(FILE *in)
+{
+	struct benchfile_header header;
+	struct stat st;
+	size_t size;
+
+	if (fread(&header, sizeof(header), 1, in) != 1)
+		early_quit(1, "BENCHFILE Failed to read header of '%s'", opt_benchfile);
+	benchfile_count = le32toh(header.count);
+	if (le32toh(header.entry_size) != sizeof(struct benchfile_entry))
+		early_quit(1, "BENCHFILE Invalid entry size %u in '%s'",
+			   (unsigned int)le32toh(header.entry_size), opt_benchfile);
+	size = sizeof(header) + (size_t)benchfile_count * sizeof(struct benchfile_entry);
+	if (fstat(fileno(in), &st) || (size_t)st.st_size != size)
+		early_quit(1, "BENCHFILE Truncated or invalid binary file '%s'", opt_benchfile);
+#ifndef WIN32
+	benchfile_map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+	if (benchfile_map == MAP_FAILED)
+		early_quit(1, "BENCHFILE Failed to mmap '%s'", opt_benchfile);
+	benchfile_table = (struct benchfile_entry *)(benchfile_map + sizeof(header));
+#else
+	benchfile_table = malloc(size - sizeof(header));
+	if (unlikely(!benchfile_table))
+		early_quit(1, "BENCHFILE Failed to malloc work table");
+	if (benchfile_count && fread(benchfile_table, size - sizeof(header), 1, in) != 1)
+		early_quit(1, "BENCHFILE Failed to read '%s'", opt_benchfile);
+#endif
+}
 
-			nonce_time = atol(commas[BENCHWORK_NONCETIME]);
+/* Load the whole benchfile once at startup into a table of pre-decoded work
+ * so devices can be served without any parsing or locking. Binary files as
+ * written by --benchfile-convert are mapped directly. */
+static void benchfile_load(void)
+{
+	char magic[sizeof(BENCHFILE_MAGIC) - 1];
+	FILE *in;
 
-			sprintf(&(item[j]), "%08lx", nonce_time);
-			j += 8;
+	in = fopen(opt_benchfile, "rb");
+	if (!in)
+		early_quit(1, "BENCHFILE Failed to open benchfile '%s'", opt_benchfile);
 
-			strcpy(&(item[j]), commas[BENCHWORK_DIFFBITS]);
-			j += benchfile_data[BENCHWORK_DIFFBITS].length;
+	if (fread(magic, sizeof(magic), 1, in) == 1 &&
+	    !memcmp(magic, BENCHFILE_MAGIC, sizeof(magic))) {
+		rewind(in);
+		benchfile_load_binary(in);
+	} else {
+		rewind(in);
+		benchfile_load_text(in);
+	}
+	fclose(in);
 
-			memset(work, 0, sizeof(*work));
+	if (benchfile_count == 0)
+		early_quit(1, "BENCHFILE No work in benchfile '%s'", opt_benchfile);
 
-			hex2bin(work->data, item, j >> 1);
+	benchfile_served = calloc(benchfile_count, sizeof(*benchfile_served));
+	benchfile_nonces = calloc(benchfile_count, sizeof(*benchfile_nonces));
+	if (unlikely(!benchfile_served || !benchfile_nonces))
+		early_quit(1, "BENCHFILE Failed to calloc stats");
 
-			calc_midstate(work);
+	applog(LOG_NOTICE, "BENCHFILE Loaded %d work items from '%s'",
+	       benchfile_count, opt_benchfile);
+}
 
-			benchfile_work++;
+static void benchfile_save(void)
+{
+	struct benchfile_header header;
+	FILE *out;
 
-			return true;
-		}
-	} while (fgets(buf, 1024, benchfile_in));
+	memcpy(header.magic, BENCHFILE_MAGIC, sizeof(header.magic));
+	header.count = htole32(benchfile_count);
+	header.entry_size = htole32(sizeof(struct benchfile_entry));
 
-	if (benchfile_work == 0)
-		quit(1, "BENCHFILE No work in benchfile '%s'", opt_benchfile);
-	fclose(benchfile_in);
-	benchfile_in = NULL;
-	return benchfile_get_work(work);
+	out = fopen(opt_benchfile_convert, "wb");
+	if (!out)
+		early_quit(1, "BENCHFILE Failed to create '%s'", opt_benchfile_convert);
+	if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+	    fwrite(benchfile_table, sizeof(struct benchfile_entry), benchfile_count, out) != (size_t)benchfile_count ||
+	    fclose(out))
+		early_quit(1, "BENCHFILE Failed to write '%s'", opt_benchfile_convert);
 }
 
+/* Any thread may call this, entries are handed out round robin with just an
+ * atomic increment */
 static void get_benchfile_work(struct work *work)
 {
-	benchfile_get_work(work);
+	unsigned int entry;
+
+	entry = __sync_fetch_and_add(&benchfile_next, 1) % benchfile_count;
+	__sync_fetch_and_add(&benchfile_served[entry], 1);
+
+	memcpy(work->data, benchfile_table[entry].data, sizeof(benchfile_table[entry].data));
+	memcpy(work->midstate, benchfile_table[entry].midstate, sizeof(work->midstate));
+	work->bench_entry = entry;
 	work->mandatory = true;
 	work->pool = pools[0];
 	cgtime(&work->tv_getwork);
@@ -3770,6 +4414,24 @@ static void get_benchfile_work(struct work *work)
 	calc_diff(work, 0);
 }
 
+static void benchfile_summary(void)
+{
+	unsigned int served = 0;
+	uint64_t nonces = 0;
+	int i;
+
+	for (i = 0; i < benchfile_count; i++) {
+		served += benchfile_served[i];
+		nonces += benchfile_nonces[i];
+		if (opt_benchfile_display) {
+			applog(LOG_WARNING, "BENCHFILE work %d served %u nonces %"PRIu64,
+			       i, benchfile_served[i], benchfile_nonces[i]);
+		}
+	}
+	applog(LOG_WARNING, "Benchfile work items: %d served: %u valid nonces: %"PRIu64"\n",
+	       benchfile_count, served, nonces);
+}
+
 #ifdef HAVE_CURSES
 static void disable_curses_windows(void)
 {
@@ -3956,6 +4618,7 @@ static void sighandler(int __maybe_unused sig)
 }
 
 static void _stage_work(struct work *work);
+static void stage_work_batch(struct work **works, int count);
 
 #define stage_work(WORK) do { \
 	_stage_work(WORK); \
@@ -4068,71 +4731,282 @@ static void modify_ntime(char *ntime, int noffset)
 	__bin2hex(ntime, bin, 4);
 }
 
-void roll_work(struct work *work)
+static void __roll_work(struct work *work, int noffset)
 {
 	uint32_t *work_ntime;
 	uint32_t ntime;
 
 	work_ntime = (uint32_t *)(work->data + 68);
 	ntime = be32toh(*work_ntime);
-	ntime++;
+	ntime += noffset;
 	*work_ntime = htobe32(ntime);
-	local_work++;
-	work->rolls++;
+	local_work += noffset;
+	work->rolls += noffset;
 	work->nonce = 0;
 	applog(LOG_DEBUG, "Successfully rolled work");
 	/* Change the ntime field if this is stratum work */
 	if (work->ntime)
-		modify_ntime(work->ntime, 1);
+		modify_ntime(work->ntime, noffset);
 
 	/* This is now a different work item so it needs a different ID for the
 	 * hashtable */
 	work->id = total_work_inc();
 }
 
-static void *submit_work_thread(void *userdata)
+void roll_work(struct work *work)
 {
-	struct work *work = (struct work *)userdata;
+	__roll_work(work, 1);
+}
+
+/* Getwork and GBT shares are submitted by one thread driving a curl multi
+ * handle, so submissions are concurrent over persistent keep-alive
+ * connections and each reply is processed as its transfer completes. */
+struct submit_req {
+	struct work *work;
+	char *req;
+	CURL *curl;
+	struct json_rpc *rpc;
+	bool resubmit;
+	struct timeval tv_submit;
+	struct timeval tv_retry;
+	struct submit_req *next;
+};
+
+#define SUBMIT_IDLE_CURLS 16
+
+static pthread_mutex_t submit_lock;
+static struct submit_req *submit_queue;
+static bool submit_started;
+static CURL *submit_curls[SUBMIT_IDLE_CURLS];
+static int submit_idle;
+#ifndef WIN32
+static int submit_pipe[2] = { -1, -1 };
+#endif
+
+static void submit_wake(void)
+{
+#ifndef WIN32
+	char c = 0;
+
+	if (write(submit_pipe[1], &c, 1) < 1)
+		applog(LOG_DEBUG, "Failed to write to submit wakeup pipe");
+#endif
+}
+
+static void submit_req_start(CURLM *multi, struct submit_req *sr)
+{
+	struct pool *pool = sr->work->pool;
+	struct cgminer_pool_stats *pool_stats = &(pool->cgminer_pool_stats);
+
+	if (submit_idle)
+		sr->curl = submit_curls[--submit_idle];
+	else {
+		sr->curl = curl_easy_init();
+		if (unlikely(!sr->curl))
+			quit(1, "Failed to curl_easy_init in submit_req_start");
+	}
+	sr->rpc = json_rpc_start(sr->curl, pool->rpc_url, pool->rpc_userpass, sr->req,
+				 false, false, pool, true);
+	curl_easy_setopt(sr->curl, CURLOPT_PRIVATE, (char *)sr);
+	cgtime(&sr->tv_submit);
+	if (unlikely(curl_multi_add_handle(multi, sr->curl)))
+		quit(1, "Failed to curl_multi_add_handle in submit_req_start");
+
+	mutex_lock(&stats_lock);
+	if (++pool_stats->submits_inflight > pool_stats->submits_inflight_max)
+		pool_stats->submits_inflight_max = pool_stats->submits_inflight;
+	mutex_unlock(&stats_lock);
+}
+
+/* Returns true if the request is finished with and can be freed, or false if
+ * it has been rescheduled for a retry */
+static bool submit_req_done(struct submit_req *sr, CURLcode result)
+{
+	struct work *work = sr->work;
 	struct pool *pool = work->pool;
-	bool resubmit = false;
-	struct curl_ent *ce;
+	struct timeval tv_submit_reply;
+	int rolltime;
+	json_t *val;
 
-	pthread_detach(pthread_self());
+	cgtime(&tv_submit_reply);
+	val = json_rpc_finish(sr->rpc, result, &rolltime);
+	sr->rpc = NULL;
+	if (submit_idle < SUBMIT_IDLE_CURLS)
+		submit_curls[submit_idle++] = sr->curl;
+	else
+		curl_easy_cleanup(sr->curl);
+	sr->curl = NULL;
+
+	mutex_lock(&stats_lock);
+	pool->cgminer_pool_stats.submits_inflight--;
+	mutex_unlock(&stats_lock);
+
+	if (submit_upstream_result(work, val, sr->resubmit, &sr->tv_submit, &tv_submit_reply)) {
+		free_work(work);
+		return true;
+	}
+	if (opt_lowmem) {
+		applog(LOG_NOTICE, "Pool %d share being discarded to minimise memory cache", pool->pool_no);
+		free_work(work);
+		return true;
+	}
+	sr->resubmit = true;
+	if (stale_work(work, true)) {
+		applog(LOG_NOTICE, "Pool %d share became stale while retrying submit, discarding", pool->pool_no);
+
+		mutex_lock(&stats_lock);
+		total_stale++;
+		pool->stale_shares++;
+		total_diff_stale += work->work_difficulty;
+		pool->diff_stale += work->work_difficulty;
+		mutex_unlock(&stats_lock);
+
+		free_work(work);
+		return true;
+	}
+
+	/* pause, then retry the submission */
+	applog(LOG_INFO, "json_rpc_call failed on submit_work, retrying");
+	tv_submit_reply.tv_sec += 5;
+	copy_time(&sr->tv_retry, &tv_submit_reply);
+	return false;
+}
+
+static void *submit_work_thread(void __maybe_unused *userdata)
+{
+	struct submit_req *retries = NULL, *sr;
+	CURLM *multi;
 
 	RenameThread("SubmitWork");
 
-	applog(LOG_DEBUG, "Creating extra submit work thread");
+	multi = curl_multi_init();
+	if (unlikely(!multi))
+		quit(1, "Failed to curl_multi_init in submit_work_thread");
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)opt_submit_conns);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* Multiplex submissions over one connection to pools speaking HTTP/2 */
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 
-	ce = pop_curl_entry(pool);
-	/* submit solution to bitcoin via JSON-RPC */
-	while (!submit_upstream_work(work, ce->curl, resubmit)) {
-		if (opt_lowmem) {
-			applog(LOG_NOTICE, "Pool %d share being discarded to minimise memory cache", pool->pool_no);
-			break;
+	while (42) {
+		struct submit_req *queued, **prev;
+		struct timeval now, timeout;
+		int maxfd = -1, running, msgs;
+		fd_set rd, wr, ex;
+		long curl_timeo;
+		CURLMsg *msg;
+
+		mutex_lock(&submit_lock);
+		queued = submit_queue;
+		submit_queue = NULL;
+		mutex_unlock(&submit_lock);
+
+		while (queued) {
+			sr = queued;
+			queued = sr->next;
+			submit_req_start(multi, sr);
 		}
-		resubmit = true;
-		if (stale_work(work, true)) {
-			applog(LOG_NOTICE, "Pool %d share became stale while retrying submit, discarding", pool->pool_no);
 
-			mutex_lock(&stats_lock);
-			total_stale++;
-			pool->stale_shares++;
-			total_diff_stale += work->work_difficulty;
-			pool->diff_stale += work->work_difficulty;
-			mutex_unlock(&stats_lock);
+		cgtime(&now);
+		prev = &retries;
+		while ((sr = *prev)) {
+			if (timercmp(&sr->tv_retry, &now, >)) {
+				prev = &sr->next;
+				continue;
+			}
+			*prev = sr->next;
+			submit_req_start(multi, sr);
+		}
 
-			free_work(work);
-			break;
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &msgs))) {
+			char *priv;
+
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+			sr = (struct submit_req *)priv;
+			curl_multi_remove_handle(multi, sr->curl);
+			if (submit_req_done(sr, msg->data.result)) {
+				free(sr->req);
+				free(sr);
+			} else {
+				sr->next = retries;
+				retries = sr;
+			}
+		}
+
+		FD_ZERO(&rd);
+		FD_ZERO(&wr);
+		FD_ZERO(&ex);
+		curl_multi_fdset(multi, &rd, &wr, &ex, &maxfd);
+		curl_multi_timeout(multi, &curl_timeo);
+		if (curl_timeo < 0 || curl_timeo > 1000)
+			curl_timeo = 1000;
+#ifndef WIN32
+		FD_SET(submit_pipe[0], &rd);
+		if (submit_pipe[0] > maxfd)
+			maxfd = submit_pipe[0];
+#else
+		/* No wakeup pipe so poll for newly queued submissions */
+		if (curl_timeo > 50)
+			curl_timeo = 50;
+		if (maxfd < 0) {
+			cgsleep_ms(curl_timeo);
+			continue;
 		}
+#endif
+		timeout.tv_sec = curl_timeo / 1000;
+		timeout.tv_usec = (curl_timeo % 1000) * 1000;
+		if (select(maxfd + 1, &rd, &wr, &ex, &timeout) < 0)
+			continue;
+#ifndef WIN32
+		if (FD_ISSET(submit_pipe[0], &rd)) {
+			char buf[64];
 
-		/* pause, then restart work-request loop */
-		applog(LOG_INFO, "json_rpc_call failed on submit_work, retrying");
+			if (read(submit_pipe[0], buf, sizeof(buf)) < 1)
+				applog(LOG_DEBUG, "Failed to read from submit wakeup pipe");
+		}
+#endif
 	}
-	push_curl_entry(ce, pool);
 
 	return NULL;
 }
 
+/* Queue work for the submit thread, starting it on first use */
+static void submit_getwork(struct work *work)
+{
+	struct submit_req *sr = calloc(sizeof(struct submit_req), 1);
+
+	if (unlikely(!sr))
+		quit(1, "Failed to calloc submit_req in submit_getwork");
+	sr->work = work;
+	sr->req = submit_upstream_req(work);
+
+	mutex_lock(&submit_lock);
+	if (unlikely(!submit_started)) {
+		pthread_t submit_thread;
+
+#ifndef WIN32
+		if (unlikely(pipe(submit_pipe)))
+			quit(1, "Failed to create submit wakeup pipe");
+		fcntl(submit_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(submit_pipe[1], F_SETFL, O_NONBLOCK);
+#endif
+		if (unlikely(pthread_create(&submit_thread, NULL, submit_work_thread, NULL)))
+			quit(1, "Failed to create submit_work_thread");
+		pthread_detach(submit_thread);
+		submit_started = true;
+	}
+	sr->next = submit_queue;
+	submit_queue = sr;
+	mutex_unlock(&submit_lock);
+
+	submit_wake();
+}
+
 struct work *make_clone(struct work *work)
 {
 	struct work *work_clone = copy_work(work);
@@ -4148,33 +5022,78 @@ struct work *make_clone(struct work *work)
 	return work_clone;
 }
 
+#define ROLL_BATCH_MAX 16
+#define ROLL_LIMIT 7000
+
+static void _copy_work(struct work *work, const struct work *base_work, int noffset);
+static int tv_sort(struct work *worka, struct work *workb);
+
+/* Generates up to count clones of work at consecutive ntime rolls and rolls
+ * work past them so it can still be used directly. The ntime lies beyond the
+ * first 64 bytes of the header so every clone shares work's midstate rather
+ * than recalculating it. Returns the number of clones generated. */
+static int roll_work_batch(struct work *work, struct work **clones, int count)
+{
+	struct timeval tv_cloned;
+	int i;
+
+	if (count > ROLL_LIMIT - 1 - work->rolls)
+		count = ROLL_LIMIT - 1 - work->rolls;
+	if (count < 1)
+		return 0;
+
+	cgtime(&tv_cloned);
+	for (i = 0; i < count; i++) {
+		struct work *work_clone = make_work();
+
+		_copy_work(work_clone, work, i + 1);
+		work_clone->rolls += i + 1;
+		work_clone->nonce = 0;
+		work_clone->clone = true;
+		copy_time(&work_clone->tv_cloned, &tv_cloned);
+		work_clone->longpoll = false;
+		work_clone->mandatory = false;
+		work_clone->tv_staged.tv_sec -= 1;
+		clones[i] = work_clone;
+	}
+	__roll_work(work, count + 1);
+
+	return count;
+}
+
+/* Rolls a batch of clones from the first rollable staged work, enough to top
+ * up the queue */
 static bool clone_available(void)
 {
-	struct work *work_clone = NULL, *work, *tmp;
-	bool cloned = false;
+	struct work *clones[ROLL_BATCH_MAX], *work, *tmp;
+	int count = 0, want;
 
 	mutex_lock(stgd_lock);
 	if (!staged_rollable)
 		goto out_unlock;
 
+	want = max_queue + 1 - __total_staged();
+	if (want < 1)
+		want = 1;
+	else if (want > ROLL_BATCH_MAX)
+		want = ROLL_BATCH_MAX;
+
 	HASH_ITER(hh, staged_work, work, tmp) {
 		if (can_roll(work) && should_roll(work)) {
-			roll_work(work);
-			work_clone = make_clone(work);
-			roll_work(work);
-			cloned = true;
-			break;
+			count = roll_work_batch(work, clones, want);
+			if (count)
+				break;
 		}
 	}
 
 out_unlock:
 	mutex_unlock(stgd_lock);
 
-	if (cloned) {
-		applog(LOG_DEBUG, "Pushing cloned available work to stage thread");
-		stage_work(work_clone);
+	if (count) {
+		applog(LOG_DEBUG, "Pushing %d cloned available work to stage thread", count);
+		stage_work_batch(clones, count);
 	}
-	return cloned;
+	return count > 0;
 }
 
 /* Clones work by rolling it if possible, and returning a clone instead of the
@@ -4183,40 +5102,99 @@ out_unlock:
 static struct work *clone_work(struct work *work)
 {
 	int mrs = mining_threads + opt_queue - total_staged();
-	struct work *work_clone;
-	bool cloned;
+	struct work *clones[ROLL_BATCH_MAX], *work_clone;
+	int count;
 
-	if (mrs < 1)
+	if (mrs < 1 || !can_roll(work) || !should_roll(work))
 		return work;
 
-	cloned = false;
 	work_clone = make_clone(work);
-	while (mrs-- > 0 && can_roll(work) && should_roll(work)) {
-		applog(LOG_DEBUG, "Pushing rolled converted work to stage thread");
-		stage_work(work_clone);
-		roll_work(work);
-		work_clone = make_clone(work);
-		/* Roll it again to prevent duplicates should this be used
-		 * directly later on */
-		roll_work(work);
-		cloned = true;
-	}
-
-	if (cloned) {
-		stage_work(work);
-		return work_clone;
+	count = roll_work_batch(work, clones, MIN(mrs, ROLL_BATCH_MAX));
+	if (!count) {
+		free_work(work_clone);
+		return work;
 	}
 
-	free_work(work_clone);
+	applog(LOG_DEBUG, "Pushing %d rolled converted work to stage thread", count);
+	stage_work_batch(clones, count);
+	stage_work(work);
+	return work_clone;
+}
 
-	return work;
+/* Times generating count rolled clones of a getwork item one at a time as
+ * clone_available() used to, against in batches, including staging them in a
+ * hashtable of the same batch size. */
+static void roll_benchmark(int count)
+{
+	struct work *base, *hash = NULL, *work, *tmp, *clones[ROLL_BATCH_MAX];
+	double single_secs, batch_secs;
+	struct timeval tv_start, tv_end;
+	struct pool *pool;
+	unsigned char midstate[32];
+	int done, i, n;
+
+	pool = calloc(1, sizeof(*pool));
+	if (unlikely(!pool))
+		quit(1, "Failed to calloc benchmark pool");
+	base = make_work();
+	for (i = 0; i < 128; i++)
+		base->data[i] = rand();
+	base->pool = pool;
+	base->rolltime = 60;
+	calc_midstate(base);
+
+	cgtime(&tv_start);
+	for (done = 0; done < count; done += n) {
+		n = MIN(count - done, ROLL_BATCH_MAX);
+		for (i = 0; i < n; i++) {
+			if (base->rolls >= ROLL_LIMIT - 2)
+				base->rolls = 0;
+			roll_work(base);
+			work = make_clone(base);
+			roll_work(base);
+			HASH_ADD_INT(hash, id, work);
+			HASH_SORT(hash, tv_sort);
+		}
+		HASH_ITER(hh, hash, work, tmp) {
+			HASH_DEL(hash, work);
+			free_work(work);
+		}
+	}
+	cgtime(&tv_end);
+	single_secs = tdiff(&tv_end, &tv_start);
+
+	cgtime(&tv_start);
+	for (done = 0; done < count; done += n) {
+		if (base->rolls >= ROLL_LIMIT - 1 - ROLL_BATCH_MAX)
+			base->rolls = 0;
+		n = roll_work_batch(base, clones, MIN(count - done, ROLL_BATCH_MAX));
+		for (i = 0; i < n; i++)
+			HASH_ADD_INT(hash, id, clones[i]);
+		HASH_SORT(hash, tv_sort);
+		__calc_midstate(midstate, clones[n - 1]->data);
+		if (memcmp(midstate, clones[n - 1]->midstate, 32))
+			early_quit(1, "Rolled work midstate mismatch");
+		HASH_ITER(hh, hash, work, tmp) {
+			HASH_DEL(hash, work);
+			free_work(work);
+		}
+	}
+	cgtime(&tv_end);
+	batch_secs = tdiff(&tv_end, &tv_start);
+
+	free_work(base);
+	free(pool);
+
+	applog(LOG_WARNING, "Roll %d work singly %.0f items/s, in batches of %d %.0f items/s (%.2fx)",
+	       count, single_secs > 0 ? count / single_secs : 0.0, ROLL_BATCH_MAX,
+	       batch_secs > 0 ? count / batch_secs : 0.0,
+	       batch_secs > 0 ? single_secs / batch_secs : 0.0);
 }
 
 #else /* HAVE_LIBCURL */
-static void *submit_work_thread(void __maybe_unused *userdata)
+static void submit_getwork(struct work *work)
 {
-	pthread_detach(pthread_self());
-	return NULL;
+	free_work(work);
 }
 #endif /* HAVE_LIBCURL */
 
@@ -4245,6 +5223,7 @@ static void _copy_work(struct work *work, const struct work *base_work, int noff
 	/* Keep the unique new id assigned during make_work to prevent copied
 	 * work from having the same id. */
 	work->id = id;
+	work->stage_gen = NULL;
 	if (base_work->job_id)
 		work->job_id = strdup(base_work->job_id);
 	if (base_work->nonce1)
@@ -4270,6 +5249,8 @@ static void _copy_work(struct work *work, const struct work *base_work, int noff
 	}
 	if (base_work->coinbase)
 		work->coinbase = strdup(base_work->coinbase);
+	if (base_work->gbt_tmpl)
+		ref_gbt_template(base_work->gbt_tmpl);
 }
 
 void set_work_ntime(struct work *work, int ntime)
@@ -4318,6 +5299,30 @@ static void pool_died(struct pool *pool)
 	}
 }
 
+/* The staleness shared by all work of a pool's job and block generation */
+static bool stale_gen(struct pool *pool, int job_gen, unsigned int gen_block, bool share)
+{
+	/* With --device-split each pool's restarts only stale its own work */
+	if (device_split() ? gen_block < (unsigned int)pool->restart_block :
+	    gen_block != work_block) {
+		applog(LOG_DEBUG, "Work stale due to block mismatch");
+		return true;
+	}
+
+	if (!share && pool->has_stratum) {
+		if (!pool->stratum_active || !pool->stratum_notify) {
+			applog(LOG_DEBUG, "Work stale due to stratum inactive");
+			return true;
+		}
+		if (job_gen != pool->job_gen) {
+			applog(LOG_DEBUG, "Work stale due to stratum job_id mismatch");
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static bool stale_work(struct work *work, bool share)
 {
 	struct timeval now;
@@ -4328,10 +5333,10 @@ static bool stale_work(struct work *work, bool share)
 	if (opt_benchmark || opt_benchfile)
 		return false;
 
-	if (work->work_block != work_block) {
-		applog(LOG_DEBUG, "Work stale due to block mismatch");
+	pool = work->pool;
+
+	if (stale_gen(pool, work->job_gen, work->work_block, share))
 		return true;
-	}
 
 	/* Technically the rolltime should be correct but some pools
 	 * advertise a broken expire= that is lower than a meaningful
@@ -4341,29 +5346,6 @@ static bool stale_work(struct work *work, bool share)
 	else
 		work_expiry = opt_expiry;
 
-	pool = work->pool;
-
-	if (!share && pool->has_stratum) {
-		bool same_job;
-
-		if (!pool->stratum_active || !pool->stratum_notify) {
-			applog(LOG_DEBUG, "Work stale due to stratum inactive");
-			return true;
-		}
-
-		same_job = true;
-
-		cg_rlock(&pool->data_lock);
-		if (strcmp(work->job_id, pool->swork.job_id))
-			same_job = false;
-		cg_runlock(&pool->data_lock);
-
-		if (!same_job) {
-			applog(LOG_DEBUG, "Work stale due to stratum job_id mismatch");
-			return true;
-		}
-	}
-
 	/* Factor in the average getwork delay of this pool, rounding it up to
 	 * the nearest second */
 	getwork_delay = pool->cgminer_pool_stats.getwork_wait_rolling * 5 + 1;
@@ -4540,7 +5522,13 @@ void switch_pools(struct pool *selected)
 		pool_tset(pool, &pool->lagging);
 
 	if (pool != last_pool && pool_strategy != POOL_LOADBALANCE && pool_strategy != POOL_BALANCE) {
-		applog(LOG_WARNING, "Switching to pool %d %s", pool->pool_no, pool->rpc_url);
+		applog(LOG_WARNING, "Switching to pool %d %s%s", pool->pool_no, pool->rpc_url,
+		       pool->stratum_active ? " (subscribed)" : "");
+		/* Time to the first share accepted by the new pool */
+		mutex_lock(&stats_lock);
+		cgtime(&pool->tv_switch);
+		pool->switch_pending = true;
+		mutex_unlock(&stats_lock);
 		if (pool_localgen(pool) || opt_fail_only)
 			clear_pool_work(last_pool);
 	}
@@ -4569,24 +5557,108 @@ void _discard_work(struct work *work)
 static void wake_gws(void)
 {
 	mutex_lock(stgd_lock);
-	pthread_cond_signal(&gws_cond);
+	pthread_cond_broadcast(&gws_cond);
 	mutex_unlock(stgd_lock);
 }
 
-static void discard_stale(void)
+static bool work_rollable(struct work *work);
+
+/* Staged work is also bucketed by its pool, job generation and block
+ * generation, so work outdated by a block change or new stratum job is found
+ * by checking each bucket rather than every work item. Protected by
+ * stgd_lock. */
+struct stage_gen {
+	struct pool *pool;
+	int job_gen;
+	unsigned int work_block;
+	int count;
+	struct list_head works;
+	struct list_head list;
+};
+
+static LIST_HEAD(stage_gens);
+
+static void __stage_gen_add(struct work *work)
+{
+	struct stage_gen *gen;
+
+	list_for_each_entry(gen, &stage_gens, list) {
+		if (gen->pool == work->pool && gen->job_gen == work->job_gen &&
+		    gen->work_block == work->work_block)
+			goto found;
+	}
+	gen = calloc(1, sizeof(*gen));
+	if (unlikely(!gen))
+		quithere(1, "Failed to calloc stage_gen");
+	gen->pool = work->pool;
+	gen->job_gen = work->job_gen;
+	gen->work_block = work->work_block;
+	INIT_LIST_HEAD(&gen->works);
+	list_add(&gen->list, &stage_gens);
+found:
+	list_add_tail(&work->gen_list, &gen->works);
+	gen->count++;
+	work->stage_gen = gen;
+}
+
+static void __stage_work_hash(struct work *work)
+{
+	HASH_ADD_INT(staged_work, id, work);
+	__stage_gen_add(work);
+}
+
+/* Removes work from the staged hashtable and its generation bucket, freeing
+ * the bucket once empty */
+static void __unstage_work(struct work *work)
+{
+	struct stage_gen *gen = work->stage_gen;
+
+	HASH_DEL(staged_work, work);
+	if (work_rollable(work))
+		staged_rollable--;
+	list_del(&work->gen_list);
+	work->stage_gen = NULL;
+	if (!--gen->count) {
+		list_del(&gen->list);
+		free(gen);
+	}
+}
+
+/* Discards staged work in buckets outdated by a block or job change, and if
+ * expire is set, checks the remaining work individually for expiry */
+static void discard_stale(bool expire)
 {
+	struct stage_gen *gen, *gtmp;
 	struct work *work, *tmp;
 	int stale = 0;
 
+	if (opt_benchmark || opt_benchfile)
+		return;
+
 	mutex_lock(stgd_lock);
-	HASH_ITER(hh, staged_work, work, tmp) {
-		if (stale_work(work, false)) {
-			HASH_DEL(staged_work, work);
+	list_for_each_entry_safe(gen, gtmp, &stage_gens, list) {
+		int count = gen->count;
+
+		if (!stale_gen(gen->pool, gen->job_gen, gen->work_block, false))
+			continue;
+		/* The bucket is freed with its last work */
+		while (count--) {
+			work = list_entry(gen->works.next, struct work, gen_list);
+			__unstage_work(work);
 			discard_work(work);
 			stale++;
 		}
 	}
-	pthread_cond_signal(&gws_cond);
+	if (expire) {
+		HASH_ITER(hh, staged_work, work, tmp) {
+			if (stale_work(work, false)) {
+				__unstage_work(work);
+				discard_work(work);
+				stale++;
+			}
+		}
+	}
+	pthread_cond_broadcast(&gws_cond);
 	mutex_unlock(stgd_lock);
 
 	if (stale)
@@ -4621,9 +5693,10 @@ int restart_wait(struct thr_info *thr, unsigned int mstime)
 	return rc;
 }
 
-static void *restart_thread(void __maybe_unused *arg)
+/* Restarts the devices mining for arg, or all devices if it's NULL */
+static void *restart_thread(void *arg)
 {
-	struct pool *cp = current_pool();
+	struct pool *cp = current_pool(), *pool = (struct pool *)arg;
 	struct cgpu_info *cgpu;
 	int i, mt;
 
@@ -4634,7 +5707,7 @@ static void *restart_thread(void __maybe_unused *arg)
 	pool_tset(cp, &cp->lagging);
 
 	/* Discard staged work that is now stale */
-	discard_stale();
+	discard_stale(false);
 
 	rd_lock(&mining_thr_lock);
 	mt = mining_threads;
@@ -4646,6 +5719,8 @@ static void *restart_thread(void __maybe_unused *arg)
 			continue;
 		if (cgpu->deven != DEV_ENABLED)
 			continue;
+		if (pool && cgpu->split_pool && cgpu->split_pool != pool)
+			continue;
 		mining_thr[i]->work_restart = true;
 		flush_queue(cgpu);
 		cgpu->drv->flush_work(cgpu);
@@ -4659,22 +5734,28 @@ static void *restart_thread(void __maybe_unused *arg)
 	/* Cancels any cancellable usb transfers. Flagged as such it means they
 	 * are usualy waiting on a read result and it's safe to abort the read
 	 * early. */
-	cancel_usb_transfers();
+	if (!pool)
+		cancel_usb_transfers();
 #endif
 	return NULL;
 }
 
 /* In order to prevent a deadlock via the various drv->flush_work
  * implementations we send the restart messages via a separate thread. */
-static void restart_threads(void)
+static void restart_pool_threads(struct pool *pool)
 {
 	pthread_t rthread;
 
 	cgtime(&restart_tv_start);
-	if (unlikely(pthread_create(&rthread, NULL, restart_thread, NULL)))
+	if (unlikely(pthread_create(&rthread, NULL, restart_thread, pool)))
 		quit(1, "Failed to create restart thread");
 }
 
+static void restart_threads(void)
+{
+	restart_pool_threads(NULL);
+}
+
 static void signal_work_update(void)
 {
 	int i;
@@ -4821,7 +5902,13 @@ static bool test_work_current(struct work *work)
 			applog(LOG_NOTICE, "New block detected on network before pool notification");
 		else if (!pool->gbt_solo)
 			applog(LOG_NOTICE, "New block detected on network");
-		restart_threads();
+		/* Devices mining for other pools have nothing newer to work on
+		 * until their own pool notifies them of the block. */
+		if (device_split()) {
+			pool->restart_block = work_block;
+			restart_pool_threads(pool);
+		} else
+			restart_threads();
 	} else {
 		if (memcmp(pool->prev_block, bedata, 32)) {
 			/* Work doesn't match what this pool has stored as
@@ -4856,7 +5943,11 @@ static bool test_work_current(struct work *work)
 					applog(LOG_NOTICE, "%sLONGPOLL from pool %d requested work restart",
 					       work->gbt ? "GBT " : "", work->pool->pool_no);
 				}
-				restart_threads();
+				if (device_split()) {
+					pool->restart_block = work_block;
+					restart_pool_threads(pool);
+				} else
+					restart_threads();
 			}
 		}
 	}
@@ -4881,10 +5972,10 @@ static bool hash_push(struct work *work)
 	bool rc = true;
 
 	mutex_lock(stgd_lock);
-	if (work_rollable(work))
-		staged_rollable++;
 	if (likely(!getq->frozen)) {
-		HASH_ADD_INT(staged_work, id, work);
+		if (work_rollable(work))
+			staged_rollable++;
+		__stage_work_hash(work);
 		HASH_SORT(staged_work, tv_sort);
 	} else
 		rc = false;
@@ -4894,6 +5985,24 @@ static bool hash_push(struct work *work)
 	return rc;
 }
 
+/* Adds a batch of work to the staged hashtable, sorting it once */
+static void hash_push_batch(struct work **works, int count)
+{
+	int i;
+
+	mutex_lock(stgd_lock);
+	if (likely(!getq->frozen)) {
+		for (i = 0; i < count; i++) {
+			if (work_rollable(works[i]))
+				staged_rollable++;
+			__stage_work_hash(works[i]);
+		}
+		HASH_SORT(staged_work, tv_sort);
+	}
+	pthread_cond_broadcast(&getq->cond);
+	mutex_unlock(stgd_lock);
+}
+
 static void _stage_work(struct work *work)
 {
 	applog(LOG_DEBUG, "Pushing work from pool %d to hash queue", work->pool->pool_no);
@@ -4903,6 +6012,19 @@ static void _stage_work(struct work *work)
 	hash_push(work);
 }
 
+static void stage_work_batch(struct work **works, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		applog(LOG_DEBUG, "Pushing work from pool %d to hash queue", works[i]->pool->pool_no);
+		works[i]->work_block = work_block;
+		test_work_current(works[i]);
+		works[i]->pool->works++;
+	}
+	hash_push_batch(works, count);
+}
+
 #ifdef HAVE_CURSES
 int curses_int(const char *query)
 {
@@ -4976,6 +6098,7 @@ void remove_pool(struct pool *pool)
 	pool->pool_no = total_pools;
 	pool->removed = true;
 	total_pools--;
+	adjust_quota_gcd();
 }
 
 /* add a mutex if this needs to be thread safe in the future */
@@ -5206,6 +6329,9 @@ void zero_stats(void)
 		 * deadlock. */
 		cgpu->drv->zero_stats(cgpu);
 	}
+#ifdef USE_USBUTILS
+	zero_usb_stats();
+#endif
 }
 
 static void set_highprio(void)
@@ -5886,7 +7012,7 @@ static void thread_reportout(struct thr_info *thr)
 	thr->cgpu->device_last_well = time(NULL);
 }
 
-static void hashmeter(int thr_id, double hashes_done)
+void hashmeter(int thr_id, double hashes_done)
 {
 	bool showlog = false;
 	double tv_tdiff;
@@ -6146,7 +7272,7 @@ void clear_pool_work(struct pool *pool)
 	mutex_lock(stgd_lock);
 	HASH_ITER(hh, staged_work, work, tmp) {
 		if (work->pool == pool) {
-			HASH_DEL(staged_work, work);
+			__unstage_work(work);
 			free_work(work);
 			cleared++;
 		}
@@ -6168,6 +7294,30 @@ static int cp_prio(void)
 	return prio;
 }
 
+/* With --standby the highest priority backup stratum pools are kept
+ * subscribed and authorised with current notify state, so switching to one
+ * generates work straight away instead of waiting for a connect, any proxy
+ * negotiation, subscribe and authorise. */
+bool pool_standby(struct pool *pool)
+{
+	struct pool *cp = current_pool();
+	int i, rank = 0;
+
+	if (!opt_standby || pool == cp || !pool->has_stratum ||
+	    pool->enabled != POOL_ENABLED || shared_strategy())
+		return false;
+	for (i = 0; i < total_pools; i++) {
+		struct pool *other = priority_pool(i);
+
+		if (other == pool)
+			return rank < opt_standby;
+		if (other != cp && other->has_stratum && !other->idle &&
+		    other->enabled == POOL_ENABLED)
+			rank++;
+	}
+	return false;
+}
+
 /* We only need to maintain a secondary pool connection when we need the
  * capacity to get work from the backup pools while still on the primary */
 static bool cnx_needed(struct pool *pool)
@@ -6192,6 +7342,8 @@ static bool cnx_needed(struct pool *pool)
 	cp = current_pool();
 	if (cp == pool)
 		return true;
+	if (pool_standby(pool))
+		return true;
 	if (!pool_localgen(cp) && (!opt_fail_only || !cp->hdr_path))
 		return true;
 	/* If we're waiting for a response from shares submitted, keep the
@@ -6366,12 +7518,14 @@ static void *stratum_sthread(void *userdata)
 
 	while (42) {
 		char noncehex[12], nonce2hex[20], s[1024];
-		struct stratum_share *sshare;
+		struct stratum_share *sshare, *found;
 		uint32_t *hash32, nonce;
 		unsigned char nonce2[8];
 		uint64_t *nonce2_64;
+		time_t sshare_time, sent;
 		struct work *work;
 		bool submitted;
+		int sshare_id;
 
 		if (unlikely(pool->removed))
 			break;
@@ -6392,7 +7546,7 @@ static void *stratum_sthread(void *userdata)
 		hash32 = (uint32_t *)work->hash;
 		submitted = false;
 
-		sshare->sshare_time = time(NULL);
+		sshare->sshare_time = sshare_time = time(NULL);
 		/* This work item is freed in parse_stratum_response */
 		sshare->work = work;
 		nonce = *((uint32_t *)(work->data + 76));
@@ -6401,7 +7555,7 @@ static void *stratum_sthread(void *userdata)
 
 		mutex_lock(&sshare_lock);
 		/* Give the stratum share a unique id */
-		sshare->id = swork_id++;
+		sshare->id = sshare_id = swork_id++;
 		mutex_unlock(&sshare_lock);
 
 		nonce2_64 = (uint64_t *)nonce2;
@@ -6418,22 +7572,45 @@ static void *stratum_sthread(void *userdata)
 		/* Try resubmitting for up to 2 minutes if we fail to submit
 		 * once and the stratum pool nonce1 still matches suggesting
 		 * we may be able to resume. */
-		while (time(NULL) < sshare->sshare_time + 120) {
+		while (time(NULL) < sshare_time + 120) {
 			bool sessionid_match;
 
+			/* Add the share to the db before sending it since a local
+			 * or low latency pool can reply before stratum_send
+			 * returns, which would make the result untracked. The
+			 * sshare must not be touched once sent. */
+			sshare->sshare_sent = sent = time(NULL);
+			mutex_lock(&sshare_lock);
+			HASH_ADD_INT(stratum_shares, id, sshare);
+			pool->sshares++;
+			mutex_unlock(&sshare_lock);
+
 			if (likely(stratum_send(pool, s, strlen(s)))) {
 				if (pool_tclear(pool, &pool->submit_fail))
 						applog(LOG_WARNING, "Pool %d communication resumed, submitting work", pool->pool_no);
 
-				mutex_lock(&sshare_lock);
-				HASH_ADD_INT(stratum_shares, id, sshare);
-				pool->sshares++;
-				mutex_unlock(&sshare_lock);
-
-				applog(LOG_DEBUG, "Successfully submitted, adding to stratum_shares db");
+				applog(LOG_DEBUG, "Successfully submitted, added to stratum_shares db");
 				submitted = true;
 				break;
 			}
+
+			/* A disconnect may have cleared the share, along with its
+			 * work, while it was being sent, so only take it back if
+			 * it is still in the db. */
+			mutex_lock(&sshare_lock);
+			HASH_FIND_INT(stratum_shares, &sshare_id, found);
+			if (likely(found == sshare)) {
+				HASH_DEL(stratum_shares, sshare);
+				pool->sshares--;
+			}
+			mutex_unlock(&sshare_lock);
+
+			if (unlikely(found != sshare)) {
+				applog(LOG_DEBUG, "Failed stratum share already cleared, not resubmitting");
+				sshare = NULL;
+				break;
+			}
+
 			if (!pool_tset(pool, &pool->submit_fail) && cnx_needed(pool)) {
 				applog(LOG_WARNING, "Pool %d stratum share submission failure", pool->pool_no);
 				total_ro++;
@@ -6457,6 +7634,10 @@ static void *stratum_sthread(void *userdata)
 			sleep(5);
 		}
 
+		/* The share and its work are no longer ours */
+		if (unlikely(!sshare))
+			continue;
+
 		if (unlikely(!submitted)) {
 			applog(LOG_DEBUG, "Failed to submit stratum share, discarding");
 			free_work(work);
@@ -6466,8 +7647,7 @@ static void *stratum_sthread(void *userdata)
 		} else {
 			int ssdiff;
 
-			sshare->sshare_sent = time(NULL);
-			ssdiff = sshare->sshare_sent - sshare->sshare_time;
+			ssdiff = sent - sshare_time;
 			if (opt_debug || ssdiff > 0) {
 				applog(LOG_INFO, "Pool %d stratum share submission lag time %d seconds",
 				       pool->pool_no, ssdiff);
@@ -6508,12 +7688,18 @@ static bool stratum_works(struct pool *pool)
 }
 
 #ifdef HAVE_LIBCURL
+/* Templates decoded after this have the coinbase header and pubkey filled in
+ * by gbt_solo_decode, this fills in the first template decoded before we knew
+ * them, before any work has been generated from it */
 static void __setup_gbt_solo(struct pool *pool)
 {
+	struct gbt_template *tmpl;
+
 	cg_wlock(&pool->gbt_lock);
-	memcpy(pool->coinbase, scriptsig_header_bin, 41);
-	pool->coinbase[41 + pool->n1_len + 4 + 1 + 8] = 25;
-	memcpy(pool->coinbase + 41 + pool->n1_len + 4 + 1 + 8 + 1, pool->script_pubkey, 25);
+	tmpl = pool->gbt_tmpl;
+	memcpy(tmpl->coinbase, scriptsig_header_bin, 41);
+	tmpl->coinbase[41 + pool->n1_len + 4 + 1 + 8] = 25;
+	memcpy(tmpl->coinbase + 41 + pool->n1_len + 4 + 1 + 8 + 1, pool->script_pubkey, 25);
 	cg_wunlock(&pool->gbt_lock);
 }
 
@@ -6551,7 +7737,7 @@ static bool setup_gbt_solo(CURL *curl, struct pool *pool)
 	__setup_gbt_solo(pool);
 
 	if (opt_debug) {
-		char *cb = bin2hex(pool->coinbase, pool->coinbase_len);
+		char *cb = bin2hex(pool->gbt_tmpl->coinbase, pool->gbt_tmpl->coinbase_len);
 
 		applog(LOG_DEBUG, "Pool %d coinbase %s", pool->pool_no, cb);
 		free(cb);
@@ -6818,7 +8004,7 @@ static struct work *hash_pop(bool blocking)
 			cgtime(&now);
 			then.tv_sec = now.tv_sec + 10;
 			then.tv_nsec = now.tv_usec * 1000;
-			pthread_cond_signal(&gws_cond);
+			pthread_cond_broadcast(&gws_cond);
 			rc = pthread_cond_timedwait(&getq->cond, stgd_lock, &then);
 			/* Check again for !no_work as multiple threads may be
 				* waiting on this condition and another may set the
@@ -6844,12 +8030,10 @@ static struct work *hash_pop(bool blocking)
 		}
 	} else
 		work = staged_work;
-	HASH_DEL(staged_work, work);
-	if (work_rollable(work))
-		staged_rollable--;
+	__unstage_work(work);
 
-	/* Signal the getwork scheduler to look for more work */
-	pthread_cond_signal(&gws_cond);
+	/* Signal the getwork scheduler and generators to look for more work */
+	pthread_cond_broadcast(&gws_cond);
 
 	/* Signal hash_pop again in case there are mutliple hash_pop waiters */
 	pthread_cond_signal(&getq->cond);
@@ -6924,99 +8108,365 @@ void set_target(unsigned char *dest_target, double diff)
 	memcpy(dest_target, target, 32);
 }
 
-#ifdef USE_AVALON2
-void submit_nonce2_nonce(struct thr_info *thr, uint32_t pool_no, uint32_t nonce2, uint32_t nonce)
+/* Called with pool->data_lock write held. The template is immutable once
+ * created and the pool holds one reference to it until it is replaced. */
+static struct work_template *__new_work_template(struct pool *pool)
 {
-	struct cgpu_info *cgpu = thr->cgpu;
-	struct device_drv *drv = cgpu->drv;
+	struct work_template *tmpl = calloc(1, sizeof(*tmpl));
+	int i;
 
-	struct pool *pool = pools[pool_no];
+	if (unlikely(!tmpl))
+		quithere(1, "Failed to calloc work template");
+
+	tmpl->refs = 1;
+	tmpl->seq = pool->swork_seq;
+	tmpl->pool = pool;
+	tmpl->work_block = work_block;
+	tmpl->job_gen = pool->job_gen;
+	tmpl->coinbase_len = pool->coinbase_len;
+	tmpl->nonce2_offset = pool->nonce2_offset;
+	tmpl->n2size = pool->n2size;
+	tmpl->merkles = pool->merkles;
+	tmpl->coinbase = malloc(tmpl->coinbase_len + tmpl->merkles * 32);
+	if (unlikely(!tmpl->coinbase))
+		quithere(1, "Failed to malloc template coinbase");
+	tmpl->merkle_bin = tmpl->coinbase + tmpl->coinbase_len;
+	memcpy(tmpl->coinbase, pool->coinbase, tmpl->coinbase_len);
+	for (i = 0; i < tmpl->merkles; i++)
+		memcpy(tmpl->merkle_bin + i * 32, pool->swork.merkle_bin[i], 32);
+	memcpy(tmpl->header_bin, pool->header_bin, 112);
+
+	/* Store the stratum work diff to check it still matches the pool's
+	 * stratum diff when submitting shares */
+	tmpl->sdiff = pool->sdiff;
+
+	/* Copy parameters required for share submission */
+	tmpl->job_id = strdup(pool->swork.job_id);
+	tmpl->nonce1 = strdup(pool->nonce1);
+	tmpl->ntime = strdup(pool->ntime);
+
+	return tmpl;
+}
+
+struct work_template *ref_work_template(struct work_template *tmpl)
+{
+	__sync_add_and_fetch(&tmpl->refs, 1);
+	return tmpl;
+}
+
+void release_work_template(struct work_template *tmpl)
+{
+	if (__sync_sub_and_fetch(&tmpl->refs, 1))
+		return;
+
+	free(tmpl->ntime);
+	free(tmpl->nonce1);
+	free(tmpl->job_id);
+	free(tmpl->coinbase);
+	free(tmpl);
+}
+
+/* Returns a reference to the pool's current template, creating it if the
+ * stratum work has changed since it was last leased, and reserves nonce2s
+ * nonce2 values starting at *nonce2 for the caller's exclusive use. */
+static struct work_template *__lease_work_template(struct pool *pool, uint64_t nonce2s,
+						   uint64_t *nonce2)
+{
+	struct work_template *tmpl, *old = NULL;
+
+	cg_wlock(&pool->data_lock);
+	tmpl = pool->work_tmpl;
+	if (!tmpl || tmpl->seq != pool->swork_seq || tmpl->work_block != work_block) {
+		old = tmpl;
+		tmpl = pool->work_tmpl = __new_work_template(pool);
+	}
+	ref_work_template(tmpl);
+	if (nonce2)
+		*nonce2 = pool->nonce2;
+	pool->nonce2 += nonce2s;
+	cg_wunlock(&pool->data_lock);
+
+	if (old)
+		release_work_template(old);
+
+	return tmpl;
+}
+
+/* For drivers of devices that can generate their own work from the pool's
+ * coinbase and merkle branch. Returns NULL if the pool has no stratum work. */
+struct work_template *lease_work_template(struct pool *pool, uint64_t nonce2s, uint64_t *nonce2)
+{
+	if (!pool->has_stratum || !pool->stratum_notify)
+		return NULL;
+	return __lease_work_template(pool, nonce2s, nonce2);
+}
+
+/* The template is out of date once the pool has sent new work or a new diff
+ * or a block change has been detected. */
+bool work_template_current(struct work_template *tmpl)
+{
+	return (tmpl->seq == tmpl->pool->swork_seq && tmpl->work_block == work_block);
+}
+
+/* Expands count work items from the template for consecutive nonce2 values
+ * starting at nonce2 without touching the pool */
+static void gen_template_works(struct work_template *tmpl, struct work **works, int count,
+			       uint64_t nonce2)
+{
+	unsigned char merkle_root[32], merkle_sha[64];
+	unsigned char *coinbase;
+	uint32_t *data32, *swap32;
+	uint64_t nonce2le;
+	int i, j;
+
+	coinbase = malloc(tmpl->coinbase_len);
+	if (unlikely(!coinbase))
+		quithere(1, "Failed to malloc coinbase");
+	memcpy(coinbase, tmpl->coinbase, tmpl->coinbase_len);
+
+	for (j = 0; j < count; j++) {
+		struct work *work = works[j];
+
+		/* Update coinbase. Always use an LE encoded nonce2 to fill in
+		 * values from left to right and prevent overflow errors with
+		 * small n2sizes */
+		nonce2le = htole64(nonce2 + j);
+		memcpy(coinbase + tmpl->nonce2_offset, &nonce2le, tmpl->n2size);
+		work->nonce2 = nonce2 + j;
+		work->nonce2_len = tmpl->n2size;
+
+		/* Generate merkle root */
+		gen_hash(coinbase, merkle_root, tmpl->coinbase_len);
+		memcpy(merkle_sha, merkle_root, 32);
+		for (i = 0; i < tmpl->merkles; i++) {
+			memcpy(merkle_sha + 32, tmpl->merkle_bin + i * 32, 32);
+			gen_hash(merkle_sha, merkle_root, 64);
+			memcpy(merkle_sha, merkle_root, 32);
+		}
+		data32 = (uint32_t *)merkle_sha;
+		swap32 = (uint32_t *)merkle_root;
+		flip32(swap32, data32);
+
+		/* Copy the data template from header_bin */
+		memcpy(work->data, tmpl->header_bin, 112);
+		memcpy(work->data + 36, merkle_root, 32);
+
+		work->sdiff = tmpl->sdiff;
+		work->job_id = strdup(tmpl->job_id);
+		work->nonce1 = strdup(tmpl->nonce1);
+		work->ntime = strdup(tmpl->ntime);
+
+		if (opt_debug) {
+			char *header, *merkle_hash;
+
+			header = bin2hex(work->data, 112);
+			merkle_hash = bin2hex((const unsigned char *)merkle_root, 32);
+			applog(LOG_DEBUG, "Generated stratum merkle %s", merkle_hash);
+			applog(LOG_DEBUG, "Generated stratum header %s", header);
+			applog(LOG_DEBUG, "Work job_id %s nonce2 %"PRIu64" ntime %s", work->job_id,
+			       work->nonce2, work->ntime);
+			free(header);
+			free(merkle_hash);
+		}
+
+		calc_midstate(work);
+		set_target(work->target, work->sdiff);
+
+		work->pool = tmpl->pool;
+		work->stratum = true;
+		work->nonce = 0;
+		work->longpoll = false;
+		work->getwork_mode = GETWORK_MODE_STRATUM;
+		work->work_block = tmpl->work_block;
+		work->job_gen = tmpl->job_gen;
+		/* Nominally allow a driver to ntime roll 60 seconds */
+		work->drv_rolllimit = 60;
+		calc_diff(work, work->sdiff);
+
+		cgtime(&work->tv_staged);
+	}
+
+	free(coinbase);
+}
+
+/* A work item for one nonce2 of a leased template, which is not part of
+ * any device queue so the driver frees it with free_work() */
+struct work *make_template_work(struct work_template *tmpl, uint64_t nonce2)
+{
 	struct work *work = make_work();
 
-	pool->nonce2 = nonce2;
-	gen_stratum_work(pool, work);
+	gen_template_works(tmpl, &work, 1, nonce2);
+	return work;
+}
+
+/* Submit a nonce found by a device that generated its own work from the
+ * template for nonce2, rolling ntime if the device changed it. Returns true
+ * if the nonce was valid. */
+bool submit_template_nonce(struct thr_info *thr, struct work_template *tmpl, uint64_t nonce2,
+			   uint32_t ntime, uint32_t nonce)
+{
+	struct work *work = make_template_work(tmpl, nonce2);
+	uint32_t base_ntime;
+	bool ret;
 
-	submit_nonce(thr, work, nonce);
+	base_ntime = be32toh(*(uint32_t *)(tmpl->header_bin + 68));
+	if (ntime && ntime != base_ntime)
+		ret = submit_noffset_nonce(thr, work, nonce, (int)(ntime - base_ntime));
+	else
+		ret = submit_nonce(thr, work, nonce);
 	free_work(work);
+
+	return ret;
+}
+
+#ifdef USE_AVALON2
+void submit_nonce2_nonce(struct thr_info *thr, uint32_t pool_no, uint32_t nonce2, uint32_t nonce)
+{
+	struct pool *pool = pools[pool_no];
+	struct work_template *tmpl;
+
+	/* The device rolls its own nonce2 so don't reserve any */
+	tmpl = lease_work_template(pool, 0, NULL);
+	if (unlikely(!tmpl))
+		return;
+	submit_template_nonce(thr, tmpl, nonce2, 0, nonce);
+	release_work_template(tmpl);
 }
 #endif
 
-/* Generates stratum based work based on the most recent notify information
- * from the pool. This will keep generating work while a pool is down so we use
- * other means to detect when the pool has died in stratum_thread */
+/* Generates count stratum work items based on the most recent notify
+ * information from the pool. This will keep generating work while a pool is
+ * down so we use other means to detect when the pool has died in
+ * stratum_thread. The nonce2 range is reserved and the template leased under
+ * the pool lock and the hashing is done outside it so that several threads can
+ * generate work from the same pool at once. */
+static void gen_stratum_work_batch(struct pool *pool, struct work **works, int count)
+{
+	struct work_template *tmpl;
+	uint64_t nonce2;
+
+	tmpl = __lease_work_template(pool, count, &nonce2);
+	gen_template_works(tmpl, works, count, nonce2);
+	release_work_template(tmpl);
+
+	mutex_lock(&stats_lock);
+	local_work += count;
+	mutex_unlock(&stats_lock);
+}
+
 static void gen_stratum_work(struct pool *pool, struct work *work)
 {
-	unsigned char merkle_root[32], merkle_sha[64];
-	uint32_t *data32, *swap32;
-	uint64_t nonce2le;
-	int i;
+	gen_stratum_work_batch(pool, &work, 1);
+}
+
+#define GEN_BATCH_MAX 16
+
+/* Work the generator threads have reserved room for but not yet staged,
+ * protected by stgd_lock */
+static int gen_pending;
+
+/* Generator threads with no stratum pool to generate for wait on this until
+ * main() generates stratum work itself */
+static pthread_cond_t gen_cond;
+
+static void gen_release(int count)
+{
+	mutex_lock(stgd_lock);
+	gen_pending -= count;
+	mutex_unlock(stgd_lock);
+}
+
+static void gen_wake(void)
+{
+	mutex_lock(stgd_lock);
+	pthread_cond_broadcast(&gen_cond);
+	mutex_unlock(stgd_lock);
+}
+
+/* Select a pool for a generator thread only if the next pick is a stratum
+ * pool it can generate work for. Any other pick is left in the schedule for
+ * main() so it doesn't use up that pool's quota. */
+static struct pool *select_gen_pool(void)
+{
+	struct pool *pool;
+	int slot;
 
-	cg_wlock(&pool->data_lock);
+	mutex_lock(&select_lock);
+	pool = __next_pool(false, &slot);
+	if (pool->has_stratum && pool->stratum_active && pool->stratum_notify)
+		pool = __select_pool(false);
+	else
+		pool = NULL;
+	mutex_unlock(&select_lock);
 
-	/* Update coinbase. Always use an LE encoded nonce2 to fill in values
-	 * from left to right and prevent overflow errors with small n2sizes */
-	nonce2le = htole64(pool->nonce2);
-	memcpy(pool->coinbase + pool->nonce2_offset, &nonce2le, pool->n2size);
-	work->nonce2 = pool->nonce2++;
-	work->nonce2_len = pool->n2size;
+	return pool;
+}
 
-	/* Downgrade to a read lock to read off the pool variables */
-	cg_dwlock(&pool->data_lock);
+/* Work generator threads top up the staged queue with batches of stratum work
+ * alongside main(), which still generates all other work and manages the
+ * lagging state and max_queue. */
+static void *gen_thread(void *userdata)
+{
+	struct gen_thr *gen = (struct gen_thr *)userdata;
+	struct cgminer_stats *gen_stats = &gen->cgminer_stats;
+	char threadname[16];
 
-	/* Generate merkle root */
-	gen_hash(pool->coinbase, merkle_root, pool->coinbase_len);
-	memcpy(merkle_sha, merkle_root, 32);
-	for (i = 0; i < pool->merkles; i++) {
-		memcpy(merkle_sha + 32, pool->swork.merkle_bin[i], 32);
-		gen_hash(merkle_sha, merkle_root, 64);
-		memcpy(merkle_sha, merkle_root, 32);
-	}
-	data32 = (uint32_t *)merkle_sha;
-	swap32 = (uint32_t *)merkle_root;
-	flip32(swap32, data32);
+	snprintf(threadname, sizeof(threadname), "GenWork/%d", gen->id);
+	RenameThread(threadname);
 
-	/* Copy the data template from header_bin */
-	memcpy(work->data, pool->header_bin, 112);
-	memcpy(work->data + 36, merkle_root, 32);
+	while (42) {
+		struct work *works[GEN_BATCH_MAX];
+		struct timeval tv_start, tv_end;
+		struct pool *pool;
+		int ts, count, i;
 
-	/* Store the stratum work diff to check it still matches the pool's
-	 * stratum diff when submitting shares */
-	work->sdiff = pool->sdiff;
+		/* Reserve room for the batch so generators woken together
+		 * don't all top up the same space */
+		mutex_lock(stgd_lock);
+		while ((ts = __total_staged() + gen_pending) > max_queue)
+			pthread_cond_wait(&gws_cond, stgd_lock);
+		/* Load balancing uses up pool quota per work item so only
+		 * batch work for strategies that use one pool at a time */
+		if (pool_strategy == POOL_LOADBALANCE || pool_strategy == POOL_BALANCE)
+			count = 1;
+		else
+			count = MIN(max_queue + 1 - ts, GEN_BATCH_MAX);
+		gen_pending += count;
+		mutex_unlock(stgd_lock);
 
-	/* Copy parameters required for share submission */
-	work->job_id = strdup(pool->swork.job_id);
-	work->nonce1 = strdup(pool->nonce1);
-	work->ntime = strdup(pool->ntime);
-	cg_runlock(&pool->data_lock);
+		pool = select_gen_pool();
+		if (!pool) {
+			/* main() generates this work, wait until it has a
+			 * stratum pool to generate for again */
+			mutex_lock(stgd_lock);
+			gen_pending -= count;
+			pthread_cond_wait(&gen_cond, stgd_lock);
+			mutex_unlock(stgd_lock);
+			continue;
+		}
 
-	if (opt_debug) {
-		char *header, *merkle_hash;
+		for (i = 0; i < count; i++)
+			works[i] = make_work();
 
-		header = bin2hex(work->data, 112);
-		merkle_hash = bin2hex((const unsigned char *)merkle_root, 32);
-		applog(LOG_DEBUG, "Generated stratum merkle %s", merkle_hash);
-		applog(LOG_DEBUG, "Generated stratum header %s", header);
-		applog(LOG_DEBUG, "Work job_id %s nonce2 %"PRIu64" ntime %s", work->job_id,
-		       work->nonce2, work->ntime);
-		free(header);
-		free(merkle_hash);
-	}
+		cgtime(&tv_start);
+		gen_stratum_work_batch(pool, works, count);
+		cgtime(&tv_end);
 
-	calc_midstate(work);
-	set_target(work->target, work->sdiff);
+		for (i = 0; i < count; i++)
+			stage_work(works[i]);
+		gen_release(count);
 
-	local_work++;
-	work->pool = pool;
-	work->stratum = true;
-	work->nonce = 0;
-	work->longpoll = false;
-	work->getwork_mode = GETWORK_MODE_STRATUM;
-	work->work_block = work_block;
-	/* Nominally allow a driver to ntime roll 60 seconds */
-	work->drv_rolllimit = 60;
-	calc_diff(work, work->sdiff);
+		subtime(&tv_end, &tv_start);
+		addtime(&tv_start, &gen_stats->getwork_wait);
+		if (time_more(&tv_start, &gen_stats->getwork_wait_max))
+			copy_time(&gen_stats->getwork_wait_max, &tv_start);
+		if (time_less(&tv_start, &gen_stats->getwork_wait_min))
+			copy_time(&gen_stats->getwork_wait_min, &tv_start);
+		gen_stats->getwork_calls++;
+		gen->works += count;
+	}
 
-	cgtime(&work->tv_staged);
+	return NULL;
 }
 
 #ifdef HAVE_LIBCURL
@@ -7060,7 +8510,6 @@ retry:
 		bool rc = work_decode(pool, work, val);
 
 		if (rc) {
-			__setup_gbt_solo(pool);
 			gen_solo_work(pool, work);
 			stage_work(work);
 		} else
@@ -7080,57 +8529,62 @@ out:
 	release_gbt_curl(pool);
 }
 
+/* The coinbase for a solo work item is only generated in binary to find the
+ * merkle root, the work keeps a reference to the template for serialising
+ * the block in the rare case it is solved. */
 static void gen_solo_work(struct pool *pool, struct work *work)
 {
 	unsigned char merkle_root[32], merkle_sha[64];
+	struct gbt_template *tmpl;
 	uint32_t *data32, *swap32;
+	unsigned char *coinbase;
 	struct timeval now;
 	uint64_t nonce2le;
 	int i;
 
 	cgtime(&now);
-	if (now.tv_sec - pool->tv_lastwork.tv_sec > 60)
+	if (now.tv_sec - pool->tv_lastwork.tv_sec >= opt_gbt_update)
 		update_gbt_solo(pool);
 
 	cg_wlock(&pool->gbt_lock);
-
-	/* Update coinbase. Always use an LE encoded nonce2 to fill in values
-	 * from left to right and prevent overflow errors with small n2sizes */
-	nonce2le = htole64(pool->nonce2);
-	memcpy(pool->coinbase + pool->nonce2_offset, &nonce2le, pool->n2size);
+	tmpl = ref_gbt_template(pool->gbt_tmpl);
 	work->nonce2 = pool->nonce2++;
-	work->nonce2_len = pool->n2size;
-	work->gbt_txns = pool->transactions + 1;
 
 	/* Downgrade to a read lock to read off the pool variables */
 	cg_dwlock(&pool->gbt_lock);
-	work->coinbase = bin2hex(pool->coinbase, pool->coinbase_len);
+	/* Copy the data template from header_bin */
+	memcpy(work->data, pool->header_bin, 112);
+	work->sdiff = pool->sdiff;
+
+	/* Copy parameters required for share submission */
+	work->ntime = strdup(pool->ntime);
+	memcpy(work->target, pool->gbt_target, 32);
+	cg_runlock(&pool->gbt_lock);
+
+	work->gbt_tmpl = tmpl;
+	work->nonce2_len = tmpl->n2size;
+	work->gbt_txns = tmpl->transactions + 1;
+
+	/* Update coinbase. Always use an LE encoded nonce2 to fill in values
+	 * from left to right and prevent overflow errors with small n2sizes */
+	coinbase = alloca(tmpl->coinbase_len);
+	memcpy(coinbase, tmpl->coinbase, tmpl->coinbase_len);
+	nonce2le = htole64(work->nonce2);
+	memcpy(coinbase + tmpl->nonce2_offset, &nonce2le, tmpl->n2size);
+
 	/* Generate merkle root */
-	gen_hash(pool->coinbase, merkle_root, pool->coinbase_len);
+	gen_hash(coinbase, merkle_root, tmpl->coinbase_len);
 	memcpy(merkle_sha, merkle_root, 32);
-	for (i = 0; i < pool->merkles; i++) {
-		unsigned char *merkle_bin;
-
-		merkle_bin = pool->merklebin + (i * 32);
-		memcpy(merkle_sha + 32, merkle_bin, 32);
+	for (i = 0; i < tmpl->merkles; i++) {
+		memcpy(merkle_sha + 32, tmpl->merklebin + i * 32, 32);
 		gen_hash(merkle_sha, merkle_root, 64);
 		memcpy(merkle_sha, merkle_root, 32);
 	}
 	data32 = (uint32_t *)merkle_sha;
 	swap32 = (uint32_t *)merkle_root;
 	flip32(swap32, data32);
-
-	/* Copy the data template from header_bin */
-	memcpy(work->data, pool->header_bin, 112);
 	memcpy(work->data + 36, merkle_root, 32);
 
-	work->sdiff = pool->sdiff;
-
-	/* Copy parameters required for share submission */
-	work->ntime = strdup(pool->ntime);
-	memcpy(work->target, pool->gbt_target, 32);
-	cg_runlock(&pool->gbt_lock);
-
 	if (opt_debug) {
 		char *header, *merkle_hash;
 
@@ -7182,7 +8636,25 @@ static void set_benchmark_work(struct cgpu_info *cgpu, struct work *work)
 		memcpy(work, &bench_lodiff_bins[cgpu->lodiff][0], 160);
 }
 
-struct work *get_work(struct thr_info *thr, const int thr_id)
+/* A --device-split device generates stratum work for its own pool itself
+ * instead of taking whichever pool's work is next in the staged queue. */
+static struct work *get_split_work(struct cgpu_info *cgpu)
+{
+	struct pool *pool = cgpu->split_pool;
+	struct work *work;
+
+	if (!pool || !pool->has_stratum || !pool->stratum_notify || pool_unworkable(pool))
+		return NULL;
+	work = make_work();
+	gen_stratum_work(pool, work);
+	mutex_lock(&select_lock);
+	pool->works++;
+	pool->quota_used++;
+	mutex_unlock(&select_lock);
+	return work;
+}
+
+static struct work *__get_work(struct thr_info *thr, const int thr_id, bool blocking)
 {
 	struct cgpu_info *cgpu = thr->cgpu;
 	struct work *work = NULL;
@@ -7191,8 +8663,20 @@ struct work *get_work(struct thr_info *thr, const int thr_id)
 	thread_reportout(thr);
 	applog(LOG_DEBUG, "Popping work from get queue to get work");
 	diff_t = time(NULL);
+	if (opt_benchfile) {
+		/* Benchfile work bypasses the staged queue */
+		work = make_work();
+		get_benchfile_work(work);
+	} else if (device_split())
+		work = get_split_work(cgpu);
 	while (!work) {
-		work = hash_pop(true);
+		work = hash_pop(blocking);
+		if (!work) {
+			/* Nothing staged, ask for more and let the caller retry */
+			wake_gws();
+			thread_reportin(thr);
+			return NULL;
+		}
 		if (stale_work(work, false)) {
 			discard_work(work);
 			wake_gws();
@@ -7218,11 +8702,23 @@ struct work *get_work(struct thr_info *thr, const int thr_id)
 	return work;
 }
 
+struct work *get_work(struct thr_info *thr, const int thr_id)
+{
+	return __get_work(thr, thr_id, true);
+}
+
+/* As get_work() but returns NULL instead of waiting when no work is staged,
+ * for drivers that run several devices from one thread. The caller must allow
+ * for the time it spent without work itself. */
+struct work *get_work_nowait(struct thr_info *thr, const int thr_id)
+{
+	return __get_work(thr, thr_id, false);
+}
+
 /* Submit a copy of the tested, statistic recorded work item asynchronously */
 static void submit_work_async(struct work *work)
 {
 	struct pool *pool = work->pool;
-	pthread_t submit_thread;
 
 	cgtime(&work->tv_work_found);
 	if (opt_benchmark) {
@@ -7271,9 +8767,8 @@ static void submit_work_async(struct work *work)
 			free_work(work);
 		}
 	} else {
-		applog(LOG_DEBUG, "Pushing submit work to work thread");
-		if (unlikely(pthread_create(&submit_thread, NULL, submit_work_thread, (void *)work)))
-			quit(1, "Failed to create submit_work_thread");
+		applog(LOG_DEBUG, "Pushing submit work to submit thread");
+		submit_getwork(work);
 	}
 }
 
@@ -7343,6 +8838,8 @@ static void update_work_stats(struct thr_info *thr, struct work *work)
 	thr->cgpu->diff1 += work->device_diff;
 	work->pool->diff1 += work->device_diff;
 	thr->cgpu->last_device_valid_work = time(NULL);
+	if (opt_benchfile)
+		benchfile_nonces[work->bench_entry]++;
 	mutex_unlock(&stats_lock);
 }
 
@@ -8318,6 +9815,82 @@ static void prune_stratum_shares(struct pool *pool)
 	}
 }
 
+/* With --quota-adapt the load balance weights are adapted so that each pool's
+ * share of accepted difficulty, rather than of work, follows its quota. Pools
+ * yield different accepted diff per work item through rejects, stales and
+ * work discarded on block changes, so each pool's weight is scaled by the mean
+ * yield over its own. Diff accepted lags the work given by the share latency,
+ * so the diff still in flight is estimated from it. Balanced mode always
+ * adapts, to even out the diff1 solutions from each pool. The schedule is
+ * rebuilt regardless to bring back pools that have become workable again. */
+#define QUOTA_MIN_WORKS 16
+#define QUOTA_MIN_SHARES 8
+
+static void update_quota_weights(bool adapt)
+{
+	struct timeval now;
+	double mean = 0;
+	int i, yields = 0;
+
+	cgtime(&now);
+	mutex_lock(&select_lock);
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+		struct cgminer_pool_stats *pool_stats = &(pool->cgminer_pool_stats);
+		double diff, elapsed, latency, yield;
+		uint64_t results;
+		int64_t works;
+
+		diff = pool_strategy == POOL_BALANCE ? pool->diff1 : pool->diff_accepted;
+		if (!adapt) {
+			pool->quota_adjust = 1.0;
+			pool->quota_yield = 0;
+			goto snapshot;
+		}
+		works = pool->quota_used - pool->quota_last_used;
+		results = pool_stats->share_results - pool->quota_last_results;
+		elapsed = tdiff(&now, &pool->tv_quota);
+		if (works < QUOTA_MIN_WORKS || results < QUOTA_MIN_SHARES || elapsed <= 0)
+			continue;
+		latency = (pool_stats->share_latency_total - pool->quota_last_latency) / results;
+		yield = (diff - pool->quota_last_diff) * (1 + latency / elapsed) / works;
+		if (yield < 0)
+			yield = 0;
+		if (pool->quota_yield > 0)
+			pool->quota_yield = (pool->quota_yield + yield * 0.63) / 1.63;
+		else
+			pool->quota_yield = yield;
+snapshot:
+		pool->quota_last_used = pool->quota_used;
+		pool->quota_last_diff = diff;
+		pool->quota_last_results = pool_stats->share_results;
+		pool->quota_last_latency = pool_stats->share_latency_total;
+		copy_time(&pool->tv_quota, &now);
+	}
+
+	for (i = 0; i < total_pools; i++) {
+		if (pools[i]->quota_yield > 0) {
+			mean += pools[i]->quota_yield;
+			yields++;
+		}
+	}
+	for (i = 0; adapt && yields > 1 && i < total_pools; i++) {
+		struct pool *pool = pools[i];
+
+		if (pool->quota_yield <= 0)
+			continue;
+		pool->quota_adjust = mean / yields / pool->quota_yield;
+		if (pool->quota_adjust < 0.25)
+			pool->quota_adjust = 0.25;
+		else if (pool->quota_adjust > 4)
+			pool->quota_adjust = 4;
+		applog(LOG_DEBUG, "Pool %d yield %g diff per work, weight adjusted by %.3f",
+		       pool->pool_no, pool->quota_yield, pool->quota_adjust);
+	}
+	quota_rebuild = true;
+	mutex_unlock(&select_lock);
+}
+
 static void *watchpool_thread(void __maybe_unused *userdata)
 {
 	int intervals = 0;
@@ -8350,7 +9923,6 @@ static void *watchpool_thread(void __maybe_unused *userdata)
 
 				pool->last_shares = pool->diff1;
 				pool->utility = (pool->utility + shares * 0.63) / 1.63;
-				pool->shares = pool->utility;
 			}
 
 			if (pool->enabled == POOL_DISABLED)
@@ -8389,12 +9961,195 @@ static void *watchpool_thread(void __maybe_unused *userdata)
 			switch_pools(NULL);
 		}
 
+		update_quota_weights(pool_strategy == POOL_BALANCE ||
+				     (opt_quota_adapt && pool_strategy == POOL_LOADBALANCE));
+
 		cgsleep_ms(30000);
 
 	}
 	return NULL;
 }
 
+static double split_hashrate(struct cgpu_info *cgpu)
+{
+	/* Count devices equally until they have a hashrate */
+	return cgpu->rolling > 0 ? cgpu->rolling : 1;
+}
+
+/* A device's pool may have been removed from pools[] since it was assigned */
+static bool split_pool_gone(struct pool *pool)
+{
+	int i;
+
+	if (pool->removed)
+		return true;
+	for (i = 0; i < total_pools; i++) {
+		if (pools[i] == pool)
+			return false;
+	}
+	return true;
+}
+
+static int split_sort(const void *a, const void *b)
+{
+	double ha = split_hashrate(*(struct cgpu_info **)a);
+	double hb = split_hashrate(*(struct cgpu_info **)b);
+
+	return ha < hb ? 1 : (ha > hb ? -1 : 0);
+}
+
+/* With --device-split each device mines for one pool at a time, so its queue
+ * holds one pool's work and a pool's restarts only flush its own devices.
+ * Every --split-slice seconds, or when the workable pools change, the devices
+ * are assigned to pools so that each pool's share of the hashes done so far,
+ * including the coming slice, follows its load balance weight. Devices stay
+ * on their pool while it still needs at least half their hashrate and the
+ * rest go fastest first to the pool needing the most. With fewer devices than
+ * pools, or uneven devices, this time slices the devices between the pools. */
+static void split_devices(void)
+{
+	double total = 0, total_hash = 0, total_done = 0, slice, elapsed;
+	static struct timeval split_tv;
+	struct cgpu_info **devs;
+	bool changed = false;
+	struct timeval now;
+	int i, j, ndevs = 0;
+
+	cgtime(&now);
+	elapsed = split_tv.tv_sec ? tdiff(&now, &split_tv) : 0;
+	mutex_lock(&select_lock);
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+		bool live = quota_base(pool) > 0 && !pool_unworkable(pool);
+
+		if (live != pool->split_live) {
+			pool->split_live = live;
+			changed = true;
+		}
+	}
+	for (i = 0; i < total_devices; i++) {
+		struct cgpu_info *cgpu = get_devices(i);
+
+		if (cgpu->split_pool && split_pool_gone(cgpu->split_pool)) {
+			cgpu->split_pool = NULL;
+			changed = true;
+		}
+	}
+	if (!changed && !split_rebuild && (!opt_split_slice || elapsed < opt_split_slice)) {
+		mutex_unlock(&select_lock);
+		return;
+	}
+	split_rebuild = false;
+	copy_time(&split_tv, &now);
+
+	/* Start the accounting again whenever the live pools change, so pools
+	 * don't catch up on their time dead as with load balance quotas */
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+
+		if (changed)
+			pool->split_done = 0;
+		else
+			pool->split_done += pool->split_hash * elapsed;
+		pool->split_devs = 0;
+		pool->split_hash = 0;
+		if (!pool->split_live)
+			continue;
+		total += quota_base(pool) * pool->quota_adjust;
+		total_done += pool->split_done;
+	}
+
+	devs = alloca(sizeof(struct cgpu_info *) * (total_devices + 1));
+	for (i = 0; i < total_devices; i++) {
+		struct cgpu_info *cgpu = get_devices(i);
+
+		if (cgpu->deven != DEV_ENABLED) {
+			cgpu->split_pool = NULL;
+			continue;
+		}
+		devs[ndevs++] = cgpu;
+		total_hash += split_hashrate(cgpu);
+	}
+
+	/* The hashrate each pool needs this slice, in split_hash */
+	slice = opt_split_slice ? opt_split_slice : 1;
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+		double share;
+
+		if (!pool->split_live)
+			continue;
+		share = quota_base(pool) * pool->quota_adjust / total;
+		if (opt_split_slice)
+			pool->split_hash = (share * (total_done + total_hash * slice) - pool->split_done) / slice;
+		else
+			pool->split_hash = share * total_hash;
+	}
+
+	qsort(devs, ndevs, sizeof(struct cgpu_info *), split_sort);
+	for (i = 0; i < ndevs; i++) {
+		struct pool *pool = devs[i]->split_pool;
+		double hash = split_hashrate(devs[i]);
+
+		if (!changed && pool && pool->split_live && pool->split_hash >= hash / 2)
+			pool->split_hash -= hash;
+		else
+			devs[i]->split_pool = NULL;
+	}
+	for (i = 0; i < ndevs; i++) {
+		struct pool *best = NULL;
+
+		if (devs[i]->split_pool)
+			continue;
+		for (j = 0; j < total_pools; j++) {
+			struct pool *pool = pools[j];
+
+			if (pool->split_live && (!best || pool->split_hash > best->split_hash))
+				best = pool;
+		}
+		/* No live pools, so fall back to the staged queue */
+		if (!best)
+			break;
+		best->split_hash -= split_hashrate(devs[i]);
+		devs[i]->split_pool = best;
+		applog(LOG_INFO, "%s %d mining for pool %d", devs[i]->drv->name,
+		       devs[i]->device_id, best->pool_no);
+	}
+
+	/* Record what each pool actually got for the next slice */
+	for (i = 0; i < total_pools; i++)
+		pools[i]->split_hash = 0;
+	for (i = 0; i < ndevs; i++) {
+		struct pool *pool = devs[i]->split_pool;
+
+		if (!pool)
+			continue;
+		pool->split_devs++;
+		pool->split_hash += split_hashrate(devs[i]);
+	}
+	mutex_unlock(&select_lock);
+}
+
+/* main() waits up to 5 seconds for another pool when the one it selected can't
+ * generate work, woken as soon as switch_pools() changes the current pool so
+ * that failing over to a subscribed standby pool is immediate. */
+static struct pool *wait_alt_pool(void)
+{
+	struct pool *cp = current_pool();
+	struct timespec abstime;
+	struct timeval now;
+
+	cgtime(&now);
+	abstime.tv_sec = now.tv_sec + 5;
+	abstime.tv_nsec = now.tv_usec * 1000;
+	mutex_lock(&lp_lock);
+	if (current_pool() == cp)
+		pthread_cond_timedwait(&lp_cond, &lp_lock, &abstime);
+	mutex_unlock(&lp_lock);
+
+	return select_pool(true);
+}
+
 /* Makes sure the hashmeter keeps going even if mining threads stall, updates
  * the screen at regular intervals, and restarts threads if they appear to have
  * died. */
@@ -8423,10 +10178,13 @@ static void *watchdog_thread(void __maybe_unused *userdata)
 
 		sleep(interval);
 
-		discard_stale();
+		discard_stale(true);
 
 		hashmeter(-1, 0);
 
+		if (device_split())
+			split_devices();
+
 #ifdef HAVE_CURSES
 		if (curses_active_locked()) {
 			struct cgpu_info *cgpu;
@@ -8606,6 +10364,9 @@ void print_summary(void)
 	applog(LOG_WARNING, "Submitting work remotely delay occasions: %d", total_ro);
 	applog(LOG_WARNING, "New blocks detected on network: %d\n", new_blocks);
 
+	if (opt_benchfile && benchfile_count)
+		benchfile_summary();
+
 	if (total_pools > 1) {
 		for (i = 0; i < total_pools; i++) {
 			struct pool *pool = pools[i];
@@ -9368,6 +11129,7 @@ int main(int argc, char *argv[])
 	mutex_init(&console_lock);
 	cglock_init(&control_lock);
 	mutex_init(&stats_lock);
+	mutex_init(&select_lock);
 	mutex_init(&sharelog_lock);
 	cglock_init(&ch_lock);
 	mutex_init(&sshare_lock);
@@ -9376,6 +11138,10 @@ int main(int argc, char *argv[])
 	rwlock_init(&mining_thr_lock);
 	rwlock_init(&devices_lock);
 
+#ifdef HAVE_LIBCURL
+	mutex_init(&submit_lock);
+#endif
+
 	mutex_init(&lp_lock);
 	if (unlikely(pthread_cond_init(&lp_cond, NULL)))
 		early_quit(1, "Failed to pthread_cond_init lp_cond");
@@ -9386,6 +11152,8 @@ int main(int argc, char *argv[])
 
 	if (unlikely(pthread_cond_init(&gws_cond, NULL)))
 		early_quit(1, "Failed to pthread_cond_init gws_cond");
+	if (unlikely(pthread_cond_init(&gen_cond, NULL)))
+		early_quit(1, "Failed to pthread_cond_init gen_cond");
 
 	/* Create a unique get work queue */
 	getq = tq_new();
@@ -9443,6 +11211,40 @@ int main(int argc, char *argv[])
 	if (!config_loaded)
 		load_default_config();
 
+#ifndef WIN32
+	num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	{
+		SYSTEM_INFO sysinfo;
+
+		GetSystemInfo(&sysinfo);
+		num_processors = sysinfo.dwNumberOfProcessors;
+	}
+#endif
+
+#ifdef USE_SCRYPT
+	if (opt_scrypt_benchmark) {
+		scrypt_benchmark();
+		early_quit(0, "Scrypt benchmark complete");
+	}
+#endif
+#ifdef HAVE_LIBCURL
+	if (opt_gbt_benchmark) {
+		gbt_benchmark(opt_gbt_benchmark);
+		early_quit(0, "GBT benchmark complete");
+	}
+	if (opt_roll_benchmark) {
+		roll_benchmark(opt_roll_benchmark);
+		early_quit(0, "Roll benchmark complete");
+	}
+#endif
+#if defined(USE_ANT_S1) || defined(USE_ANT_S2)
+	if (opt_bitmain_replay) {
+		bitmain_replay(opt_bitmain_replay);
+		early_quit(0, "Bitmain replay complete");
+	}
+#endif
+
 	if (!opt_sha256 && !opt_scrypt)
 		early_quit(1, "Must explicitly specify mining algorithm (--sha256 or --scrypt)");
 
@@ -9469,7 +11271,18 @@ int main(int argc, char *argv[])
 			hex2bin(&bench_lodiff_bins[i][0], &bench_lodiffs[i][0], 160);
 		}
 		set_target(bench_target, 32);
+
+		if (opt_benchfile) {
+			benchfile_load();
+			if (opt_benchfile_convert) {
+				benchfile_save();
+				early_quit(0, "BENCHFILE Converted %d work items to '%s'",
+					   benchfile_count, opt_benchfile_convert);
+			}
+		}
 	}
+	if (opt_benchfile_convert && !opt_benchfile)
+		early_quit(1, "--benchfile-convert requires --benchfile");
 
 #ifdef HAVE_CURSES
 	if (opt_realquiet || opt_display_devs)
@@ -9756,6 +11569,26 @@ begin_bench:
 	if (total_control_threads != 8)
 		early_quit(1, "incorrect total_control_threads (%d) should be 8", total_control_threads);
 
+	if (!opt_benchmark && !opt_benchfile) {
+		if (opt_gen_threads < 0)
+			opt_gen_threads = MAX(num_processors - 1, 0);
+		gen_thr = calloc(opt_gen_threads, sizeof(*gen_thr));
+		if (opt_gen_threads && !gen_thr)
+			early_quit(1, "Failed to calloc gen_thr");
+		for (i = 0; i < opt_gen_threads; i++) {
+			struct gen_thr *gen = &gen_thr[i];
+
+			gen->id = i;
+			gen->cgminer_stats.getwork_wait_min.tv_sec = MIN_SEC_UNSET;
+			if (thr_info_create(&gen->thr, NULL, gen_thread, gen))
+				early_quit(1, "work generator thread create failed");
+			pthread_detach(gen->thr.pth);
+			total_gen_threads++;
+		}
+		if (total_gen_threads)
+			applog(LOG_INFO, "Started %d work generator threads", total_gen_threads);
+	}
+
 	set_highprio();
 
 	/* Once everything is set up, main() becomes the getwork scheduler */
@@ -9769,6 +11602,15 @@ begin_bench:
 		opt_work_update = false;
 		cp = current_pool();
 
+		/* Device threads take benchfile work directly in get_work() so
+		 * there is nothing to stage */
+		if (opt_benchfile) {
+			mutex_lock(stgd_lock);
+			pthread_cond_wait(&gws_cond, stgd_lock);
+			mutex_unlock(stgd_lock);
+			continue;
+		}
+
 		/* If the primary pool is a getwork pool and cannot roll work,
 		 * try to stage one extra work per mining thread */
 		if (!pool_localgen(cp) && !staged_rollable)
@@ -9822,9 +11664,8 @@ begin_bench:
 retry:
 		if (pool->has_stratum) {
 			while (!pool->stratum_active || !pool->stratum_notify) {
-				struct pool *altpool = select_pool(true);
+				struct pool *altpool = wait_alt_pool();
 
-				cgsleep_ms(5000);
 				if (altpool != pool) {
 					pool = altpool;
 					goto retry;
@@ -9833,15 +11674,12 @@ retry:
 			gen_stratum_work(pool, work);
 			applog(LOG_DEBUG, "Generated stratum work");
 			stage_work(work);
+			if (total_gen_threads)
+				gen_wake();
 			continue;
 		}
 
-		if (opt_benchfile) {
-			get_benchfile_work(work);
-			applog(LOG_DEBUG, "Generated benchfile work");
-			stage_work(work);
-			continue;
-		} else if (opt_benchmark) {
+		if (opt_benchmark) {
 			get_benchmark_work(work);
 			applog(LOG_DEBUG, "Generated benchmark work");
 			stage_work(work);
@@ -9853,9 +11691,8 @@ retry:
 
 		if (pool->gbt_solo) {
 			while (pool->idle) {
-				struct pool *altpool = select_pool(true);
+				struct pool *altpool = wait_alt_pool();
 
-				cgsleep_ms(5000);
 				if (altpool != pool) {
 					pool = altpool;
 					goto retry;
@@ -9869,9 +11706,8 @@ retry:
 
 		if (pool->has_gbt) {
 			while (pool->idle) {
-				struct pool *altpool = select_pool(true);
+				struct pool *altpool = wait_alt_pool();
 
-				cgsleep_ms(5000);
 				if (altpool != pool) {
 					pool = altpool;
 					goto retry;
@@ -17,6 +17,7 @@
 #include <stdbool.h>
 
 #include "spi-context.h"
+#include "spi-emu.h"
 #include "logging.h"
 #include "miner.h"
 #include "util.h"
@@ -906,6 +907,73 @@ void A1_detect(bool hotplug)
 }
 
 #define TEMP_UPDATE_INT_MS	2000
+
+/*
+ * Rather than reading the register of every chip on every pass, a chip
+ * with both job slots full is next polled when its running job should
+ * be done, from its measured nonce range time, and then every
+ * range / A1_POLL_DIV (at least A1_POLL_MIN_MS) until it is.
+ * The range time is measured between completions while the chip
+ * had a queued job, and is reset by a flush. Chips are polled on every
+ * pass until it is known, or at the latest every A1_POLL_MAX_MS.
+ */
+#define A1_POLL_MIN_MS		2
+#define A1_POLL_MAX_MS		1000
+#define A1_POLL_DIV		32
+/* expect the next completion this much early, in percent of the range */
+#define A1_POLL_EARLY		5
+#define A1_IDLE_MS		40
+
+static void schedule_poll(struct A1_chip *chip, int now)
+{
+	int due, step;
+
+	if (chip->range_ms == 0) {
+		chip->next_poll = 0;
+		return;
+	}
+
+	step = chip->range_ms / A1_POLL_DIV;
+	if (step < A1_POLL_MIN_MS)
+		step = A1_POLL_MIN_MS;
+
+	due = chip->last_done + chip->range_ms -
+	      chip->range_ms * A1_POLL_EARLY / 100;
+	if (due < now + step)
+		due = now + step;
+	if (due > now + A1_POLL_MAX_MS)
+		due = now + A1_POLL_MAX_MS;
+	chip->next_poll = due;
+}
+
+static void chip_done(struct A1_chip *chip, uint8_t qstate, int now)
+{
+	int range;
+
+	/* only a completion with a queued job behind it times a full range */
+	if (chip->was_full && qstate == 1 && chip->last_done) {
+		range = now - chip->last_done;
+		if (chip->range_ms == 0)
+			chip->range_ms = range;
+		else
+			chip->range_ms = (chip->range_ms * 7 + range) / 8;
+	}
+	chip->last_done = now;
+}
+
+/* As submit_nonce, but emulated chips only find nonces to the emulator diff */
+static bool A1_submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce)
+{
+	if (likely(spi_emu_diff <= 0))
+		return submit_nonce(thr, work, nonce);
+	if (!test_nonce_diff(work, nonce, spi_emu_diff)) {
+		inc_hw_errors(thr);
+		return false;
+	}
+	submit_tested_work(thr, work);
+	return true;
+}
+
 static int64_t A1_scanwork(struct thr_info *thr)
 {
 	int i;
@@ -960,7 +1028,7 @@ static int64_t A1_scanwork(struct thr_info *thr)
 			chip->stales++;
 			continue;
 		}
-		if (!submit_nonce(thr, work, nonce)) {
+		if (!A1_submit_nonce(thr, work, nonce)) {
 			applog(LOG_WARNING, "%d: chip %d: invalid nonce 0x%08x",
 			       cid, chip_id, nonce);
 			chip->hw_errors++;
@@ -973,11 +1041,21 @@ static int64_t A1_scanwork(struct thr_info *thr)
 		chip->nonces_found++;
 	}
 
-	/* check for completed works */
+	/* check for completed works, on chips due to be polled */
+	int now = get_current_ms();
+	int next_poll = now + A1_IDLE_MS;
 	for (i = a1->num_active_chips; i > 0; i--) {
 		uint8_t c = i;
 		if (is_chip_disabled(a1, c))
 			continue;
+		struct A1_chip *chip = &a1->chips[i - 1];
+		if (chip->next_poll && now < chip->next_poll) {
+			a1->polls_skipped++;
+			if (next_poll > chip->next_poll)
+				next_poll = chip->next_poll;
+			continue;
+		}
+		a1->reg_polls++;
 		if (!cmd_READ_REG(a1, c)) {
 			disable_chip(a1, c);
 			continue;
@@ -985,9 +1063,12 @@ static int64_t A1_scanwork(struct thr_info *thr)
 		uint8_t qstate = a1->spi_rx[5] & 3;
 		uint8_t qbuff = a1->spi_rx[6];
 		struct work *work;
-		struct A1_chip *chip = &a1->chips[i - 1];
 		switch(qstate) {
 		case 3:
+			chip->was_full = true;
+			schedule_poll(chip, now);
+			if (chip->next_poll && next_poll > chip->next_poll)
+				next_poll = chip->next_poll;
 			continue;
 		case 2:
 			applog(LOG_ERR, "%d: chip %d: invalid state = 2",
@@ -997,6 +1078,11 @@ static int64_t A1_scanwork(struct thr_info *thr)
 			/* fall through */
 		case 0:
 			work_updated = true;
+			if (chip->was_full)
+				chip_done(chip, qstate, now);
+			chip->was_full = false;
+			/* poll again next pass until both slots are full */
+			chip->next_poll = 0;
 
 			work = wq_dequeue(&a1->active_wq);
 			if (work == NULL) {
@@ -1008,6 +1094,9 @@ static int64_t A1_scanwork(struct thr_info *thr)
 				chip->nonce_ranges_done++;
 				nonce_ranges_processed++;
 			}
+			/* an empty chip starts the job now */
+			if (qstate == 0)
+				chip->last_done = now;
 			applog(LOG_DEBUG, "%d: chip %d: job done: %d/%d/%d/%d",
 			       cid, c,
 			       chip->nonce_ranges_done, chip->nonces_found,
@@ -1027,9 +1116,17 @@ static int64_t A1_scanwork(struct thr_info *thr)
 		applog(LOG_DEBUG, "%d, nonces processed %d",
 		       cid, nonce_ranges_processed);
 	}
-	/* in case of no progress, prevent busy looping */
-	if (!work_updated)
-		cgsleep_ms(40);
+	/* in case of no progress, sleep until the next chip is due */
+	if (!work_updated) {
+		int sleep_ms = next_poll - get_current_ms();
+
+		if (sleep_ms < 1)
+			sleep_ms = 1;
+		if (sleep_ms > A1_IDLE_MS)
+			sleep_ms = A1_IDLE_MS;
+		a1->idle_sleeps++;
+		cgsleep_ms(sleep_ms);
+	}
 
 	return (int64_t)nonce_ranges_processed << 32;
 }
@@ -1084,6 +1181,10 @@ static void A1_flush_work(struct cgpu_info *cgpu)
 			chip->work[j] = NULL;
 		}
 		chip->last_queued_id = 0;
+		/* the reset emptied the chip, poll it on the next pass */
+		chip->next_poll = 0;
+		chip->last_done = 0;
+		chip->was_full = false;
 	}
 	/* flush queued work */
 	applog(LOG_DEBUG, "%d: flushing queued work...", cid);
@@ -1109,6 +1210,51 @@ static void A1_get_statline_before(char *buf, size_t len,
 		    a1->temp == 0 ? "   " : temp);
 }
 
+static struct api_data *A1_api_stats(struct cgpu_info *cgpu)
+{
+	struct A1_chain *a1 = cgpu->device_data;
+	struct api_data *root = NULL;
+	uint64_t nonces = 0, hw_errors = 0, stales = 0, ranges = 0;
+	int i, disabled = 0, range_ms = 0, timed = 0;
+
+	mutex_lock(&a1->lock);
+	for (i = 0; i < a1->num_active_chips; i++) {
+		struct A1_chip *chip = &a1->chips[i];
+
+		nonces += chip->nonces_found;
+		hw_errors += chip->hw_errors;
+		stales += chip->stales;
+		ranges += chip->nonce_ranges_done;
+		if (is_chip_disabled(a1, i + 1))
+			disabled++;
+		if (chip->range_ms) {
+			range_ms += chip->range_ms;
+			timed++;
+		}
+	}
+	mutex_unlock(&a1->lock);
+	if (timed)
+		range_ms /= timed;
+
+	root = api_add_int(root, "Chain", &(a1->chain_id), true);
+	root = api_add_int(root, "Chips", &(a1->num_chips), true);
+	root = api_add_int(root, "Active Chips", &(a1->num_active_chips), true);
+	root = api_add_int(root, "Disabled Chips", &disabled, true);
+	root = api_add_int(root, "Cores", &(a1->num_cores), true);
+	root = api_add_int(root, "Queued", &(a1->active_wq.num_elems), true);
+	root = api_add_uint64(root, "Nonces", &nonces, true);
+	root = api_add_uint64(root, "HW Errors", &hw_errors, true);
+	root = api_add_uint64(root, "Stales", &stales, true);
+	root = api_add_uint64(root, "Nonce Ranges", &ranges, true);
+	root = api_add_int(root, "Chip Range mS", &range_ms, true);
+	root = api_add_uint64(root, "Reg Polls", &(a1->reg_polls), true);
+	root = api_add_uint64(root, "Polls Skipped", &(a1->polls_skipped), true);
+	root = api_add_uint64(root, "Idle Sleeps", &(a1->idle_sleeps), true);
+
+	root = spi_api_stats(a1->spi_ctx, root);
+	return spi_emu_api_stats(a1->spi_ctx, root);
+}
+
 struct device_drv bitmineA1_drv = {
 	.drv_id = DRIVER_bitmineA1,
 	.dname = "BitmineA1",
@@ -1120,4 +1266,5 @@ struct device_drv bitmineA1_drv = {
 	.queue_full = A1_queue_full,
 	.flush_work = A1_flush_work,
 	.get_statline_before = A1_get_statline_before,
+	.get_api_stats = A1_api_stats,
 };
@@ -286,6 +286,8 @@ typedef struct sitem {
 	// WITEMs used to build the work
 	K_ITEM *witems[BAB_MAXCHIPS];
 	struct timeval work_start;
+	// flush_gen when the work was built
+	uint32_t flush_gen;
 } SITEM;
 
 #define ALLOC_RITEMS 256
@@ -424,6 +426,22 @@ struct bab_info {
 	uint64_t ign_total_work_links;
 
 	struct timeval last_sent_work;
+
+	/*
+	 * Incremented by each flush, the SPI thread skips the send delay
+	 * until it has sent work built since the latest flush
+	 */
+	uint32_t flush_gen;
+	bool spi_urgent;
+	uint64_t urgent_sends;
+	uint64_t stale_sends;
+
+	// Send delay adapted to the fastest chip's nonce rate
+	int work_delay;
+	double work_rate;
+	uint64_t rate_good[BAB_MAXCHIPS];
+	struct timeval rate_time;
+
 	uint64_t delay_count;
 	double delay_min;
 	double delay_max;
@@ -531,6 +549,19 @@ struct bab_info {
 // Don't send work more often than this
 #define BAB_EXPECTED_WORK_DELAY_mS 899
 
+/*
+ * Unless the fastest chip would finish a full nonce range before then
+ * Every BAB_WORK_RATE_mS the nonce rate of each chip is measured
+ * 1 nonce per second is ~4.295GH/s i.e. a nonce range per second
+ * and if the fastest chip's nonce range takes less than
+ * BAB_EXPECTED_WORK_DELAY_mS the delay is reduced to
+ * BAB_WORK_RANGE_PERCENT of its range time, but no lower than
+ * BAB_MIN_WORK_DELAY_mS
+ */
+#define BAB_WORK_RATE_mS 30000
+#define BAB_WORK_RANGE_PERCENT 75
+#define BAB_MIN_WORK_DELAY_mS 300
+
 /*
  * If a chip only has bad results after this time limit in seconds,
  * then switch it down to min_speed
@@ -1584,6 +1615,7 @@ static void bab_detect(bool hotplug)
 	cgtime(&(babcgpu->dev_start_tv));
 	// Ignore detection tests
 	babinfo->last_did.tv_sec = 0;
+	babinfo->work_delay = BAB_EXPECTED_WORK_DELAY_mS;
 
 	babinfo->initialised = true;
 
@@ -1601,6 +1633,47 @@ static void bab_identify(__maybe_unused struct cgpu_info *babcgpu)
 {
 }
 
+/*
+ * Every BAB_WORK_RATE_mS, set the work_delay from the number of
+ * good nonces the fastest chip found since last time
+ */
+static void bab_work_rate(struct bab_info *babinfo, struct timeval *now)
+{
+	double elapsed, rate, best, range_ms;
+	int chip, work_delay;
+
+	if (babinfo->rate_time.tv_sec == 0) {
+		memcpy(&(babinfo->rate_time), now, sizeof(*now));
+		return;
+	}
+
+	elapsed = ms_tdiff(now, &(babinfo->rate_time));
+	if (elapsed < BAB_WORK_RATE_mS)
+		return;
+
+	best = 0;
+	for (chip = 0; chip < babinfo->chips; chip++) {
+		rate = (double)(babinfo->chip_good[chip] - babinfo->rate_good[chip]) * 1000.0 / elapsed;
+		if (best < rate)
+			best = rate;
+		babinfo->rate_good[chip] = babinfo->chip_good[chip];
+	}
+	memcpy(&(babinfo->rate_time), now, sizeof(*now));
+
+	work_delay = BAB_EXPECTED_WORK_DELAY_mS;
+	if (best > 0) {
+		range_ms = 1000.0 / best;
+		if (range_ms < BAB_EXPECTED_WORK_DELAY_mS) {
+			work_delay = (int)(range_ms * BAB_WORK_RANGE_PERCENT / 100.0);
+			if (work_delay < BAB_MIN_WORK_DELAY_mS)
+				work_delay = BAB_MIN_WORK_DELAY_mS;
+		}
+	}
+
+	babinfo->work_rate = best;
+	babinfo->work_delay = work_delay;
+}
+
 // thread to do spi txrx
 static void *bab_spi(void *userdata)
 {
@@ -1610,6 +1683,7 @@ static void *bab_spi(void *userdata)
 	K_ITEM *sitem, *witem;
 	double wait, delay;
 	int chip, band;
+	bool urgent, stale;
 
 	applog(LOG_DEBUG, "%s%i: SPIing...",
 			  babcgpu->drv->name, babcgpu->device_id);
@@ -1642,23 +1716,38 @@ static void *bab_spi(void *userdata)
 			continue;
 		}
 
-		// TODO: need an LP/urgent flag to skip this possible cgsem_mswait()
-		// maybe zero last_sent_work.tv_sec ?
+		// A flush skips the delay, also if it happens while waiting
 		while (babinfo->last_sent_work.tv_sec) {
+			mutex_lock(&(babinfo->did_lock));
+			urgent = babinfo->spi_urgent;
+			mutex_unlock(&(babinfo->did_lock));
+			if (urgent)
+				break;
+
 			cgtime(&now);
 			delay = tdiff(&now, &(babinfo->last_sent_work)) * 1000.0;
-			if (delay < BAB_EXPECTED_WORK_DELAY_mS)
-				cgsem_mswait(&(babinfo->spi_work), BAB_EXPECTED_WORK_DELAY_mS - delay);
+			if (delay < babinfo->work_delay)
+				cgsem_mswait(&(babinfo->spi_work), babinfo->work_delay - delay);
 			else
 				break;
 		}
 
 		/*
-		 * TODO: handle if an LP happened after bab_do_work() started
-		 * i.e. we don't want to send the work
-		 * Have an LP counter that at this point would show the work
-		 * is stale - so don't send it
+		 * Work built before the last flush is still sent since the
+		 * same transfer returns the chip results, but the flush stays
+		 * urgent until the work built after it has also been sent
 		 */
+		mutex_lock(&(babinfo->did_lock));
+		stale = (DATAS(sitem)->flush_gen != babinfo->flush_gen);
+		if (babinfo->spi_urgent) {
+			babinfo->urgent_sends++;
+			if (!stale)
+				babinfo->spi_urgent = false;
+		}
+		if (stale)
+			babinfo->stale_sends++;
+		mutex_unlock(&(babinfo->did_lock));
+
 		cgtime(&send);
 		bab_txrx(sitem, false);
 		cgtime(&start);
@@ -1712,6 +1801,8 @@ static void *bab_spi(void *userdata)
 		if (babinfo->send_max < delay)
 			babinfo->send_max = delay;
 
+		bab_work_rate(babinfo, &start);
+
 		cgsem_mswait(&(babinfo->spi_work), BAB_STD_WAIT_mS);
 	}
 
@@ -1727,9 +1818,12 @@ static void bab_flush_work(struct cgpu_info *babcgpu)
 
 	mutex_lock(&(babinfo->did_lock));
 	babinfo->last_did.tv_sec = 0;
+	babinfo->flush_gen++;
+	babinfo->spi_urgent = true;
 	mutex_unlock(&(babinfo->did_lock));
 
 	cgsem_post(&(babinfo->scan_work));
+	cgsem_post(&(babinfo->spi_work));
 }
 
 #define DATA_MERKLE7 16
@@ -2131,19 +2225,23 @@ static bool bab_do_work(struct cgpu_info *babcgpu)
 	struct timeval when, now;
 	double delay;
 	int chip, rep, j, nonces, spie = 0, miso = 0;
-	uint32_t nonce, spichk;
+	uint32_t nonce, spichk, flush_gen;
 	bool res;
 
 	cgtime(&now);
 	mutex_lock(&(babinfo->did_lock));
 	delay = us_tdiff(&now, &(babinfo->last_did));
+	flush_gen = babinfo->flush_gen;
 	mutex_unlock(&(babinfo->did_lock));
-	if (delay < BAB_STD_WORK_DELAY_uS)
+	// Reduced by the same amount as the SPI send delay
+	if (delay < BAB_STD_WORK_DELAY_uS -
+		    (BAB_EXPECTED_WORK_DELAY_mS - babinfo->work_delay) * 1000)
 		return false;
 
 	K_WLOCK(babinfo->sfree_list);
 	sitem = k_unlink_head_zero(babinfo->sfree_list);
 	K_WUNLOCK(babinfo->sfree_list);
+	DATAS(sitem)->flush_gen = flush_gen;
 
 	for (chip = 0; chip < babinfo->chips; chip++) {
 		if (!(babinfo->disabled[chip])) {
@@ -2985,6 +3083,12 @@ static struct api_data *bab_api_stats(struct cgpu_info *babcgpu)
 	root = api_add_int(root, "Reply Wait", &(babinfo->reply_wait), true);
 	root = api_add_uint64(root, "Reply Waits", &(babinfo->reply_waits), true);
 
+	root = api_add_int(root, "Work Delay", &(babinfo->work_delay), true);
+	root = api_add_double(root, "Work Nonce Rate", &(babinfo->work_rate), true);
+	root = api_add_uint32(root, "Flush Gen", &(babinfo->flush_gen), true);
+	root = api_add_uint64(root, "Urgent Sends", &(babinfo->urgent_sends), true);
+	root = api_add_uint64(root, "Stale Sends", &(babinfo->stale_sends), true);
+
 	root = api_add_uint64(root, "Work Unrolled", &(babinfo->work_unrolled), true);
 	root = api_add_uint64(root, "Work Rolled", &(babinfo->work_rolled), true);
 
@@ -51,6 +51,7 @@ bool opt_bitmain_checkn2diff = false;
 bool opt_bitmain_beeper = false;
 bool opt_bitmain_tempoverctrl = true;
 #endif
+char *opt_bitmain_capture;
 int opt_bitmain_temp = BITMAIN_TEMP_TARGET;
 int opt_bitmain_overheat = BITMAIN_TEMP_OVERHEAT;
 int opt_bitmain_fan_min = BITMAIN_DEFAULT_FAN_MIN_PWM;
@@ -107,70 +108,46 @@ static unsigned char bit_swap_table[256] =
 // --------------------------------------------------------------
 //      CRC16 check table
 // --------------------------------------------------------------
-const uint8_t chCRCHTalbe[] = // CRC high byte table
-{
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
- 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
- 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
- 0x00, 0xC1, 0x81, 0x40
-};
+/*
+ * CRC-16/MODBUS (reflected 0xA001, init 0xFFFF), two bytes per step.
+ * crc16_table[0] is the usual byte table, crc16_table[1] is the same
+ * advanced by one more zero byte so a 16 bit chunk needs two lookups
+ */
+static uint16_t crc16_table[2][256];
 
-const uint8_t chCRCLTalbe[] = // CRC low byte table
+static void bitmain_crc16_init(void)
 {
- 0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7,
- 0x05, 0xC5, 0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E,
- 0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09, 0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9,
- 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC,
- 0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
- 0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32,
- 0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D,
- 0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38,
- 0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF,
- 0x2D, 0xED, 0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
- 0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1,
- 0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4,
- 0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB,
- 0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA,
- 0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
- 0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0,
- 0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97,
- 0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C, 0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E,
- 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98, 0x88, 0x48, 0x49, 0x89,
- 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
- 0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83,
- 0x41, 0x81, 0x80, 0x40
-};
+	uint16_t crc;
+	int i, j;
+
+	if (crc16_table[0][1])
+		return;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+		crc16_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc16_table[0][i];
+		crc16_table[1][i] = (crc >> 8) ^ crc16_table[0][crc & 0xff];
+	}
+}
 
 static uint16_t CRC16(const uint8_t* p_data, uint16_t w_len)
 {
-	uint8_t chCRCHi = 0xFF; // CRC high byte initialize
-	uint8_t chCRCLo = 0xFF; // CRC low byte initialize
-	uint16_t wIndex = 0;    // CRC cycling index
+	uint16_t crc = 0xFFFF;
 
-	while (w_len--) {
-		wIndex = chCRCLo ^ *p_data++;
-		chCRCLo = chCRCHi ^ chCRCHTalbe[wIndex];
-		chCRCHi = chCRCLTalbe[wIndex];
+	while (w_len >= 2) {
+		crc ^= p_data[0] | (p_data[1] << 8);
+		crc = crc16_table[1][crc & 0xff] ^ crc16_table[0][crc >> 8];
+		p_data += 2;
+		w_len -= 2;
 	}
-	return ((chCRCHi << 8) | chCRCLo);
+	if (w_len)
+		crc = (crc >> 8) ^ crc16_table[0][(crc ^ *p_data) & 0xff];
+	return crc;
 }
 
 static uint32_t num2bit(int num)
@@ -1118,512 +1095,367 @@ static void bitmain_update_temps(struct cgpu_info *bitmain, struct bitmain_info
 #endif
 }
 
-static void bitmain_parse_results(struct cgpu_info *bitmain, struct bitmain_info *info,
-				  struct thr_info *thr, uint8_t *buf, int *offset)
+static void bitmain_rxstatus(struct cgpu_info *bitmain, struct bitmain_info *info,
+			     struct thr_info *thr, struct bitmain_rxstatus_data *rxstatusdata)
 {
-#ifdef USE_ANT_S1
-	int i, j, n, m, errordiff, spare = BITMAIN_READ_SIZE;
 	uint32_t checkbit = 0x00000000;
-	bool found = false;
-	struct work *work = NULL;
-	//char *ob_hex = NULL;
-	uint64_t searches;
-	K_ITEM *witem;
-
-	for (i = 0; i <= spare; i++) {
-		if (buf[i] == 0xa1) {
-			struct bitmain_rxstatus_data rxstatusdata;
-			applog(LOG_DEBUG, "%s%d: %s() RxStatus Data",
-					  bitmain->drv->name, bitmain->device_id,
-					  __func__);
-			if (*offset < 2) {
-				return;
-			}
-			if (buf[i+1] > 124) {
-				applog(LOG_ERR, "%s%d: %s() RxStatus Data datalen=%d error",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, buf[i+1]+2);
-				continue;
-			}
-			if (*offset < buf[i+1] + 2) {
-				return;
+	int j, n, m, errordiff;
+#ifdef USE_ANT_S1
+	mutex_lock(&info->qlock);
+	info->chain_num = rxstatusdata->chain_num;
+	info->fifo_space = rxstatusdata->fifo_space;
+	info->nonce_error = rxstatusdata->nonce_error;
+	errordiff = info->nonce_error-info->last_nonce_error;
+	applog(LOG_DEBUG, "%s%d: %s() RxStatus Data"
+			" version=%d chainnum=%d fifospace=%d"
+			" nonceerror=%d-%d freq=%d chain info:",
+			bitmain->drv->name, bitmain->device_id, __func__,
+			rxstatusdata->version, info->chain_num,
+			info->fifo_space, info->last_nonce_error,
+			info->nonce_error, info->frequency);
+	for (n = 0; n < rxstatusdata->chain_num; n++) {
+		info->chain_asic_num[n] = rxstatusdata->chain_asic_num[n];
+		info->chain_asic_status[n] = rxstatusdata->chain_asic_status[n];
+		memset(info->chain_asic_status_t[n], 0, 40);
+		j = 0;
+		for (m = 0; m < 32; m++) {
+			if (m%8 == 0 && m != 0) {
+				info->chain_asic_status_t[n][j] = ' ';
+				j++;
 			}
-			if (bitmain_parse_rxstatus(buf+i, buf[i+1]+2, &rxstatusdata) != 0) {
-				applog(LOG_ERR, "%s%d: %s() RxStatus Data error len=%d",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, buf[i+1]+2);
-			} else {
-				mutex_lock(&info->qlock);
-				info->chain_num = rxstatusdata.chain_num;
-				info->fifo_space = rxstatusdata.fifo_space;
-				info->nonce_error = rxstatusdata.nonce_error;
-				errordiff = info->nonce_error-info->last_nonce_error;
-				applog(LOG_DEBUG, "%s%d: %s() RxStatus Data"
-						" version=%d chainnum=%d fifospace=%d"
-						" nonceerror=%d-%d freq=%d chain info:",
-						bitmain->drv->name, bitmain->device_id, __func__,
-						rxstatusdata.version, info->chain_num,
-						info->fifo_space, info->last_nonce_error,
-						info->nonce_error, info->frequency);
-				for (n = 0; n < rxstatusdata.chain_num; n++) {
-					info->chain_asic_num[n] = rxstatusdata.chain_asic_num[n];
-					info->chain_asic_status[n] = rxstatusdata.chain_asic_status[n];
-					memset(info->chain_asic_status_t[n], 0, 40);
-					j = 0;
-					for (m = 0; m < 32; m++) {
-						if (m%8 == 0 && m != 0) {
-							info->chain_asic_status_t[n][j] = ' ';
-							j++;
-						}
-						checkbit = num2bit(m);
-						if (rxstatusdata.chain_asic_status[n] & checkbit)
-							info->chain_asic_status_t[n][j] = 'o';
-						else
-							info->chain_asic_status_t[n][j] = 'x';
+			checkbit = num2bit(m);
+			if (rxstatusdata->chain_asic_status[n] & checkbit)
+				info->chain_asic_status_t[n][j] = 'o';
+			else
+				info->chain_asic_status_t[n][j] = 'x';
 
-						j++;
-					}
-					applog(LOG_DEBUG, "%s%d: %s() RxStatus Data chain(%d)"
-							" asic_num=%d asic_status=%08x-%s",
-							bitmain->drv->name, bitmain->device_id,
-							__func__,
-							n, info->chain_asic_num[n],
-							info->chain_asic_status[n],
-							info->chain_asic_status_t[n]);
-				}
-				mutex_unlock(&info->qlock);
+			j++;
+		}
+		applog(LOG_DEBUG, "%s%d: %s() RxStatus Data chain(%d)"
+				" asic_num=%d asic_status=%08x-%s",
+				bitmain->drv->name, bitmain->device_id,
+				__func__,
+				n, info->chain_asic_num[n],
+				info->chain_asic_status[n],
+				info->chain_asic_status_t[n]);
+	}
+	mutex_unlock(&info->qlock);
 
-				if (errordiff > 0) {
-					for (j = 0; j < errordiff; j++) {
-						bitmain_inc_nvw(info, thr);
+	if (errordiff > 0) {
+		for (j = 0; j < errordiff; j++) {
+			bitmain_inc_nvw(info, thr);
+		}
+		mutex_lock(&info->qlock);
+		info->last_nonce_error += errordiff;
+		mutex_unlock(&info->qlock);
+	}
+	bitmain_update_temps(bitmain, info, rxstatusdata);
+#else // S2
+	int r, asicnum = 0;
+
+	mutex_lock(&info->qlock);
+	info->chain_num = rxstatusdata->chain_num;
+	info->fifo_space = rxstatusdata->fifo_space;
+	info->hw_version[0] = rxstatusdata->hw_version[0];
+	info->hw_version[1] = rxstatusdata->hw_version[1];
+	info->hw_version[2] = rxstatusdata->hw_version[2];
+	info->hw_version[3] = rxstatusdata->hw_version[3];
+	info->nonce_error = rxstatusdata->nonce_error;
+	errordiff = info->nonce_error-info->last_nonce_error;
+	applog(LOG_DEBUG, "%s%d: %s() RxStatus Data"
+			" version=%d chainnum=%d fifospace=%d"
+			" hwv1=%d hwv2=%d hwv3=%d hwv4=%d"
+			" nonceerror=%d-%d freq=%d chain info:",
+			bitmain->drv->name, bitmain->device_id, __func__,
+			rxstatusdata->version, info->chain_num, info->fifo_space,
+			info->hw_version[0], info->hw_version[1],
+			info->hw_version[2], info->hw_version[3],
+			info->last_nonce_error,
+			info->nonce_error, info->frequency);
+	memcpy(info->chain_asic_exist, rxstatusdata->chain_asic_exist, BITMAIN_MAX_CHAIN_NUM*32);
+	memcpy(info->chain_asic_status, rxstatusdata->chain_asic_status, BITMAIN_MAX_CHAIN_NUM*32);
+	for (n = 0; n < rxstatusdata->chain_num; n++) {
+		info->chain_asic_num[n] = rxstatusdata->chain_asic_num[n];
+		memset(info->chain_asic_status_t[n], 0, 320);
+		j = 0;
+		if (info->chain_asic_num[n] <= 0)
+			asicnum = 0;
+		else {
+			if (info->chain_asic_num[n] % 32 == 0)
+				asicnum = info->chain_asic_num[n] / 32;
+			else
+				asicnum = info->chain_asic_num[n] / 32 + 1;
+		}
+		if (asicnum > 0) {
+			for (m = asicnum-1; m >= 0; m--) {
+				for (r = 0; r < 32; r++) {
+					if ((r % 8) == 0 && r != 0) {
+						info->chain_asic_status_t[n][j] = ' ';
+						j++;
 					}
-					mutex_lock(&info->qlock);
-					info->last_nonce_error += errordiff;
-					mutex_unlock(&info->qlock);
+					checkbit = num2bit(r);
+					if (rxstatusdata->chain_asic_exist[n*8+m] & checkbit) {
+						if (rxstatusdata->chain_asic_status[n*8+m] & checkbit)
+							info->chain_asic_status_t[n][j] = 'o';
+						else
+							info->chain_asic_status_t[n][j] = 'x';
+					} else
+						info->chain_asic_status_t[n][j] = '-';
+					j++;
 				}
-				bitmain_update_temps(bitmain, info, &rxstatusdata);
+				info->chain_asic_status_t[n][j] = ' ';
+				j++;
 			}
+		}
+		applog(LOG_DEBUG, "%s%d: %s() RxStatis Data chain(%d) asic_num=%d "
+				  "asic_exist=%08x%08x%08x%08x%08x%08x%08x%08x "
+				  "asic_status=%08x%08x%08x%08x%08x%08x%08x%08x",
+				  bitmain->drv->name, bitmain->device_id,
+				  __func__, n, info->chain_asic_num[n],
+				  info->chain_asic_exist[n*8+0],
+				  info->chain_asic_exist[n*8+1],
+				  info->chain_asic_exist[n*8+2],
+				  info->chain_asic_exist[n*8+3],
+				  info->chain_asic_exist[n*8+4],
+				  info->chain_asic_exist[n*8+5],
+				  info->chain_asic_exist[n*8+6],
+				  info->chain_asic_exist[n*8+7],
+				  info->chain_asic_status[n*8+0],
+				  info->chain_asic_status[n*8+1],
+				  info->chain_asic_status[n*8+2],
+				  info->chain_asic_status[n*8+3],
+				  info->chain_asic_status[n*8+4],
+				  info->chain_asic_status[n*8+5],
+				  info->chain_asic_status[n*8+6],
+				  info->chain_asic_status[n*8+7]);
+		applog(LOG_ERR, "%s%d: %s() RxStatis Data chain(%d) asic_num=%d"
+				" asic_status=%s",
+				bitmain->drv->name, bitmain->device_id,
+				__func__, n, info->chain_asic_num[n],
+				info->chain_asic_status_t[n]);
+	}
+	mutex_unlock(&info->qlock);
 
-			found = true;
-			spare = buf[i+1] + 2 + i;
-			if (spare > *offset) {
-				applog(LOG_ERR, "%s%d: %s() spare(%d) > offset(%d)",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, spare, *offset);
-				spare = *offset;
-			}
-			break;
-		} else if (buf[i] == 0xa2) {
-			struct bitmain_rxnonce_data rxnoncedata;
-			int nonce_num = 0;
-			applog(LOG_DEBUG, "%s%d: %s() RxNonce Data",
+	if (errordiff > 0) {
+		for (j = 0; j < errordiff; j++)
+			bitmain_inc_nvw(info, thr);
+		mutex_lock(&info->qlock);
+		info->last_nonce_error += errordiff;
+		mutex_unlock(&info->qlock);
+	}
+	bitmain_update_temps(bitmain, info, rxstatusdata);
+#endif
+}
+
+/*
+ * Work items are recycled from the tail of work_list so any wid still
+ * in wid_items is in one of the last LIMIT_WITEMS sent, anything older
+ * has been overwritten and is reported as not found
+ * Must hold qlock
+ */
+static struct work *bitmain_find_work(struct bitmain_info *info, uint32_t wid)
+{
+	K_ITEM *witem;
+
+	witem = info->wid_items[wid % LIMIT_WITEMS];
+	if (witem && DATAW(witem)->wid == wid)
+		return DATAW(witem)->work;
+	return NULL;
+}
+
+static void bitmain_rxnonce(struct cgpu_info *bitmain, struct bitmain_info *info,
+			    struct thr_info *thr, struct bitmain_rxnonce_data *rxnoncedata,
+			    int nonce_num)
+{
+	struct work *work;
+	int j;
+
+	for (j = 0; j < nonce_num; j++) {
+		mutex_lock(&info->qlock);
+		work = bitmain_find_work(info, rxnoncedata->nonces[j].work_id);
+		mutex_unlock(&info->qlock);
+		if (work) {
+			// It's always found first time now
+			info->min_search = info->max_search = 1;
+			info->work_search++;
+			info->tot_search++;
+
+			applog(LOG_DEBUG, "%s%d: %s() RxNonce Data find "
+					  "work(%"PRIu32"-%"PRIu32")(%08x)",
 					  bitmain->drv->name, bitmain->device_id,
-					  __func__);
-			if (*offset < 2) {
-				return;
-			}
-			if (buf[i+1] > 70) {
-				applog(LOG_ERR, "%s%d: %s() RxNonce Data datalen=%d error",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, buf[i+1]+2);
-				continue;
-			}
-			if (*offset < buf[i+1] + 2) {
-				return;
-			}
-			if (bitmain_parse_rxnonce(buf+i, buf[i+1]+2, &rxnoncedata, &nonce_num) != 0) {
-				applog(LOG_ERR, "%s%d: %s() RxNonce Data error len=%d",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, buf[i+1]+2);
+					  __func__, work->id,
+					  rxnoncedata->nonces[j].work_id,
+					  rxnoncedata->nonces[j].nonce);
+
+			if (isdupnonce(bitmain, work, rxnoncedata->nonces[j].nonce)) {
+				// ignore it
 			} else {
-				for (j = 0; j < nonce_num; j++) {
-					searches = 0;
+				if (submit_nonce(thr, work, rxnoncedata->nonces[j].nonce)) {
+					applog(LOG_DEBUG, "%s%d: %s() RxNonce Data ok",
+							  bitmain->drv->name,
+							  bitmain->device_id,
+							  __func__);
 					mutex_lock(&info->qlock);
-					witem = info->work_list->head;
-					while (witem) {
-						searches++;
-						if (DATAW(witem)->work->id == rxnoncedata.nonces[j].work_id)
-							break;
-						witem = witem->next;
-					}
+#ifdef USE_ANT_S1
+					info->nonces++;
+#else
+					info->nonces += work->device_diff;
+#endif
 					mutex_unlock(&info->qlock);
-					if (witem) {
-						if (info->work_search == 0) {
-							info->min_search = searches;
-							info->max_search = searches;
-						} else {
-							if (info->min_search > searches)
-								info->min_search = searches;
-							if (info->max_search < searches)
-								info->max_search = searches;
-						}
-						info->work_search++;
-						info->tot_search += searches;
-
-						work = DATAW(witem)->work;
-						applog(LOG_DEBUG, "%s%d: %s() RxNonce Data find "
-								  "work(%"PRIu32"-%"PRIu32")(%08x)",
-								  bitmain->drv->name, bitmain->device_id,
-								  __func__, work->id,
-								  rxnoncedata.nonces[j].work_id,
-								  rxnoncedata.nonces[j].nonce);
-
-						applog(LOG_DEBUG, "%s%d: %s() nonce = %08x",
-								  bitmain->drv->name, bitmain->device_id,
-								  __func__, rxnoncedata.nonces[j].nonce);
-						if (isdupnonce(bitmain, work, rxnoncedata.nonces[j].nonce)) {
-							// ignore it
-						} else {
-							if (submit_nonce(thr, work, rxnoncedata.nonces[j].nonce)) {
-								applog(LOG_DEBUG, "%s%d: %s() RxNonce Data ok",
-										  bitmain->drv->name,
-										  bitmain->device_id,
-										  __func__);
-								mutex_lock(&info->qlock);
-								info->nonces++;
-								mutex_unlock(&info->qlock);
-							} else {
-								applog(LOG_ERR, "%s%d: %s() RxNonce Data "
-										"error work(%"PRIu32")",
-										bitmain->drv->name,
-										bitmain->device_id,
-										__func__,
-										rxnoncedata.nonces[j].work_id);
-							}
-						}
-					} else {
-						if (info->failed_search == 0) {
-							info->min_failed = searches;
-							info->max_failed = searches;
-						} else {
-							if (info->min_failed > searches)
-								info->min_failed = searches;
-							if (info->max_failed < searches)
-								info->max_failed = searches;
-						}
-						info->failed_search++;
-						info->tot_failed += searches;
-
-						mutex_lock(&info->qlock);
-						uint32_t min = 0, max = 0;
-						int count = 0;
-						if (info->work_list->tail) {
-							min = DATAW(info->work_list->tail)->wid;
-							max = DATAW(info->work_list->head)->wid;
-							count = info->work_list->count;
-						}
-						mutex_unlock(&info->qlock);
-						applog(LOG_ERR, "%s%d: %s() Work not found for id (%"PRIu32")"
-								" (min=%"PRIu32" max=%"PRIu32" count=%d)",
-								bitmain->drv->name, bitmain->device_id,
-								__func__, rxnoncedata.nonces[j].work_id.
-								min, max);
-					}
+				} else {
+					applog(LOG_ERR, "%s%d: %s() RxNonce Data "
+							"error work(%"PRIu32")",
+							bitmain->drv->name,
+							bitmain->device_id,
+							__func__,
+							rxnoncedata->nonces[j].work_id);
 				}
-				mutex_lock(&info->qlock);
-				info->fifo_space = rxnoncedata.fifo_space;
-				mutex_unlock(&info->qlock);
-				applog(LOG_DEBUG, "%s%d: %s() RxNonce Data fifo space=%d",
-						  bitmain->drv->name, bitmain->device_id,
-						  __func__, rxnoncedata.fifo_space);
 			}
-
-			found = true;
-			spare = buf[i+1] + 2 + i;
-			if (spare > *offset) {
-				applog(LOG_ERR, "%s%d: %s() RxNonce Data space(%d) > offset(%d)",
-						bitmain->drv->name, bitmain->device_id, __func__, 
-						spare, *offset);
-				spare = *offset;
-			}
-			break;
 		} else {
-			applog(LOG_ERR, "%s%d: %s() data type error=%02x",
+			info->min_failed = info->max_failed = 1;
+			info->failed_search++;
+			info->tot_failed++;
+
+			applog(LOG_ERR, "%s%d: %s() Work not found for id (%"PRIu32")"
+					" (last=%"PRIu32")",
 					bitmain->drv->name, bitmain->device_id,
-					__func__, buf[i]);
+					__func__, rxnoncedata->nonces[j].work_id,
+					info->last_wid);
 		}
 	}
-	if (!found) {
-		spare = *offset - BITMAIN_READ_SIZE;
-		/* We are buffering and haven't accumulated one more corrupt
-		 * work result. */
-		if (spare < (int)BITMAIN_READ_SIZE)
-			return;
-		bitmain_inc_nvw(info, thr);
+	mutex_lock(&info->qlock);
+	info->fifo_space = rxnoncedata->fifo_space;
+	mutex_unlock(&info->qlock);
+	applog(LOG_DEBUG, "%s%d: %s() RxNonce Data fifo space=%d",
+			  bitmain->drv->name, bitmain->device_id,
+			  __func__, rxnoncedata->fifo_space);
+}
+
+#define RING_BYTE(_ring, _off) ((_ring)->buf[((_ring)->tail + (_off)) & BITMAIN_RING_MASK])
+
+/* Big enough for the parse functions to copy a whole structure out of */
+#define BITMAIN_SCRATCH_SIZE (sizeof(struct bitmain_rxstatus_data) > sizeof(struct bitmain_rxnonce_data) ? \
+				sizeof(struct bitmain_rxstatus_data) : sizeof(struct bitmain_rxnonce_data))
+
+/*
+ * Return the complete frame at the ring tail, without consuming it, or
+ * NULL if more data is needed. Bytes that can't start a valid frame header
+ * are skipped and counted in junk. The frame is returned in place unless
+ * it is too close to the end of the ring, then it's copied to scratch
+ */
+static const uint8_t *bitmain_next_frame(struct bitmain_ring *ring, uint8_t *scratch,
+					 int *framelen, uint64_t *junk, uint64_t *wrapped)
+{
+	uint32_t used, off, first;
+	int len, maxlen;
+
+	while ((used = ring->head - ring->tail) >= BITMAIN_FRAME_HEAD) {
+		switch (RING_BYTE(ring, 0)) {
+			case BITMAIN_DATA_TYPE_RXSTATUS:
+				maxlen = BITMAIN_MAX_STATUS_LEN;
+				break;
+			case BITMAIN_DATA_TYPE_RXNONCE:
+				maxlen = BITMAIN_MAX_NONCE_LEN;
+				break;
+			default:
+				maxlen = -1;
+				break;
+		}
+#ifdef USE_ANT_S1
+		len = RING_BYTE(ring, 1);
+#else
+		len = RING_BYTE(ring, 2) | (RING_BYTE(ring, 3) << 8);
+#endif
+		if (len > maxlen) {
+			ring->tail++;
+			(*junk)++;
+			continue;
+		}
+		*framelen = len + BITMAIN_FRAME_HEAD;
+		if (used < (uint32_t)(*framelen))
+			return NULL;
+
+		off = ring->tail & BITMAIN_RING_MASK;
+		if (off + BITMAIN_SCRATCH_SIZE <= BITMAIN_RING_SIZE)
+			return ring->buf + off;
+
+		first = BITMAIN_RING_SIZE - off;
+		if (first > (uint32_t)(*framelen))
+			first = *framelen;
+		memcpy(scratch, ring->buf + off, first);
+		memcpy(scratch + first, ring->buf, *framelen - first);
+		(*wrapped)++;
+		return scratch;
 	}
+	return NULL;
+}
 
-	*offset -= spare;
-	memmove(buf, buf + spare, *offset);
-#else // S2
-	int i, j, n, m, r, errordiff, spare = BITMAIN_READ_SIZE;
-	uint32_t checkbit = 0x00000000;
-	bool found = false;
-	struct work *work = NULL;
-	struct bitmain_packet_head packethead;
-	int asicnum = 0;
-	uint64_t searches;
-	K_ITEM *witem;
+static void bitmain_parse_results(struct cgpu_info *bitmain, struct bitmain_info *info,
+				  struct thr_info *thr)
+{
+	struct bitmain_rxstatus_data rxstatusdata;
+	struct bitmain_rxnonce_data rxnoncedata;
+	uint8_t scratch[BITMAIN_SCRATCH_SIZE];
+	uint64_t junk = info->rx_junk;
+	const uint8_t *frame;
+	int framelen, nonce_num;
+#ifdef USE_ANT_S2
+	bool short_nonce = false;
+#endif
 
-	for (i = 0; i <= spare; i++) {
-		if (buf[i] == 0xa1) {
-			struct bitmain_rxstatus_data rxstatusdata;
+	while ((frame = bitmain_next_frame(&info->rx, scratch, &framelen,
+					   &info->rx_junk, &info->rx_wrapped))) {
+		if (frame[0] == BITMAIN_DATA_TYPE_RXSTATUS) {
 			applog(LOG_DEBUG, "%s%d: %s() RxStatus Data",
 					  bitmain->drv->name, bitmain->device_id,
 					  __func__);
-			if (*offset < 4) {
-				return;
-			}
-			memcpy(&packethead, buf+i, sizeof(struct bitmain_packet_head));
-			packethead.length = htole16(packethead.length);
-			if (packethead.length > 1130) {
-				applog(LOG_ERR, "%s%d: %s() RxStatus Data datalen=%d error",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, packethead.length+4);
+			if (bitmain_parse_rxstatus(frame, framelen, &rxstatusdata) == 0) {
+				info->rx.tail += framelen;
+				info->rx_frames++;
+				bitmain_rxstatus(bitmain, info, thr, &rxstatusdata);
 				continue;
 			}
-			if (*offset < packethead.length + 4)
-				return;
-			if (bitmain_parse_rxstatus(buf+i, packethead.length+4, &rxstatusdata) != 0) {
-				applog(LOG_ERR, "%s%d: %s() RxStatus Data error len=%d",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, packethead.length+4);
-			} else {
-				mutex_lock(&info->qlock);
-				info->chain_num = rxstatusdata.chain_num;
-				info->fifo_space = rxstatusdata.fifo_space;
-				info->hw_version[0] = rxstatusdata.hw_version[0];
-				info->hw_version[1] = rxstatusdata.hw_version[1];
-				info->hw_version[2] = rxstatusdata.hw_version[2];
-				info->hw_version[3] = rxstatusdata.hw_version[3];
-				info->nonce_error = rxstatusdata.nonce_error;
-				errordiff = info->nonce_error-info->last_nonce_error;
-				applog(LOG_DEBUG, "%s%d: %s() RxStatus Data"
-						" version=%d chainnum=%d fifospace=%d"
-						" hwv1=%d hwv2=%d hwv3=%d hwv4=%d"
-						" nonceerror=%d-%d freq=%d chain info:",
-						bitmain->drv->name, bitmain->device_id, __func__,
-						rxstatusdata.version, info->chain_num, info->fifo_space,
-						info->hw_version[0], info->hw_version[1],
-						info->hw_version[2], info->hw_version[3],
-						info->last_nonce_error,
-						info->nonce_error, info->frequency);
-				memcpy(info->chain_asic_exist, rxstatusdata.chain_asic_exist, BITMAIN_MAX_CHAIN_NUM*32);
-				memcpy(info->chain_asic_status, rxstatusdata.chain_asic_status, BITMAIN_MAX_CHAIN_NUM*32);
-				for (n = 0; n < rxstatusdata.chain_num; n++) {
-					info->chain_asic_num[n] = rxstatusdata.chain_asic_num[n];
-					memset(info->chain_asic_status_t[n], 0, 320);
-					j = 0;
-					if (info->chain_asic_num[n] <= 0)
-						asicnum = 0;
-					else {
-						if (info->chain_asic_num[n] % 32 == 0)
-							asicnum = info->chain_asic_num[n] / 32;
-						else
-							asicnum = info->chain_asic_num[n] / 32 + 1;
-					}
-					if (asicnum > 0) {
-						for (m = asicnum-1; m >= 0; m--) {
-							for (r = 0; r < 32; r++) {
-								if ((r % 8) == 0 && r != 0) {
-									info->chain_asic_status_t[n][j] = ' ';
-									j++;
-								}
-								checkbit = num2bit(r);
-								if (rxstatusdata.chain_asic_exist[n*8+m] & checkbit) {
-									if (rxstatusdata.chain_asic_status[n*8+m] & checkbit)
-										info->chain_asic_status_t[n][j] = 'o';
-									else
-										info->chain_asic_status_t[n][j] = 'x';
-								} else
-									info->chain_asic_status_t[n][j] = '-';
-								j++;
-							}
-							info->chain_asic_status_t[n][j] = ' ';
-							j++;
-						}
-					}
-					applog(LOG_DEBUG, "%s%d: %s() RxStatis Data chain(%d) asic_num=%d "
-							  "asic_exist=%08x%08x%08x%08x%08x%08x%08x%08x "
-							  "asic_status=%08x%08x%08x%08x%08x%08x%08x%08x",
-							  bitmain->drv->name, bitmain->device_id,
-							  __func__, n, info->chain_asic_num[n],
-							  info->chain_asic_exist[n*8+0],
-							  info->chain_asic_exist[n*8+1],
-							  info->chain_asic_exist[n*8+2],
-							  info->chain_asic_exist[n*8+3],
-							  info->chain_asic_exist[n*8+4],
-							  info->chain_asic_exist[n*8+5],
-							  info->chain_asic_exist[n*8+6],
-							  info->chain_asic_exist[n*8+7],
-							  info->chain_asic_status[n*8+0],
-							  info->chain_asic_status[n*8+1],
-							  info->chain_asic_status[n*8+2],
-							  info->chain_asic_status[n*8+3],
-							  info->chain_asic_status[n*8+4],
-							  info->chain_asic_status[n*8+5],
-							  info->chain_asic_status[n*8+6],
-							  info->chain_asic_status[n*8+7]);
-					applog(LOG_ERR, "%s%d: %s() RxStatis Data chain(%d) asic_num=%d"
-							" asic_status=%s",
-							bitmain->drv->name, bitmain->device_id,
-							__func__, n, info->chain_asic_num[n],
-							info->chain_asic_status_t[n]);
-				}
-				mutex_unlock(&info->qlock);
-
-				if (errordiff > 0) {
-					for (j = 0; j < errordiff; j++)
-						bitmain_inc_nvw(info, thr);
-					mutex_lock(&info->qlock);
-					info->last_nonce_error += errordiff;
-					mutex_unlock(&info->qlock);
-				}
-				bitmain_update_temps(bitmain, info, &rxstatusdata);
-			}
-
-			found = true;
-			spare = packethead.length + 4 + i;
-			if (spare > *offset) {
-				applog(LOG_ERR, "%s%d: %s() spare(%d) > offset(%d)",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, spare, *offset);
-				spare = *offset;
-			}
-			break;
-		} else if (buf[i] == 0xa2) {
-			struct bitmain_rxnonce_data rxnoncedata;
-			int nonce_num = 0;
+			applog(LOG_ERR, "%s%d: %s() RxStatus Data error len=%d",
+					bitmain->drv->name, bitmain->device_id,
+					__func__, framelen);
+		} else {
 			applog(LOG_DEBUG, "%s%d: %s() RxNonce Data",
 					  bitmain->drv->name, bitmain->device_id,
 					  __func__);
-			if (*offset < 4)
-				return;
-			memcpy(&packethead, buf+i, sizeof(struct bitmain_packet_head));
-			packethead.length = htole16(packethead.length);
-			if (packethead.length > 1030) {
-				applog(LOG_ERR, "%s%d: %s() RxNonce Data datalen=%d error",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, packethead.length+4);
+			nonce_num = 0;
+			if (bitmain_parse_rxnonce(frame, framelen, &rxnoncedata, &nonce_num) == 0) {
+				info->rx.tail += framelen;
+				info->rx_frames++;
+				bitmain_rxnonce(bitmain, info, thr, &rxnoncedata, nonce_num);
+#ifdef USE_ANT_S2
+				short_nonce = (nonce_num < BITMAIN_MAX_NONCE_NUM);
+#endif
 				continue;
 			}
-			if (*offset < packethead.length + 4)
-				return;
-			if (bitmain_parse_rxnonce(buf+i, packethead.length+4, &rxnoncedata, &nonce_num) != 0) {
-				applog(LOG_ERR, "%s%d: %s() RxNonce Data error len=%d",
-						bitmain->drv->name, bitmain->device_id,
-						__func__, packethead.length+4);
-			} else {
-				for (j = 0; j < nonce_num; j++) {
-					searches = 0;
-					mutex_lock(&info->qlock);
-					witem = info->work_list->head;
-					while (witem && DATAW(witem)->work) {
-						searches++;
-						if (DATAW(witem)->wid == rxnoncedata.nonces[j].work_id)
-							break;
-						witem = witem->next;
-					}
-					if (witem && DATAW(witem)->work) {
-						work = DATAW(witem)->work;
-						mutex_unlock(&info->qlock);
-						if (info->work_search == 0) {
-							info->min_search = searches;
-							info->max_search = searches;
-						} else {
-							if (info->min_search > searches)
-								info->min_search = searches;
-							if (info->max_search < searches)
-								info->max_search = searches;
-						}
-						info->work_search++;
-						info->tot_search += searches;
-
-						applog(LOG_DEBUG, "%s%d: %s() RxNonce Data find "
-								  "work(%"PRIu32"-%"PRIu32")(%08x)",
-								  bitmain->drv->name, bitmain->device_id,
-								  __func__, work->id,
-								  rxnoncedata.nonces[j].work_id,
-								  rxnoncedata.nonces[j].nonce);
-
-						applog(LOG_DEBUG, "%s%d: %s() nonce = %08x",
-								  bitmain->drv->name, bitmain->device_id,
-								  __func__, rxnoncedata.nonces[j].nonce);
-						if (isdupnonce(bitmain, work, rxnoncedata.nonces[j].nonce)) {
-							// ignore it
-						} else {
-							if (submit_nonce(thr, work, rxnoncedata.nonces[j].nonce)) {
-								applog(LOG_DEBUG, "%s%d: %s() RxNonce Data ok",
-										  bitmain->drv->name,
-										  bitmain->device_id,
-										  __func__);
-								mutex_lock(&info->qlock);
-								info->nonces += work->device_diff;
-								mutex_unlock(&info->qlock);
-							} else {
-								applog(LOG_ERR, "%s%d: %s() RxNonce Data "
-										"error work(%"PRIu32")",
-										bitmain->drv->name,
-										bitmain->device_id,
-										__func__,
-										rxnoncedata.nonces[j].work_id);
-							}
-						}
-					} else {
-						mutex_unlock(&info->qlock);
-						if (info->failed_search == 0) {
-							info->min_failed = searches;
-							info->max_failed = searches;
-						} else {
-							if (info->min_failed > searches)
-								info->min_failed = searches;
-							if (info->max_failed < searches)
-								info->max_failed = searches;
-						}
-						info->failed_search++;
-						info->tot_failed += searches;
-
-						applog(LOG_ERR, "%s%d: %s() Work not found for id (%"PRIu32")",
-								bitmain->drv->name, bitmain->device_id,
-								__func__, rxnoncedata.nonces[j].work_id);
-					}
-				}
-				mutex_lock(&info->qlock);
-				info->fifo_space = rxnoncedata.fifo_space;
-				mutex_unlock(&info->qlock);
-				applog(LOG_DEBUG, "%s%d: %s() RxNonce Data fifo space=%d",
-						  bitmain->drv->name, bitmain->device_id,
-						  __func__, rxnoncedata.fifo_space);
-
-				if (nonce_num < BITMAIN_MAX_NONCE_NUM)
-					cgsleep_ms(5);
-			}
-
-			found = true;
-			spare = packethead.length + 4 + i;
-			if (spare > *offset) {
-				applog(LOG_ERR, "%s%d: %s() RxNonce Data space(%d) > offset(%d)",
-						bitmain->drv->name, bitmain->device_id, __func__,
-						spare, *offset);
-				spare = *offset;
-			}
-			break;
-		} else {
-			applog(LOG_ERR, "%s%d: %s() data type error=%02x",
+			applog(LOG_ERR, "%s%d: %s() RxNonce Data error len=%d",
 					bitmain->drv->name, bitmain->device_id,
-					__func__, buf[i]);
+					__func__, framelen);
 		}
+		// Not a frame after all, resync from the next byte
+		info->rx_bad_frames++;
+		info->rx.tail++;
+		info->rx_junk++;
 	}
-	if (!found) {
-		spare = *offset - BITMAIN_READ_SIZE;
-		/* We are buffering and haven't accumulated one more corrupt
-		 * work result. */
-		if (spare < (int)BITMAIN_READ_SIZE)
-			return;
-		bitmain_inc_nvw(info, thr);
+
+	/* Count a corrupt work result for each result sized run of junk */
+	if (info->rx_junk / BITMAIN_READ_SIZE > junk / BITMAIN_READ_SIZE) {
+		applog(LOG_ERR, "%s%d: %s() skipped %"PRIu64" bytes of data",
+				bitmain->drv->name, bitmain->device_id,
+				__func__, info->rx_junk - junk);
+		junk = info->rx_junk / BITMAIN_READ_SIZE - junk / BITMAIN_READ_SIZE;
+		while (junk--)
+			bitmain_inc_nvw(info, thr);
 	}
 
-	*offset -= spare;
-	memmove(buf, buf + spare, *offset);
+#ifdef USE_ANT_S2
+	// Let more nonces accumulate after a part full reply
+	if (short_nonce)
+		cgsleep_ms(5);
 #endif
 }
 
@@ -1637,41 +1469,45 @@ static void *bitmain_get_results(void *userdata)
 {
 	struct cgpu_info *bitmain = (struct cgpu_info *)userdata;
 	struct bitmain_info *info = bitmain->device_data;
-	int offset = 0, ret = 0;
-	const int rsize = BITMAIN_FTDI_READSIZE;
-	char readbuf[BITMAIN_READBUF_SIZE];
+	struct bitmain_ring *ring = &info->rx;
 	struct thr_info *thr = info->thr;
 	char threadname[24];
 	int errorcount = 0;
+	uint32_t off, rsize;
+	int ret = 0;
 
 	snprintf(threadname, 24, "btm_recv/%d", bitmain->device_id);
 	RenameThread(threadname);
 
-	while (likely(!bitmain->shutdown)) {
-		unsigned char buf[rsize];
+	if (opt_bitmain_capture && *opt_bitmain_capture) {
+		char filename[PATH_MAX];
 
-		applog(LOG_DEBUG, "%s%d: %s() offset=%d",
-				  bitmain->drv->name, bitmain->device_id, __func__, offset);
+		snprintf(filename, sizeof(filename), "%s.%d",
+			 opt_bitmain_capture, bitmain->device_id);
+		info->rx_capture = fopen(filename, "ab");
+		if (!info->rx_capture)
+			applog(LOG_ERR, "%s%d: failed to open capture file %s.%d",
+					bitmain->drv->name, bitmain->device_id,
+					opt_bitmain_capture, bitmain->device_id);
+	}
 
-		if (offset >= (int)BITMAIN_READ_SIZE) {
+	while (likely(!bitmain->shutdown)) {
+		applog(LOG_DEBUG, "%s%d: %s() used=%"PRIu32,
+				  bitmain->drv->name, bitmain->device_id, __func__,
+				  ring->head - ring->tail);
+
+		if (ring->head - ring->tail >= BITMAIN_READ_SIZE) {
 			applog(LOG_DEBUG, "%s%d: %s() start",
 					  bitmain->drv->name, bitmain->device_id, __func__);
-			bitmain_parse_results(bitmain, info, thr, (uint8_t *)readbuf, &offset);
+			bitmain_parse_results(bitmain, info, thr);
 			applog(LOG_DEBUG, "%s%d: %s() stop",
 					  bitmain->drv->name, bitmain->device_id, __func__);
 		}
 
-		if (unlikely(offset + rsize >= BITMAIN_READBUF_SIZE)) {
-			/* This should never happen */
-			applog(LOG_DEBUG, "%s%d: readbuf overflow, resetting buffer",
-					  bitmain->drv->name, bitmain->device_id);
-			offset = 0;
-		}
-
 		if (unlikely(info->reset)) {
 			bitmain_running_reset(info);
 			/* Discard anything in the buffer */
-			offset = 0;
+			ring->tail = ring->head;
 		}
 
 #ifdef USE_ANT_S1
@@ -1679,9 +1515,18 @@ static void *bitmain_get_results(void *userdata)
 		cgsleep_ms(2);
 #endif
 
+		/* Read straight into the free space up to the end of the ring,
+		 * the parser never leaves more than a partial frame behind */
+		off = ring->head & BITMAIN_RING_MASK;
+		rsize = BITMAIN_RING_SIZE - (ring->head - ring->tail);
+		if (rsize > BITMAIN_RING_SIZE - off)
+			rsize = BITMAIN_RING_SIZE - off;
+		if (rsize > BITMAIN_FTDI_READSIZE)
+			rsize = BITMAIN_FTDI_READSIZE;
+
 		applog(LOG_DEBUG, "%s%d: %s() read",
 				  bitmain->drv->name, bitmain->device_id, __func__);
-		ret = bitmain_read(bitmain, buf, rsize, BITMAIN_READ_TIMEOUT, C_BITMAIN_READ);
+		ret = bitmain_read(bitmain, ring->buf + off, rsize, BITMAIN_READ_TIMEOUT, C_BITMAIN_READ);
 		applog(LOG_DEBUG, "%s%d: %s() read=%d",
 				  bitmain->drv->name, bitmain->device_id, __func__, ret);
 
@@ -1703,11 +1548,18 @@ static void *bitmain_get_results(void *userdata)
 		if (opt_debug) {
 			applog(LOG_DEBUG, "%s%d: get:",
 					  bitmain->drv->name, bitmain->device_id);
-			hexdump((uint8_t *)buf, ret);
+			hexdump(ring->buf + off, ret);
 		}
 
-		memcpy(readbuf+offset, buf, ret);
-		offset += ret;
+		if (info->rx_capture)
+			fwrite(ring->buf + off, 1, ret, info->rx_capture);
+
+		ring->head += ret;
+	}
+
+	if (info->rx_capture) {
+		fclose(info->rx_capture);
+		info->rx_capture = NULL;
 	}
 	return NULL;
 }
@@ -2149,6 +2001,9 @@ static struct cgpu_info *bitmain_detect_one(libusb_device *dev, struct usb_find_
 
 	info->work_list = k_new_list("Work", sizeof(WITEM), ALLOC_WITEMS, LIMIT_WITEMS, true);
 	info->work_ready = k_new_store(info->work_list);
+	info->wid_items = calloc(LIMIT_WITEMS, sizeof(*(info->wid_items)));
+	if (unlikely(!info->wid_items))
+		quit(1, "Failed to calloc bitmain wid_items");
 #ifdef USE_ANT_S2
 	info->wbuild = k_new_store(info->work_list);
 #endif
@@ -2237,6 +2092,9 @@ static void ser_detect()
 
 	info->work_list = k_new_list("Work", sizeof(WITEM), ALLOC_WITEMS, LIMIT_WITEMS, true);
 	info->work_ready = k_new_store(info->work_list);
+	info->wid_items = calloc(LIMIT_WITEMS, sizeof(*(info->wid_items)));
+	if (unlikely(!info->wid_items))
+		quit(1, "Failed to calloc bitmain wid_items");
 	info->wbuild = k_new_store(info->work_list);
 
 	applog(LOG_DEBUG, "%s%d: detected %s "
@@ -2263,6 +2121,7 @@ giveup:
 #ifdef USE_ANT_S1
 static void ants1_detect(bool __maybe_unused hotplug)
 {
+	bitmain_crc16_init();
 	is_usb = true;
 	usb_detect(&ANTDRV, bitmain_detect_one);
 }
@@ -2280,6 +2139,8 @@ static void ants2_detect(bool __maybe_unused hotplug)
 
 	first_ant = false;
 
+	bitmain_crc16_init();
+
 	if (opt_bitmain_dev && *opt_bitmain_dev)
 		is_usb = false;
 	else
@@ -2440,6 +2301,7 @@ static bool bitmain_fill(struct cgpu_info *bitmain)
 					}
 					DATAW(witem)->work = usework;
 					DATAW(witem)->wid = ++info->last_wid;
+					info->wid_items[DATAW(witem)->wid % LIMIT_WITEMS] = witem;
 					info->queued++;
 					k_add_head(info->work_ready, witem);
 					queuednum++;
@@ -2732,6 +2594,10 @@ static struct api_data *bitmain_api_stats(struct cgpu_info *cgpu)
 	avg = info->failed_search ? (float)(info->tot_failed) /
 					(float)(info->failed_search) : 0;
 	root = api_add_avg(root, "avg_failed", &avg, true);
+	root = api_add_uint64(root, "rx_frames", &(info->rx_frames), true);
+	root = api_add_uint64(root, "rx_bad_frames", &(info->rx_bad_frames), true);
+	root = api_add_uint64(root, "rx_junk", &(info->rx_junk), true);
+	root = api_add_uint64(root, "rx_wrapped", &(info->rx_wrapped), true);
 
 	root = api_add_int(root, "temp_hi", &(info->temp_hi), false);
 #ifdef USE_ANT_S1
@@ -2760,6 +2626,111 @@ static struct api_data *bitmain_api_stats(struct cgpu_info *cgpu)
 	return root;
 }
 
+/*
+ * Decode a file of raw results saved with --bitmain-capture, fed in read
+ * sized chunks through the same ring and frame decoder the device uses,
+ * repeatedly for a couple of seconds, then report the rates
+ */
+void bitmain_replay(const char *filename)
+{
+	struct bitmain_rxstatus_data rxstatusdata;
+	struct bitmain_rxnonce_data rxnoncedata;
+	uint8_t scratch[BITMAIN_SCRATCH_SIZE];
+	uint64_t frames = 0, nonces = 0, bad = 0, junk = 0, wrapped = 0;
+	struct timeval tv_start, tv_end;
+	struct bitmain_ring *ring;
+	const uint8_t *frame;
+	double secs, crc_secs;
+	uint32_t off, chunk;
+	uint16_t crc = 0;
+	int framelen, nonce_num, passes = 0, crc_passes = 0;
+	long size, pos;
+	uint8_t *data;
+	FILE *fp;
+
+	bitmain_crc16_init();
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		quit(1, "%s: failed to open replay file %s", ANTDRV.dname, filename);
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if (size <= 0)
+		quit(1, "%s: replay file %s is empty", ANTDRV.dname, filename);
+	data = malloc(size);
+	ring = calloc(1, sizeof(*ring));
+	if (unlikely(!data || !ring))
+		quit(1, "Failed to alloc bitmain replay data");
+	if (fread(data, 1, size, fp) != (size_t)size)
+		quit(1, "%s: failed to read replay file %s", ANTDRV.dname, filename);
+	fclose(fp);
+
+	cgtime(&tv_start);
+	do {
+		ring->head = ring->tail = 0;
+		for (pos = 0; pos < size; pos += chunk) {
+			off = ring->head & BITMAIN_RING_MASK;
+			chunk = BITMAIN_RING_SIZE - (ring->head - ring->tail);
+			if (chunk > BITMAIN_RING_SIZE - off)
+				chunk = BITMAIN_RING_SIZE - off;
+			if (chunk > BITMAIN_FTDI_READSIZE)
+				chunk = BITMAIN_FTDI_READSIZE;
+			if (chunk > size - pos)
+				chunk = size - pos;
+			memcpy(ring->buf + off, data + pos, chunk);
+			ring->head += chunk;
+
+			while ((frame = bitmain_next_frame(ring, scratch, &framelen,
+							   &junk, &wrapped))) {
+				if (frame[0] == BITMAIN_DATA_TYPE_RXSTATUS) {
+					if (bitmain_parse_rxstatus(frame, framelen, &rxstatusdata) == 0) {
+						ring->tail += framelen;
+						frames++;
+						continue;
+					}
+				} else {
+					if (bitmain_parse_rxnonce(frame, framelen, &rxnoncedata, &nonce_num) == 0) {
+						ring->tail += framelen;
+						frames++;
+						nonces += nonce_num;
+						continue;
+					}
+				}
+				bad++;
+				ring->tail++;
+				junk++;
+			}
+		}
+		passes++;
+		cgtime(&tv_end);
+		secs = tdiff(&tv_end, &tv_start);
+	} while (secs < 2.0);
+
+	// CRC alone over the same data in maximum sized frames
+	cgtime(&tv_start);
+	do {
+		for (pos = 0; pos < size; pos += BITMAIN_MAX_FRAME_SIZE)
+			crc ^= CRC16(data + pos, MIN(size - pos, BITMAIN_MAX_FRAME_SIZE));
+		crc_passes++;
+		cgtime(&tv_end);
+		crc_secs = tdiff(&tv_end, &tv_start);
+	} while (crc_secs < 1.0);
+
+	applog(LOG_WARNING, "%s: replay %s %ld bytes x%d in %.3fs %.1fMB/s %.0f frames/s",
+	       ANTDRV.dname, filename, size, passes, secs,
+	       (double)size * passes / secs / 1000000.0, (double)frames / secs);
+	applog(LOG_WARNING, "%s: replay per pass frames %"PRIu64" nonces %"PRIu64
+	       " bad %"PRIu64" junk %"PRIu64" wrapped %"PRIu64,
+	       ANTDRV.dname, frames / passes, nonces / passes, bad / passes,
+	       junk / passes, wrapped / passes);
+	applog(LOG_WARNING, "%s: replay CRC16 %.1fMB/s (%04x)",
+	       ANTDRV.dname, (double)size * crc_passes / crc_secs / 1000000.0, crc);
+
+	free(ring);
+	free(data);
+}
+
 static void bitmain_shutdown(struct thr_info *thr)
 {
 	do_bitmain_close(thr);
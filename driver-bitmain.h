@@ -268,6 +268,30 @@ struct bitmain_rxnonce_data {
 #endif
 } __attribute__((packed, aligned(4)));
 
+/*
+ * Results are read straight into a ring and decoded in place, a frame is
+ * only copied out when it wraps the end of the ring
+ */
+#define BITMAIN_RING_SIZE BITMAIN_READBUF_SIZE
+#define BITMAIN_RING_MASK (BITMAIN_RING_SIZE - 1)
+#ifdef USE_ANT_S1
+#define BITMAIN_FRAME_HEAD 2
+#define BITMAIN_MAX_STATUS_LEN 124
+#define BITMAIN_MAX_NONCE_LEN 70
+#else // S2
+#define BITMAIN_FRAME_HEAD 4
+#define BITMAIN_MAX_STATUS_LEN 1130
+#define BITMAIN_MAX_NONCE_LEN 1030
+#endif
+#define BITMAIN_MAX_FRAME_SIZE (BITMAIN_MAX_STATUS_LEN + BITMAIN_FRAME_HEAD)
+
+struct bitmain_ring {
+	uint8_t buf[BITMAIN_RING_SIZE];
+	// Free running byte counts, only their difference matters
+	uint32_t head;
+	uint32_t tail;
+};
+
 struct bitmain_info {
 	int queued;
 	int results;
@@ -366,6 +390,16 @@ struct bitmain_info {
 	uint64_t tot_failed;
 	uint64_t min_failed;
 	uint64_t max_failed;
+	// Work items indexed by wid % LIMIT_WITEMS
+	K_ITEM **wid_items;
+
+	// Results
+	struct bitmain_ring rx;
+	FILE *rx_capture;
+	uint64_t rx_frames;
+	uint64_t rx_bad_frames;
+	uint64_t rx_junk;
+	uint64_t rx_wrapped;
 };
 
 // Work
@@ -416,6 +450,8 @@ extern int opt_bitmain_freq_max;
 extern bool opt_bitmain_auto;
 extern char *set_bitmain_fan(char *arg);
 extern char *set_bitmain_freq(char *arg);
+extern char *opt_bitmain_capture;
+extern void bitmain_replay(const char *filename);
 
 #endif /* USE_ANT_S1 || USE_ANT_S2 */
 #endif	/* BITMAIN_H */
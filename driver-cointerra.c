@@ -229,44 +229,41 @@ static void cta_detect(bool __maybe_unused hotplug)
 	usb_detect(&cointerra_drv, cta_detect_one);
 }
 
-/* This function will remove a work item from the hashtable if it matches the
- * id in work->subid and return a pointer to the work but it will not free the
- * work. It may return NULL if it cannot find matching work. */
-static struct work *take_work_by_id(struct cgpu_info *cgpu, uint16_t id)
+/* Must be called with qlock held. Looks up the work item with id in
+ * work->subid. The id table holds the cgminer work id of the last work sent
+ * with each id so it normally finds it directly, and the hashtable is only
+ * searched if the table is stale. It may return NULL if it cannot find
+ * matching work. */
+static struct work *__find_work_by_id(struct cgpu_info *cgpu, struct cointerra_info *info,
+				      uint16_t id)
 {
-	struct work *work, *tmp, *ret = NULL;
+	int wid = info->wid_ids[id & CTA_WID_MASK];
+	struct work *work, *tmp;
+
+	HASH_FIND_INT(cgpu->queued_work, &wid, work);
+	if (likely(work && work->subid == id))
+		return work;
 
-	wr_lock(&cgpu->qlock);
 	HASH_ITER(hh, cgpu->queued_work, work, tmp) {
-		if (work->subid == id) {
-			ret = work;
-			break;
-		}
+		if (work->subid == id)
+			return work;
 	}
-	if (ret)
-		__work_completed(cgpu, ret);
-	wr_unlock(&cgpu->qlock);
-
-	return ret;
+	return NULL;
 }
 
-/* This function will look up a work item in the hashtable if it matches the
- * id in work->subid and return a cloned work item if it matches. It may return
- * NULL if it cannot find matching work. */
-static struct work *clone_work_by_id(struct cgpu_info *cgpu, uint16_t id)
+/* This function will remove a work item from the hashtable if it matches the
+ * id in work->subid and return a pointer to the work but it will not free the
+ * work. It may return NULL if it cannot find matching work. */
+static struct work *take_work_by_id(struct cgpu_info *cgpu, struct cointerra_info *info,
+				    uint16_t id)
 {
-	struct work *work, *tmp, *ret = NULL;
+	struct work *ret;
 
-	rd_lock(&cgpu->qlock);
-	HASH_ITER(hh, cgpu->queued_work, work, tmp) {
-		if (work->subid == id) {
-			ret = work;
-			break;
-		}
-	}
+	wr_lock(&cgpu->qlock);
+	ret = __find_work_by_id(cgpu, info, id);
 	if (ret)
-		ret = copy_work(ret);
-	rd_unlock(&cgpu->qlock);
+		__work_completed(cgpu, ret);
+	wr_unlock(&cgpu->qlock);
 
 	return ret;
 }
@@ -315,12 +312,12 @@ static void cta_parse_reqwork(struct cgpu_info *cointerra, struct cointerra_info
 	mutex_unlock(&info->lock);
 }
 
+/* work is the clone of the work matching this message, or NULL */
 static void cta_parse_recvmatch(struct thr_info *thr, struct cgpu_info *cointerra,
-				struct cointerra_info *info, char *buf)
+				struct cointerra_info *info, char *buf, struct work *work)
 {
 	uint32_t timestamp_offset, mcu_tag;
 	uint16_t retwork;
-	struct work *work;
 
 	/* No endian switch needs doing here since it's sent and returned as
 	 * the same 4 bytes */
@@ -329,7 +326,6 @@ static void cta_parse_recvmatch(struct thr_info *thr, struct cgpu_info *cointerr
 	applog(LOG_DEBUG, "%s %d: Match message for id 0x%04x MCU id 0x%08x received",
 	       cointerra->drv->name, cointerra->device_id, retwork, mcu_tag);
 
-	work = clone_work_by_id(cointerra, retwork);
 	if (likely(work)) {
 		uint8_t wdiffbits = u8_from_msg(buf, CTA_WORK_DIFFBITS);
 		uint32_t nonce = hu32_from_msg(buf, CTA_MATCH_NONCE);
@@ -439,11 +435,36 @@ static void cta_parse_recvmatch(struct thr_info *thr, struct cgpu_info *cointerr
 	}
 }
 
+/* Look up the work for a batch of match messages with a single hold of
+ * qlock, then test and submit each of them. */
+static void cta_parse_matches(struct thr_info *thr, struct cgpu_info *cointerra,
+			      struct cointerra_info *info, char **msgs, int nmsgs)
+{
+	struct work *works[CTA_MATCH_BATCH];
+	int i;
+
+	rd_lock(&cointerra->qlock);
+	for (i = 0; i < nmsgs; i++) {
+		/* No endian switch needs doing here since it's sent and
+		 * returned as the same 2 bytes */
+		uint16_t retwork = *(uint16_t *)(&msgs[i][CTA_DRIVER_TAG]);
+
+		works[i] = __find_work_by_id(cointerra, info, retwork);
+		if (works[i])
+			works[i] = copy_work(works[i]);
+	}
+	rd_unlock(&cointerra->qlock);
+	info->match_batches++;
+
+	for (i = 0; i < nmsgs; i++)
+		cta_parse_recvmatch(thr, cointerra, info, msgs[i], works[i]);
+}
+
 static void cta_parse_wdone(struct thr_info *thr, struct cgpu_info *cointerra,
 			    struct cointerra_info *info, char *buf)
 {
 	uint16_t retwork = *(uint16_t *)(&buf[CTA_DRIVER_TAG]);
-	struct work *work = take_work_by_id(cointerra, retwork);
+	struct work *work = take_work_by_id(cointerra, info, retwork);
 	uint64_t hashes;
 
 	if (likely(work)) {
@@ -683,7 +704,7 @@ static void cta_parse_msg(struct thr_info *thr, struct cgpu_info *cointerra,
 			cta_parse_reqwork(cointerra, info, buf);
 			break;
 		case CTA_RECV_MATCH:
-			cta_parse_recvmatch(thr, cointerra, info, buf);
+			cta_parse_matches(thr, cointerra, info, &buf, 1);
 			break;
 		case CTA_RECV_WDONE:
 			applog(LOG_DEBUG, "%s %d: Work done message received",
@@ -721,19 +742,94 @@ static void cta_parse_msg(struct thr_info *thr, struct cgpu_info *cointerra,
 	}
 }
 
+#define CTA_RING_BYTE(_ring, _off) ((_ring)->buf[((_ring)->tail + (_off)) & CTA_RING_MASK])
+
+/* Return the complete message at the ring tail, without consuming it, or
+ * NULL if more data is needed. Bytes that can't start a message header are
+ * skipped and counted in junk. The message is returned in place unless it
+ * wraps the end of the ring, then it's copied to scratch. */
+static char *cta_next_msg(struct cta_ring *ring, char *scratch, uint64_t *junk,
+			  uint64_t *wrapped)
+{
+	uint32_t off, first;
+
+	while (ring->head - ring->tail >= CTA_MSG_SIZE) {
+		if (CTA_RING_BYTE(ring, 0) != cointerra_hdr[0] ||
+		    CTA_RING_BYTE(ring, 1) != cointerra_hdr[1]) {
+			ring->tail++;
+			(*junk)++;
+			continue;
+		}
+
+		off = ring->tail & CTA_RING_MASK;
+		if (off + CTA_MSG_SIZE <= CTA_RING_SIZE)
+			return ring->buf + off;
+
+		first = CTA_RING_SIZE - off;
+		memcpy(scratch, ring->buf + off, first);
+		memcpy(scratch + first, ring->buf, CTA_MSG_SIZE - first);
+		(*wrapped)++;
+		return scratch;
+	}
+	return NULL;
+}
+
+/* Parse every complete message in the ring. Match messages are collected so
+ * their work can be looked up together, any other message flushes them first
+ * so messages are still handled in the order they arrived. Consumed messages
+ * stay valid in the ring until the next read, and only one message per pass
+ * can wrap so a single scratch buffer is enough. */
+static void cta_parse_msgs(struct thr_info *thr, struct cgpu_info *cointerra,
+			   struct cointerra_info *info)
+{
+	char scratch[CTA_MSG_SIZE], *matches[CTA_MATCH_BATCH], *msg;
+	uint64_t junk = info->rx_junk;
+	int nmatches = 0;
+	uint8_t type;
+
+	while ((msg = cta_next_msg(&info->rx, scratch, &info->rx_junk, &info->rx_wrapped))) {
+		if (unlikely(info->rx_junk != junk)) {
+			applog(LOG_WARNING, "%s %d: Reads out of sync, discarding %"PRIu64" bytes",
+			       cointerra->drv->name, cointerra->device_id, info->rx_junk - junk);
+			inc_hw_errors(thr);
+			junk = info->rx_junk;
+		}
+		info->rx.tail += CTA_MSG_SIZE;
+
+		type = msg[CTA_MSG_TYPE];
+		info->rx_msgs[type < CTA_RECV_TYPES ? type : CTA_RECV_UNUSED]++;
+
+		if (type == CTA_RECV_MATCH) {
+			matches[nmatches++] = msg;
+			if (nmatches == CTA_MATCH_BATCH) {
+				cta_parse_matches(thr, cointerra, info, matches, nmatches);
+				nmatches = 0;
+			}
+			continue;
+		}
+		if (nmatches) {
+			cta_parse_matches(thr, cointerra, info, matches, nmatches);
+			nmatches = 0;
+		}
+		cta_parse_msg(thr, cointerra, info, msg);
+	}
+	if (nmatches)
+		cta_parse_matches(thr, cointerra, info, matches, nmatches);
+}
+
 static void *cta_recv_thread(void *arg)
 {
 	struct thr_info *thr = (struct thr_info *)arg;
 	struct cgpu_info *cointerra = thr->cgpu;
 	struct cointerra_info *info = cointerra->device_data;
+	struct cta_ring *rx = &info->rx;
 	char threadname[24];
-	int offset = 0;
 
 	snprintf(threadname, 24, "cta_recv/%d", cointerra->device_id);
 	RenameThread(threadname);
 
 	while (likely(!cointerra->shutdown)) {
-		char buf[CTA_READBUF_SIZE];
+		uint32_t off, len;
 		int amount, err;
 
 		if (unlikely(cointerra->usbinfo.nodev)) {
@@ -742,47 +838,27 @@ static void *cta_recv_thread(void *arg)
 			break;
 		}
 
-		err = usb_read(cointerra, buf + offset, CTA_MSG_SIZE, &amount, C_CTA_READ);
+		/* Read as much as one transfer will return into the free
+		 * space up to the end of the ring. */
+		off = rx->head & CTA_RING_MASK;
+		len = CTA_RING_SIZE - (rx->head - rx->tail);
+		if (len > CTA_RING_SIZE - off)
+			len = CTA_RING_SIZE - off;
+		if (len > CTA_READ_SIZE)
+			len = CTA_READ_SIZE;
+
+		err = usb_read_once(cointerra, rx->buf + off, len, &amount, C_CTA_READ);
 		if (err && err != LIBUSB_ERROR_TIMEOUT) {
 			applog(LOG_ERR, "%s %d: Read error %d, read %d", cointerra->drv->name,
 			       cointerra->device_id, err, amount);
 			break;
 		}
-		offset += amount;
-
-		while (offset >= CTA_MSG_SIZE) {
-			char *msg = mystrstr(buf, offset, cointerra_hdr);
-			int begin;
-
-			if (unlikely(!msg)) {
-				applog(LOG_WARNING, "%s %d: No message header found, discarding buffer",
-				       cointerra->drv->name, cointerra->device_id);
-				inc_hw_errors(thr);
-				/* Save the last byte in case it's the fist
-				 * byte of a header. */
-				begin = CTA_MSG_SIZE - 1;
-				offset -= begin;
-				memmove(buf, buf + begin, offset);
-				continue;
-			}
-
-			if (unlikely(msg != buf)) {
-				begin = msg - buf;
-				applog(LOG_WARNING, "%s %d: Reads out of sync, discarding %d bytes",
-				       cointerra->drv->name, cointerra->device_id, begin);
-				inc_hw_errors(thr);
-				offset -= begin;
-				memmove(buf, msg, offset);
-				if (offset < CTA_MSG_SIZE)
-					break;
-			}
+		if (!amount)
+			continue;
 
-			/* We have enough buffer for a full message, parse now */
-			cta_parse_msg(thr, cointerra, info, msg);
-			offset -= CTA_MSG_SIZE;
-			if (offset > 0)
-				memmove(buf, buf + CTA_MSG_SIZE, offset);
-		}
+		rx->head += amount;
+		info->rx_reads++;
+		cta_parse_msgs(thr, cointerra, info);
 	}
 
 	return NULL;
@@ -892,6 +968,7 @@ static bool cta_fill(struct cgpu_info *cointerra)
 	if (unlikely(++info->work_id == 0))
 		info->work_id = 1;
 	work->subid = info->work_id;
+	info->wid_ids[info->work_id & CTA_WID_MASK] = work->id;
 
 	diffbits = diff_to_bits(work->device_diff);
 
@@ -1147,6 +1224,21 @@ static int bits_set(char v)
 	return c;
 }
 
+/* Names of the received message types counted in rx_msgs */
+static const char *cta_recv_names[CTA_RECV_TYPES] = {
+	[CTA_RECV_UNUSED] = "Unknown",
+	[CTA_RECV_REQWORK] = "ReqWork",
+	[CTA_RECV_MATCH] = "Match",
+	[CTA_RECV_WDONE] = "WorkDone",
+	[CTA_RECV_STATREAD] = "StatRead",
+	[CTA_RECV_STATSET] = "StatSet",
+	[CTA_RECV_INFO] = "Info",
+	[CTA_RECV_MSG] = "Msg",
+	[CTA_RECV_RDONE] = "ResetDone",
+	[CTA_RECV_STATDEBUG] = "StatDebug",
+	[CTA_RECV_IRSTAT] = "IRStat",
+};
+
 static struct api_data *cta_api_stats(struct cgpu_info *cgpu)
 {
 	struct api_data *root = NULL;
@@ -1338,6 +1430,17 @@ static struct api_data *cta_api_stats(struct cgpu_info *cgpu)
 		root = api_add_int16(root, buf, &info->fmatch_errors[i], false);
 	}
 
+	root = api_add_uint64(root, "RX Reads", &info->rx_reads, false);
+	for (i = 0; i < CTA_RECV_TYPES; i++) {
+		if (!cta_recv_names[i])
+			continue;
+		sprintf(buf, "RX %s", cta_recv_names[i]);
+		root = api_add_uint64(root, buf, &info->rx_msgs[i], false);
+	}
+	root = api_add_uint64(root, "RX Junk", &info->rx_junk, false);
+	root = api_add_uint64(root, "RX Wrapped", &info->rx_wrapped, false);
+	root = api_add_uint64(root, "Match Batches", &info->match_batches, false);
+
 	return root;
 }
 
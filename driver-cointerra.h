@@ -150,6 +150,25 @@
 #define CTA_REQ_MSGTYPE		3
 #define CTA_REQ_INTERVAL	5
 
+/* Replies are read in bulk straight into a ring and parsed in place, a
+ * message is only copied out when it wraps the end of the ring. */
+#define CTA_READ_SIZE		512
+#define CTA_RING_SIZE		CTA_READBUF_SIZE
+#define CTA_RING_MASK		(CTA_RING_SIZE - 1)
+/* Most match messages looked up with a single qlock */
+#define CTA_MATCH_BATCH		(CTA_READ_SIZE / CTA_MSG_SIZE)
+/* Last work sent with each work_id, indexed by its low bits */
+#define CTA_WID_ITEMS		1024
+#define CTA_WID_MASK		(CTA_WID_ITEMS - 1)
+#define CTA_RECV_TYPES		(CTA_RECV_IRSTAT + 1)
+
+struct cta_ring {
+	char buf[CTA_RING_SIZE];
+	/* Free running byte counts, only their difference matters */
+	uint32_t head;
+	uint32_t tail;
+};
+
 
 int opt_cta_load;
 int opt_ps_load;
@@ -246,6 +265,15 @@ struct cointerra_info {
 	uint16_t irstat_status[CTA_CORES];
 
 	uint64_t old_hashes[16 * 2];
+
+	/* Receive ring and counters for the read thread */
+	struct cta_ring rx;
+	uint64_t rx_reads;
+	uint64_t rx_msgs[CTA_RECV_TYPES];
+	uint64_t rx_junk;
+	uint64_t rx_wrapped;
+	uint64_t match_batches;
+	int wid_ids[CTA_WID_ITEMS];
 };
 
 #endif /* COINTERRA_H */
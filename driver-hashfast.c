@@ -66,6 +66,9 @@ char *set_hfa_fan(char *arg)
 }
 
 static unsigned char crc8_table[256];	/* CRC-8 table */
+/* The CRC-8 state after the constant opcode, chip and core address bytes of
+ * an OP_HASH header, so only the sequence and length need adding per frame */
+static unsigned char crc8_op_hash;
 
 static void hfa_init_crc8(void)
 {
@@ -79,18 +82,33 @@ static void hfa_init_crc8(void)
 			crc = (crc << 1) ^ ((crc & 0x80) ? DI8 : 0);
 		crc8_table[i] = crc & 0xFF;
 	}
+
+	crc = crc8_table[0xff ^ OP_HASH];
+	crc = crc8_table[crc ^ HF_GWQ_ADDRESS];
+	crc8_op_hash = crc8_table[crc ^ 0];
 }
 
+/* Bytes 1-6 inclusive, the preamble is not included */
 static unsigned char hfa_crc8(unsigned char *h)
 {
-	int i;
 	unsigned char crc;
 
-	h++;	// Preamble not included
-	for (i = 1, crc = 0xff; i < 7; i++)
-		crc = crc8_table[crc ^ *h++];
+	crc = crc8_table[0xff ^ h[1]];
+	crc = crc8_table[crc ^ h[2]];
+	crc = crc8_table[crc ^ h[3]];
+	crc = crc8_table[crc ^ h[4]];
+	crc = crc8_table[crc ^ h[5]];
+	return crc8_table[crc ^ h[6]];
+}
+
+/* hfa_crc8() of an OP_HASH header to HF_GWQ_ADDRESS core 0 */
+static unsigned char hfa_crc8_hash(unsigned char *h)
+{
+	unsigned char crc;
 
-	return crc;
+	crc = crc8_table[crc8_op_hash ^ h[4]];
+	crc = crc8_table[crc ^ h[5]];
+	return crc8_table[crc ^ h[6]];
 }
 
 struct hfa_cmd {
@@ -917,6 +935,7 @@ static void hfa_parse_gwq_status(struct cgpu_info *hashfast, struct hashfast_inf
 {
 	struct hf_gwq_data *g = (struct hf_gwq_data *)(h + 1);
 	struct work *work;
+	int credits = 0;
 
 	applog(LOG_DEBUG, "%s %s: OP_GWQ_STATUS, device_head %4d tail %4d my tail %4d shed %3d inflight %4d",
 	       hashfast->drv->name, hashfast->unique_id, g->sequence_head, g->sequence_tail, info->hash_sequence_tail,
@@ -935,6 +954,8 @@ static void hfa_parse_gwq_status(struct cgpu_info *hashfast, struct hashfast_inf
 	info->raw_hashes += g->hash_count;
 	info->device_sequence_head = g->sequence_head;
 	info->device_sequence_tail = g->sequence_tail;
+	if (info->shed_count != g->shed_count)
+		credits++;
 	info->shed_count = g->shed_count;
 	/* Free any work that is no longer required */
 	while (info->device_sequence_tail != info->hash_sequence_tail) {
@@ -953,7 +974,13 @@ static void hfa_parse_gwq_status(struct cgpu_info *hashfast, struct hashfast_inf
 		       hashfast->drv->name, hashfast->unique_id, info->hash_sequence_tail);
 		free_work(work);
 		info->works[info->hash_sequence_tail] = NULL;
+		info->credits_returned++;
+		credits++;
 	}
+	/* Each completed job is a credit to send another one, wake scanwork
+	 * if it's waiting for them. */
+	if (credits)
+		pthread_cond_signal(&info->credit_cond);
 	mutex_unlock(&info->lock);
 }
 
@@ -1322,6 +1349,8 @@ static bool hfa_init(struct thr_info *thr)
 
 	mutex_init(&info->lock);
 	mutex_init(&info->rlock);
+	if (unlikely(pthread_cond_init(&info->credit_cond, NULL)))
+		quit(1, "Failed to create hfa pthread cond");
 	if (pthread_create(&info->read_thr, NULL, hfa_read, (void *)thr))
 		quit(1, "Failed to pthread_create read thr in hfa_prepare");
 
@@ -1350,6 +1379,22 @@ static inline int hfa_basejobs(struct hashfast_info *info)
 	return info->usb_init_base.inflight_target - info->shed_count;
 }
 
+/* How many more jobs the device has room for, based on the sequence numbers
+ * from the last OP_GWQ_STATUS. Must be called with info->lock held. */
+static int hfa_credits(struct hashfast_info *info)
+{
+	int ret;
+
+	ret = hfa_basejobs(info) - HF_SEQUENCE_DISTANCE(info->hash_sequence_head, info->device_sequence_tail);
+	/* Place an upper limit on how many jobs to queue to prevent sending
+	 * more work than the device can use after a period of outage. */
+	if (ret > hfa_basejobs(info))
+		ret = hfa_basejobs(info);
+	if (unlikely(ret < 0))
+		ret = 0;
+	return ret;
+}
+
 /* Figure out how many jobs to send. */
 static int hfa_jobs(struct cgpu_info *hashfast, struct hashfast_info *info)
 {
@@ -1367,20 +1412,50 @@ static int hfa_jobs(struct cgpu_info *hashfast, struct hashfast_info *info)
 	}
 
 	mutex_lock(&info->lock);
-	ret = hfa_basejobs(info) - HF_SEQUENCE_DISTANCE(info->hash_sequence_head, info->device_sequence_tail);
-	/* Place an upper limit on how many jobs to queue to prevent sending
-	 * more work than the device can use after a period of outage. */
-	if (ret > hfa_basejobs(info))
-		ret = hfa_basejobs(info);
+	ret = hfa_credits(info);
 	mutex_unlock(&info->lock);
 
-	if (unlikely(ret < 0))
-		ret = 0;
-
 out:
 	return ret;
 }
 
+/* Wait up to mstime for the device to complete jobs, or for a work restart,
+ * then figure out how many jobs to send. */
+static int hfa_wait_jobs(struct thr_info *thr, struct cgpu_info *hashfast,
+			 struct hashfast_info *info, unsigned int mstime)
+{
+	struct timeval now, then, tdiff;
+	struct timespec abstime;
+
+	tdiff.tv_sec = mstime / 1000;
+	tdiff.tv_usec = mstime * 1000 - (tdiff.tv_sec * 1000000);
+	cgtime(&now);
+	timeradd(&now, &tdiff, &then);
+	abstime.tv_sec = then.tv_sec;
+	abstime.tv_nsec = then.tv_usec * 1000;
+
+	mutex_lock(&info->lock);
+	if (!thr->work_restart && (info->overheat || !hfa_credits(info))) {
+		info->credit_waits++;
+		pthread_cond_timedwait(&info->credit_cond, &info->lock, &abstime);
+	}
+	mutex_unlock(&info->lock);
+
+	return hfa_jobs(hashfast, info);
+}
+
+/* Wake scanwork if it's waiting for jobs to complete, to see the restart */
+static void hfa_flush_work(struct cgpu_info *hashfast)
+{
+	struct hashfast_info *info = hashfast->device_data;
+
+	if (!info)
+		return;
+	mutex_lock(&info->lock);
+	pthread_cond_signal(&info->credit_cond);
+	mutex_unlock(&info->lock);
+}
+
 static void hfa_set_fanspeed(struct cgpu_info *hashfast, struct hashfast_info *info,
 			     int fandiff)
 {
@@ -1635,6 +1710,88 @@ static void hfa_running_shutdown(struct cgpu_info *hashfast, struct hashfast_inf
 	usb_nodev(hashfast);
 }
 
+#define HFA_HASH_FRAME_SIZE (sizeof(struct hf_header) + sizeof(struct hf_hash_usb))
+
+/* Assemble an OP_HASH frame for work at sequence into frame */
+static void hfa_hash_frame(struct cgpu_info *hashfast, uint8_t *frame, struct work *work,
+			   int sequence)
+{
+	struct hf_header *h = (struct hf_header *)frame;
+	struct hf_hash_usb *op_hash_data = (struct hf_hash_usb *)(h + 1);
+	uint64_t intdiff;
+	uint32_t *p;
+	int i;
+
+	h->preamble = HF_PREAMBLE;
+	h->operation_code = OP_HASH;
+	h->chip_address = HF_GWQ_ADDRESS;
+	h->core_address = 0;
+	h->hdata = htole16((uint16_t)sequence);
+	h->data_length = sizeof(*op_hash_data) / 4;
+	h->crc8 = hfa_crc8_hash(frame);
+
+	memcpy(op_hash_data->midstate, work->midstate, sizeof(op_hash_data->midstate));
+	memcpy(op_hash_data->merkle_residual, work->data + 64, 4);
+	p = (uint32_t *)(work->data + 64 + 4);
+	op_hash_data->timestamp = *p++;
+	op_hash_data->bits = *p++;
+	op_hash_data->starting_nonce = 0;
+	op_hash_data->nonce_loops = 0;
+	op_hash_data->ntime_loops = 0;
+
+	/* Set the number of leading zeroes to look for based on diff.
+	 * Diff 1 = 32, Diff 2 = 33, Diff 4 = 34 etc. */
+	intdiff = (uint64_t)work->device_diff;
+	for (i = 31; intdiff; i++, intdiff >>= 1);
+	op_hash_data->search_difficulty = i;
+	op_hash_data->group = 0;
+
+	applog(LOG_DEBUG, "%s %s: OP_HASH sequence %d search_difficulty %d work_difficulty %g",
+	       hashfast->drv->name, hashfast->unique_id, sequence,
+	       op_hash_data->search_difficulty, work->work_difficulty);
+}
+
+/* Send a batch of OP_HASH frames in one write. The device accepts
+ * every frame written in full so a short write is only resent from the
+ * first incomplete frame, otherwise frames would be duplicated. */
+static bool hfa_send_hash_batch(struct cgpu_info *hashfast, uint8_t *packet, int frames)
+{
+	struct hashfast_info *info = hashfast->device_data;
+	int ret, amount, sent = 0, tx_length = frames * HFA_HASH_FRAME_SIZE;
+	bool retried = false;
+
+	if (unlikely(hashfast->usbinfo.nodev))
+		return false;
+
+	info->last_send = time(NULL);
+	applog(LOG_DEBUG, "%s %s: Sending %d OP_HASH frames", hashfast->drv->name,
+	       hashfast->unique_id, frames);
+retry:
+	amount = 0;
+	ret = usb_write(hashfast, (char *)packet + sent, tx_length - sent, &amount,
+			hfa_cmds[OP_HASH].usb_cmd);
+	if (unlikely(ret < 0 || amount != tx_length - sent)) {
+		if (hashfast->usbinfo.nodev)
+			return false;
+		if (!retried) {
+			applog(LOG_ERR, "%s %s: hfa_send_hash_batch: USB Send error, ret %d amount %d vs. tx_length %d, retrying",
+			       hashfast->drv->name, hashfast->unique_id, ret, amount, tx_length - sent);
+			if (amount > 0)
+				sent += amount / HFA_HASH_FRAME_SIZE * HFA_HASH_FRAME_SIZE;
+			retried = true;
+			goto retry;
+		}
+		applog(LOG_ERR, "%s %s: hfa_send_hash_batch: USB Send error, ret %d amount %d vs. tx_length %d",
+		       hashfast->drv->name, hashfast->unique_id, ret, amount, tx_length - sent);
+		return false;
+	}
+
+	if (retried)
+		applog(LOG_WARNING, "%s %s: hfa_send_hash_batch: recovered OK", hashfast->drv->name, hashfast->unique_id);
+
+	return true;
+}
+
 static int64_t hfa_scanwork(struct thr_info *thr)
 {
 	struct cgpu_info *hashfast = thr->cgpu;
@@ -1680,13 +1837,12 @@ restart:
 		jobs = hfa_jobs(hashfast, info);
 	}
 
-	/* Wait on restart_wait for up to 0.5 seconds or submit jobs as soon as
-	 * they're required. */
+	/* Wait for up to 0.5 seconds for the device to return credits, or
+	 * submit jobs as soon as they're required. */
 	while (!jobs && ++cycles < 5) {
-		ret = restart_wait(thr, 100);
-		if (unlikely(!ret))
+		jobs = hfa_wait_jobs(thr, hashfast, info, 100);
+		if (unlikely(thr->work_restart))
 			goto restart;
-		jobs = hfa_jobs(hashfast, info);
 	}
 
 	if (jobs) {
@@ -1694,50 +1850,43 @@ restart:
 		       jobs);
 	}
 
-	while (jobs-- > 0) {
-		struct hf_hash_usb op_hash_data;
-		struct work *work;
-		uint64_t intdiff;
-		int i, sequence;
-		uint32_t *p;
-
-		/* This is a blocking function if there's no work */
-		if (!base_work)
-			base_work = get_work(thr, thr->id);
-
-		/* HFA hardware actually had ntime rolling disabled so we
-		 * can roll the work ourselves here to minimise the amount of
-		 * work we need to generate. */
-		if (base_work->drv_rolllimit > jobs) {
-			base_work->drv_rolllimit--;
-			roll_work(base_work);
-			work = make_clone(base_work);
-		} else {
-			work = base_work;
-			base_work = NULL;
+	/* Send the jobs as batches of OP_HASH frames, up to HFA_HASH_BATCH in
+	 * each USB write. */
+	while (jobs > 0) {
+		uint8_t packet[HFA_HASH_BATCH * HFA_HASH_FRAME_SIZE];
+		struct work *works[HFA_HASH_BATCH];
+		int frames, sequence, i;
+
+		sequence = info->hash_sequence_head;
+		for (frames = 0; frames < HFA_HASH_BATCH && jobs-- > 0; frames++) {
+			struct work *work;
+
+			/* This is a blocking function if there's no work */
+			if (!base_work)
+				base_work = get_work(thr, thr->id);
+
+			/* HFA hardware actually had ntime rolling disabled so we
+			 * can roll the work ourselves here to minimise the amount of
+			 * work we need to generate. */
+			if (base_work->drv_rolllimit > jobs) {
+				base_work->drv_rolllimit--;
+				roll_work(base_work);
+				work = make_clone(base_work);
+			} else {
+				work = base_work;
+				base_work = NULL;
+			}
+
+			if (++sequence >= info->num_sequence)
+				sequence = 0;
+			hfa_hash_frame(hashfast, packet + frames * HFA_HASH_FRAME_SIZE, work, sequence);
+			works[frames] = work;
 		}
 
-		/* Assemble the data frame and send the OP_HASH packet */
-		memcpy(op_hash_data.midstate, work->midstate, sizeof(op_hash_data.midstate));
-		memcpy(op_hash_data.merkle_residual, work->data + 64, 4);
-		p = (uint32_t *)(work->data + 64 + 4);
-		op_hash_data.timestamp = *p++;
-		op_hash_data.bits = *p++;
-		op_hash_data.starting_nonce = 0;
-		op_hash_data.nonce_loops = 0;
-		op_hash_data.ntime_loops = 0;
-
-		/* Set the number of leading zeroes to look for based on diff.
-		 * Diff 1 = 32, Diff 2 = 33, Diff 4 = 34 etc. */
-		intdiff = (uint64_t)work->device_diff;
-		for (i = 31; intdiff; i++, intdiff >>= 1);
-		op_hash_data.search_difficulty = i;
-		op_hash_data.group = 0;
-		if ((sequence = info->hash_sequence_head + 1) >= info->num_sequence)
-			sequence = 0;
-		ret = hfa_send_frame(hashfast, OP_HASH, sequence, (uint8_t *)&op_hash_data, sizeof(op_hash_data));
+		ret = hfa_send_hash_batch(hashfast, packet, frames);
 		if (unlikely(!ret)) {
-			free_work(work);
+			for (i = 0; i < frames; i++)
+				free_work(works[i]);
 			if (base_work)
 				free_work(base_work);
 			hfa_running_shutdown(hashfast, info);
@@ -1745,13 +1894,17 @@ restart:
 		}
 
 		mutex_lock(&info->lock);
-		info->hash_sequence_head = sequence;
-		info->works[info->hash_sequence_head] = work;
+		for (i = 0; i < frames; i++) {
+			if (++info->hash_sequence_head >= info->num_sequence)
+				info->hash_sequence_head = 0;
+			info->works[info->hash_sequence_head] = works[i];
+		}
+		info->hash_frames += frames;
+		info->hash_batches++;
 		mutex_unlock(&info->lock);
 
-		applog(LOG_DEBUG, "%s %s: OP_HASH sequence %d search_difficulty %d work_difficulty %g",
-		       hashfast->drv->name, hashfast->unique_id, info->hash_sequence_head,
-		       op_hash_data.search_difficulty, work->work_difficulty);
+		applog(LOG_DEBUG, "%s %s: Sent %d OP_HASH frames in one write",
+		       hashfast->drv->name, hashfast->unique_id, frames);
 	}
 
 	if (base_work)
@@ -1863,6 +2016,10 @@ static struct api_data *hfa_api_stats(struct cgpu_info *cgpu)
 	root = api_add_uint64(root, "calc hashcount", &info->calc_hashes, false);
 	root = api_add_int(root, "no matching work", &info->no_matching_work, false);
 	root = api_add_uint16(root, "shed count", &info->shed_count, false);
+	root = api_add_uint64(root, "credits returned", &info->credits_returned, false);
+	root = api_add_uint64(root, "credit waits", &info->credit_waits, false);
+	root = api_add_uint64(root, "hash frames", &info->hash_frames, false);
+	root = api_add_uint64(root, "hash batches", &info->hash_batches, false);
 	root = api_add_int(root, "resets", &info->resets, false);
 
 	return root;
@@ -1947,6 +2104,7 @@ struct device_drv hashfast_drv = {
 	.thread_init = hfa_init,
 	.hash_work = &hash_driver_work,
 	.scanwork = hfa_scanwork,
+	.flush_work = hfa_flush_work,
 	.get_api_stats = hfa_api_stats,
 	.get_statline_before = hfa_statline_before,
 	.reinit_device = hfa_reinit,
@@ -43,6 +43,9 @@ char *opt_hfa_options;
 #define HFA_FAN_DEFAULT 33
 #define HFA_FAN_MAX 85
 #define HFA_FAN_MIN 5
+/* Most OP_HASH frames to send in one USB write. Each frame is exactly one
+ * 64 byte full speed USB packet. */
+#define HFA_HASH_BATCH 16
 
 // Matching fields for hf_statistics, but large #s for local accumulation, per-die
 struct hf_long_statistics {
@@ -128,6 +131,7 @@ struct hashfast_info {
 
 	pthread_mutex_t lock;
 	pthread_mutex_t rlock;
+	pthread_cond_t credit_cond;                 // Signalled when jobs complete or on a restart
 	struct work **works;
 	uint16_t hash_sequence_head;                // HOST:   The next hash sequence # to be sent
 	uint16_t hash_sequence_tail;                // HOST:   Follows device_sequence_tail around to free work
@@ -136,6 +140,10 @@ struct hashfast_info {
 	int64_t hash_count;
 	uint64_t raw_hashes;
 	uint64_t calc_hashes;
+	uint64_t credits_returned;                  // Jobs completed according to OP_GWQ_STATUS
+	uint64_t credit_waits;                      // Times scanwork waited for jobs to complete
+	uint64_t hash_frames;                       // OP_HASH frames sent
+	uint64_t hash_batches;                      // USB writes they were sent in
 	uint16_t shed_count;                        // Dynamic copy of #cores device has shed for thermal control
 	int no_matching_work;
 	int resets;
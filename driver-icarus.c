@@ -67,6 +67,7 @@ ASSERT1(sizeof(uint32_t) == 4);
 
 // TODO: USB? Different calculation? - see usbstats to work it out e.g. 1/2 of normal send time
 //  or even use that number? 1/2
+//  (--icarus-timing auto does use the usbstats, see ICARUS_AUTO below)
 // #define ICARUS_READ_TIME(baud) ((double)ICARUS_READ_SIZE * (double)8.0 / (double)(baud))
 // maybe 1ms?
 #define ICARUS_READ_TIME(baud) (0.001)
@@ -158,6 +159,55 @@ ASSERT1(sizeof(uint32_t) == 4);
 
 static struct timeval history_sec = { HISTORY_SEC, 0 };
 
+// 'auto' timing mode doesn't collect history sets, it refits Hs and W after
+// every usable nonce with each older nonce weighted down by a constant factor,
+// so the estimate follows roughly the last ICARUS_AUTO_WINDOW nonces
+// It then sets read_time as close to fullnonce as the measured delay between
+// aborting work and the next work arriving at the device allows, instead of
+// the fixed ICARUS_READ_REDUCE, to keep the idle gap between ranges minimal
+#define ICARUS_AUTO_WINDOW 100
+#define ICARUS_AUTO_DECAY (1.0 - 1.0 / (double)ICARUS_AUTO_WINDOW)
+// Don't use a fit until it has this many nonces
+#define ICARUS_AUTO_MIN_VALUES MIN_DATA_COUNT
+// Ignore a fit more than this factor away from the device's default Hs
+#define ICARUS_AUTO_HS_RANGE 4.0
+// How many aborts to measure before trusting the abort overhead
+#define ICARUS_AUTO_MIN_ABORTS 3
+// Smallest margin in ms to abort before the expected end of the nonce range
+#define ICARUS_AUTO_MARGIN_MIN 10
+// Standard deviations of jitter to add to the margin
+#define ICARUS_AUTO_SIGMAS 3.0
+
+struct ICARUS_AUTO {
+	// Weighted sums for the Tn = Hs * Xn + W fit
+	double sumw;
+	double sumXiTi;
+	double sumXi;
+	double sumTi;
+	double sumXi2;
+	uint32_t values;
+	// Weighted variance of Ti about the fit
+	double fit_var;
+
+	// Seconds for a nonce to cross the USB, from the usbstats
+	double latency;
+	// Seconds from the read_time abort to the next work being sent
+	double overhead;
+	double overhead_var;
+	uint32_t aborts;
+	// Seconds read_time is set below fullnonce
+	double margin;
+
+	// The previous work sent, to measure overhead and idle time
+	struct timeval last_start;
+	int last_ret;
+	int last_read_time;
+
+	struct timeval first_start;
+	uint64_t nonces;
+	double idle_total;
+};
+
 // Store the last INFO_HISTORY data sets
 // [0] = current data, not yet ready to be included as an estimate
 // Each new data set throws the last old set off the end thus
@@ -175,7 +225,7 @@ struct ICARUS_HISTORY {
 	uint32_t hash_count_max;
 };
 
-enum timing_mode { MODE_DEFAULT, MODE_SHORT, MODE_LONG, MODE_VALUE };
+enum timing_mode { MODE_DEFAULT, MODE_SHORT, MODE_LONG, MODE_VALUE, MODE_AUTO };
 
 static const char *MODE_DEFAULT_STR = "default";
 static const char *MODE_SHORT_STR = "short";
@@ -183,6 +233,8 @@ static const char *MODE_SHORT_STREQ = "short=";
 static const char *MODE_LONG_STR = "long";
 static const char *MODE_LONG_STREQ = "long=";
 static const char *MODE_VALUE_STR = "value";
+static const char *MODE_AUTO_STR = "auto";
+static const char *MODE_AUTO_STREQ = "auto=";
 static const char *MODE_UNKNOWN_STR = "unknown";
 
 struct ICARUS_INFO {
@@ -221,6 +273,10 @@ struct ICARUS_INFO {
 	uint64_t history_count;
 	struct timeval history_time;
 
+	// The device's default Hs and the 'auto' mode estimator
+	double Hs_default;
+	struct ICARUS_AUTO autot;
+
 	// icarus-options
 	int baud;
 	int work_division;
@@ -234,6 +290,11 @@ struct ICARUS_INFO {
 	int nonce_size;
 
 	bool failing;
+
+	// CPU seconds used by the thread driving this device
+	double thread_cpu;
+	// Set when driven by an --icarus-event-threads loop
+	struct icarus_loop *loop;
 };
 
 #define ICARUS_MIDSTATE_SIZE 32
@@ -525,6 +586,8 @@ static const char *timing_mode_str(enum timing_mode timing_mode)
 		return MODE_LONG_STR;
 	case MODE_VALUE:
 		return MODE_VALUE_STR;
+	case MODE_AUTO:
+		return MODE_AUTO_STR;
 	default:
 		return MODE_UNKNOWN_STR;
 	}
@@ -635,6 +698,24 @@ static void set_timing_mode(int this_option_offset, struct cgpu_info *icarus)
 			info->read_time_limit = 0;
 		if (info->read_time_limit > ICARUS_READ_TIME_LIMIT_MAX)
 			info->read_time_limit = ICARUS_READ_TIME_LIMIT_MAX;
+	} else if (strcasecmp(buf, MODE_AUTO_STR) == 0
+		|| strncasecmp(buf, MODE_AUTO_STREQ, strlen(MODE_AUTO_STREQ)) == 0) {
+		// auto[=limit] - start from the default then keep refining it
+		info->fullnonce = info->Hs * (((double)0xffffffff) + 1);
+		info->read_time = SECTOMS(info->fullnonce) - ICARUS_READ_REDUCE;
+		if (unlikely(info->read_time < ICARUS_READ_COUNT_MIN))
+			info->read_time = ICARUS_READ_COUNT_MIN;
+
+		info->timing_mode = MODE_AUTO;
+		info->do_icarus_timing = true;
+
+		if (buf[strlen(MODE_AUTO_STR)] == '=') {
+			info->read_time_limit = atoi(&buf[strlen(MODE_AUTO_STREQ)]);
+			if (info->read_time_limit < 0)
+				info->read_time_limit = 0;
+			if (info->read_time_limit > ICARUS_READ_TIME_LIMIT_MAX)
+				info->read_time_limit = ICARUS_READ_TIME_LIMIT_MAX;
+		}
 	} else if ((Hs = atof(buf)) != 0) {
 		// ns[=read_time]
 		info->Hs = Hs / NANOSEC;
@@ -670,6 +751,9 @@ static void set_timing_mode(int this_option_offset, struct cgpu_info *icarus)
 	}
 
 	info->min_data_count = MIN_DATA_COUNT;
+	info->Hs_default = info->Hs;
+	memset(&(info->autot), 0, sizeof(info->autot));
+	info->autot.margin = (double)ICARUS_READ_REDUCE / 1000.0;
 
 	// All values are in multiples of ICARUS_WAIT_TIMEOUT
 	info->read_time_limit *= ICARUS_WAIT_TIMEOUT;
@@ -1269,31 +1353,10 @@ static void cmr2_commands(struct cgpu_info *icarus)
 	}
 }
 
-static int64_t icarus_scanwork(struct thr_info *thr)
+/* Returns false if the device has failed and should be dropped */
+static bool icarus_check_failing(struct cgpu_info *icarus)
 {
-	struct cgpu_info *icarus = thr->cgpu;
 	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
-	int ret, err, amount;
-	unsigned char nonce_bin[ICARUS_BUF_SIZE];
-	struct ICARUS_WORK workdata;
-	char *ob_hex;
-	uint32_t nonce;
-	int64_t hash_count = 0;
-	struct timeval tv_start, tv_finish, elapsed;
-	struct timeval tv_history_start, tv_history_finish;
-	double Ti, Xi;
-	int curr_hw_errors, i;
-	bool was_hw_error;
-	struct work *work;
-
-	struct ICARUS_HISTORY *history0, *history;
-	int count;
-	double Hs, W, fullnonce;
-	int read_time;
-	bool limited;
-	int64_t estimate_hashes;
-	uint32_t values;
-	int64_t hash_count_range;
 
 	if (unlikely(share_work_tdiff(icarus) > info->fail_time)) {
 		if (info->failing) {
@@ -1301,7 +1364,7 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 				applog(LOG_ERR, "%s %d: Device failed to respond to restart",
 				       icarus->drv->name, icarus->device_id);
 				usb_nodev(icarus);
-				return -1;
+				return false;
 			}
 		} else {
 			applog(LOG_WARNING, "%s %d: No valid hashes for over %d secs, attempting to reset",
@@ -1313,48 +1376,199 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 
 	// Device is gone
 	if (icarus->usbinfo.nodev)
-		return -1;
+		return false;
 
-	elapsed.tv_sec = elapsed.tv_usec = 0;
+	return true;
+}
+
+static void icarus_work_data(struct work *work, struct ICARUS_WORK *workdata)
+{
+	memset((void *)workdata, 0, sizeof(*workdata));
+	memcpy(&(workdata->midstate), work->midstate, ICARUS_MIDSTATE_SIZE);
+	memcpy(&(workdata->work), work->data + ICARUS_WORK_DATA_OFFSET, ICARUS_WORK_SIZE);
+	rev((void *)(&(workdata->midstate)), ICARUS_MIDSTATE_SIZE);
+	rev((void *)(&(workdata->work)), ICARUS_WORK_SIZE);
+}
+
+static struct work *icarus_get_work(struct thr_info *thr, struct ICARUS_WORK *workdata)
+{
+	struct work *work;
 
 	work = get_work(thr, thr->id);
-	memset((void *)(&workdata), 0, sizeof(workdata));
-	memcpy(&(workdata.midstate), work->midstate, ICARUS_MIDSTATE_SIZE);
-	memcpy(&(workdata.work), work->data + ICARUS_WORK_DATA_OFFSET, ICARUS_WORK_SIZE);
-	rev((void *)(&(workdata.midstate)), ICARUS_MIDSTATE_SIZE);
-	rev((void *)(&(workdata.work)), ICARUS_WORK_SIZE);
+	icarus_work_data(work, workdata);
 
-	if (info->speed_next_work || info->flash_next_work)
-		cmr2_commands(icarus);
+	return work;
+}
 
-	// We only want results for the work we are about to send
-	usb_buffer_clear(icarus);
+/* CPU seconds used so far by the calling thread */
+static double icarus_thread_cpu(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
 
-	err = usb_write_ii(icarus, info->intinfo, (char *)(&workdata), sizeof(workdata), &amount, C_SENDWORK);
-	if (err < 0 || amount != sizeof(workdata)) {
-		applog(LOG_ERR, "%s%i: Comms error (werr=%d amt=%d)",
-				icarus->drv->name, icarus->device_id, err, amount);
-		dev_error(icarus, REASON_DEV_COMMS_ERROR);
-		icarus_initialise(icarus, info->baud);
-		goto out;
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+#endif
+	return 0;
+}
+
+/* 'auto' mode: set fullnonce and read_time from the current fit and margin */
+static void icarus_auto_read_time(struct cgpu_info *icarus, struct ICARUS_INFO *info)
+{
+	struct ICARUS_AUTO *autot = &(info->autot);
+	double fullnonce;
+	int read_time, level;
+	bool limited;
+
+	fullnonce = info->W + info->Hs * (((double)0xffffffff) + 1);
+	read_time = SECTOMS(fullnonce - autot->margin);
+	if (info->read_time_limit > 0 && read_time > info->read_time_limit) {
+		read_time = info->read_time_limit;
+		limited = true;
+	} else
+		limited = false;
+	if (unlikely(read_time < ICARUS_READ_COUNT_MIN))
+		read_time = ICARUS_READ_COUNT_MIN;
+
+	// Only report changes bigger than the usual jitter
+	if (abs(read_time - info->read_time) >= ICARUS_WAIT_TIMEOUT)
+		level = LOG_WARNING;
+	else
+		level = LOG_DEBUG;
+	applog(level, "%s%d Auto-estimate: Hs=%e W=%e read_time=%dms%s fullnonce=%.3fs margin=%.3fs",
+	       icarus->drv->name, icarus->device_id, info->Hs, info->W, read_time,
+	       limited ? " (limited)" : "", fullnonce, autot->margin);
+
+	info->fullnonce = fullnonce;
+	info->read_time = read_time;
+}
+
+/* 'auto' mode: called with each work's start time, to measure how long the
+ * previous work took to be replaced after read_time aborted it, and how long
+ * the device was idle having finished the nonce range before that */
+static void icarus_auto_cycle(struct cgpu_info *icarus, struct ICARUS_INFO *info,
+			      int ret, struct timeval *tv_start)
+{
+	struct ICARUS_AUTO *autot = &(info->autot);
+	double cycle, fullnonce, overhead, diff, alpha;
+	// What this work was sent with, before any change below
+	int read_time = info->read_time;
+
+	if (autot->first_start.tv_sec == 0)
+		copy_time(&(autot->first_start), tv_start);
+	else if (autot->last_start.tv_sec != 0) {
+		cycle = tdiff(tv_start, &(autot->last_start));
+		fullnonce = info->W + info->Hs * (((double)0xffffffff) + 1);
+
+		// Any longer was a pause or disable, not the timing
+		if (cycle > 0 && cycle < fullnonce * 2) {
+			if (cycle > fullnonce)
+				autot->idle_total += cycle - fullnonce;
+
+			if (autot->last_ret == ICA_NONCE_TIMEOUT) {
+				overhead = cycle - (double)(autot->last_read_time) / 1000.0;
+				autot->aborts++;
+				if (autot->aborts < ICARUS_AUTO_WINDOW / 5)
+					alpha = 1.0 / (double)(autot->aborts);
+				else
+					alpha = 5.0 / (double)ICARUS_AUTO_WINDOW;
+				diff = overhead - autot->overhead;
+				autot->overhead += alpha * diff;
+				autot->overhead_var = (1.0 - alpha) * (autot->overhead_var + alpha * diff * diff);
+
+				if (autot->aborts >= ICARUS_AUTO_MIN_ABORTS) {
+					autot->margin = autot->overhead + ICARUS_AUTO_SIGMAS *
+						sqrt(autot->overhead_var + autot->fit_var);
+					if (autot->margin < (double)ICARUS_AUTO_MARGIN_MIN / 1000.0)
+						autot->margin = (double)ICARUS_AUTO_MARGIN_MIN / 1000.0;
+					icarus_auto_read_time(icarus, info);
+				}
+			}
+		}
 	}
 
-	if (opt_debug) {
-		ob_hex = bin2hex((void *)(&workdata), sizeof(workdata));
-		applog(LOG_DEBUG, "%s%d: sent %s",
-			icarus->drv->name, icarus->device_id, ob_hex);
-		free(ob_hex);
+	copy_time(&(autot->last_start), tv_start);
+	autot->last_ret = ret;
+	autot->last_read_time = read_time;
+}
+
+/* 'auto' mode: add a nonce found Xi hashes and elapsed seconds after the work
+ * was sent to the fit, and use the new fit if it's sane */
+static void icarus_auto_fit(struct cgpu_info *icarus, struct ICARUS_INFO *info,
+			    double Xi, double elapsed)
+{
+	struct ICARUS_AUTO *autot = &(info->autot);
+	double Ti, Hs, W, r, den;
+
+	autot->latency = usb_cmd_delay(icarus, C_SENDWORK);
+	Ti = elapsed - autot->latency;
+
+	if (info->values > 0) {
+		r = Ti - (info->Hs * Xi + info->W);
+		autot->fit_var = ICARUS_AUTO_DECAY * autot->fit_var + (1.0 - ICARUS_AUTO_DECAY) * r * r;
 	}
 
-	/* Icarus will return 4 bytes (ICARUS_READ_SIZE) nonces or nothing */
-	memset(nonce_bin, 0, sizeof(nonce_bin));
-	ret = icarus_get_nonce(icarus, nonce_bin, &tv_start, &tv_finish, thr, info->read_time);
-	if (ret == ICA_NONCE_ERROR)
-		goto out;
+	autot->sumw = ICARUS_AUTO_DECAY * autot->sumw + 1.0;
+	autot->sumXiTi = ICARUS_AUTO_DECAY * autot->sumXiTi + Xi * Ti;
+	autot->sumXi = ICARUS_AUTO_DECAY * autot->sumXi + Xi;
+	autot->sumTi = ICARUS_AUTO_DECAY * autot->sumTi + Ti;
+	autot->sumXi2 = ICARUS_AUTO_DECAY * autot->sumXi2 + Xi * Xi;
+	autot->values++;
+
+	if (autot->values < ICARUS_AUTO_MIN_VALUES)
+		return;
+
+	den = autot->sumw * autot->sumXi2 - autot->sumXi * autot->sumXi;
+	if (den <= 0)
+		return;
+	Hs = (autot->sumw * autot->sumXiTi - autot->sumXi * autot->sumTi) / den;
+	if (Hs < info->Hs_default / ICARUS_AUTO_HS_RANGE
+	||  Hs > info->Hs_default * ICARUS_AUTO_HS_RANGE) {
+		applog(LOG_DEBUG, "%s%d Auto-estimate: ignoring Hs=%e",
+		       icarus->drv->name, icarus->device_id, Hs);
+		return;
+	}
+	W = (autot->sumTi - Hs * autot->sumXi) / autot->sumw;
+
+	info->Hs = Hs;
+	info->W = W;
+	info->values = autot->values;
+	icarus_auto_read_time(icarus, info);
+}
+
+/* Work out the hashes done from the result of the read that followed sending
+ * work, and feed the timing history */
+static int64_t icarus_hashes_done(struct thr_info *thr, struct work *work, int ret,
+				  unsigned char *nonce_bin, struct timeval *tv_start,
+				  struct timeval *tv_finish)
+{
+	struct cgpu_info *icarus = thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+	uint32_t nonce;
+	int64_t hash_count = 0;
+	struct timeval elapsed;
+	struct timeval tv_history_start, tv_history_finish;
+	double Ti, Xi;
+	int curr_hw_errors, i;
+	bool was_hw_error, timing_value;
+
+	struct ICARUS_HISTORY *history0, *history;
+	int count;
+	double Hs, W, fullnonce;
+	int read_time;
+	bool limited;
+	int64_t estimate_hashes;
+	uint32_t values;
+	int64_t hash_count_range;
+
+	elapsed.tv_sec = elapsed.tv_usec = 0;
+
+	if (info->timing_mode == MODE_AUTO)
+		icarus_auto_cycle(icarus, info, ret, tv_start);
 
 	// aborted before becoming idle, get new work
 	if (ret == ICA_NONCE_TIMEOUT || ret == ICA_NONCE_RESTART) {
-		timersub(&tv_finish, &tv_start, &elapsed);
+		timersub(tv_finish, tv_start, &elapsed);
 
 		// ONLY up to just when it aborted
 		// We didn't read a reply so we don't subtract ICARUS_READ_TIME
@@ -1371,8 +1585,7 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 				(long unsigned int)estimate_hashes,
 				(long)elapsed.tv_sec, (long)elapsed.tv_usec);
 
-		hash_count = estimate_hashes;
-		goto out;
+		return estimate_hashes;
 	}
 
 	memcpy((char *)&nonce, nonce_bin, ICARUS_READ_SIZE);
@@ -1385,6 +1598,7 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 	if (was_hw_error)
 		hash_count = 0;
 	else {
+		info->autot.nonces++;
 		hash_count = (nonce & info->nonce_mask);
 		hash_count++;
 		hash_count *= info->fpga_count;
@@ -1405,7 +1619,7 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 #endif
 
 	if (opt_debug || info->do_icarus_timing)
-		timersub(&tv_finish, &tv_start, &elapsed);
+		timersub(tv_finish, tv_start, &elapsed);
 
 	applog(LOG_DEBUG, "%s%d: nonce = 0x%08x = 0x%08lX hashes (%ld.%06lds)",
 			icarus->drv->name, icarus->device_id,
@@ -1415,16 +1629,29 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 	// Ignore possible end condition values ... and hw errors
 	// TODO: set limitations on calculated values depending on the device
 	// to avoid crap values caused by CPU/Task Switching/Swapping/etc
-	if (info->do_icarus_timing
-	&&  !was_hw_error
-	&&  ((nonce & info->nonce_mask) > END_CONDITION)
-	&&  ((nonce & info->nonce_mask) < (info->nonce_mask & ~END_CONDITION))) {
+	// ('auto' mode limits Hs to ICARUS_AUTO_HS_RANGE of the default)
+	timing_value = info->do_icarus_timing
+			&& !was_hw_error
+			&& ((nonce & info->nonce_mask) > END_CONDITION)
+			&& ((nonce & info->nonce_mask) < (info->nonce_mask & ~END_CONDITION));
+	if (timing_value && info->timing_mode == MODE_AUTO) {
+		cgtime(&tv_history_start);
+
+		icarus_auto_fit(icarus, info, (double)hash_count,
+				(double)(elapsed.tv_sec) + ((double)(elapsed.tv_usec))/((double)1000000));
+
+		info->history_count++;
+		cgtime(&tv_history_finish);
+
+		timersub(&tv_history_finish, &tv_history_start, &tv_history_finish);
+		timeradd(&tv_history_finish, &(info->history_time), &(info->history_time));
+	} else if (timing_value) {
 		cgtime(&tv_history_start);
 
 		history0 = &(info->history[0]);
 
 		if (history0->values == 0)
-			timeradd(&tv_start, &history_sec, &(history0->finish));
+			timeradd(tv_start, &history_sec, &(history0->finish));
 
 		Ti = (double)(elapsed.tv_sec)
 			+ ((double)(elapsed.tv_usec))/((double)1000000)
@@ -1443,7 +1670,7 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 			history0->hash_count_min = hash_count;
 
 		if (history0->values >= info->min_data_count
-		&&  timercmp(&tv_start, &(history0->finish), >)) {
+		&&  timercmp(tv_start, &(history0->finish), >)) {
 			for (i = INFO_HISTORY; i > 0; i--)
 				memcpy(&(info->history[i]),
 					&(info->history[i-1]),
@@ -1481,7 +1708,7 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 			W = history0->sumTi/history0->values - Hs*history0->sumXi/history0->values;
 			hash_count_range = history0->hash_count_max - history0->hash_count_min;
 			values = history0->values;
-			
+
 			// Initialise history0 to zero for next data set
 			memset(history0, 0, sizeof(struct ICARUS_HISTORY));
 
@@ -1517,16 +1744,538 @@ static int64_t icarus_scanwork(struct thr_info *thr)
 		timersub(&tv_history_finish, &tv_history_start, &tv_history_finish);
 		timeradd(&tv_history_finish, &(info->history_time), &(info->history_time));
 	}
+
+	return hash_count;
+}
+
+static int64_t icarus_scanwork(struct thr_info *thr)
+{
+	struct cgpu_info *icarus = thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+	int ret, err, amount;
+	unsigned char nonce_bin[ICARUS_BUF_SIZE];
+	struct ICARUS_WORK workdata;
+	char *ob_hex;
+	int64_t hash_count = 0;
+	struct timeval tv_start, tv_finish;
+	struct work *work;
+
+	if (!icarus_check_failing(icarus))
+		return -1;
+
+	work = icarus_get_work(thr, &workdata);
+
+	if (info->speed_next_work || info->flash_next_work)
+		cmr2_commands(icarus);
+
+	// We only want results for the work we are about to send
+	usb_buffer_clear(icarus);
+
+	err = usb_write_ii(icarus, info->intinfo, (char *)(&workdata), sizeof(workdata), &amount, C_SENDWORK);
+	if (err < 0 || amount != sizeof(workdata)) {
+		applog(LOG_ERR, "%s%i: Comms error (werr=%d amt=%d)",
+				icarus->drv->name, icarus->device_id, err, amount);
+		dev_error(icarus, REASON_DEV_COMMS_ERROR);
+		icarus_initialise(icarus, info->baud);
+		goto out;
+	}
+
+	if (opt_debug) {
+		ob_hex = bin2hex((void *)(&workdata), sizeof(workdata));
+		applog(LOG_DEBUG, "%s%d: sent %s",
+			icarus->drv->name, icarus->device_id, ob_hex);
+		free(ob_hex);
+	}
+
+	/* Icarus will return 4 bytes (ICARUS_READ_SIZE) nonces or nothing */
+	memset(nonce_bin, 0, sizeof(nonce_bin));
+	ret = icarus_get_nonce(icarus, nonce_bin, &tv_start, &tv_finish, thr, info->read_time);
+	if (ret == ICA_NONCE_ERROR)
+		goto out;
+
+	hash_count = icarus_hashes_done(thr, work, ret, nonce_bin, &tv_start, &tv_finish);
 out:
 	free_work(work);
+	info->thread_cpu = icarus_thread_cpu();
 
 	return hash_count;
 }
 
+/*
+ * With --icarus-event-threads N the devices are not each driven by their own
+ * mining thread blocking in icarus_get_nonce(). Instead the mining thread
+ * hands its device to one of N event loop threads and exits. Each loop runs
+ * the same send work / read nonce / abort at read_time cycle as
+ * icarus_scanwork() for all its devices at once, as a state machine per
+ * device, with every USB transfer submitted asynchronously. Completions are
+ * queued to the loop by the libusb polling thread and the loop sleeps until
+ * the next completion or the next read_time deadline.
+ * The timing and hash estimates are shared with icarus_scanwork() via
+ * icarus_hashes_done() so all the --icarus-timing modes behave the same.
+ */
+enum icarus_ev_state {
+	ICA_EV_IDLE,
+	ICA_EV_SEND,
+	ICA_EV_READ,
+	ICA_EV_ABORT,
+	ICA_EV_DISABLED,
+	ICA_EV_DEAD
+};
+
+// Longest a loop sleeps, to notice disabled devices being enabled
+#define ICARUS_LOOP_IDLE_mS 1000
+// How often the hashmeter is updated, as in hash_driver_work()
+#define ICARUS_METER_uS 200000
+// How often a device waiting for work looks for it again
+#define ICARUS_LOOP_NOWORK_mS 10
+
+struct icarus_loop;
+
+struct icarus_ev {
+	struct icarus_loop *loop;
+	struct icarus_ev *next;
+	struct icarus_ev *ready_next;
+	struct thr_info *thr;
+	struct usb_async *ua_write;
+	struct usb_async *ua_read;
+	enum icarus_ev_state state;
+
+	struct work *work;
+	struct ICARUS_WORK workdata;
+	int sent;
+	unsigned char nonce_bin[ICARUS_BUF_SIZE];
+	int got;
+	struct timeval tv_start;
+	struct timeval tv_deadline;
+
+	int64_t hashes_done;
+	struct timeval tv_meter;
+	// When the device last found no work staged, 0 if it has work
+	time_t nowork;
+};
+
+struct icarus_loop {
+	int id;
+	pthread_t pth;
+	cgsem_t sem;
+	pthread_mutex_t lock;
+	// Devices only the loop thread walks
+	struct icarus_ev *devs;
+	// Protected by lock
+	struct icarus_ev *added;
+	struct icarus_ev *ready;
+	int devices;
+
+	double cpu;
+	uint64_t wakeups;
+};
+
+static pthread_mutex_t icarus_loops_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct icarus_loop *icarus_loops;
+static int icarus_loops_started;
+// Devices being driven by their own mining thread
+static int icarus_threads;
+
+static void icarus_ev_callback(__maybe_unused struct usb_async *ua, void *userdata)
+{
+	struct icarus_ev *ev = (struct icarus_ev *)userdata;
+	struct icarus_loop *loop = ev->loop;
+	bool wake;
+
+	mutex_lock(&loop->lock);
+	wake = (loop->ready == NULL);
+	ev->ready_next = loop->ready;
+	loop->ready = ev;
+	mutex_unlock(&loop->lock);
+
+	if (wake)
+		cgsem_post(&loop->sem);
+}
+
+static void icarus_ev_read(struct icarus_ev *ev)
+{
+	struct cgpu_info *icarus = ev->thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+	int err;
+
+	err = usb_async_submit(ev->ua_read, NULL, info->nonce_size - ev->got, C_GETRESULTS);
+	if (err) {
+		applog(LOG_ERR, "%s%i: Comms error (rerr=%d amt=%d)", icarus->drv->name,
+		       icarus->device_id, err, ev->got);
+		dev_error(icarus, REASON_DEV_COMMS_ERROR);
+		ev->state = ICA_EV_IDLE;
+	} else
+		ev->state = ICA_EV_READ;
+}
+
+/* The equivalent of one hash_driver_work() loop for a device, after its
+ * icarus_scanwork() equivalent has finished */
+static void icarus_ev_done(struct icarus_ev *ev, int ret)
+{
+	struct thr_info *thr = ev->thr;
+	struct timeval tv_finish, diff;
+
+	cgtime(&tv_finish);
+	if (ret != ICA_NONCE_ERROR) {
+		ev->hashes_done += icarus_hashes_done(thr, ev->work, ret, ev->nonce_bin,
+						      &ev->tv_start, &tv_finish);
+	}
+	free_work(ev->work);
+	ev->work = NULL;
+	thr->work_restart = false;
+
+	timersub(&tv_finish, &ev->tv_meter, &diff);
+	if ((ev->hashes_done && (diff.tv_sec > 0 || diff.tv_usec > ICARUS_METER_uS)) ||
+	    diff.tv_sec >= opt_log_interval) {
+		hashmeter(thr->id, ev->hashes_done);
+		ev->hashes_done = 0;
+		copy_time(&ev->tv_meter, &tv_finish);
+	}
+	ev->state = ICA_EV_IDLE;
+}
+
+static void icarus_ev_send_failed(struct icarus_ev *ev, int err)
+{
+	struct cgpu_info *icarus = ev->thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+
+	applog(LOG_ERR, "%s%i: Comms error (werr=%d amt=%d)",
+	       icarus->drv->name, icarus->device_id, err, ev->sent);
+	dev_error(icarus, REASON_DEV_COMMS_ERROR);
+	icarus_initialise(icarus, info->baud);
+	icarus_ev_done(ev, ICA_NONCE_ERROR);
+}
+
+static void icarus_ev_start(struct icarus_ev *ev)
+{
+	struct thr_info *thr = ev->thr;
+	struct cgpu_info *icarus = thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+	time_t now;
+	int err;
+
+	if (icarus->shutdown) {
+		ev->state = ICA_EV_DEAD;
+		return;
+	}
+
+	if (unlikely(thr->pause || icarus->deven != DEV_ENABLED)) {
+		applog(LOG_WARNING, "Thread %d being disabled", thr->id);
+		icarus->rolling = 0;
+		ev->state = ICA_EV_DISABLED;
+		return;
+	}
+
+	if (!icarus_check_failing(icarus)) {
+		applog(LOG_ERR, "%s %d failure, disabling!", icarus->drv->name, icarus->device_id);
+		icarus->deven = DEV_DISABLED;
+		dev_error(icarus, REASON_THREAD_ZERO_HASH);
+		ev->state = ICA_EV_DEAD;
+		return;
+	}
+
+	/* The loop can't wait for work, so a device with none tries again
+	 * on the next wakeup. As with get_work() blocking, the time without
+	 * work mustn't count towards the device failing. */
+	thr->work_update = false;
+	ev->work = get_work_nowait(thr, thr->id);
+	now = time(NULL);
+	if (ev->nowork)
+		icarus->last_device_valid_work += now - ev->nowork;
+	if (!ev->work) {
+		ev->nowork = now;
+		return;
+	}
+	ev->nowork = 0;
+	icarus_work_data(ev->work, &ev->workdata);
+
+	// Rare and slow, so these stay synchronous
+	if (info->speed_next_work || info->flash_next_work)
+		cmr2_commands(icarus);
+
+	usb_buffer_clear(icarus);
+
+	ev->sent = 0;
+	ev->state = ICA_EV_SEND;
+	err = usb_async_submit(ev->ua_write, (char *)(&ev->workdata), sizeof(ev->workdata), C_SENDWORK);
+	if (err)
+		icarus_ev_send_failed(ev, err);
+}
+
+static void icarus_ev_complete(struct icarus_ev *ev)
+{
+	struct thr_info *thr = ev->thr;
+	struct cgpu_info *icarus = thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+	char buf[ICARUS_BUF_SIZE];
+	struct timeval now;
+	int err, amount, ret;
+	char *ob_hex;
+
+	if (ev->state == ICA_EV_SEND) {
+		err = usb_async_complete(ev->ua_write, NULL, 0, &amount);
+		if (err < 0 || amount <= 0) {
+			icarus_ev_send_failed(ev, err);
+			return;
+		}
+		ev->sent += amount;
+		if (ev->sent < (int)sizeof(ev->workdata)) {
+			err = usb_async_submit(ev->ua_write, (char *)(&ev->workdata) + ev->sent,
+					       sizeof(ev->workdata) - ev->sent, C_SENDWORK);
+			if (err)
+				icarus_ev_send_failed(ev, err);
+			return;
+		}
+
+		if (opt_debug) {
+			ob_hex = bin2hex((void *)(&ev->workdata), sizeof(ev->workdata));
+			applog(LOG_DEBUG, "%s%d: sent %s",
+				icarus->drv->name, icarus->device_id, ob_hex);
+			free(ob_hex);
+		}
+
+		/* Icarus will return 4 bytes (ICARUS_READ_SIZE) nonces or nothing */
+		memset(ev->nonce_bin, 0, sizeof(ev->nonce_bin));
+		ev->got = 0;
+		cgtime(&ev->tv_start);
+		us_to_timeval(&ev->tv_deadline, (int64_t)info->read_time * 1000);
+		timeradd(&ev->tv_start, &ev->tv_deadline, &ev->tv_deadline);
+		icarus_ev_read(ev);
+		return;
+	}
+
+	// ICA_EV_READ or ICA_EV_ABORT
+	err = usb_async_complete(ev->ua_read, buf, info->nonce_size - ev->got, &amount);
+	if (amount > 0) {
+		memcpy(ev->nonce_bin + ev->got, buf, amount);
+		ev->got += amount;
+	}
+
+	if (err < 0 && err != LIBUSB_ERROR_TIMEOUT) {
+		applog(LOG_ERR, "%s%i: Comms error (rerr=%d amt=%d)", icarus->drv->name,
+		       icarus->device_id, err, ev->got);
+		dev_error(icarus, REASON_DEV_COMMS_ERROR);
+		icarus_ev_done(ev, ICA_NONCE_ERROR);
+		return;
+	}
+
+	cgtime(&now);
+	if (ev->got < info->nonce_size && !err && ev->state == ICA_EV_READ &&
+	    timercmp(&now, &ev->tv_deadline, <)) {
+		icarus_ev_read(ev);
+		return;
+	}
+
+	if (ev->got >= ICARUS_READ_SIZE)
+		ret = ICA_NONCE_OK;
+	else if (thr->work_restart) {
+		applog(LOG_DEBUG, "Icarus Read: Work restart at %d ms",
+		       SECTOMS(tdiff(&now, &ev->tv_start)));
+		ret = ICA_NONCE_RESTART;
+	} else {
+		applog(LOG_DEBUG, "Icarus Read: No data for %d ms",
+		       SECTOMS(tdiff(&now, &ev->tv_start)));
+		ret = ICA_NONCE_TIMEOUT;
+	}
+	icarus_ev_done(ev, ret);
+}
+
+static void icarus_ev_service(struct icarus_ev *ev, struct timeval *now)
+{
+	struct thr_info *thr = ev->thr;
+	struct cgpu_info *icarus = thr->cgpu;
+
+	switch (ev->state) {
+		case ICA_EV_READ:
+			if (icarus->shutdown || thr->work_restart ||
+			    !timercmp(now, &ev->tv_deadline, <)) {
+				usb_async_cancel(ev->ua_read);
+				ev->state = ICA_EV_ABORT;
+			}
+			break;
+		case ICA_EV_DISABLED:
+			if (icarus->shutdown) {
+				ev->state = ICA_EV_DEAD;
+				break;
+			}
+			if (thr->pause || icarus->deven != DEV_ENABLED)
+				break;
+			applog(LOG_WARNING, "Thread %d being re-enabled", thr->id);
+			cgsem_reset(&thr->sem);
+			icarus->drv->thread_enable(thr);
+			ev->state = ICA_EV_IDLE;
+			// fall through
+		case ICA_EV_IDLE:
+			icarus_ev_start(ev);
+			break;
+		default:
+			break;
+	}
+}
+
+static void *icarus_loop_thread(void *userdata)
+{
+	struct icarus_loop *loop = (struct icarus_loop *)userdata;
+	struct icarus_ev *ev, *next, **prev;
+	struct timeval now, diff;
+	char threadname[16];
+	int ms;
+
+	pthread_detach(pthread_self());
+	snprintf(threadname, sizeof(threadname), "ICA/Loop%d", loop->id);
+	RenameThread(threadname);
+
+	while (42) {
+		mutex_lock(&loop->lock);
+		ev = loop->ready;
+		loop->ready = NULL;
+		while (loop->added) {
+			next = loop->added->next;
+			loop->added->next = loop->devs;
+			loop->devs = loop->added;
+			loop->added = next;
+		}
+		mutex_unlock(&loop->lock);
+
+		for (; ev; ev = next) {
+			next = ev->ready_next;
+			icarus_ev_complete(ev);
+		}
+
+		cgtime(&now);
+		ms = ICARUS_LOOP_IDLE_mS;
+		prev = &loop->devs;
+		for (ev = loop->devs; ev; ev = next) {
+			next = ev->next;
+			icarus_ev_service(ev, &now);
+			if (ev->state == ICA_EV_DEAD) {
+				struct cgpu_info *icarus = ev->thr->cgpu;
+
+				*prev = next;
+				icarus->deven = DEV_DISABLED;
+				usb_async_free(ev->ua_write);
+				usb_async_free(ev->ua_read);
+				free(ev);
+				mutex_lock(&loop->lock);
+				loop->devices--;
+				mutex_unlock(&loop->lock);
+				applog(LOG_DEBUG, "%s%d: removed from event loop %d",
+				       icarus->drv->name, icarus->device_id, loop->id);
+				continue;
+			}
+			prev = &ev->next;
+			if (ev->state == ICA_EV_IDLE && ms > ICARUS_LOOP_NOWORK_mS)
+				ms = ICARUS_LOOP_NOWORK_mS;
+			if (ev->state == ICA_EV_READ) {
+				timersub(&ev->tv_deadline, &now, &diff);
+				if (diff.tv_sec < 0)
+					ms = 0;
+				else if (diff.tv_sec * 1000 + diff.tv_usec / 1000 < ms)
+					ms = diff.tv_sec * 1000 + (diff.tv_usec + 999) / 1000;
+			}
+		}
+
+		loop->cpu = icarus_thread_cpu();
+		loop->wakeups++;
+		if (ms > 0)
+			cgsem_mswait(&loop->sem, ms);
+	}
+
+	return NULL;
+}
+
+static void icarus_ev_add(struct thr_info *thr)
+{
+	struct cgpu_info *icarus = thr->cgpu;
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+	struct icarus_loop *loop;
+	struct icarus_ev *ev;
+	int i;
+
+	ev = calloc(1, sizeof(*ev));
+	if (unlikely(!ev))
+		quit(1, "Failed to calloc icarus_ev");
+	ev->thr = thr;
+	ev->state = ICA_EV_IDLE;
+	ev->ua_write = usb_async_init(icarus, info->intinfo, DEFAULT_EP_OUT, icarus_ev_callback, ev);
+	ev->ua_read = usb_async_init(icarus, info->intinfo, DEFAULT_EP_IN, icarus_ev_callback, ev);
+	cgtime(&ev->tv_meter);
+
+	mutex_lock(&icarus_loops_lock);
+	if (!icarus_loops) {
+		icarus_loops = calloc(opt_icarus_event_threads, sizeof(*icarus_loops));
+		if (unlikely(!icarus_loops))
+			quit(1, "Failed to calloc icarus_loops");
+	}
+	/* Start a new loop until there are enough, then share them out */
+	if (icarus_loops_started < opt_icarus_event_threads) {
+		loop = &icarus_loops[icarus_loops_started];
+		loop->id = icarus_loops_started;
+		cgsem_init(&loop->sem);
+		mutex_init(&loop->lock);
+		if (unlikely(pthread_create(&loop->pth, NULL, icarus_loop_thread, loop)))
+			quit(1, "Failed to create icarus event loop thread");
+		icarus_loops_started++;
+	} else {
+		loop = &icarus_loops[0];
+		for (i = 1; i < icarus_loops_started; i++) {
+			if (icarus_loops[i].devices < loop->devices)
+				loop = &icarus_loops[i];
+		}
+	}
+	mutex_unlock(&icarus_loops_lock);
+
+	ev->loop = loop;
+	info->loop = loop;
+
+	mutex_lock(&loop->lock);
+	ev->next = loop->added;
+	loop->added = ev;
+	loop->devices++;
+	mutex_unlock(&loop->lock);
+	cgsem_post(&loop->sem);
+
+	applog(LOG_DEBUG, "%s%d: added to event loop %d",
+	       icarus->drv->name, icarus->device_id, loop->id);
+}
+
+static void icarus_hash_work(struct thr_info *thr)
+{
+	if (opt_icarus_event_threads) {
+		/* The loop drives the device from here and this thread ends */
+		icarus_ev_add(thr);
+		return;
+	}
+
+	mutex_lock(&icarus_loops_lock);
+	icarus_threads++;
+	mutex_unlock(&icarus_loops_lock);
+
+	hash_driver_work(thr);
+
+	mutex_lock(&icarus_loops_lock);
+	icarus_threads--;
+	mutex_unlock(&icarus_loops_lock);
+}
+
+static void icarus_flush_work(struct cgpu_info *icarus)
+{
+	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(icarus->device_data);
+
+	// Wake the loop so it sees the work restart
+	if (info->loop)
+		cgsem_post(&info->loop->sem);
+}
+
 static struct api_data *icarus_api_stats(struct cgpu_info *cgpu)
 {
 	struct api_data *root = NULL;
 	struct ICARUS_INFO *info = (struct ICARUS_INFO *)(cgpu->device_data);
+	int loop_id, driver_threads, i;
+	double thread_cpu, driver_cpu;
+	struct ICARUS_AUTO *autot = &(info->autot);
+	double elapsed, predicted_mhs, observed_mhs, predicted_idle, observed_idle, idle;
+	struct timeval now;
 
 	// Warning, access to these is not locked - but we don't really
 	// care since hashing performance is way more important than
@@ -1550,6 +2299,60 @@ static struct api_data *icarus_api_stats(struct cgpu_info *cgpu)
 	root = api_add_int(root, "work_division", &(info->work_division), false);
 	root = api_add_int(root, "fpga_count", &(info->fpga_count), false);
 
+	/* What the 'auto' fit expects the device to do against what it did, the
+	 * MH/s from the nonces found and the idle time as % of the time mining */
+	if (info->timing_mode == MODE_AUTO) {
+		cgtime(&now);
+		elapsed = autot->first_start.tv_sec ? tdiff(&now, &(autot->first_start)) : 0;
+		predicted_mhs = info->Hs > 0 ? 1.0 / (info->Hs * 1000000.0) : 0;
+		idle = (double)(info->read_time) / 1000.0 + autot->overhead - info->fullnonce;
+		if (elapsed > 0) {
+			observed_mhs = (double)(autot->nonces) * (((double)0xffffffff) + 1)
+					/ (elapsed * 1000000.0);
+			predicted_idle = idle > 0 ? 100.0 * idle * (double)(autot->aborts) / elapsed : 0;
+			observed_idle = 100.0 * autot->idle_total / elapsed;
+		} else
+			observed_mhs = predicted_idle = observed_idle = 0;
+
+		root = api_add_double(root, "usb_latency", &(autot->latency), false);
+		root = api_add_double(root, "abort_overhead", &(autot->overhead), false);
+		root = api_add_double(root, "abort_margin", &(autot->margin), false);
+		root = api_add_uint(root, "aborts", &(autot->aborts), false);
+		root = api_add_uint64(root, "nonces", &(autot->nonces), false);
+		root = api_add_mhs(root, "predicted_mhs", &predicted_mhs, true);
+		root = api_add_mhs(root, "observed_mhs", &observed_mhs, true);
+		root = api_add_percent(root, "predicted_idle", &predicted_idle, true);
+		root = api_add_percent(root, "observed_idle", &observed_idle, true);
+		root = api_add_double(root, "idle_time", &(autot->idle_total), false);
+	}
+
+	/* Which thread drives the device and what all the threads driving
+	 * Icarus devices are costing, to compare with --icarus-event-threads */
+	loop_id = info->loop ? info->loop->id : -1;
+	thread_cpu = info->loop ? info->loop->cpu : info->thread_cpu;
+	driver_cpu = 0;
+	mutex_lock(&icarus_loops_lock);
+	driver_threads = icarus_threads + icarus_loops_started;
+	for (i = 0; i < icarus_loops_started; i++)
+		driver_cpu += icarus_loops[i].cpu;
+	mutex_unlock(&icarus_loops_lock);
+	rd_lock(&devices_lock);
+	for (i = 0; i < total_devices; i++) {
+		struct cgpu_info *cgpu2 = devices[i];
+		struct ICARUS_INFO *info2;
+
+		if (cgpu2->drv->drv_id != DRIVER_icarus || !cgpu2->device_data)
+			continue;
+		info2 = (struct ICARUS_INFO *)(cgpu2->device_data);
+		if (!info2->loop)
+			driver_cpu += info2->thread_cpu;
+	}
+	rd_unlock(&devices_lock);
+	root = api_add_int(root, "event_loop", &loop_id, true);
+	root = api_add_double(root, "thread_cpu", &thread_cpu, true);
+	root = api_add_int(root, "driver_threads", &driver_threads, true);
+	root = api_add_double(root, "driver_cpu", &driver_cpu, true);
+
 	return root;
 }
 
@@ -1619,7 +2422,8 @@ struct device_drv icarus_drv = {
 	.dname = "Icarus",
 	.name = "ICA",
 	.drv_detect = icarus_detect,
-	.hash_work = &hash_driver_work,
+	.hash_work = &icarus_hash_work,
+	.flush_work = icarus_flush_work,
 	.get_api_stats = icarus_api_stats,
 	.get_statline_before = icarus_statline_before,
 	.set_device = icarus_set,
@@ -59,6 +59,10 @@ static const char *msg_reply = "Reply";
 #define CMD_REPLY_RETRIES	8	// how many retries for cmds
 #define MAX_WORK_COUNT		4	// for now, must be binary multiple and match firmware
 #define TACH_FACTOR		87890	// fan rpm divisor
+#define KLN_READ_SIZE		512	// most read from a single transfer
+#define KLN_RING_SIZE		4096	// reply ring, must be a power of 2
+#define KLN_RING_MASK		(KLN_RING_SIZE - 1)
+#define KLN_NONCE_BATCH		(KLN_READ_SIZE / REPLY_SIZE + 1)
 
 #define KLN_KILLWORK_TEMP	53.5
 #define KLN_COOLED_DOWN		45.5
@@ -192,6 +196,8 @@ typedef struct device_info {
 	uint64_t totalhashcount;
 	uint32_t rangesize;
 	uint32_t *chipstats;
+	// cgminer work id of the last work sent with each workid
+	int work_ids[256];
 } DEVINFO;
 
 typedef struct klist {
@@ -204,6 +210,25 @@ typedef struct klist {
 	bool working;
 } KLIST;
 
+// Replies are read in bulk straight into a ring and handled in place,
+// a reply is only copied out when it wraps the end of the ring
+typedef struct kln_ring {
+	uint8_t buf[KLN_RING_SIZE];
+	// Free running byte counts, only their difference matters
+	uint32_t head;
+	uint32_t tail;
+} KRING;
+
+// reply types counted for the API, anything else counts as unknown
+static const uint8_t kln_reply_cmds[] = {
+	KLN_CMD_NONCE, KLN_CMD_WORK, KLN_CMD_STATUS, KLN_CMD_ABORT,
+	KLN_CMD_ENABLE, KLN_CMD_CONFIG, KLN_CMD_IDENT
+};
+#define KLN_REPLY_TYPES ((int)sizeof(kln_reply_cmds))
+static const char *kln_reply_names[KLN_REPLY_TYPES + 1] = {
+	"Nonce", "Work", "Status", "Abort", "Enable", "Config", "Ident", "Unknown"
+};
+
 typedef struct jobque {
 	int workqc;
 	struct timeval last_update;
@@ -249,6 +274,14 @@ struct klondike_info {
 	int wque_size;
 	int wque_cleared;
 
+	// only updated by the replies thread
+	KRING rx;
+	uint64_t rx_reads;
+	uint64_t rx_replies[KLN_REPLY_TYPES + 1];
+	uint64_t rx_wrapped;
+	uint64_t rx_dropped;
+	uint64_t nonce_batches;
+
 	bool initialised;
 };
 
@@ -851,11 +884,31 @@ static void klondike_identify(__maybe_unused struct cgpu_info *klncgpu)
 */
 }
 
-static void klondike_check_nonce(struct cgpu_info *klncgpu, KLIST *kitem)
+// Must be called with qlock held
+static struct work *__klondike_find_work(struct cgpu_info *klncgpu, KLINE *kline,
+					 struct timeval *tv_now)
+{
+	struct klondike_info *klninfo = (struct klondike_info *)(klncgpu->device_data);
+	struct work *work;
+	int id;
+
+	// devinfo[] isn't allocated, nor the dev checked, until initialised
+	if (!klninfo->initialised)
+		return NULL;
+
+	id = klninfo->devinfo[kline->wr.dev].work_ids[kline->wr.workid];
+	HASH_FIND_INT(klncgpu->queued_work, &id, work);
+	if (work && work->subid == (kline->wr.dev*256 + kline->wr.workid) &&
+	    ms_tdiff(tv_now, &(work->tv_stamp)) < OLD_WORK_MS)
+		return work;
+
+	return NULL;
+}
+
+static void klondike_check_nonce(struct cgpu_info *klncgpu, KLINE *kline,
+				 struct timeval *tv_when, struct work *work)
 {
 	struct klondike_info *klninfo = (struct klondike_info *)(klncgpu->device_data);
-	struct work *work, *look, *tmp;
-	KLINE *kline = &(kitem->kline);
 	struct timeval tv_now;
 	double us_diff;
 	uint32_t nonce = K_NONCE(kline->wr.nonce) - 0xC0;
@@ -864,18 +917,6 @@ static void klondike_check_nonce(struct cgpu_info *klncgpu, KLIST *kitem)
 			  klncgpu->drv->name, klncgpu->device_id, (int)(kline->wr.dev),
 			  kline->wr.workid, (unsigned int)nonce);
 
-	work = NULL;
-	cgtime(&tv_now);
-	rd_lock(&(klncgpu->qlock));
-	HASH_ITER(hh, klncgpu->queued_work, look, tmp) {
-		if (ms_tdiff(&tv_now, &(look->tv_stamp)) < OLD_WORK_MS &&
-		    (look->subid == (kline->wr.dev*256 + kline->wr.workid))) {
-			work = look;
-			break;
-		}
-	}
-	rd_unlock(&(klncgpu->qlock));
-
 	if (work) {
 		wr_lock(&(klninfo->stat_lock));
 		klninfo->devinfo[kline->wr.dev].noncecount++;
@@ -897,7 +938,7 @@ static void klondike_check_nonce(struct cgpu_info *klncgpu, KLIST *kitem)
 
 		klninfo->devinfo[kline->wr.dev].chipstats[(nonce / klninfo->devinfo[kline->wr.dev].rangesize) + (ok ? 0 : klninfo->status[kline->wr.dev].kline.ws.chipcount)]++;
 
-		us_diff = us_tdiff(&tv_now, &(kitem->tv_when));
+		us_diff = us_tdiff(&tv_now, tv_when);
 		if (klninfo->delay_count == 0) {
 			klninfo->delay_min = us_diff;
 			klninfo->delay_max = us_diff;
@@ -911,7 +952,7 @@ static void klondike_check_nonce(struct cgpu_info *klncgpu, KLIST *kitem)
 		klninfo->delay_total += us_diff;
 
 		if (klninfo->nonce_count > 0) {
-			us_diff = us_tdiff(&(kitem->tv_when), &(klninfo->tv_last_nonce_received));
+			us_diff = us_tdiff(tv_when, &(klninfo->tv_last_nonce_received));
 			if (klninfo->nonce_count == 1) {
 				klninfo->nonce_min = us_diff;
 				klninfo->nonce_max = us_diff;
@@ -925,7 +966,7 @@ static void klondike_check_nonce(struct cgpu_info *klncgpu, KLIST *kitem)
 		}
 		klninfo->nonce_count++;
 
-		memcpy(&(klninfo->tv_last_nonce_received), &(kitem->tv_when),
+		memcpy(&(klninfo->tv_last_nonce_received), tv_when,
 			sizeof(klninfo->tv_last_nonce_received));
 
 		return;
@@ -938,14 +979,74 @@ static void klondike_check_nonce(struct cgpu_info *klncgpu, KLIST *kitem)
 	//inc_hw_errors(klncgpu->thr[0]);
 }
 
+// look up the work for a batch of nonces with a single hold of qlock,
+// then submit each of them
+static void klondike_check_nonces(struct cgpu_info *klncgpu, KLINE **klines, int count,
+				  struct timeval *tv_when)
+{
+	struct klondike_info *klninfo = (struct klondike_info *)(klncgpu->device_data);
+	struct work *works[KLN_NONCE_BATCH];
+	struct timeval tv_now;
+	int i;
+
+	cgtime(&tv_now);
+	rd_lock(&(klncgpu->qlock));
+	for (i = 0; i < count; i++)
+		works[i] = __klondike_find_work(klncgpu, klines[i], &tv_now);
+	rd_unlock(&(klncgpu->qlock));
+	klninfo->nonce_batches++;
+
+	for (i = 0; i < count; i++) {
+		klondike_check_nonce(klncgpu, klines[i], tv_when, works[i]);
+		display_kline(klncgpu, klines[i], msg_reply);
+	}
+}
+
+static int kln_reply_type(uint8_t cmd)
+{
+	int i;
+
+	for (i = 0; i < KLN_REPLY_TYPES; i++)
+		if (kln_reply_cmds[i] == cmd)
+			break;
+	return i;
+}
+
+// Consume and return the reply at the ring tail, or NULL if more data
+// is needed. It stays valid in the ring until the next read, unless it
+// wraps the end of the ring, then it's copied to scratch - only one
+// reply between reads can wrap
+static KLINE *kln_next_reply(KRING *ring, KLINE *scratch, uint64_t *wrapped)
+{
+	uint32_t off, first;
+
+	if (ring->head - ring->tail < REPLY_SIZE)
+		return NULL;
+
+	off = ring->tail & KLN_RING_MASK;
+	ring->tail += REPLY_SIZE;
+	if (off + REPLY_SIZE <= KLN_RING_SIZE)
+		return (KLINE *)(ring->buf + off);
+
+	first = KLN_RING_SIZE - off;
+	memcpy((void *)scratch, ring->buf + off, first);
+	memcpy((uint8_t *)scratch + first, ring->buf, REPLY_SIZE - first);
+	(*wrapped)++;
+	return scratch;
+}
+
 // thread to keep looking for replies
 static void *klondike_get_replies(void *userdata)
 {
 	struct cgpu_info *klncgpu = (struct cgpu_info *)userdata;
 	struct klondike_info *klninfo = (struct klondike_info *)(klncgpu->device_data);
+	KLINE *nonces[KLN_NONCE_BATCH], *kline, scratch;
+	KRING *rx = &(klninfo->rx);
 	KLIST *kitem = NULL;
+	struct timeval tv_when;
+	uint32_t off, len;
 	char *hexdata;
-	int err, recd, slaves, dev, isc;
+	int err, recd, slaves, dev, isc, block_seq, nnonces;
 	bool overheat, sent;
 
 	applog(LOG_DEBUG, "%s%i: listening for replies",
@@ -955,29 +1056,37 @@ static void *klondike_get_replies(void *userdata)
 		if (klncgpu->usbinfo.nodev)
 			return NULL;
 
-		if (kitem == NULL)
-			kitem = allocate_kitem(klncgpu);
-		else
-			memset((void *)&(kitem->kline), 0, sizeof(kitem->kline));
-
-		err = usb_read(klncgpu, (char *)&(kitem->kline), REPLY_SIZE, &recd, C_GETRESULTS);
-		if (err || recd != REPLY_SIZE) {
-			if (err != -7)
-				applog(LOG_ERR, "%s%i: reply err=%d amt=%d",
-						klncgpu->drv->name, klncgpu->device_id,
-						err, recd);
+		// read as much as one transfer returns into the ring
+		off = rx->head & KLN_RING_MASK;
+		len = KLN_RING_SIZE - (rx->head - rx->tail);
+		if (len > KLN_RING_SIZE - off)
+			len = KLN_RING_SIZE - off;
+		if (len > KLN_READ_SIZE)
+			len = KLN_READ_SIZE;
+
+		err = usb_read_once(klncgpu, (char *)(rx->buf + off), len, &recd, C_GETRESULTS);
+		if (err && err != LIBUSB_ERROR_TIMEOUT)
+			applog(LOG_ERR, "%s%i: reply err=%d amt=%d",
+					klncgpu->drv->name, klncgpu->device_id,
+					err, recd);
+		if (recd > 0) {
+			rx->head += recd;
+			klninfo->rx_reads++;
 		}
-		if (!err && recd == REPLY_SIZE) {
-			cgtime(&(kitem->tv_when));
-			rd_lock(&(klninfo->stat_lock));
-			kitem->block_seq = klninfo->block_seq;
-			rd_unlock(&(klninfo->stat_lock));
+
+		cgtime(&tv_when);
+		rd_lock(&(klninfo->stat_lock));
+		block_seq = klninfo->block_seq;
+		rd_unlock(&(klninfo->stat_lock));
+
+		nnonces = 0;
+		while ((kline = kln_next_reply(rx, &scratch, &(klninfo->rx_wrapped))) != NULL) {
 			if (opt_log_level <= READ_DEBUG) {
-				hexdata = bin2hex((unsigned char *)&(kitem->kline.hd.dev), recd-1);
+				hexdata = bin2hex((unsigned char *)&(kline->hd.dev), REPLY_SIZE-1);
 				applog(READ_DEBUG, "%s%i:%d reply [%c:%s]",
 						klncgpu->drv->name, klncgpu->device_id,
-						(int)(kitem->kline.hd.dev),
-						kitem->kline.hd.cmd, hexdata);
+						(int)(kline->hd.dev),
+						kline->hd.cmd, hexdata);
 				free(hexdata);
 			}
 
@@ -987,27 +1096,49 @@ static void *klondike_get_replies(void *userdata)
 				slaves = klninfo->status[0].kline.ws.slavecount;
 				rd_unlock(&(klninfo->stat_lock));
 
-				if (kitem->kline.hd.dev > slaves) {
+				if (kline->hd.dev > slaves) {
 					applog(LOG_ERR, "%s%i: reply [%c] has invalid dev=%d (max=%d) using 0",
 							klncgpu->drv->name, klncgpu->device_id,
-							(char)(kitem->kline.hd.cmd),
-							(int)(kitem->kline.hd.dev),
+							(char)(kline->hd.cmd),
+							(int)(kline->hd.dev),
 							slaves);
 					/* TODO: this is rather problematic if there are slaves
 					 * however without slaves - it should always be zero */
-					kitem->kline.hd.dev = 0;
+					kline->hd.dev = 0;
 				} else {
 					wr_lock(&(klninfo->stat_lock));
-					klninfo->jobque[kitem->kline.hd.dev].late_update_sequential = 0;
+					klninfo->jobque[kline->hd.dev].late_update_sequential = 0;
 					wr_unlock(&(klninfo->stat_lock));
 				}
 			}
 
+			klninfo->rx_replies[kln_reply_type(kline->hd.cmd)]++;
+
+			// nonces are checked in place, a batch at a time
+			if (kline->hd.cmd == KLN_CMD_NONCE) {
+				nonces[nnonces++] = kline;
+				if (nnonces == KLN_NONCE_BATCH) {
+					klondike_check_nonces(klncgpu, nonces, nnonces, &tv_when);
+					nnonces = 0;
+				}
+				continue;
+			}
+
+			// keep replies in order
+			if (nnonces) {
+				klondike_check_nonces(klncgpu, nonces, nnonces, &tv_when);
+				nnonces = 0;
+			}
+
+			if (kitem == NULL)
+				kitem = allocate_kitem(klncgpu);
+			else
+				memset((void *)&(kitem->kline), 0, sizeof(kitem->kline));
+			memcpy((void *)&(kitem->kline), (void *)kline, REPLY_SIZE);
+			memcpy(&(kitem->tv_when), &tv_when, sizeof(kitem->tv_when));
+			kitem->block_seq = block_seq;
+
 			switch (kitem->kline.hd.cmd) {
-				case KLN_CMD_NONCE:
-					klondike_check_nonce(klncgpu, kitem);
-					display_kline(klncgpu, &kitem->kline, msg_reply);
-					break;
 				case KLN_CMD_WORK:
 					// We can't do/check this until it's initialised
 					if (klninfo->initialised) {
@@ -1118,6 +1249,14 @@ static void *klondike_get_replies(void *userdata)
 					break;
 			}
 		}
+		if (nnonces)
+			klondike_check_nonces(klncgpu, nonces, nnonces, &tv_when);
+
+		// the rest of a partial reply won't follow a failed read
+		if (err && rx->head != rx->tail) {
+			klninfo->rx_dropped += rx->head - rx->tail;
+			rx->tail = rx->head;
+		}
 	}
 	return NULL;
 }
@@ -1234,6 +1373,7 @@ static bool klondike_send_work(struct cgpu_info *klncgpu, int dev, struct work *
 	memcpy(kline.wt.merkle, work->data + MERKLE_OFFSET, MERKLE_BYTES);
 	kline.wt.workid = (uint8_t)(klninfo->devinfo[dev].nextworkid++ & 0xFF);
 	work->subid = dev*256 + kline.wt.workid;
+	klninfo->devinfo[dev].work_ids[kline.wt.workid] = work->id;
 	cgtime(&work->tv_stamp);
 
 	if (opt_log_level <= LOG_DEBUG) {
@@ -1449,7 +1589,7 @@ static struct api_data *klondike_api_stats(struct cgpu_info *klncgpu)
 	struct klondike_info *klninfo = (struct klondike_info *)(klncgpu->device_data);
 	struct api_data *root = NULL;
 	char buf[32];
-	int dev, slaves;
+	int dev, slaves, n;
 
 	if (klninfo->status == NULL)
 		return NULL;
@@ -1530,6 +1670,15 @@ static struct api_data *klondike_api_stats(struct cgpu_info *klncgpu)
 	root = api_add_int(root, "WQue Size", &(klninfo->wque_size), true);
 	root = api_add_int(root, "WQue Cleared", &(klninfo->wque_cleared), true);
 
+	root = api_add_uint64(root, "RX Reads", &(klninfo->rx_reads), true);
+	for (n = 0; n <= KLN_REPLY_TYPES; n++) {
+		sprintf(buf, "RX %s", kln_reply_names[n]);
+		root = api_add_uint64(root, buf, &(klninfo->rx_replies[n]), true);
+	}
+	root = api_add_uint64(root, "RX Wrapped", &(klninfo->rx_wrapped), true);
+	root = api_add_uint64(root, "RX Dropped", &(klninfo->rx_dropped), true);
+	root = api_add_uint64(root, "Nonce Batches", &(klninfo->nonce_batches), true);
+
 	rd_unlock(&(klninfo->stat_lock));
 
 	return root;
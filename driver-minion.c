@@ -43,6 +43,13 @@ static bool minreread = true;
 #define MINION_SPI_SPEED 1000000
 #define MINION_SPI_BUFSIZ 1024
 
+/*
+ * The most tasks minion_spi_write sends in one SPI_IOC_MESSAGE
+ * and their total size, within the default spidev bufsiz
+ */
+#define MINION_BATCH_TASKS 16
+#define MINION_BATCH_BYTES 4096
+
 #define MINION_CHIPS 32
 #define MINION_CORES 99
 #define FAKE_CORE MINION_CORES
@@ -402,6 +409,17 @@ struct minion_que {
  */
 #define MINION_REPLY_mS 88
 
+/*
+ * Without an interrupt, or as the poll() timeout when there is one,
+ * the result check interval adapts to the nonce rate of the fastest
+ * chip, measured every MINION_REPLY_RATE_mS, aiming to check when it
+ * should have MINION_RESULT_INT_SIZE results waiting - as the interrupt
+ * would - but never more often than MINION_REPLY_MIN_mS
+ * MINION_REPLY_mS is the maximum, used until there is a rate
+ */
+#define MINION_REPLY_MIN_mS 8
+#define MINION_REPLY_RATE_mS 1000
+
 /*
  * Max time to wait before returning the amount of work done
  * A result interrupt will send a trigger for this also
@@ -606,6 +624,7 @@ struct minion_info {
 	cgsem_t task_ready;
 	cgsem_t nonce_ready;
 	cgsem_t scan_work;
+	cgsem_t reply_wake;
 
 	int spifd;
 	char gpiointvalue[64];
@@ -634,6 +653,13 @@ struct minion_info {
 
 	struct minion_status chip_status[MINION_CHIPS];
 
+	// Adaptive result checking in minion_spi_reply
+	int reply_ms;
+	double reply_rate;
+	uint64_t reply_checks;
+	uint64_t reply_wakes;
+	uint64_t reply_timeouts;
+
 	uint64_t interrupts;
 	uint64_t result_interrupts;
 	uint64_t command_interrupts;
@@ -650,6 +676,14 @@ struct minion_info {
 	uint64_t work_rolled;
 
 	uint64_t spi_errors;
+
+	// SPI_IOC_MESSAGE batches sent by minion_spi_write
+	uint64_t batches;
+	uint64_t batch_tasks;
+	uint64_t batch_bytes;
+	int batch_max;
+	double batch_us;
+	double batch_us_max;
 	uint64_t fifo_spi_errors[MINION_CHIPS];
 	uint64_t res_spi_errors[MINION_CHIPS];
 	uint64_t use_res2[MINION_CHIPS];
@@ -670,6 +704,7 @@ struct minion_info {
 	// Task list
 	K_LIST *tfree_list;
 	K_STORE *task_list;
+	K_STORE *utask_list;
 	K_STORE *treply_list;
 
 	uint64_t next_tid;
@@ -703,6 +738,10 @@ struct minion_info {
 	bool initialised;
 };
 
+// Urgent tasks are on their own list so minion_spi_write can send them first
+#define add_task(_info, _item) \
+		k_add_head(DATAT(_item)->urgent ? (_info)->utask_list : (_info)->task_list, _item)
+
 static void ready_work(struct cgpu_info *minioncgpu, struct work *work, bool rolled)
 {
 	struct minion_info *minioninfo = (struct minion_info *)(minioncgpu->device_data);
@@ -1052,7 +1091,8 @@ static int _do_ioctl(struct minion_info *minioninfo, uint8_t *obuf, uint32_t osi
 }
 #endif
 
-static bool _minion_txrx(struct cgpu_info *minioncgpu, struct minion_info *minioninfo, TITEM *task, MINION_FFL_ARGS)
+// Build the task's command in its obuf
+static void minion_task_prep(TITEM *task)
 {
 	struct minion_header *head;
 
@@ -1068,8 +1108,10 @@ static bool _minion_txrx(struct cgpu_info *minioncgpu, struct minion_info *minio
 	if (task->wsiz)
 		memcpy(&(head->data[0]), task->wbuf, task->wsiz);
 	task->osiz = HSIZE() + task->wsiz + task->rsiz;
+}
 
-	task->reply = do_ioctl(task->obuf, task->osiz, task->rbuf, task->rsiz);
+static bool minion_task_reply(struct cgpu_info *minioncgpu, TITEM *task, MINION_FFL_ARGS)
+{
 	if (task->reply < 0) {
 		applog(LOG_ERR, "%s%d: chip=%d ioctl failed reply=%d err=%d" MINION_FFL,
 				minioncgpu->drv->name, minioncgpu->device_id,
@@ -1083,6 +1125,79 @@ static bool _minion_txrx(struct cgpu_info *minioncgpu, struct minion_info *minio
 	return (task->reply >= (int)(task->osiz));
 }
 
+static bool _minion_txrx(struct cgpu_info *minioncgpu, struct minion_info *minioninfo, TITEM *task, MINION_FFL_ARGS)
+{
+	minion_task_prep(task);
+
+	task->reply = do_ioctl(task->obuf, task->osiz, task->rbuf, task->rsiz);
+
+	return minion_task_reply(minioncgpu, task, MINION_FFL_PASS);
+}
+
+/*
+ * Send the tasks as one SPI_IOC_MESSAGE, changing CS between them
+ * so each is a separate command, the same as sending them one at a time
+ */
+static void minion_txrx_batch(struct cgpu_info *minioncgpu, struct minion_info *minioninfo, TITEM **tasks, int count)
+{
+	struct spi_ioc_transfer tran[MINION_BATCH_TASKS];
+	struct timeval sta, fin;
+	uint32_t bytes = 0;
+	TITEM *task;
+	double us;
+	int i, ret;
+
+#if MINION_SHOW_IO
+	// Show each task's I/O separately
+	for (i = 0; i < count; i++)
+		minion_txrx(tasks[i]);
+	return;
+#endif
+
+	memset(tran, 0, sizeof(tran));
+	for (i = 0; i < count; i++) {
+		task = tasks[i];
+		minion_task_prep(task);
+		memset(&(task->obuf[0]) + task->osiz - task->rsiz, 0xff, task->rsiz);
+		memset(task->rbuf, 0x00, task->osiz);
+
+		tran[i].tx_buf = (uintptr_t)(task->obuf);
+		tran[i].rx_buf = (uintptr_t)(task->rbuf);
+		tran[i].len = task->osiz;
+		tran[i].delay_usecs = 0;
+		tran[i].speed_hz = MINION_SPI_SPEED;
+		tran[i].cs_change = (i < count - 1) ? 1 : 0;
+		bytes += task->osiz;
+	}
+
+	mutex_lock(&(minioninfo->spi_lock));
+	cgtime(&sta);
+	ret = ioctl(minioninfo->spifd, SPI_IOC_MESSAGE(count), (void *)tran);
+	cgtime(&fin);
+	mutex_unlock(&(minioninfo->spi_lock));
+
+	IO_STAT_STORE(&sta, &fin, &sta, &fin, &fin, tasks[0]->obuf, bytes, ret, count);
+
+	us = us_tdiff(&fin, &sta);
+	minioninfo->batches++;
+	minioninfo->batch_tasks += count;
+	minioninfo->batch_bytes += bytes;
+	if (minioninfo->batch_max < count)
+		minioninfo->batch_max = count;
+	minioninfo->batch_us += us;
+	if (minioninfo->batch_us_max < us)
+		minioninfo->batch_us_max = us;
+
+	for (i = 0; i < count; i++) {
+		task = tasks[i];
+		if (ret >= (int)bytes)
+			task->reply = task->osiz;
+		else
+			task->reply = ret < 0 ? ret : 0;
+		minion_task_reply(minioncgpu, task, MINION_FFL_HERE);
+	}
+}
+
 // Only for DATA_SIZ commands
 static int build_cmd(struct cgpu_info *minioncgpu, struct minion_info *minioninfo, int chip, uint8_t reg, uint8_t *rbuf, uint32_t rsiz, uint8_t *data)
 {
@@ -1887,6 +2002,7 @@ static void minion_detect(bool hotplug)
 
 	minioninfo->tfree_list = k_new_list("Task", sizeof(TITEM), ALLOC_TITEMS, LIMIT_TITEMS, true);
 	minioninfo->task_list = k_new_store(minioninfo->tfree_list);
+	minioninfo->utask_list = k_new_store(minioninfo->tfree_list);
 	minioninfo->treply_list = k_new_store(minioninfo->tfree_list);
 
 	minioninfo->rfree_list = k_new_list("Reply", sizeof(RITEM), ALLOC_RITEMS, LIMIT_RITEMS, true);
@@ -1900,6 +2016,9 @@ static void minion_detect(bool hotplug)
 	cgsem_init(&(minioninfo->task_ready));
 	cgsem_init(&(minioninfo->nonce_ready));
 	cgsem_init(&(minioninfo->scan_work));
+	cgsem_init(&(minioninfo->reply_wake));
+
+	minioninfo->reply_ms = MINION_REPLY_mS;
 
 	minioninfo->initialised = true;
 
@@ -1920,17 +2039,185 @@ static void minion_identify(__maybe_unused struct cgpu_info *minioncgpu)
 	// flash a led
 }
 
+// Returns if the task should be sent, and sets if its reply should be kept
+static bool minion_task_check(struct cgpu_info *minioncgpu, TITEM *titem, bool *store_reply)
+{
+	bool do_txrx = true;
+
+	*store_reply = true;
+
+	switch (titem->address) {
+		// TODO: case MINION_SYS_TEMP_CTL:
+		// TODO: case MINION_SYS_FREQ_CTL:
+		case READ_ADDR(MINION_SYS_CHIP_STA):
+		case WRITE_ADDR(MINION_SYS_RSTN_CTL):
+		case WRITE_ADDR(MINION_SYS_INT_CLR):
+		case READ_ADDR(MINION_SYS_IDLE_CNT):
+		case READ_ADDR(MINION_CORE_ENA0_31):
+		case READ_ADDR(MINION_CORE_ENA32_63):
+		case READ_ADDR(MINION_CORE_ENA64_95):
+		case READ_ADDR(MINION_CORE_ENA96_98):
+		case READ_ADDR(MINION_CORE_ACT0_31):
+		case READ_ADDR(MINION_CORE_ACT32_63):
+		case READ_ADDR(MINION_CORE_ACT64_95):
+		case READ_ADDR(MINION_CORE_ACT96_98):
+			*store_reply = false;
+			break;
+		case WRITE_ADDR(MINION_QUE_0):
+//applog(LOG_ERR, "%s%i: ZZZ send task_id 0x%04x - chip %d", minioncgpu->drv->name, minioncgpu->device_id, titem->task_id, titem->chip);
+			*store_reply = false;
+			break;
+		default:
+			do_txrx = false;
+			titem->reply = MINION_UNEXPECTED_TASK;
+			applog(LOG_ERR, "%s%i: Unexpected task address 0x%02x (%s)",
+					minioncgpu->drv->name, minioncgpu->device_id,
+					(unsigned int)(titem->address),
+					addr2txt(titem->address));
+
+			break;
+	}
+
+	return do_txrx;
+}
+
+// Process the result of a task after it has been sent
+static void minion_task_done(struct cgpu_info *minioncgpu, struct minion_info *minioninfo, TITEM *titem)
+{
+	int chip = titem->chip;
+	K_ITEM *task, *work;
+
+	switch (titem->address) {
+		case READ_ADDR(MINION_SYS_CHIP_STA):
+			if (titem->reply >= (int)(titem->osiz)) {
+				uint8_t *rep = &(titem->rbuf[titem->osiz - titem->rsiz]);
+				mutex_lock(&(minioninfo->sta_lock));
+				minioninfo->chip_status[chip].temp = STA_TEMP(rep);
+				minioninfo->chip_status[chip].cores = STA_CORES(rep);
+				minioninfo->chip_status[chip].freq = STA_FREQ(rep);
+				mutex_unlock(&(minioninfo->sta_lock));
+
+				if (minioninfo->chip_status[chip].overheat) {
+					switch (STA_TEMP(rep)) {
+						case MINION_TEMP_40:
+						case MINION_TEMP_60:
+						case MINION_TEMP_80:
+							cgtime(&(minioninfo->chip_status[chip].lastrecover));
+							minioninfo->chip_status[chip].overheat = false;
+							applog(LOG_WARNING, "%s%d: chip %d cooled, restarting",
+									    minioncgpu->drv->name,
+									    minioncgpu->device_id,
+									    chip);
+							cgtime(&(minioninfo->chip_status[chip].lastrecover));
+							minioninfo->chip_status[chip].overheattime +=
+								tdiff(&(minioninfo->chip_status[chip].lastrecover),
+									&(minioninfo->chip_status[chip].lastoverheat));
+							break;
+						default:
+							break;
+					}
+				} else {
+					if (opt_minion_overheat && STA_TEMP(rep) == MINION_TEMP_OVER) {
+						cgtime(&(minioninfo->chip_status[chip].lastoverheat));
+						minioninfo->chip_status[chip].overheat = true;
+						applog(LOG_WARNING, "%s%d: chip %d overheated! idling",
+								    minioncgpu->drv->name,
+								    minioncgpu->device_id,
+								    chip);
+						K_WLOCK(minioninfo->tfree_list);
+						task = k_unlink_head(minioninfo->tfree_list);
+						DATAT(task)->tid = ++(minioninfo->next_tid);
+						DATAT(task)->chip = chip;
+						DATAT(task)->write = true;
+						DATAT(task)->address = MINION_SYS_RSTN_CTL;
+						DATAT(task)->task_id = 0; // ignored
+						DATAT(task)->wsiz = MINION_SYS_SIZ;
+						DATAT(task)->rsiz = 0;
+						DATAT(task)->wbuf[0] = SYS_RSTN_CTL_FLUSH;
+						DATAT(task)->wbuf[1] = 0;
+						DATAT(task)->wbuf[2] = 0;
+						DATAT(task)->wbuf[3] = 0;
+						DATAT(task)->urgent = true;
+						add_task(minioninfo, task);
+						K_WUNLOCK(minioninfo->tfree_list);
+						minioninfo->chip_status[chip].overheats++;
+					}
+				}
+			}
+			break;
+		case READ_ADDR(MINION_SYS_IDLE_CNT):
+			{
+				uint32_t *cnt = (uint32_t *)&(titem->rbuf[titem->osiz - titem->rsiz]);
+				minioninfo->chip_status[chip].idle = *cnt;
+			}
+			break;
+		case WRITE_ADDR(MINION_SYS_RSTN_CTL):
+			// Do this here after it has actually been flushed
+			if ((titem->wbuf[0] & SYS_RSTN_CTL_FLUSH) == SYS_RSTN_CTL_FLUSH) {
+				K_WLOCK(minioninfo->wwork_list);
+				work = minioninfo->wchip_list[chip]->head;
+				while (work) {
+					DATAW(work)->stale = true;
+					minioninfo->chip_status[chip].chipwork--;
+					if (minioninfo->chip_status[chip].realwork > 0)
+						minioninfo->chip_status[chip].realwork--;
+					work = work->next;
+				}
+				minioninfo->chip_status[chip].chipwork = 0;
+				minioninfo->chip_status[chip].realwork = 0;
+				K_WUNLOCK(minioninfo->wwork_list);
+			}
+			break;
+		case WRITE_ADDR(MINION_QUE_0):
+			K_WLOCK(minioninfo->wchip_list[chip]);
+			k_unlink_item(minioninfo->wque_list[chip], titem->witem);
+			k_add_head(minioninfo->wchip_list[chip], titem->witem);
+			minioninfo->chip_status[chip].quework--;
+			minioninfo->chip_status[chip].chipwork++;
+			minioninfo->chip_status[chip].realwork++;
+			K_WUNLOCK(minioninfo->wchip_list[chip]);
+			break;
+		case READ_ADDR(MINION_CORE_ENA0_31):
+		case READ_ADDR(MINION_CORE_ENA32_63):
+		case READ_ADDR(MINION_CORE_ENA64_95):
+		case READ_ADDR(MINION_CORE_ENA96_98):
+			{
+				uint32_t *rep = (uint32_t *)&(titem->rbuf[titem->osiz - titem->rsiz]);
+				int off = titem->address - READ_ADDR(MINION_CORE_ENA0_31);
+				minioninfo->chip_core_ena[off][chip] = *rep;
+			}
+			break;
+		case READ_ADDR(MINION_CORE_ACT0_31):
+		case READ_ADDR(MINION_CORE_ACT32_63):
+		case READ_ADDR(MINION_CORE_ACT64_95):
+		case READ_ADDR(MINION_CORE_ACT96_98):
+			{
+				uint32_t *rep = (uint32_t *)&(titem->rbuf[titem->osiz - titem->rsiz]);
+				int off = titem->address - READ_ADDR(MINION_CORE_ACT0_31);
+				minioninfo->chip_core_act[off][chip] = *rep;
+			}
+			break;
+		case WRITE_ADDR(MINION_SYS_INT_CLR):
+			break;
+		default:
+			break;
+	}
+}
+
 /*
  * SPI/ioctl write thread
  * Non urgent work is to keep the queue full
  * Urgent work is when an LP occurs (or the queue is empty/low)
+ * Each pass sends all the urgent tasks then the oldest other tasks, grouped
+ * by chip, as one SPI_IOC_MESSAGE batch
  */
 static void *minion_spi_write(void *userdata)
 {
 	struct cgpu_info *minioncgpu = (struct cgpu_info *)userdata;
 	struct minion_info *minioninfo = (struct minion_info *)(minioncgpu->device_data);
-	K_ITEM *item, *tail, *task, *work;
-	TITEM *titem;
+	K_ITEM *batch[MINION_BATCH_TASKS], *item;
+	TITEM *sends[MINION_BATCH_TASKS];
+	bool store_reply[MINION_BATCH_TASKS], sent[MINION_BATCH_TASKS];
 
 	applog(MINION_LOG, "%s%i: SPI writing...",
 				minioncgpu->drv->name, minioncgpu->device_id);
@@ -1943,207 +2230,119 @@ static void *minion_spi_write(void *userdata)
 		cgsleep_ms(1); // asap to start mining
 	}
 
-	// TODO: combine all urgent into a single I/O?
-	// Then combine all state 1 for the same chip into a single I/O ?
-	// (then again for state 2?)
 	while (minioncgpu->shutdown == false) {
-		item = NULL;
+		int count = 0, send = 0, i, j;
+		uint32_t bytes = 0, osiz;
+		K_STORE *tlist;
+
 		K_WLOCK(minioninfo->task_list);
-		tail = minioninfo->task_list->tail;
-		if (tail) {
-			// Find first urgent item
-			item = tail;
-			while (item && !(DATAT(item)->urgent))
-				item = item->prev;
-
-			// No urgent items, just do the tail
+		while (count < MINION_BATCH_TASKS) {
+			tlist = minioninfo->utask_list;
+			if (!tlist->tail)
+				tlist = minioninfo->task_list;
+			item = tlist->tail;
 			if (!item)
-				item = tail;
+				break;
 
-			k_unlink_item(minioninfo->task_list, item);
+			osiz = HSIZE() + DATAT(item)->wsiz + DATAT(item)->rsiz;
+			if (count && bytes + osiz > MINION_BATCH_BYTES)
+				break;
+
+			k_unlink_item(tlist, item);
+			batch[count++] = item;
+			bytes += osiz;
 		}
 		K_WUNLOCK(minioninfo->task_list);
 
-		if (item) {
-			bool do_txrx = true;
-			bool store_reply = true;
+		if (!count) {
+			cgsem_mswait(&(minioninfo->task_ready), MINION_TASK_mS);
+			continue;
+		}
 
-			titem = DATAT(item);
+		// Group the non urgent tasks by chip keeping each chip's order
+		for (i = 1; i < count; i++) {
+			item = batch[i];
+			if (DATAT(item)->urgent)
+				continue;
+			for (j = i; j > 0 && !(DATAT(batch[j-1])->urgent) &&
+				    DATAT(batch[j-1])->chip > DATAT(item)->chip; j--)
+				batch[j] = batch[j-1];
+			batch[j] = item;
+		}
 
-			switch (titem->address) {
-				// TODO: case MINION_SYS_TEMP_CTL:
-				// TODO: case MINION_SYS_FREQ_CTL:
-				case READ_ADDR(MINION_SYS_CHIP_STA):
-				case WRITE_ADDR(MINION_SYS_RSTN_CTL):
-				case WRITE_ADDR(MINION_SYS_INT_CLR):
-				case READ_ADDR(MINION_SYS_IDLE_CNT):
-				case READ_ADDR(MINION_CORE_ENA0_31):
-				case READ_ADDR(MINION_CORE_ENA32_63):
-				case READ_ADDR(MINION_CORE_ENA64_95):
-				case READ_ADDR(MINION_CORE_ENA96_98):
-				case READ_ADDR(MINION_CORE_ACT0_31):
-				case READ_ADDR(MINION_CORE_ACT32_63):
-				case READ_ADDR(MINION_CORE_ACT64_95):
-				case READ_ADDR(MINION_CORE_ACT96_98):
-					store_reply = false;
-					break;
-				case WRITE_ADDR(MINION_QUE_0):
-//applog(LOG_ERR, "%s%i: ZZZ send task_id 0x%04x - chip %d", minioncgpu->drv->name, minioncgpu->device_id, titem->task_id, titem->chip);
-					store_reply = false;
-					break;
-				default:
-					do_txrx = false;
-					titem->reply = MINION_UNEXPECTED_TASK;
-					applog(LOG_ERR, "%s%i: Unexpected task address 0x%02x (%s)",
-							minioncgpu->drv->name, minioncgpu->device_id,
-							(unsigned int)(titem->address),
-							addr2txt(titem->address));
+		for (i = 0; i < count; i++) {
+			sent[i] = minion_task_check(minioncgpu, DATAT(batch[i]), &(store_reply[i]));
+			if (sent[i])
+				sends[send++] = DATAT(batch[i]);
+		}
 
-					break;
-			}
+		if (send)
+			minion_txrx_batch(minioncgpu, minioninfo, sends, send);
 
-			if (do_txrx) {
-				minion_txrx(titem);
-
-				int chip = titem->chip;
-				switch (titem->address) {
-					case READ_ADDR(MINION_SYS_CHIP_STA):
-						if (titem->reply >= (int)(titem->osiz)) {
-							uint8_t *rep = &(titem->rbuf[titem->osiz - titem->rsiz]);
-							mutex_lock(&(minioninfo->sta_lock));
-							minioninfo->chip_status[chip].temp = STA_TEMP(rep);
-							minioninfo->chip_status[chip].cores = STA_CORES(rep);
-							minioninfo->chip_status[chip].freq = STA_FREQ(rep);
-							mutex_unlock(&(minioninfo->sta_lock));
-
-							if (minioninfo->chip_status[chip].overheat) {
-								switch (STA_TEMP(rep)) {
-									case MINION_TEMP_40:
-									case MINION_TEMP_60:
-									case MINION_TEMP_80:
-										cgtime(&(minioninfo->chip_status[chip].lastrecover));
-										minioninfo->chip_status[chip].overheat = false;
-										applog(LOG_WARNING, "%s%d: chip %d cooled, restarting",
-												    minioncgpu->drv->name,
-												    minioncgpu->device_id,
-												    chip);
-										cgtime(&(minioninfo->chip_status[chip].lastrecover));
-										minioninfo->chip_status[chip].overheattime +=
-											tdiff(&(minioninfo->chip_status[chip].lastrecover),
-												&(minioninfo->chip_status[chip].lastoverheat));
-										break;
-									default:
-										break;
-								}
-							} else {
-								if (opt_minion_overheat && STA_TEMP(rep) == MINION_TEMP_OVER) {
-									cgtime(&(minioninfo->chip_status[chip].lastoverheat));
-									minioninfo->chip_status[chip].overheat = true;
-									applog(LOG_WARNING, "%s%d: chip %d overheated! idling",
-											    minioncgpu->drv->name,
-											    minioncgpu->device_id,
-											    chip);
-									K_WLOCK(minioninfo->tfree_list);
-									task = k_unlink_head(minioninfo->tfree_list);
-									DATAT(task)->tid = ++(minioninfo->next_tid);
-									DATAT(task)->chip = chip;
-									DATAT(task)->write = true;
-									DATAT(task)->address = MINION_SYS_RSTN_CTL;
-									DATAT(task)->task_id = 0; // ignored
-									DATAT(task)->wsiz = MINION_SYS_SIZ;
-									DATAT(task)->rsiz = 0;
-									DATAT(task)->wbuf[0] = SYS_RSTN_CTL_FLUSH;
-									DATAT(task)->wbuf[1] = 0;
-									DATAT(task)->wbuf[2] = 0;
-									DATAT(task)->wbuf[3] = 0;
-									DATAT(task)->urgent = true;
-									k_add_head(minioninfo->task_list, task);
-									K_WUNLOCK(minioninfo->tfree_list);
-									minioninfo->chip_status[chip].overheats++;
-								}
-							}
-						}
-						break;
-					case READ_ADDR(MINION_SYS_IDLE_CNT):
-						{
-							uint32_t *cnt = (uint32_t *)&(titem->rbuf[titem->osiz - titem->rsiz]);
-							minioninfo->chip_status[chip].idle = *cnt;
-						}
-						break;
-					case WRITE_ADDR(MINION_SYS_RSTN_CTL):
-						// Do this here after it has actually been flushed
-						if ((titem->wbuf[0] & SYS_RSTN_CTL_FLUSH) == SYS_RSTN_CTL_FLUSH) {
-							K_WLOCK(minioninfo->wwork_list);
-							work = minioninfo->wchip_list[chip]->head;
-							while (work) {
-								DATAW(work)->stale = true;
-								minioninfo->chip_status[chip].chipwork--;
-								if (minioninfo->chip_status[chip].realwork > 0)
-									minioninfo->chip_status[chip].realwork--;
-								work = work->next;
-							}
-							minioninfo->chip_status[chip].chipwork = 0;
-							minioninfo->chip_status[chip].realwork = 0;
-							K_WUNLOCK(minioninfo->wwork_list);
-						}
-						break;
-					case WRITE_ADDR(MINION_QUE_0):
-						K_WLOCK(minioninfo->wchip_list[chip]);
-						k_unlink_item(minioninfo->wque_list[chip], titem->witem);
-						k_add_head(minioninfo->wchip_list[chip], titem->witem);
-						minioninfo->chip_status[chip].quework--;
-						minioninfo->chip_status[chip].chipwork++;
-						minioninfo->chip_status[chip].realwork++;
-						K_WUNLOCK(minioninfo->wchip_list[chip]);
-						break;
-					case READ_ADDR(MINION_CORE_ENA0_31):
-					case READ_ADDR(MINION_CORE_ENA32_63):
-					case READ_ADDR(MINION_CORE_ENA64_95):
-					case READ_ADDR(MINION_CORE_ENA96_98):
-						{
-							uint32_t *rep = (uint32_t *)&(titem->rbuf[titem->osiz - titem->rsiz]);
-							int off = titem->address - READ_ADDR(MINION_CORE_ENA0_31);
-							minioninfo->chip_core_ena[off][chip] = *rep;
-						}
-						break;
-					case READ_ADDR(MINION_CORE_ACT0_31):
-					case READ_ADDR(MINION_CORE_ACT32_63):
-					case READ_ADDR(MINION_CORE_ACT64_95):
-					case READ_ADDR(MINION_CORE_ACT96_98):
-						{
-							uint32_t *rep = (uint32_t *)&(titem->rbuf[titem->osiz - titem->rsiz]);
-							int off = titem->address - READ_ADDR(MINION_CORE_ACT0_31);
-							minioninfo->chip_core_act[off][chip] = *rep;
-						}
-						break;
-					case WRITE_ADDR(MINION_SYS_INT_CLR):
-						break;
-					default:
-						break;
-				}
-			}
+		for (i = 0; i < count; i++) {
+			item = batch[i];
+			if (sent[i])
+				minion_task_done(minioncgpu, minioninfo, DATAT(item));
 
 			K_WLOCK(minioninfo->treply_list);
-			if (store_reply)
+			if (store_reply[i])
 				k_add_head(minioninfo->treply_list, item);
 			else
 				k_free_head(minioninfo->tfree_list, item);
 			K_WUNLOCK(minioninfo->treply_list);
-
-			/*
-			 * Always check for the next task immediately if we just did one
-			 * i.e. empty the task queue
-			 */
-			continue;
 		}
-		cgsem_mswait(&(minioninfo->task_ready), MINION_TASK_mS);
+
+		/*
+		 * Always check for the next tasks immediately if we just did some
+		 * i.e. empty the task queue
+		 */
 	}
 	return NULL;
 }
 
+/*
+ * Recalculate reply_ms from the good nonces found by each chip since
+ * the last calculation, if it was at least MINION_REPLY_RATE_mS ago
+ */
+static void minion_reply_rate(struct minion_info *minioninfo, uint64_t *last_good, struct timeval *last_rate)
+{
+	struct timeval now;
+	double elapsed, rate, best;
+	int chip, ms;
+
+	cgtime(&now);
+	elapsed = ms_tdiff(&now, last_rate);
+	if (elapsed < MINION_REPLY_RATE_mS)
+		return;
+
+	best = 0;
+	for (chip = 0; chip < MINION_CHIPS; chip++) {
+		if (minioninfo->chip[chip]) {
+			rate = (double)(minioninfo->chip_good[chip] - last_good[chip]) * 1000.0 / elapsed;
+			if (best < rate)
+				best = rate;
+		}
+		last_good[chip] = minioninfo->chip_good[chip];
+	}
+	memcpy(last_rate, &now, sizeof(now));
+
+	if (best > 0) {
+		ms = (int)(1000.0 * MINION_RESULT_INT_SIZE / best);
+		if (ms < MINION_REPLY_MIN_mS)
+			ms = MINION_REPLY_MIN_mS;
+		if (ms > MINION_REPLY_mS)
+			ms = MINION_REPLY_mS;
+	} else
+		ms = MINION_REPLY_mS;
+
+	minioninfo->reply_rate = best;
+	minioninfo->reply_ms = ms;
+}
+
 /*
  * SPI/ioctl reply thread
- * ioctl done every interrupt or MINION_REPLY_mS checking for results
+ * ioctl done every interrupt or reply_ms checking for results
+ * Without the interrupt, a flush will also wake it early to refill the emptied chips
  */
 static void *minion_spi_reply(void *userdata)
 {
@@ -2155,7 +2354,8 @@ static void *minion_spi_reply(void *userdata)
 	int chip, resoff;
 	int chipwork, gap;
 	bool somelow;
-	struct timeval now;
+	struct timeval now, last_rate;
+	uint64_t last_good[MINION_CHIPS];
 
 #if ENABLE_INT_NONO
 	TITEM clr_task;
@@ -2222,8 +2422,12 @@ static void *minion_spi_reply(void *userdata)
 	rsiz = MINION_SYS_SIZ; // for READ, use 0 for WRITE
 #endif
 
+	memset(last_good, 0, sizeof(last_good));
+	cgtime(&last_rate);
+
 	somelow = false;
 	while (minioncgpu->shutdown == false) {
+		minioninfo->reply_checks++;
 		for (chip = 0; chip < MINION_CHIPS; chip++) {
 			if (minioninfo->chip[chip]) {
 				int tries = 0;
@@ -2454,8 +2658,13 @@ repeek:
 			minion_txrx(&clr_task);
 #endif
 
+		minion_reply_rate(minioninfo, last_good, &last_rate);
+
 #if !ENABLE_INT_NONO
-		cgsleep_ms(MINION_REPLY_mS);
+		if (cgsem_mswait(&(minioninfo->reply_wake), minioninfo->reply_ms))
+			minioninfo->reply_timeouts++;
+		else
+			minioninfo->reply_wakes++;
 #else
 		// TODO: this is going to require a bit of tuning with 2TH/s mining:
 		// The interrupt size MINION_RESULT_INT_SIZE should be high enough to expect
@@ -2463,10 +2672,12 @@ repeek:
 		// If all chips don't have some results when an interrupt occurs, then it is a waste
 		// since we have to check all chips for results anyway since we don't know which one
 		// caused the interrupt
-		// MINION_REPLY_mS needs to be low enough in the case of bad luck where no chip
+		// reply_ms needs to be low enough in the case of bad luck where no chip
 		// finds MINION_RESULT_INT_SIZE results in a short amount of time, so we go check
 		// them all anyway - to avoid high latency when there are only a few results due to low luck
-		ret = poll(&pfd, 1, MINION_REPLY_mS);
+		ret = poll(&pfd, 1, minioninfo->reply_ms);
+		if (ret == 0)
+			minioninfo->reply_timeouts++;
 		if (ret > 0) {
 			bool gotres;
 			int c;
@@ -2813,6 +3024,7 @@ static void minion_flush_work(struct cgpu_info *minioncgpu)
 {
 	struct minion_info *minioninfo = (struct minion_info *)(minioncgpu->device_data);
 	K_ITEM *stale_unused_work, *prev_unused, *task, *prev_task, *witem;
+	K_STORE *tlist;
 	int i;
 
 	applog(MINION_LOG, "%s%i: flushing work",
@@ -2840,18 +3052,21 @@ static void minion_flush_work(struct cgpu_info *minioncgpu)
 
 	// No deadlock since this is the only code to get 2 locks
 	K_WLOCK(minioninfo->tfree_list);
-	task = minioninfo->task_list->tail;
-	while (task) {
-		prev_task = task->prev;
-		if (DATAT(task)->address == WRITE_ADDR(MINION_QUE_0)) {
-			minioninfo->chip_status[DATAT(task)->chip].quework--;
-			witem = DATAT(task)->witem;
-			k_unlink_item(minioninfo->wque_list[DATAT(task)->chip], witem);
-			k_free_head(minioninfo->wfree_list, witem);
-			k_unlink_item(minioninfo->task_list, task);
-			k_free_head(minioninfo->tfree_list, task);
+	for (i = 0; i < 2; i++) {
+		tlist = i ? minioninfo->utask_list : minioninfo->task_list;
+		task = tlist->tail;
+		while (task) {
+			prev_task = task->prev;
+			if (DATAT(task)->address == WRITE_ADDR(MINION_QUE_0)) {
+				minioninfo->chip_status[DATAT(task)->chip].quework--;
+				witem = DATAT(task)->witem;
+				k_unlink_item(minioninfo->wque_list[DATAT(task)->chip], witem);
+				k_free_head(minioninfo->wfree_list, witem);
+				k_unlink_item(tlist, task);
+				k_free_head(minioninfo->tfree_list, task);
+			}
+			task = prev_task;
 		}
-		task = prev_task;
 	}
 	for (i = 0; i < MINION_CHIPS; i++) {
 		if (minioninfo->chip[i]) {
@@ -2869,14 +3084,18 @@ static void minion_flush_work(struct cgpu_info *minioncgpu)
 			DATAT(task)->wbuf[2] = 0;
 			DATAT(task)->wbuf[3] = 0;
 			DATAT(task)->urgent = true;
-			k_add_head(minioninfo->task_list, task);
+			add_task(minioninfo, task);
 		}
 	}
 	K_WUNLOCK(minioninfo->tfree_list);
 
 	K_WUNLOCK(minioninfo->wwork_list);
 
-	// TODO: send a signal to force getting and sending new work - needs cgsem_wait in the sending thread
+	// Send the urgent flush tasks now and check for results once they are done
+	cgsem_post(&(minioninfo->task_ready));
+#if !ENABLE_INT_NONO
+	cgsem_post(&(minioninfo->reply_wake));
+#endif
 
 	// TODO: should we use this thread to do the following work?
 	if (stale_unused_work) {
@@ -2932,7 +3151,7 @@ static void sys_chip_sta(struct cgpu_info *minioncgpu, int chip)
 			DATAT(item)->urgent = false;
 
 			K_WLOCK(minioninfo->task_list);
-			k_add_head(minioninfo->task_list, item);
+			add_task(minioninfo, item);
 			item = k_unlink_head(minioninfo->tfree_list);
 			DATAT(item)->tid = ++(minioninfo->next_tid);
 			K_WUNLOCK(minioninfo->task_list);
@@ -2946,7 +3165,7 @@ static void sys_chip_sta(struct cgpu_info *minioncgpu, int chip)
 			DATAT(item)->urgent = false;
 
 			K_WLOCK(minioninfo->task_list);
-			k_add_head(minioninfo->task_list, item);
+			add_task(minioninfo, item);
 			K_WUNLOCK(minioninfo->task_list);
 
 			// Get the core ena and act state
@@ -2966,7 +3185,7 @@ static void sys_chip_sta(struct cgpu_info *minioncgpu, int chip)
 				DATAT(item)->urgent = false;
 
 				K_WLOCK(minioninfo->task_list);
-				k_add_head(minioninfo->task_list, item);
+				add_task(minioninfo, item);
 				// Act
 				item = k_unlink_head(minioninfo->tfree_list);
 				DATAT(item)->tid = ++(minioninfo->next_tid);
@@ -2981,7 +3200,7 @@ static void sys_chip_sta(struct cgpu_info *minioncgpu, int chip)
 				DATAT(item)->urgent = false;
 
 				K_WLOCK(minioninfo->task_list);
-				k_add_head(minioninfo->task_list, item);
+				add_task(minioninfo, item);
 				K_WUNLOCK(minioninfo->task_list);
 			}
 		}
@@ -3033,7 +3252,7 @@ static void new_work_task(struct cgpu_info *minioncgpu, K_ITEM *witem, int chip,
 	K_WUNLOCK(minioninfo->wque_list[chip]);
 
 	K_WLOCK(minioninfo->task_list);
-	k_add_head(minioninfo->task_list, item);
+	add_task(minioninfo, item);
 	K_WUNLOCK(minioninfo->task_list);
 
 	if (urgent)
@@ -3194,7 +3413,7 @@ static void minion_do_work(struct cgpu_info *minioncgpu)
 		DATAT(task)->wbuf[2] = 0;
 		DATAT(task)->wbuf[3] = 0;
 		DATAT(task)->urgent = false;
-		k_add_head(minioninfo->task_list, task);
+		add_task(minioninfo, task);
 		K_WUNLOCK(minioninfo->tfree_list);
 	}
 #endif
@@ -3511,6 +3730,7 @@ static struct api_data *minion_api_stats(struct cgpu_info *minioncgpu)
 	char buf[32];
 	int i, to, j;
 	int chip, max_chip, que_work, chip_work, temp;
+	float avg;
 
 	if (minioninfo->initialised == false)
 		return NULL;
@@ -3723,6 +3943,7 @@ static struct api_data *minion_api_stats(struct cgpu_info *minioncgpu)
 	root = api_add_int(root, "TFree Total", &(minioninfo->tfree_list->total), true);
 	root = api_add_int(root, "TFree Count", &(minioninfo->tfree_list->count), true);
 	root = api_add_int(root, "Task Count", &(minioninfo->task_list->count), true);
+	root = api_add_int(root, "Urgent Task Count", &(minioninfo->utask_list->count), true);
 	root = api_add_int(root, "Reply Count", &(minioninfo->treply_list->count), true);
 
 	root = api_add_int(root, "RFree Total", &(minioninfo->rfree_list->total), true);
@@ -3776,12 +3997,27 @@ static struct api_data *minion_api_stats(struct cgpu_info *minioncgpu)
 #endif
 
 	root = api_add_uint64(root, "Total SPI Errors", &(minioninfo->spi_errors), true);
+	root = api_add_uint64(root, "SPI Batches", &(minioninfo->batches), true);
+	root = api_add_uint64(root, "SPI Batch Tasks", &(minioninfo->batch_tasks), true);
+	root = api_add_int(root, "SPI Batch Max", &(minioninfo->batch_max), true);
+	avg = minioninfo->batches ? (float)(minioninfo->batch_tasks) / (float)(minioninfo->batches) : 0;
+	root = api_add_avg(root, "SPI Batch Avg", &avg, true);
+	avg = minioninfo->batches ? (float)(minioninfo->batch_bytes) / (float)(minioninfo->batches) : 0;
+	root = api_add_avg(root, "SPI Batch Bytes Avg", &avg, true);
+	avg = minioninfo->batches ? minioninfo->batch_us / (float)(minioninfo->batches) : 0;
+	root = api_add_avg(root, "SPI Batch uS Avg", &avg, true);
+	root = api_add_double(root, "SPI Batch uS Max", &(minioninfo->batch_us_max), true);
 	root = api_add_uint64(root, "Work Unrolled", &(minioninfo->work_unrolled), true);
 	root = api_add_uint64(root, "Work Rolled", &(minioninfo->work_rolled), true);
 	root = api_add_uint64(root, "Ints", &(minioninfo->interrupts), true);
 	root = api_add_uint64(root, "Res Ints", &(minioninfo->result_interrupts), true);
 	root = api_add_uint64(root, "Cmd Ints", &(minioninfo->command_interrupts), true);
 	root = api_add_string(root, "Last Int", minioninfo->last_interrupt, true);
+	root = api_add_int(root, "Reply mS", &(minioninfo->reply_ms), true);
+	root = api_add_double(root, "Reply Nonce Rate", &(minioninfo->reply_rate), true);
+	root = api_add_uint64(root, "Reply Checks", &(minioninfo->reply_checks), true);
+	root = api_add_uint64(root, "Reply Wakes", &(minioninfo->reply_wakes), true);
+	root = api_add_uint64(root, "Reply Timeouts", &(minioninfo->reply_timeouts), true);
 	root = api_add_hex32(root, "Next TaskID", &(minioninfo->next_task_id), true);
 
 	root = api_add_elapsed(root, "Elapsed", &(total_secs), true);
@@ -0,0 +1,675 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+/*
+ This driver emulates chains of queued ASIC chips without any hardware so the
+ work pipeline (fill_queue, submit_nonce, stratum submission and restarts) can
+ be load tested at production like rates.
+
+ Each chain is a separate device with its own work queue of queue depth work
+ items. Each chip takes one work item from the queue, "hashes" the full nonce
+ range at the configured chip hashrate and then completes it.
+ While a chip holds a work item it returns nonces at the configured nonce rate.
+ The nonces are real solutions to the work, found by brute forcing it to the
+ low sim difficulty, but are accounted for as normal diff 1 nonces. A result
+ is only handed back to cgminer after the configured result latency, and a
+ configurable percentage of results are corrupted to produce HW errors.
+
+ A flush (work restart) discards all queued and in progress work on the chain
+ but, like real hardware, results already found are still returned.
+
+ With a TemplateRange the chain doesn't queue work at all but, like devices
+ that roll nonce2 themselves, leases the current pool's work template with
+ that many nonce2 values and each chip generates its own work from it. The
+ results are rebuilt from the template and nonce2 when they are returned.
+*/
+
+#include "config.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "compat.h"
+#include "miner.h"
+
+#define SIM_MAX_CHAINS 64
+#define SIM_MAX_CHIPS 256
+#define SIM_MAX_QUEUE 1024
+
+#define SIM_DEF_CHAINS 1
+#define SIM_DEF_CHIPS 16
+#define SIM_DEF_GHS 1.0
+#define SIM_DEF_QUEUE 32
+// 0 means derive the nonce rate from the chip hashrate as diff 1 nonces
+#define SIM_DEF_NONCE_RATE 0.0
+#define SIM_DEF_HWERR 0.0
+#define SIM_DEF_LATENCY_mS 0
+// Roughly 4k sha256d per nonce found
+#define SIM_DEF_DIFF 0.000001
+
+// How often to update the chips
+#define SIM_SCAN_mS 10
+
+// Nonces owed to a chip beyond this are dropped and counted as overrun
+#define SIM_MAX_DUE 64.0
+
+#define SIM_NONCE_RANGE 4294967296.0
+
+struct sim_result {
+	struct work *work;
+	struct work_template *tmpl;
+	uint64_t nonce2;
+	uint32_t nonce;
+	bool hwerror;
+	struct timeval tv_due;
+	struct sim_result *next;
+};
+
+struct sim_chip {
+	struct work *work;
+	struct work_template *tmpl;
+	uint64_t nonce2;
+	uint32_t nonce;
+	double hashes;
+	double nonces_due;
+};
+
+struct sim_info {
+	struct cgpu_info *cgpu;
+	int chain;
+
+	int chips;
+	double chip_hashrate;
+	int queue_depth;
+	double nonce_rate;
+	double hwerr;
+	int latency_ms;
+	double diff;
+	int template_range;
+
+	pthread_mutex_t lock;
+	bool flush;
+
+	struct work **queue;
+	int queue_head;
+	int queue_count;
+
+	struct sim_chip *chip;
+
+	struct work_template *tmpl;
+	uint64_t tmpl_nonce2;
+	uint64_t tmpl_nonce2_end;
+
+	struct sim_result *results;
+	struct sim_result *results_tail;
+	int results_pending;
+
+	struct timeval tv_last;
+	unsigned int seed;
+
+	uint64_t works_queued;
+	uint64_t works_done;
+	uint64_t works_flushed;
+	uint64_t flushes;
+	uint64_t nonces;
+	uint64_t nonces_overrun;
+	uint64_t hw_injected;
+	uint64_t bf_hashes;
+	uint64_t max_latency_ms;
+	uint64_t template_leases;
+};
+
+static struct sim_info sim_defaults;
+static int sim_chains;
+
+static char *sim_options[] = {
+	"Chains",
+	"Chips",
+	"ChipGHs",
+	"QueueDepth",
+	"NonceRate",
+	"HWErrorPercent",
+	"LatencymS",
+	"Difficulty",
+	"TemplateRange"
+};
+
+#define INVOP " Invalid Option "
+
+static void sim_get_options(void)
+{
+	char *ptr, *colon;
+	int which, val;
+	double fval;
+
+	sim_chains = SIM_DEF_CHAINS;
+	sim_defaults.chips = SIM_DEF_CHIPS;
+	sim_defaults.chip_hashrate = SIM_DEF_GHS * 1000000000.0;
+	sim_defaults.queue_depth = SIM_DEF_QUEUE;
+	sim_defaults.nonce_rate = SIM_DEF_NONCE_RATE;
+	sim_defaults.hwerr = SIM_DEF_HWERR;
+	sim_defaults.latency_ms = SIM_DEF_LATENCY_mS;
+	sim_defaults.diff = SIM_DEF_DIFF;
+
+	which = 0;
+	ptr = opt_sim_options;
+	while (ptr && *ptr) {
+		colon = strchr(ptr, ':');
+		if (colon)
+			*(colon++) = '\0';
+
+		if (*ptr && tolower(*ptr) != 'd') {
+			switch (which) {
+				case 0:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 1 || val > SIM_MAX_CHAINS) {
+						quit(1, "SIM"INVOP"%s '%s' must be 1 <= %s <= %d",
+							sim_options[which], ptr,
+							sim_options[which], SIM_MAX_CHAINS);
+					}
+					sim_chains = val;
+					break;
+				case 1:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 1 || val > SIM_MAX_CHIPS) {
+						quit(1, "SIM"INVOP"%s '%s' must be 1 <= %s <= %d",
+							sim_options[which], ptr,
+							sim_options[which], SIM_MAX_CHIPS);
+					}
+					sim_defaults.chips = val;
+					break;
+				case 2:
+					fval = atof(ptr);
+					if (fval <= 0.0) {
+						quit(1, "SIM"INVOP"%s '%s' must be > 0",
+							sim_options[which], ptr);
+					}
+					sim_defaults.chip_hashrate = fval * 1000000000.0;
+					break;
+				case 3:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 1 || val > SIM_MAX_QUEUE) {
+						quit(1, "SIM"INVOP"%s '%s' must be 1 <= %s <= %d",
+							sim_options[which], ptr,
+							sim_options[which], SIM_MAX_QUEUE);
+					}
+					sim_defaults.queue_depth = val;
+					break;
+				case 4:
+					fval = atof(ptr);
+					if (fval < 0.0) {
+						quit(1, "SIM"INVOP"%s '%s' must be >= 0",
+							sim_options[which], ptr);
+					}
+					sim_defaults.nonce_rate = fval;
+					break;
+				case 5:
+					fval = atof(ptr);
+					if (fval < 0.0 || fval > 100.0) {
+						quit(1, "SIM"INVOP"%s '%s' must be 0 <= %s <= 100",
+							sim_options[which], ptr,
+							sim_options[which]);
+					}
+					sim_defaults.hwerr = fval / 100.0;
+					break;
+				case 6:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 0 || val > 60000) {
+						quit(1, "SIM"INVOP"%s '%s' must be 0 <= %s <= 60000",
+							sim_options[which], ptr,
+							sim_options[which]);
+					}
+					sim_defaults.latency_ms = val;
+					break;
+				case 7:
+					fval = atof(ptr);
+					if (fval <= 0.0 || fval > 1.0) {
+						quit(1, "SIM"INVOP"%s '%s' must be 0 < %s <= 1",
+							sim_options[which], ptr,
+							sim_options[which]);
+					}
+					sim_defaults.diff = fval;
+					break;
+				case 8:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 0) {
+						quit(1, "SIM"INVOP"%s '%s' must be >= 0",
+							sim_options[which], ptr);
+					}
+					sim_defaults.template_range = val;
+					break;
+				default:
+					break;
+			}
+		}
+		ptr = colon;
+		which++;
+	}
+
+	if (sim_defaults.nonce_rate == 0.0)
+		sim_defaults.nonce_rate = sim_defaults.chip_hashrate / SIM_NONCE_RANGE;
+}
+
+static void sim_detect(bool hotplug)
+{
+	struct cgpu_info *cgpu;
+	struct sim_info *info;
+	int i;
+
+	/* The simulated devices are only created once and only if asked for */
+	if (hotplug || !opt_sim_options)
+		return;
+
+	if (opt_scrypt) {
+		applog(LOG_WARNING, "SIM devices only support sha256, ignoring --sim-options");
+		return;
+	}
+
+	sim_get_options();
+
+	for (i = 0; i < sim_chains; i++) {
+		cgpu = calloc(1, sizeof(*cgpu));
+		if (unlikely(!cgpu))
+			quit(1, "Failed to calloc sim cgpu");
+		cgpu->drv = &sim_drv;
+		cgpu->deven = DEV_ENABLED;
+		cgpu->threads = 1;
+
+		info = calloc(1, sizeof(*info));
+		if (unlikely(!info))
+			quit(1, "Failed to calloc sim info");
+		memcpy(info, &sim_defaults, sizeof(*info));
+		info->cgpu = cgpu;
+		info->chain = i;
+		mutex_init(&info->lock);
+		info->queue = calloc(info->queue_depth, sizeof(*info->queue));
+		info->chip = calloc(info->chips, sizeof(*info->chip));
+		if (unlikely(!info->queue || !info->chip))
+			quit(1, "Failed to calloc sim chain %d", i);
+		info->seed = (unsigned int)time(NULL) + i;
+		cgpu->device_data = info;
+
+		if (!add_cgpu(cgpu))
+			quit(1, "Failed to add sim chain %d", i);
+
+		applog(LOG_WARNING, "%s%d: Simulating %d chips at %.3fGH/s each"
+		       " queue %d nonces %.3f/s/chip hw %.2f%% latency %dms diff %g",
+		       cgpu->drv->name, cgpu->device_id, info->chips,
+		       info->chip_hashrate / 1000000000.0, info->queue_depth,
+		       info->nonce_rate, info->hwerr * 100.0,
+		       info->latency_ms, info->diff);
+		if (info->template_range) {
+			applog(LOG_WARNING, "%s%d: Generating work from templates %d nonce2 per lease",
+			       cgpu->drv->name, cgpu->device_id, info->template_range);
+		}
+	}
+}
+
+static bool sim_prepare(struct thr_info *thr)
+{
+	struct sim_info *info = thr->cgpu->device_data;
+
+	cgtime(&info->tv_last);
+	return true;
+}
+
+static bool sim_queue_full(struct cgpu_info *cgpu)
+{
+	struct sim_info *info = cgpu->device_data;
+	struct work *work;
+	int tail;
+
+	if (info->template_range || info->queue_count >= info->queue_depth)
+		return true;
+
+	work = get_queued(cgpu);
+	if (work) {
+		tail = (info->queue_head + info->queue_count) % info->queue_depth;
+		info->queue[tail] = work;
+		info->queue_count++;
+		info->works_queued++;
+	}
+
+	return (info->queue_count >= info->queue_depth);
+}
+
+static struct work *sim_dequeue(struct sim_info *info)
+{
+	struct work *work;
+
+	if (!info->queue_count)
+		return NULL;
+
+	work = info->queue[info->queue_head];
+	info->queue[info->queue_head] = NULL;
+	info->queue_head = (info->queue_head + 1) % info->queue_depth;
+	info->queue_count--;
+
+	return work;
+}
+
+/* Each chip generates its own work from the chain's leased template, which is
+ * renewed once its nonce2 range is used up or the pool's work has changed */
+static bool sim_template_work(struct sim_info *info, struct sim_chip *chip)
+{
+	if (info->tmpl && (info->tmpl_nonce2 >= info->tmpl_nonce2_end ||
+	    !work_template_current(info->tmpl))) {
+		release_work_template(info->tmpl);
+		info->tmpl = NULL;
+	}
+
+	if (!info->tmpl) {
+		info->tmpl = lease_work_template(current_pool(), info->template_range,
+						 &info->tmpl_nonce2);
+		if (!info->tmpl)
+			return false;
+		info->tmpl_nonce2_end = info->tmpl_nonce2 + info->template_range;
+		info->template_leases++;
+	}
+
+	chip->tmpl = ref_work_template(info->tmpl);
+	chip->nonce2 = info->tmpl_nonce2++;
+	chip->work = make_template_work(chip->tmpl, chip->nonce2);
+	info->works_queued++;
+
+	return true;
+}
+
+static void sim_chip_done(struct cgpu_info *cgpu, struct sim_chip *chip)
+{
+	if (chip->tmpl) {
+		free_work(chip->work);
+		release_work_template(chip->tmpl);
+		chip->tmpl = NULL;
+	} else
+		work_completed(cgpu, chip->work);
+	chip->work = NULL;
+}
+
+/* Discard everything the chain holds except the results already found */
+static void sim_flush(struct cgpu_info *cgpu, struct sim_info *info)
+{
+	struct work *work;
+	int i;
+
+	while ((work = sim_dequeue(info)) != NULL) {
+		work_completed(cgpu, work);
+		info->works_flushed++;
+	}
+
+	for (i = 0; i < info->chips; i++) {
+		struct sim_chip *chip = &(info->chip[i]);
+
+		if (chip->work) {
+			sim_chip_done(cgpu, chip);
+			info->works_flushed++;
+		}
+		chip->nonces_due = 0;
+	}
+
+	info->flushes++;
+}
+
+/* Brute force the chip's work to the sim difficulty then queue the result
+ * to be returned after the result latency */
+static void sim_find_nonce(struct sim_info *info, struct sim_chip *chip, struct timeval *now)
+{
+	struct sim_result *result;
+	uint32_t nonce;
+
+	do {
+		nonce = chip->nonce++;
+		info->bf_hashes++;
+	} while (!test_nonce_diff(chip->work, nonce, info->diff));
+
+	result = calloc(1, sizeof(*result));
+	if (unlikely(!result))
+		quit(1, "Failed to calloc sim result");
+
+	if (chip->tmpl) {
+		result->tmpl = ref_work_template(chip->tmpl);
+		result->nonce2 = chip->nonce2;
+	} else
+		result->work = copy_work(chip->work);
+	result->nonce = nonce;
+	if (info->hwerr > 0.0 &&
+	    (double)rand_r(&info->seed) / (double)RAND_MAX < info->hwerr) {
+		result->nonce ^= 1 << (rand_r(&info->seed) % 32);
+		result->hwerror = true;
+		info->hw_injected++;
+	}
+
+	copy_time(&result->tv_due, now);
+	result->tv_due.tv_sec += info->latency_ms / 1000;
+	result->tv_due.tv_usec += (info->latency_ms % 1000) * 1000;
+	if (result->tv_due.tv_usec >= 1000000) {
+		result->tv_due.tv_sec++;
+		result->tv_due.tv_usec -= 1000000;
+	}
+
+	/* The latency is the same for every result so they stay in due order */
+	if (info->results_tail)
+		info->results_tail->next = result;
+	else
+		info->results = result;
+	info->results_tail = result;
+	info->results_pending++;
+	info->nonces++;
+}
+
+static void sim_return_results(struct thr_info *thr, struct sim_info *info, struct timeval *now)
+{
+	struct sim_result *result;
+	uint64_t late;
+
+	while ((result = info->results) != NULL) {
+		if (tdiff(now, &result->tv_due) < 0)
+			break;
+
+		info->results = result->next;
+		if (!info->results)
+			info->results_tail = NULL;
+		info->results_pending--;
+
+		late = (uint64_t)(tdiff(now, &result->tv_due) * 1000.0) + info->latency_ms;
+		if (late > info->max_latency_ms)
+			info->max_latency_ms = late;
+
+		/* Sim nonces only meet the sim diff so only the HW errors can
+		 * go through the diff 1 test in submit_template_nonce() */
+		if (result->tmpl) {
+			if (result->hwerror) {
+				submit_template_nonce(thr, result->tmpl, result->nonce2, 0,
+						      result->nonce);
+			} else {
+				struct work *work = make_template_work(result->tmpl, result->nonce2);
+
+				test_nonce_diff(work, result->nonce, info->diff);
+				submit_tested_work(thr, work);
+				free_work(work);
+			}
+			release_work_template(result->tmpl);
+		} else {
+			if (result->hwerror)
+				submit_nonce(thr, result->work, result->nonce);
+			else
+				submit_tested_work(thr, result->work);
+			free_work(result->work);
+		}
+		free(result);
+	}
+}
+
+static int64_t sim_scanwork(struct thr_info *thr)
+{
+	struct cgpu_info *cgpu = thr->cgpu;
+	struct sim_info *info = cgpu->device_data;
+	struct timeval now;
+	double elapsed, hashes = 0;
+	bool flush;
+	int i;
+
+	mutex_lock(&info->lock);
+	flush = info->flush;
+	info->flush = false;
+	mutex_unlock(&info->lock);
+
+	if (flush)
+		sim_flush(cgpu, info);
+
+	cgtime(&now);
+	elapsed = tdiff(&now, &info->tv_last);
+	copy_time(&info->tv_last, &now);
+
+	for (i = 0; i < info->chips; i++) {
+		struct sim_chip *chip = &(info->chip[i]);
+
+		if (!chip->work) {
+			if (info->template_range) {
+				if (!sim_template_work(info, chip))
+					continue;
+			} else
+				chip->work = sim_dequeue(info);
+			if (!chip->work)
+				continue;
+			chip->nonce = rand_r(&info->seed);
+			chip->hashes = 0;
+		}
+
+		chip->hashes += elapsed * info->chip_hashrate;
+		hashes += elapsed * info->chip_hashrate;
+
+		chip->nonces_due += elapsed * info->nonce_rate;
+		if (chip->nonces_due > SIM_MAX_DUE) {
+			info->nonces_overrun += (uint64_t)(chip->nonces_due - SIM_MAX_DUE);
+			chip->nonces_due = SIM_MAX_DUE;
+		}
+		while (chip->nonces_due >= 1.0) {
+			sim_find_nonce(info, chip, &now);
+			chip->nonces_due -= 1.0;
+		}
+
+		if (chip->hashes >= SIM_NONCE_RANGE) {
+			sim_chip_done(cgpu, chip);
+			info->works_done++;
+		}
+	}
+
+	sim_return_results(thr, info, &now);
+
+	if (!thr->work_restart)
+		cgsleep_ms(SIM_SCAN_mS);
+
+	return (int64_t)hashes;
+}
+
+static void sim_flush_work(struct cgpu_info *cgpu)
+{
+	struct sim_info *info = cgpu->device_data;
+
+	mutex_lock(&info->lock);
+	info->flush = true;
+	mutex_unlock(&info->lock);
+}
+
+static struct api_data *sim_api_stats(struct cgpu_info *cgpu)
+{
+	struct sim_info *info = cgpu->device_data;
+	struct api_data *root = NULL;
+	double ghs;
+	int busy = 0, i;
+
+	for (i = 0; i < info->chips; i++) {
+		if (info->chip[i].work)
+			busy++;
+	}
+	ghs = info->chip_hashrate / 1000000000.0;
+
+	root = api_add_int(root, "Chain", &(info->chain), true);
+	root = api_add_int(root, "Chips", &(info->chips), true);
+	root = api_add_int(root, "Chips Busy", &busy, true);
+	root = api_add_double(root, "Chip GHs", &ghs, true);
+	root = api_add_int(root, "Queue Depth", &(info->queue_depth), true);
+	root = api_add_int(root, "Queued", &(info->queue_count), true);
+	root = api_add_double(root, "Nonce Rate", &(info->nonce_rate), true);
+	root = api_add_double(root, "HW Error Rate", &(info->hwerr), true);
+	root = api_add_int(root, "Latency mS", &(info->latency_ms), true);
+	root = api_add_diff(root, "Sim Diff", &(info->diff), true);
+	root = api_add_uint64(root, "Works Queued", &(info->works_queued), true);
+	root = api_add_uint64(root, "Works Done", &(info->works_done), true);
+	root = api_add_uint64(root, "Works Flushed", &(info->works_flushed), true);
+	root = api_add_uint64(root, "Flushes", &(info->flushes), true);
+	root = api_add_uint64(root, "Nonces", &(info->nonces), true);
+	root = api_add_uint64(root, "Nonces Overrun", &(info->nonces_overrun), true);
+	root = api_add_uint64(root, "HW Injected", &(info->hw_injected), true);
+	root = api_add_int(root, "Results Pending", &(info->results_pending), true);
+	root = api_add_uint64(root, "Max Latency mS", &(info->max_latency_ms), true);
+	root = api_add_uint64(root, "BF Hashes", &(info->bf_hashes), true);
+	root = api_add_int(root, "Template Range", &(info->template_range), true);
+	root = api_add_uint64(root, "Template Leases", &(info->template_leases), true);
+
+	return root;
+}
+
+static void sim_zero_stats(struct cgpu_info *cgpu)
+{
+	struct sim_info *info = cgpu->device_data;
+
+	info->works_queued = 0;
+	info->works_done = 0;
+	info->works_flushed = 0;
+	info->flushes = 0;
+	info->nonces = 0;
+	info->nonces_overrun = 0;
+	info->hw_injected = 0;
+	info->bf_hashes = 0;
+	info->max_latency_ms = 0;
+	info->template_leases = 0;
+}
+
+static void sim_shutdown(struct thr_info *thr)
+{
+	struct cgpu_info *cgpu = thr->cgpu;
+	struct sim_info *info = cgpu->device_data;
+	struct sim_result *result;
+
+	sim_flush(cgpu, info);
+
+	while ((result = info->results) != NULL) {
+		info->results = result->next;
+		if (result->tmpl)
+			release_work_template(result->tmpl);
+		else
+			free_work(result->work);
+		free(result);
+	}
+	info->results_tail = NULL;
+	info->results_pending = 0;
+
+	if (info->tmpl) {
+		release_work_template(info->tmpl);
+		info->tmpl = NULL;
+	}
+}
+
+struct device_drv sim_drv = {
+	.drv_id = DRIVER_sim,
+	.dname = "simulator",
+	.name = "SIM",
+	.drv_detect = sim_detect,
+	.thread_prepare = sim_prepare,
+	.hash_work = hash_queued_work,
+	.queue_full = sim_queue_full,
+	.scanwork = sim_scanwork,
+	.flush_work = sim_flush_work,
+	.get_api_stats = sim_api_stats,
+	.zero_stats = sim_zero_stats,
+	.thread_shutdown = sim_shutdown,
+	.max_diff = 1,
+};
@@ -14,6 +14,11 @@
 
  The jobs sent each with unique ID and returned asynchronously in one of the next
  transactions. REQUEST_PERIOD and REQUEST_SIZE define the communication rate with minergate.
+
+ A separate I/O thread owns the socket once mining starts. It keeps up to
+ SPOND_MAX_IN_FLIGHT requests outstanding, sends as soon as a batch is ready
+ rather than on a fixed lockstep, and the batch size comes from how much work
+ minergate already has against the hash rate it reports.
 */
 
 #include <float.h>
@@ -31,6 +36,9 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "config.h"
 
@@ -63,6 +71,7 @@ static inline void swap32yes(void *out, const void *in, size_t sz)
 		(((uint32_t*)out)[swapcounter]) = swab32(((uint32_t*)in)[swapcounter]);
 }
 
+/* Blocking exchange, only used to clean the socket before the I/O thread starts */
 static void send_minergate_pkt(const minergate_req_packet* mp_req, minergate_rsp_packet* mp_rsp,
 			       int  socket_fd)
 {
@@ -73,15 +82,18 @@ static void send_minergate_pkt(const minergate_req_packet* mp_req, minergate_rsp
 	if (unlikely(nwrote != nbytes))
 		_quit(-1);
 	nbytes = sizeof(minergate_rsp_packet);
-	nread = read(socket_fd, (void *)mp_rsp, nbytes);
+	nread = recv(socket_fd, (void *)mp_rsp, nbytes, MSG_WAITALL);
 	if (unlikely(nread != nbytes))
 		_quit(-1);
 	passert(mp_rsp->magic == 0xcaf4);
 }
 
+static void *spond_io_thread(void *userdata);
+
 static bool spondoolies_prepare(struct thr_info *thr)
 {
 	struct cgpu_info *spondoolies = thr->cgpu;
+	struct spond_adapter *a = spondoolies->device_data;
 	struct timeval now;
 
 	assert(spondoolies);
@@ -90,6 +102,22 @@ static bool spondoolies_prepare(struct thr_info *thr)
 #if NEED_FIX
 	get_datestamp(spondoolies->init, &now);
 #endif
+	a->last_scan = now;
+	a->last_send = now;
+
+	if (pipe(a->wake_fd) == -1) {
+		applog(LOG_ERR, "SPOND failed to create wake pipe");
+		return false;
+	}
+	fcntl(a->wake_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(a->wake_fd[1], F_SETFL, O_NONBLOCK);
+	fcntl(a->socket_fd, F_SETFL, fcntl(a->socket_fd, F_GETFL) | O_NONBLOCK);
+	cgsem_init(&a->io_sem);
+
+	if (pthread_create(&a->io_thr, NULL, spond_io_thread, (void *)spondoolies)) {
+		applog(LOG_ERR, "SPOND failed to create I/O thread");
+		return false;
+	}
 	return true;
 }
 
@@ -119,26 +147,264 @@ static int init_socket(void)
 	return socket_fd;
 }
 
-static bool spondoolies_flush_queue(struct spond_adapter* a, bool flush_queue)
+static void spond_wake(struct spond_adapter *a)
 {
-	if (!a->parse_resp) {
-		static int i = 0;
-
-		if (i++ % 10 == 0 && a->works_in_minergate_and_pending_tx + a->works_pending_tx != a->works_in_driver)
-			printf("%d + %d != %d\n", a->works_in_minergate_and_pending_tx, a->works_pending_tx,a->works_in_driver);
-		assert(a->works_in_minergate_and_pending_tx + a->works_pending_tx == a->works_in_driver);
-		send_minergate_pkt(a->mp_next_req,  a->mp_last_rsp, a->socket_fd);
-		if (flush_queue)
-			a->mp_next_req->mask |= 0x02;
-		else
-			a->mp_next_req->mask &= ~0x02;
+	char c = 0;
+
+	// Full pipe means it's already due to wake
+	if (write(a->wake_fd[1], &c, 1)) {};
+}
+
+/* Jobs sent to minergate and not yet returned. Must hold lock */
+static int spond_backlog(struct spond_adapter *a)
+{
+	return a->works_in_minergate_and_pending_tx - a->works_pending_tx;
+}
+
+/* How many jobs minergate should have queued, from the rate it reports */
+static int spond_backlog_target(struct spond_adapter *a)
+{
+	int target;
+
+	if (!a->gh_div_10_rate)
+		return REQUEST_SIZE;
+	target = (double)(a->gh_div_10_rate) * 10e9 / 4294967296.0 *
+		 SPOND_BACKLOG_mS / 1000.0;
+	if (target < SPOND_MIN_BACKLOG)
+		target = SPOND_MIN_BACKLOG;
+	if (target > MINERGATE_TOTAL_QUEUE)
+		target = MINERGATE_TOTAL_QUEUE;
+	return target;
+}
+
+/* Jobs the next request should carry to bring minergate up to target */
+static int spond_batch(struct spond_adapter *a)
+{
+	int batch = spond_backlog_target(a) - spond_backlog(a);
+
+	if (batch < 0)
+		batch = 0;
+	if (batch > REQUEST_SIZE)
+		batch = REQUEST_SIZE;
+	return batch;
+}
+
+/* Must hold lock */
+static bool spond_send_due(struct spond_adapter *a, struct timeval *now)
+{
+	if (a->tx_left || a->in_flight >= SPOND_MAX_IN_FLIGHT)
+		return false;
+	if (a->reset_mg_queue)
+		return true;
+	// Results only come back with a response so poll at least this often
+	if (us_tdiff(now, &a->last_send) >= REQUEST_PERIOD)
+		return true;
+	if (!a->works_pending_tx)
+		return false;
+	if (a->works_pending_tx >= spond_batch(a))
+		return true;
+	// Running low, don't wait for a full batch
+	return spond_backlog(a) < spond_backlog_target(a) / 2;
+}
+
+/* Swap the request being filled for the one just sent. Must hold lock */
+static void spond_start_tx(struct spond_adapter *a, struct timeval *now)
+{
+	minergate_req_packet *req = a->mp_next_req;
+	static int i = 0;
+
+	if (i++ % 10 == 0 && a->works_in_minergate_and_pending_tx + a->works_pending_tx != a->works_in_driver)
+		printf("%d + %d != %d\n", a->works_in_minergate_and_pending_tx, a->works_pending_tx,a->works_in_driver);
+	assert(a->works_in_minergate_and_pending_tx + a->works_pending_tx == a->works_in_driver);
+
+	if (a->reset_mg_queue) {
+		req->mask |= 0x02;
+		a->reset_mg_queue = 0;
+	} else
+		req->mask &= ~0x02;
+
+	a->mp_next_req = a->mp_tx_req;
+	a->mp_next_req->req_count = 0;
+	a->mp_tx_req = req;
+	a->tx_left = sizeof(minergate_req_packet);
+
+	a->works_in_minergate_and_pending_tx += a->works_pending_tx;
+	a->jobs_sent += a->works_pending_tx;
+	a->works_pending_tx = 0;
+
+	a->sent[(a->sent_head + a->in_flight) % SPOND_MAX_IN_FLIGHT] = *now;
+	a->in_flight++;
+	if (a->in_flight > a->max_in_flight)
+		a->max_in_flight = a->in_flight;
+	a->last_send = *now;
+	a->requests++;
+}
 
-		a->mp_next_req->req_count = 0;
-		a->parse_resp = 1;
-		a->works_in_minergate_and_pending_tx += a->works_pending_tx;
-		a->works_pending_tx = 0;
+/* Submit the results of a complete response. Must hold lock */
+static void spond_parse_rsp(struct spond_adapter *a)
+{
+	int array_size, i, j;
+
+	a->gh_div_10_rate = a->mp_last_rsp->gh_div_10_rate;
+	array_size = a->mp_last_rsp->rsp_count;
+	for (i = 0; i < array_size; i++) { // walk the jobs
+		int job_id;
+
+		minergate_do_job_rsp* work = a->mp_last_rsp->rsp + i;
+		job_id = work->work_id_in_sw;
+		if (work->res == 1)
+			a->overflows++;
+		if ((a->my_jobs[job_id].cgminer_work)) {
+			if (a->my_jobs[job_id].merkle_root == work->mrkle_root) {
+				assert(a->my_jobs[job_id].state == SPONDWORK_STATE_IN_BUSY);
+				a->works_in_minergate_and_pending_tx--;
+				a->works_in_driver--;
+				a->jobs_returned++;
+				for (j = 0; j < 2; j++) {
+					if (work->winner_nonce[j]) {
+						bool __maybe_unused ok;
+						struct work *cg_work = a->my_jobs[job_id].cgminer_work;
+#ifndef SP_NTIME
+						ok = submit_nonce(cg_work->thr, cg_work, work->winner_nonce[j]);
+#else
+						ok = submit_noffset_nonce(cg_work->thr, cg_work, work->winner_nonce[j], work->ntime_offset);
+#endif
+						//printf("OK on %d:%d = %d\n",work->work_id_in_sw,j, ok);
+						a->wins++;
+					}
+				}
+				//printf("%d ntime_clones = %d\n",job_id,a->my_jobs[job_id].ntime_clones);
+				if ((--a->my_jobs[job_id].ntime_clones) == 0) {
+					//printf("Done with %d\n", job_id);
+					work_completed(a->cgpu, a->my_jobs[job_id].cgminer_work);
+					a->good++;
+					a->my_jobs[job_id].cgminer_work = NULL;
+					a->my_jobs[job_id].state = SPONDWORK_STATE_EMPTY;
+				}
+			} else {
+				a->bad++;
+				printf("Dropping minergate old job id=%d mrkl=%x my-mrkl=%x\n",
+				       job_id, a->my_jobs[job_id].merkle_root, work->mrkle_root);
+			}
+		} else {
+			a->empty++;
+			printf("No cgminer job (id:%d res:%d)!\n",job_id, work->res);
+		}
 	}
-	return true;
+}
+
+static void *spond_io_thread(void *userdata)
+{
+	struct cgpu_info *cgpu = (struct cgpu_info *)userdata;
+	struct spond_adapter *a = cgpu->device_data;
+	struct pollfd pfd[2];
+	struct timeval now;
+	char junk[64];
+	double reply_ms;
+	int timeout_ms, ret;
+	ssize_t n;
+
+	RenameThread("spond_io");
+
+	pfd[0].fd = a->socket_fd;
+	pfd[1].fd = a->wake_fd[0];
+	pfd[1].events = POLLIN;
+
+	while (likely(!cgpu->shutdown)) {
+		cgtime(&now);
+		mutex_lock(&a->lock);
+		if (spond_send_due(a, &now))
+			spond_start_tx(a, &now);
+		pfd[0].events = POLLIN;
+		if (a->tx_left)
+			pfd[0].events |= POLLOUT;
+		if (a->tx_left || a->in_flight >= SPOND_MAX_IN_FLIGHT)
+			timeout_ms = REQUEST_PERIOD / 1000;
+		else {
+			timeout_ms = (REQUEST_PERIOD - us_tdiff(&now, &a->last_send)) / 1000;
+			if (timeout_ms < 1)
+				timeout_ms = 1;
+		}
+		mutex_unlock(&a->lock);
+
+		ret = poll(pfd, 2, timeout_ms);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			quit(1, "SPOND minergate poll failed %d", errno);
+		}
+		if (ret == 0)
+			continue;
+
+		if (pfd[1].revents & POLLIN) {
+			while (read(a->wake_fd[0], junk, sizeof(junk)) > 0)
+				;
+		}
+
+		// Only this thread touches the tx buffer and counts once sending
+		if ((pfd[0].revents & POLLOUT) && a->tx_left) {
+			n = write(a->socket_fd, (char *)(a->mp_tx_req) +
+				  sizeof(minergate_req_packet) - a->tx_left, a->tx_left);
+			if (n < 0 && errno != EAGAIN && errno != EINTR)
+				quit(1, "SPOND minergate write failed %d", errno);
+			if (n > 0) {
+				mutex_lock(&a->lock);
+				a->tx_left -= n;
+				mutex_unlock(&a->lock);
+			}
+		}
+
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			n = read(a->socket_fd, (char *)(a->mp_last_rsp) + a->rx_got,
+				 sizeof(minergate_rsp_packet) - a->rx_got);
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+				quit(1, "SPOND minergate connection lost %d", errno);
+			if (n > 0)
+				a->rx_got += n;
+			if (a->rx_got == sizeof(minergate_rsp_packet)) {
+				passert(a->mp_last_rsp->magic == 0xcaf4);
+				a->rx_got = 0;
+				cgtime(&now);
+				mutex_lock(&a->lock);
+				reply_ms = tdiff(&now, &a->sent[a->sent_head]) * 1000.0;
+				a->reply_ms_total += reply_ms;
+				if (reply_ms > a->reply_ms_max)
+					a->reply_ms_max = reply_ms;
+				a->sent_head = (a->sent_head + 1) % SPOND_MAX_IN_FLIGHT;
+				if (a->in_flight > 0)
+					a->in_flight--;
+				a->responses++;
+				spond_parse_rsp(a);
+				mutex_unlock(&a->lock);
+				cgsem_post(&a->io_sem);
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take back the jobs not yet sent, they're all stale now
+ * Must hold lock
+ */
+static void spond_drop_pending(struct spond_adapter *a)
+{
+	int i, job_id;
+
+	for (i = 0; i < a->works_pending_tx; i++) {
+		job_id = a->mp_next_req->req[i].work_id_in_sw;
+		if (!a->my_jobs[job_id].cgminer_work)
+			continue;
+		if ((--a->my_jobs[job_id].ntime_clones) == 0) {
+			work_completed(a->cgpu, a->my_jobs[job_id].cgminer_work);
+			a->my_jobs[job_id].cgminer_work = NULL;
+			a->my_jobs[job_id].state = SPONDWORK_STATE_EMPTY;
+		}
+	}
+	a->works_in_driver -= a->works_pending_tx;
+	a->dropped_pending += a->works_pending_tx;
+	a->works_pending_tx = 0;
+	a->mp_next_req->req_count = 0;
 }
 
 static void spondoolies_detect(__maybe_unused bool hotplug)
@@ -146,6 +412,7 @@ static void spondoolies_detect(__maybe_unused bool hotplug)
 	struct cgpu_info *cgpu = calloc(1, sizeof(*cgpu));
 	struct device_drv *drv = &spondoolies_drv;
 	struct spond_adapter *a;
+	int i;
 
 #if NEED_FIX
 	nDevs = 1;
@@ -162,6 +429,7 @@ static void spondoolies_detect(__maybe_unused bool hotplug)
 	a->cgpu = (void *)cgpu;
 	a->adapter_state = ADAPTER_STATE_OPERATIONAL;
 	a->mp_next_req = allocate_minergate_packet_req(0xca, 0xfe);
+	a->mp_tx_req = allocate_minergate_packet_req(0xca, 0xfe);
 	a->mp_last_rsp = allocate_minergate_packet_rsp(0xca, 0xfe);
 
 	pthread_mutex_init(&a->lock, NULL);
@@ -172,10 +440,13 @@ static void spondoolies_detect(__maybe_unused bool hotplug)
 	}
 
 	assert(add_cgpu(cgpu));
-	// Clean MG socket
-	spondoolies_flush_queue(a, true);
-	spondoolies_flush_queue(a, true);
-	spondoolies_flush_queue(a, true);
+	// Clean MG socket, dropping any old work after the first request
+	for (i = 0; i < 3; i++) {
+		send_minergate_pkt(a->mp_next_req, a->mp_last_rsp, a->socket_fd);
+		a->mp_next_req->mask |= 0x02;
+	}
+	a->mp_next_req->mask &= ~0x02;
+	a->mp_tx_req->mask = a->mp_next_req->mask;
 	applog(LOG_DEBUG, "SPOND spondoolies_detect done");
 }
 
@@ -183,11 +454,37 @@ static struct api_data *spondoolies_api_stats(struct cgpu_info *cgpu)
 {
 	struct spond_adapter *a = cgpu->device_data;
 	struct api_data *root = NULL;
+	double avg;
+	int backlog, target;
 
 	root = api_add_int(root, "ASICs total rate", &a->temp_rate, false);
 	root = api_add_int(root, "Temparature rear", &a->rear_temp, false);
 	root = api_add_int(root, "Temparature front", &a->front_temp, false);
 
+	mutex_lock(&a->lock);
+	backlog = spond_backlog(a);
+	target = spond_backlog_target(a);
+	root = api_add_uint64(root, "Requests", &a->requests, true);
+	root = api_add_uint64(root, "Responses", &a->responses, true);
+	root = api_add_int(root, "In Flight", &a->in_flight, true);
+	root = api_add_int(root, "Max In Flight", &a->max_in_flight, true);
+	root = api_add_int(root, "Backlog", &backlog, true);
+	root = api_add_int(root, "Backlog Target", &target, true);
+	avg = a->requests ? (double)(a->jobs_sent) / (double)(a->requests) : 0;
+	root = api_add_double(root, "Batch Av", &avg, true);
+	avg = a->responses ? a->reply_ms_total / (double)(a->responses) : 0;
+	root = api_add_double(root, "Reply mS Av", &avg, true);
+	root = api_add_double(root, "Reply mS Max", &a->reply_ms_max, true);
+	root = api_add_uint64(root, "Jobs Sent", &a->jobs_sent, true);
+	root = api_add_uint64(root, "Jobs Returned", &a->jobs_returned, true);
+	root = api_add_uint64(root, "Overflows", &a->overflows, true);
+	root = api_add_uint64(root, "Flushes", &a->flushes, true);
+	root = api_add_uint64(root, "Dropped Pending", &a->dropped_pending, true);
+	root = api_add_int(root, "Wins", &a->wins, true);
+	root = api_add_int(root, "Bad", &a->bad, true);
+	root = api_add_int(root, "Empty", &a->empty, true);
+	mutex_unlock(&a->lock);
+
 	return root;
 }
 
@@ -215,8 +512,13 @@ static unsigned char get_leading_zeroes(const unsigned char *target)
 }
 #endif
 
-static void spondoolies_shutdown(__maybe_unused struct thr_info *thr)
+static void spondoolies_shutdown(struct thr_info *thr)
 {
+	struct cgpu_info *cgpu = thr->cgpu;
+	struct spond_adapter *a = cgpu->device_data;
+
+	spond_wake(a);
+	pthread_join(a->io_thr, NULL);
 }
 
 static void fill_minergate_request(minergate_do_job_req* work, struct work *cg_work,
@@ -249,36 +551,19 @@ static void fill_minergate_request(minergate_do_job_req* work, struct work *cg_w
 }
 
 // returns true if queue full.
-static struct timeval last_force_queue = {0};
-
 static bool spondoolies_queue_full(struct cgpu_info *cgpu)
 {
-	// Only once every 1/10 second do work.
 	struct spond_adapter* a = cgpu->device_data;
-	int next_job_id, ntime_clones, i;
-	struct timeval tv;
+	int next_job_id, ntime_clones, batch, i;
 	struct work *work;
-	unsigned int usec;
 	bool ret = false;
 
 	mutex_lock(&a->lock);
 	passert(a->works_pending_tx <= REQUEST_SIZE);
 
-	gettimeofday(&tv, NULL);
-
-	usec = (tv.tv_sec-last_force_queue.tv_sec) * 1000000;
-	usec += (tv.tv_usec-last_force_queue.tv_usec);
-
-	if ((usec >= REQUEST_PERIOD) || (a->reset_mg_queue == 2) ||
-	    ((a->reset_mg_queue == 1) && (a->works_pending_tx == REQUEST_SIZE))) {
-		spondoolies_flush_queue(a, (a->reset_mg_queue == 2));
-		if (a->reset_mg_queue)
-			a->reset_mg_queue--;
-		last_force_queue = tv;
-	}
-
-	// see if we have enough jobs
-	if (a->works_pending_tx == REQUEST_SIZE) {
+	// see if we have enough jobs for what minergate can take
+	batch = spond_batch(a);
+	if (a->works_pending_tx >= batch) {
 		ret = true;
 		goto return_unlock;
 	}
@@ -291,8 +576,9 @@ static bool spondoolies_queue_full(struct cgpu_info *cgpu)
 	}
 	work = get_queued(cgpu);
 	if (!work) {
+		mutex_unlock(&a->lock);
 		cgsleep_ms(10);
-		goto return_unlock;
+		return false;
 	}
 
 	work->thr = cgpu->thr[0];
@@ -308,7 +594,10 @@ static bool spondoolies_queue_full(struct cgpu_info *cgpu)
 	a->my_jobs[a->current_job_id].ntime_clones = 0;
 
 	ntime_clones = (work->drv_rolllimit < MAX_NROLES) ? work->drv_rolllimit : MAX_NROLES;
-	for (i = 0 ; (i < ntime_clones) && (a->works_pending_tx < REQUEST_SIZE) ; i++) {
+	// Always send the work itself even if it can't be rolled
+	if (ntime_clones < 1)
+		ntime_clones = 1;
+	for (i = 0 ; (i < ntime_clones) && (a->works_pending_tx < batch) ; i++) {
 		minergate_do_job_req* pkt_job =  &a->mp_next_req->req[a->works_pending_tx];
 		fill_minergate_request(pkt_job, work, i);
 		a->works_in_driver++;
@@ -318,6 +607,9 @@ static bool spondoolies_queue_full(struct cgpu_info *cgpu)
 		a->my_jobs[a->current_job_id].ntime_clones++;
 	}
 
+	if (a->works_pending_tx >= batch || spond_backlog(a) < spond_backlog_target(a) / 2)
+		spond_wake(a);
+
 return_unlock:
 	mutex_unlock(&a->lock);
 
@@ -345,16 +637,15 @@ static void spond_poll_stats(struct cgpu_info *spond, struct spond_adapter *a)
 }
 
 // Return completed work to submit_nonce() and work_completed() 
-// struct timeval last_force_queue = {0};  
+// The I/O thread does the submitting, this just waits for it and does the stats
 static int64_t spond_scanhash(struct thr_info *thr)
 {
 	struct cgpu_info *cgpu = thr->cgpu;
 	struct spond_adapter *a = cgpu->device_data;
 	int64_t ghashes = 0;
-	cgtimer_t cgt;
+	struct timeval now;
 	time_t now_t;
 
-	cgsleep_prepare_r(&cgt);
 	now_t = time(NULL);
 	/* Poll stats only once per second */
 	if (now_t != a->last_stats) {
@@ -362,59 +653,13 @@ static int64_t spond_scanhash(struct thr_info *thr)
 		spond_poll_stats(cgpu, a);
 	}
 
-	if (a->parse_resp) {
-		int array_size, i, j;
-
-		mutex_lock(&a->lock);
-		ghashes = (a->mp_last_rsp->gh_div_10_rate);
-		ghashes = ghashes  * 10000 * REQUEST_PERIOD;
-		array_size = a->mp_last_rsp->rsp_count;
-		for (i = 0; i < array_size; i++) { // walk the jobs
-			int job_id;
-
-			minergate_do_job_rsp* work = a->mp_last_rsp->rsp + i;
-			job_id = work->work_id_in_sw;
-			if ((a->my_jobs[job_id].cgminer_work)) {
-				if (a->my_jobs[job_id].merkle_root == work->mrkle_root) {
-					assert(a->my_jobs[job_id].state == SPONDWORK_STATE_IN_BUSY);
-					a->works_in_minergate_and_pending_tx--;
-					a->works_in_driver--;
-					for (j = 0; j < 2; j++) {
-						if (work->winner_nonce[j]) {
-							bool __maybe_unused ok;
-							struct work *cg_work = a->my_jobs[job_id].cgminer_work;
-#ifndef SP_NTIME
-							ok = submit_nonce(cg_work->thr, cg_work, work->winner_nonce[j]);
-#else
-							ok = submit_noffset_nonce(cg_work->thr, cg_work, work->winner_nonce[j], work->ntime_offset);
-#endif
-							//printf("OK on %d:%d = %d\n",work->work_id_in_sw,j, ok);
-							a->wins++;
-						}
-					}
-					//printf("%d ntime_clones = %d\n",job_id,a->my_jobs[job_id].ntime_clones);
-					if ((--a->my_jobs[job_id].ntime_clones) == 0) {
-						//printf("Done with %d\n", job_id);
-						work_completed(a->cgpu, a->my_jobs[job_id].cgminer_work);
-						a->good++;
-						a->my_jobs[job_id].cgminer_work = NULL;
-						a->my_jobs[job_id].state = SPONDWORK_STATE_EMPTY;
-					}
-				} else {
-					a->bad++;
-					printf("Dropping minergate old job id=%d mrkl=%x my-mrkl=%x\n",
-					       job_id, a->my_jobs[job_id].merkle_root, work->mrkle_root);
-				}
-			} else {
-				a->empty++;
-				printf("No cgminer job (id:%d res:%d)!\n",job_id, work->res);
-			}
-		}
-		mutex_unlock(&a->lock);
+	cgsem_mswait(&a->io_sem, REQUEST_PERIOD / 1000);
 
-		a->parse_resp = 0;
-	}
-	cgsleep_ms_r(&cgt, 40);
+	cgtime(&now);
+	mutex_lock(&a->lock);
+	ghashes = (double)(a->gh_div_10_rate) * 10e9 * tdiff(&now, &a->last_scan);
+	a->last_scan = now;
+	mutex_unlock(&a->lock);
 
 	return ghashes;
 }
@@ -425,8 +670,11 @@ static void spond_flush_work(struct cgpu_info *cgpu)
 	struct spond_adapter *a = cgpu->device_data;
 
 	mutex_lock(&a->lock);
-	a->reset_mg_queue = 2;
+	spond_drop_pending(a);
+	a->reset_mg_queue = 1;
+	a->flushes++;
 	mutex_unlock(&a->lock);
+	spond_wake(a);
 }
 
 struct device_drv spondoolies_drv = {
@@ -29,6 +29,12 @@ typedef enum spond_work_state {
 #define MAX_JOBS_IN_MINERGATE MINERGATE_TOTAL_QUEUE // 1.5 sec worth of jobs
 #define MAX_NROLES 50 
 
+// Requests sent to minergate before waiting for a response
+#define SPOND_MAX_IN_FLIGHT 2
+// Keep this much work queued in minergate at the rate it reports
+#define SPOND_BACKLOG_mS 300
+#define SPOND_MIN_BACKLOG (REQUEST_SIZE / 4)
+
 typedef struct {
 	struct work      *cgminer_work;
 	SPONDWORK_STATE  state;
@@ -54,13 +60,38 @@ struct spond_adapter {
 	int works_in_minergate_and_pending_tx;
 	int works_pending_tx;
 	int socket_fd;
-	int reset_mg_queue;  // 2=reset, 1=fast send, 0=nada
+	int reset_mg_queue;  // 1=drop old work with the next request, 0=nada
 	int current_job_id;
-	int parse_resp;
 	minergate_req_packet* mp_next_req;
 	minergate_rsp_packet* mp_last_rsp;
 	spond_driver_work my_jobs[MAX_JOBS_IN_MINERGATE];
 
+	// Pipelined minergate I/O
+	pthread_t io_thr;
+	int wake_fd[2];
+	cgsem_t io_sem;
+	minergate_req_packet* mp_tx_req;
+	size_t tx_left;
+	size_t rx_got;
+	int in_flight;
+	struct timeval last_send;
+	struct timeval sent[SPOND_MAX_IN_FLIGHT];
+	int sent_head;
+	int gh_div_10_rate;
+	struct timeval last_scan;
+
+	// I/O statistics
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t jobs_sent;
+	uint64_t jobs_returned;
+	uint64_t overflows;
+	uint64_t flushes;
+	uint64_t dropped_pending;
+	int max_in_flight;
+	double reply_ms_total;
+	double reply_ms_max;
+
 	// Temperature statistics
 	int temp_rate;
 	int rear_temp;
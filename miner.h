@@ -246,7 +246,8 @@ static inline int fsync (int fd)
 	DRIVER_ADD_COMMAND(avalon) \
 	DRIVER_ADD_COMMAND(spondoolies) \
 	DRIVER_ADD_COMMAND(gridseed) \
-	DRIVER_ADD_COMMAND(zeus)
+	DRIVER_ADD_COMMAND(zeus) \
+	DRIVER_ADD_COMMAND(sim)
 
 #define DRIVER_PARSE_COMMANDS(DRIVER_ADD_COMMAND) \
 	FPGA_PARSE_COMMANDS(DRIVER_ADD_COMMAND) \
@@ -416,6 +417,18 @@ struct cgminer_pool_stats {
 	uint64_t times_received;
 	uint64_t bytes_received;
 	uint64_t net_bytes_received;
+	uint64_t share_results;
+	double share_latency_total;
+	double share_latency_max;
+	uint32_t switches;
+	double switch_latency_total;
+	double switch_latency_max;
+	int submits_inflight;
+	int submits_inflight_max;
+	uint32_t templates;
+	int template_txns;
+	double template_time_total;
+	double template_time_max;
 };
 
 struct cgpu_info {
@@ -512,6 +525,9 @@ struct cgpu_info {
 	struct work *unqueued_work;
 	unsigned int queued_count;
 
+	/* The pool this device mines for with --device-split */
+	struct pool *split_pool;
+
 	bool shutdown;
 
 	struct timeval dev_start_tv;
@@ -553,6 +569,15 @@ struct thr_info {
 	bool	work_update;
 };
 
+/* Stratum work generator threads, Calls and Wait in cgminer_stats are the
+ * batches generated and the time taken */
+struct gen_thr {
+	int id;
+	struct thr_info thr;
+	struct cgminer_stats cgminer_stats;
+	uint64_t works;
+};
+
 struct string_elist {
 	char *string;
 	bool free_me;
@@ -987,6 +1012,7 @@ extern bool opt_restart;
 #ifdef USE_ICARUS
 extern char *opt_icarus_options;
 extern char *opt_icarus_timing;
+extern int opt_icarus_event_threads;
 extern float opt_anu_freq;
 #endif
 extern bool opt_worktime;
@@ -1006,6 +1032,7 @@ extern char *opt_bab_options;
 #endif
 #ifdef USE_BITMINE_A1
 extern char *opt_bitmine_a1_options;
+extern char *opt_spi_emu;
 #endif
 #ifdef USE_ANT_S1
 extern char *opt_bitmain_options;
@@ -1042,6 +1069,9 @@ extern char *opt_gridseed_options;
 extern char *opt_gridseed_freq;
 extern char *opt_gridseed_override;
 #endif
+#ifdef USE_SIM
+extern char *opt_sim_options;
+#endif
 #ifdef USE_ZEUS
 extern bool opt_zeus_debug;
 extern int opt_zeus_chips_count;
@@ -1063,6 +1093,11 @@ extern json_t *json_web_config(const char *url);
 extern json_t *json_rpc_call(CURL *curl, const char *url, const char *userpass,
 			     const char *rpc_req, bool, bool, int *,
 			     struct pool *pool, bool);
+struct json_rpc;
+extern struct json_rpc *json_rpc_start(CURL *curl, const char *url,
+				       const char *userpass, const char *rpc_req,
+				       bool, bool, struct pool *pool, bool);
+extern json_t *json_rpc_finish(struct json_rpc *rpc, int rc, int *rolltime);
 #endif
 extern const char *proxytype(proxytypes_t proxytype);
 extern char *get_proxy(char *url, struct pool *pool);
@@ -1110,6 +1145,11 @@ extern int enabled_pools;
 extern void get_intrange(char *arg, int *val1, int *val2);
 extern bool detect_stratum(struct pool *pool, char *url);
 extern void print_summary(void);
+extern bool opt_quota_adapt;
+extern bool opt_device_split;
+extern int opt_split_slice;
+extern int opt_standby;
+extern bool pool_standby(struct pool *pool);
 extern void adjust_quota_gcd(void);
 extern struct pool *add_pool(void);
 extern bool add_pool_details(struct pool *pool, bool live, char *url, char *user, char *pass);
@@ -1133,6 +1173,8 @@ extern bool opt_scrypt;
 #endif
 extern double total_secs;
 extern int mining_threads;
+extern int total_gen_threads;
+extern struct gen_thr *gen_thr;
 extern int total_devices;
 extern int zombie_devs;
 extern struct cgpu_info **devices;
@@ -1196,7 +1238,26 @@ struct pool {
 	char diff[8];
 	int quota;
 	int quota_gcd;
-	int quota_used;
+	int quota_current;
+	int64_t quota_used;
+	double quota_adjust;
+	double quota_yield;
+	int64_t quota_last_used;
+	double quota_last_diff;
+	uint64_t quota_last_results;
+	double quota_last_latency;
+	struct timeval tv_quota;
+
+	/* --device-split devices, hashrate and MH done for this pool */
+	int split_devs;
+	double split_hash;
+	double split_done;
+	bool split_live;
+	int restart_block;
+
+	/* Switched to as the current pool and waiting for a share */
+	struct timeval tv_switch;
+	bool switch_pending;
 	int works;
 
 	double diff_accepted;
@@ -1223,7 +1284,7 @@ struct pool {
 	struct timeval tv_idle;
 
 	double utility;
-	int last_shares, shares;
+	int last_shares;
 
 	char *rpc_req;
 	char *rpc_url;
@@ -1278,6 +1339,9 @@ struct pool {
 	bool stratum_init;
 	bool stratum_notify;
 	struct stratum_work swork;
+	int swork_seq; /* bumped on any change to the stratum work */
+	int job_gen; /* bumped when the stratum job id changes */
+	struct work_template *work_tmpl;
 	pthread_t stratum_sthread;
 	pthread_t stratum_rthread;
 	pthread_mutex_t stratum_lock;
@@ -1303,7 +1367,7 @@ struct pool {
 	bool gbt_solo;
 	unsigned char merklebin[16 * 32];
 	int transactions;
-	char *txn_data;
+	struct gbt_template *gbt_tmpl;
 	unsigned char scriptsig_base[100];
 	unsigned char script_pubkey[25 + 3];
 	int nValue;
@@ -1326,6 +1390,57 @@ struct pool {
 	struct timeval tv_lastwork;
 };
 
+struct gbt_txn {
+	unsigned char txid[32];
+	size_t ofs;
+	size_t len;
+	UT_hash_handle hh;
+};
+
+/* A GBT block template with the transactions held in binary along with their
+ * txids and the merkle branch. Transactions it has in common with the previous
+ * template are reused rather than decoded again. Solo work holds a reference
+ * so the block is only serialised if the work solves it. */
+struct gbt_template {
+	int refs;
+	int transactions;
+	unsigned char *txn_bin;
+	size_t txn_len;
+	struct gbt_txn *txn;
+	struct gbt_txn *txn_index;
+	int reused;
+	int merkles;
+	unsigned char merklebin[16 * 32];
+	unsigned char *coinbase;
+	int coinbase_len;
+	int nonce2_offset;
+	int n2size;
+};
+
+/* A snapshot of a stratum pool's work, made on the first lease after each
+ * notify, diff or extranonce change. Drivers lease it along with a nonce2
+ * range of their own and generate work from it locally. */
+struct work_template {
+	int refs;
+	int seq;
+	struct pool *pool;
+	int work_block;
+	int job_gen;
+
+	unsigned char *coinbase;
+	int coinbase_len;
+	int nonce2_offset;
+	int n2size;
+	unsigned char *merkle_bin;
+	int merkles;
+	unsigned char header_bin[112];
+	double sdiff;
+
+	char *job_id;
+	char *nonce1;
+	char *ntime;
+};
+
 #define GETWORK_MODE_TESTPOOL 'T'
 #define GETWORK_MODE_POOL 'P'
 #define GETWORK_MODE_LP 'L'
@@ -1374,10 +1489,15 @@ struct work {
 	bool		gbt;
 	char		*coinbase;
 	int		gbt_txns;
+	struct gbt_template *gbt_tmpl;
 
 	unsigned int	work_block;
+	int		job_gen;
 	uint32_t	id;
 	UT_hash_handle	hh;
+	/* The staleness generation bucket this work is staged in */
+	struct stage_gen *stage_gen;
+	struct list_head gen_list;
 
 	/* This is the diff work we're aiming to submit and should match the
 	 * work->target binary */
@@ -1396,6 +1516,8 @@ struct work {
 	struct timeval	tv_work_start;
 	struct timeval	tv_work_found;
 	char		getwork_mode;
+	// Index of the benchfile work this came from
+	int		bench_entry;
 };
 
 #ifdef USE_MODMINER
@@ -1446,8 +1568,16 @@ extern bool submit_tested_work(struct thr_info *thr, struct work *work);
 extern bool submit_nonce(struct thr_info *thr, struct work *work, uint32_t nonce);
 extern bool submit_noffset_nonce(struct thr_info *thr, struct work *work, uint32_t nonce,
 			  int noffset);
+extern struct work_template *lease_work_template(struct pool *pool, uint64_t nonce2s, uint64_t *nonce2);
+extern struct work_template *ref_work_template(struct work_template *tmpl);
+extern void release_work_template(struct work_template *tmpl);
+extern bool work_template_current(struct work_template *tmpl);
+extern struct work *make_template_work(struct work_template *tmpl, uint64_t nonce2);
+extern bool submit_template_nonce(struct thr_info *thr, struct work_template *tmpl, uint64_t nonce2,
+				  uint32_t ntime, uint32_t nonce);
 extern int share_work_tdiff(struct cgpu_info *cgpu);
 extern struct work *get_work(struct thr_info *thr, const int thr_id);
+extern struct work *get_work_nowait(struct thr_info *thr, const int thr_id);
 extern void __add_queued(struct cgpu_info *cgpu, struct work *work);
 extern struct work *get_queued(struct cgpu_info *cgpu);
 extern void add_queued(struct cgpu_info *cgpu, struct work *work);
@@ -1462,6 +1592,7 @@ extern int age_queued_work(struct cgpu_info *cgpu, double secs);
 extern void work_completed(struct cgpu_info *cgpu, struct work *work);
 extern struct work *take_queued_work_bymidstate(struct cgpu_info *cgpu, char *midstate, size_t midstatelen, char *data, int offset, size_t datalen);
 extern void flush_queue(struct cgpu_info *cgpu);
+extern void hashmeter(int thr_id, double hashes_done);
 extern void hash_driver_work(struct thr_info *mythr);
 extern void hash_queued_work(struct thr_info *mythr);
 extern void _wlog(const char *str);
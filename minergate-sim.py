@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+
+# Copyright 2026 agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free
+# Software Foundation; either version 3 of the License, or (at your option) any
+# later version.  See COPYING for more details.
+
+# A local minergate stand-in for testing and benchmarking the cgminer
+# spondoolies driver without an SP10.
+#
+# It listens on the minergate UNIX socket and answers every request packet with
+# a response packet, as minergate does. Jobs are queued up to the minergate
+# queue size and completed in order at the rate a miner of --ghs would get
+# through them (each job is one 2^32 nonce range). Completed jobs are returned
+# in the next response. No nonces are returned, since finding real ones is far
+# too slow here, so this measures job delivery only.
+#
+# It reports the request rate, the job rates in and out, the average batch
+# size, how long jobs wait in minergate before they're returned, and how much
+# hashing time was lost with an empty queue (starved).
+#
+#	./minergate-sim.py --ghs 1400 &
+#	./stratum-sim.py --bench 60 --sim-options '' --cgminer ./cgminer
+#
+# Use --bench to run a command while serving, then report and exit:
+#	./minergate-sim.py --ghs 1400 --bench -- ./stratum-sim.py --bench 60 --sim-options ''
+#
+# Use --help for all the options
+
+import argparse
+import os
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+# mg_proto_parser.h
+SOCKET_FILE = '/tmp/connection_pipe'
+PROTOCOL_VERSION = 6
+MAGIC = 0xcaf4
+MAX_REQUESTS = 100
+MAX_RESPONDS = 300
+TOTAL_QUEUE = 300
+
+HEAD = struct.Struct('<BBBBHH')
+JOB_REQ = struct.Struct('<IIII8IBBBB')
+JOB_RSP = struct.Struct('<IIIIBBBB')
+REQ_SIZE = HEAD.size + JOB_REQ.size * MAX_REQUESTS
+RSP_SIZE = HEAD.size + JOB_RSP.size * MAX_RESPONDS
+
+RES_DONE = 0
+RES_OVERFLOW = 1
+
+NONCES_PER_JOB = 4294967296.0
+
+class Stats:
+	def __init__(self):
+		self.lock = threading.Lock()
+		self.reset()
+
+	def reset(self):
+		self.start = time.time()
+		self.requests = 0
+		self.jobs_in = 0
+		self.jobs_out = 0
+		self.overflows = 0
+		self.flushed = 0
+		self.flushes = 0
+		self.depth = 0
+		self.latency = 0.0
+		self.latency_max = 0.0
+		self.starved = 0.0
+		self.busy = 0.0
+
+	def line(self):
+		with self.lock:
+			el = max(time.time() - self.start, 0.001)
+			req = max(self.requests, 1)
+			out = max(self.jobs_out, 1)
+			hashing = max(self.busy + self.starved, 0.001)
+			return ('%.0fs requests %d (%.1f/s) jobs in %d (%.1f/s) out %d (%.1f/s)'
+				' batch av %.1f depth av %.1f latency av %.1fms max %.1fms'
+				' starved %.2f%% overflow %d flushes %d flushed %d' %
+				(el, self.requests, self.requests / el,
+				 self.jobs_in, self.jobs_in / el, self.jobs_out, self.jobs_out / el,
+				 self.jobs_in / float(req), self.depth / float(req),
+				 self.latency * 1000.0 / out, self.latency_max * 1000.0,
+				 self.starved * 100.0 / hashing, self.overflows,
+				 self.flushes, self.flushed))
+
+def recv_exact(conn, size):
+	data = b''
+	while len(data) < size:
+		more = conn.recv(size - len(data))
+		if not more:
+			return None
+		data += more
+	return data
+
+class Minergate:
+	def __init__(self, args, stats):
+		self.args = args
+		self.stats = stats
+		self.rate = args.ghs * 1e9 / NONCES_PER_JOB
+		self.queue = []
+		self.done = []
+		self.last = time.time()
+		self.progress = 0.0
+
+	# Run the chips from the last request until now
+	def hash(self, now):
+		el = now - self.last
+		self.last = now
+		while el > 0:
+			if not self.queue:
+				self.stats.starved += el
+				self.progress = 0.0
+				return
+			need = (1.0 - self.progress) / self.rate
+			if need > el:
+				self.progress += el * self.rate
+				self.stats.busy += el
+				return
+			el -= need
+			self.stats.busy += need
+			self.progress = 0.0
+			self.done.append(self.queue.pop(0) + (RES_DONE,))
+
+	def request(self, data):
+		now = time.time()
+		rid, reqid, ver, mask, magic, count = HEAD.unpack_from(data, 0)
+		if magic != MAGIC or ver != PROTOCOL_VERSION or count > MAX_REQUESTS:
+			raise ValueError('bad request magic %04x version %d count %d' %
+					 (magic, ver, count))
+		with self.stats.lock:
+			self.hash(now)
+			self.stats.requests += 1
+			self.stats.depth += len(self.queue)
+			if mask & 0x02:
+				self.stats.flushes += 1
+				self.stats.flushed += len(self.queue)
+				self.done += [job + (RES_DONE,) for job in self.queue]
+				self.queue = []
+				self.progress = 0.0
+			for i in range(count):
+				job = JOB_REQ.unpack_from(data, HEAD.size + i * JOB_REQ.size)
+				# work_id_in_sw, mrkle_root, ntime_offset, arrival
+				item = (job[0], job[3], job[14], now)
+				self.stats.jobs_in += 1
+				if len(self.queue) >= TOTAL_QUEUE:
+					self.stats.overflows += 1
+					self.done.append(item + (RES_OVERFLOW,))
+				else:
+					self.queue.append(item)
+
+			ret = self.done[:MAX_RESPONDS]
+			self.done = self.done[MAX_RESPONDS:]
+			for job in ret:
+				lat = now - job[3]
+				self.stats.latency += lat
+				if lat > self.stats.latency_max:
+					self.stats.latency_max = lat
+			self.stats.jobs_out += len(ret)
+
+		rate = min(int(self.args.ghs / 10), 255)
+		rsp = bytearray(RSP_SIZE)
+		HEAD.pack_into(rsp, 0, rid, reqid, PROTOCOL_VERSION, rate, MAGIC, len(ret))
+		for i, job in enumerate(ret):
+			JOB_RSP.pack_into(rsp, HEAD.size + i * JOB_RSP.size,
+					  job[0], job[1], 0, 0, job[2], job[4], 0, 0)
+		return bytes(rsp)
+
+def client(conn, args, stats):
+	mg = Minergate(args, stats)
+	try:
+		while True:
+			data = recv_exact(conn, REQ_SIZE)
+			if data is None:
+				break
+			rsp = mg.request(data)
+			if args.delay:
+				time.sleep(args.delay / 1000.0)
+			conn.sendall(rsp)
+	except (OSError, ValueError) as e:
+		sys.stderr.write('Minergate client error: %s\n' % e)
+	conn.close()
+
+def serve(args, stats):
+	try:
+		os.unlink(args.socket)
+	except OSError:
+		pass
+	srv = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+	srv.bind(args.socket)
+	srv.listen(4)
+
+	def accept():
+		while True:
+			conn, _ = srv.accept()
+			threading.Thread(target=client, args=(conn, args, stats), daemon=True).start()
+
+	threading.Thread(target=accept, daemon=True).start()
+	return srv
+
+def main():
+	parser = argparse.ArgumentParser(description='Local minergate simulator')
+	parser.add_argument('--socket', default=SOCKET_FILE)
+	parser.add_argument('--ghs', type=float, default=1400.0,
+			    help='hashrate the jobs are completed at')
+	parser.add_argument('--delay', type=float, default=0.0,
+			    help='milliseconds to wait before each response')
+	parser.add_argument('--report', type=float, default=10.0,
+			    help='seconds between stats lines on stderr, 0 for none')
+	parser.add_argument('--skip', type=float, default=0.0,
+			    help='seconds to ignore at startup before collecting stats')
+	parser.add_argument('--bench', action='store_true',
+			    help='run the command after -- while serving, then report')
+	parser.add_argument('command', nargs='*',
+			    help='command to run with --bench, after --')
+	args = parser.parse_args()
+
+	stats = Stats()
+	srv = serve(args, stats)
+	sys.stderr.write('Minergate simulator listening on %s at %.0f GH/s\n' %
+			 (args.socket, args.ghs))
+
+	proc = None
+	if args.bench:
+		if not args.command:
+			parser.error('--bench needs a command after --')
+		proc = subprocess.Popen(args.command)
+
+	started = time.time()
+	skipped = args.skip <= 0
+	last = started
+	try:
+		while proc is None or proc.poll() is None:
+			time.sleep(0.2)
+			now = time.time()
+			if not skipped and now - started >= args.skip:
+				with stats.lock:
+					stats.reset()
+				skipped = True
+				last = now
+			if args.report and now - last >= args.report:
+				sys.stderr.write('Minergate: %s\n' % stats.line())
+				last = now
+	except KeyboardInterrupt:
+		pass
+	print('Minergate: ' + stats.line())
+	srv.close()
+	try:
+		os.unlink(args.socket)
+	except OSError:
+		pass
+
+if __name__ == '__main__':
+	main()
@@ -29,10 +29,15 @@
 
 #include "config.h"
 #include "miner.h"
+#include "scrypt.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 typedef struct SHA256Context {
 	uint32_t state[8];
@@ -402,20 +407,214 @@ static void scrypt_1024_1_1_256_sp(const uint32_t* input, char* scratchpad, uint
 	PBKDF2_SHA256_80_128_32(input, X, ostate);
 }
 
-/* 131583 rounded up to 4 byte alignment */
-#define SCRATCHBUF_SIZE	(131584)
+/* The multi lane code hashes SCRYPT_LANES nonces at once with each 32 bit
+ * word of the salsa20/8 state held across the lanes of a vector. The gcc
+ * vector extensions compile to SSE2/AVX2 on x86 and NEON on ARM, or to plain
+ * scalar code on anything else. */
+#ifdef __AVX2__
+#define SCRYPT_LANES 8
+#else
+#define SCRYPT_LANES 4
+#endif
+
+typedef uint32_t lane_t __attribute__ ((vector_size (SCRYPT_LANES * 4)));
+
+static inline void
+salsa20_8_lanes(lane_t B[16], const lane_t Bx[16])
+{
+	lane_t x00,x01,x02,x03,x04,x05,x06,x07,x08,x09,x10,x11,x12,x13,x14,x15;
+	size_t i;
+
+	x00 = (B[ 0] ^= Bx[ 0]);
+	x01 = (B[ 1] ^= Bx[ 1]);
+	x02 = (B[ 2] ^= Bx[ 2]);
+	x03 = (B[ 3] ^= Bx[ 3]);
+	x04 = (B[ 4] ^= Bx[ 4]);
+	x05 = (B[ 5] ^= Bx[ 5]);
+	x06 = (B[ 6] ^= Bx[ 6]);
+	x07 = (B[ 7] ^= Bx[ 7]);
+	x08 = (B[ 8] ^= Bx[ 8]);
+	x09 = (B[ 9] ^= Bx[ 9]);
+	x10 = (B[10] ^= Bx[10]);
+	x11 = (B[11] ^= Bx[11]);
+	x12 = (B[12] ^= Bx[12]);
+	x13 = (B[13] ^= Bx[13]);
+	x14 = (B[14] ^= Bx[14]);
+	x15 = (B[15] ^= Bx[15]);
+	for (i = 0; i < 8; i += 2) {
+#define R(a,b) (((a) << (b)) | ((a) >> (32 - (b))))
+		/* Operate on columns. */
+		x04 ^= R(x00+x12, 7);	x09 ^= R(x05+x01, 7);	x14 ^= R(x10+x06, 7);	x03 ^= R(x15+x11, 7);
+		x08 ^= R(x04+x00, 9);	x13 ^= R(x09+x05, 9);	x02 ^= R(x14+x10, 9);	x07 ^= R(x03+x15, 9);
+		x12 ^= R(x08+x04,13);	x01 ^= R(x13+x09,13);	x06 ^= R(x02+x14,13);	x11 ^= R(x07+x03,13);
+		x00 ^= R(x12+x08,18);	x05 ^= R(x01+x13,18);	x10 ^= R(x06+x02,18);	x15 ^= R(x11+x07,18);
+
+		/* Operate on rows. */
+		x01 ^= R(x00+x03, 7);	x06 ^= R(x05+x04, 7);	x11 ^= R(x10+x09, 7);	x12 ^= R(x15+x14, 7);
+		x02 ^= R(x01+x00, 9);	x07 ^= R(x06+x05, 9);	x08 ^= R(x11+x10, 9);	x13 ^= R(x12+x15, 9);
+		x03 ^= R(x02+x01,13);	x04 ^= R(x07+x06,13);	x09 ^= R(x08+x11,13);	x14 ^= R(x13+x12,13);
+		x00 ^= R(x03+x02,18);	x05 ^= R(x04+x07,18);	x10 ^= R(x09+x08,18);	x15 ^= R(x14+x13,18);
+#undef R
+	}
+	B[ 0] += x00;
+	B[ 1] += x01;
+	B[ 2] += x02;
+	B[ 3] += x03;
+	B[ 4] += x04;
+	B[ 5] += x05;
+	B[ 6] += x06;
+	B[ 7] += x07;
+	B[ 8] += x08;
+	B[ 9] += x09;
+	B[10] += x10;
+	B[11] += x11;
+	B[12] += x12;
+	B[13] += x13;
+	B[14] += x14;
+	B[15] += x15;
+}
+
+/* As scrypt_1024_1_1_256_sp for SCRYPT_LANES inputs of 20 words each. The
+ * scratchpad holds 1024 * 32 vectors interleaved the same way as X so the
+ * fill loop is all vector stores, the mix loop reads each lane's V[j] with
+ * its own j. */
+static void scrypt_1024_1_1_256_sp_lanes(const uint32_t *input, char *scratchpad,
+					 uint32_t ostate[][8])
+{
+	lane_t *V;
+	lane_t X[32];
+	uint32_t x[32];
+	uint32_t i, k, l;
+
+	V = (lane_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (l = 0; l < SCRYPT_LANES; l++) {
+		PBKDF2_SHA256_80_128(input + l * 20, x);
+		for (k = 0; k < 32; k++)
+			X[k][l] = x[k];
+	}
+
+	for (i = 0; i < 1024; i++) {
+		memcpy(&V[i * 32], X, sizeof(X));
+
+		salsa20_8_lanes(&X[0], &X[16]);
+		salsa20_8_lanes(&X[16], &X[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		for (l = 0; l < SCRYPT_LANES; l++) {
+			const lane_t *Vj = &V[(X[16][l] & 1023) * 32];
+
+			for (k = 0; k < 32; k++)
+				X[k][l] ^= Vj[k][l];
+		}
+
+		salsa20_8_lanes(&X[0], &X[16]);
+		salsa20_8_lanes(&X[16], &X[0]);
+	}
+
+	for (l = 0; l < SCRYPT_LANES; l++) {
+		for (k = 0; k < 32; k++)
+			x[k] = X[k][l];
+		PBKDF2_SHA256_80_128_32(input + l * 20, x, ostate[l]);
+	}
+}
+
+/* The multi lane scratchpad plus 63 bytes for alignment, which also covers
+ * the 131583 bytes the single scratchpad needs */
+#define SCRYPT_ARENA_SIZE (SCRYPT_LANES * 131072 + 64)
+#define SCRYPT_HUGE_PAGE (2 * 1024 * 1024)
+
+/* One scratchpad arena per thread, allocated the first time a thread hashes
+ * and reused for every nonce after that instead of alloca/malloc per call. */
+struct scrypt_arena {
+	char *buf;
+	size_t size;
+	bool mapped;
+	bool huge;
+};
+
+static pthread_key_t scrypt_arena_key;
+static pthread_once_t scrypt_arena_once = PTHREAD_ONCE_INIT;
+
+static void scrypt_arena_free(void *arg)
+{
+	struct scrypt_arena *arena = (struct scrypt_arena *)arg;
+
+#ifndef WIN32
+	if (arena->mapped)
+		munmap(arena->buf, arena->size);
+	else
+#endif
+		free(arena->buf);
+	free(arena);
+}
+
+static void scrypt_arena_init(void)
+{
+	if (unlikely(pthread_key_create(&scrypt_arena_key, scrypt_arena_free)))
+		quithere(1, "Failed to create scrypt arena key");
+}
+
+static struct scrypt_arena *scrypt_get_arena(void)
+{
+	struct scrypt_arena *arena;
+
+	pthread_once(&scrypt_arena_once, scrypt_arena_init);
+	arena = pthread_getspecific(scrypt_arena_key);
+	if (likely(arena))
+		return arena;
+
+	arena = calloc(sizeof(*arena), 1);
+	if (unlikely(!arena))
+		quithere(1, "Failed to calloc scrypt arena");
+
+#ifndef WIN32
+	/* Huge pages take the TLB misses out of the random V[j] reads, try
+	 * explicit ones first then fall back to asking for transparent ones */
+	arena->size = (SCRYPT_ARENA_SIZE + SCRYPT_HUGE_PAGE - 1) & ~(SCRYPT_HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+	arena->buf = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (arena->buf != MAP_FAILED)
+		arena->huge = true;
+	else
+#endif
+	{
+		arena->buf = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+		if (arena->buf != MAP_FAILED)
+			madvise(arena->buf, arena->size, MADV_HUGEPAGE);
+#endif
+	}
+	if (arena->buf != MAP_FAILED)
+		arena->mapped = true;
+	else
+#endif
+	{
+		arena->size = SCRYPT_ARENA_SIZE;
+		arena->buf = malloc(arena->size);
+		if (unlikely(!arena->buf))
+			quithere(1, "Failed to malloc scrypt arena");
+	}
+
+	if (unlikely(pthread_setspecific(scrypt_arena_key, arena)))
+		quithere(1, "Failed to set scrypt arena");
+
+	applog(LOG_DEBUG, "Scrypt arena %d bytes%s", (int)arena->size,
+	       arena->huge ? " using huge pages" : "");
+	return arena;
+}
 
 void scrypt_regenhash(struct work *work)
 {
 	uint32_t data[20];
-	char *scratchbuf;
 	uint32_t *nonce = (uint32_t *)(work->data + 76);
 	uint32_t *ohash = (uint32_t *)(work->hash);
 
 	be32enc_vect(data, (const uint32_t *)work->data, 19);
 	data[19] = htobe32(*nonce);
-	scratchbuf = alloca(SCRATCHBUF_SIZE);
-	scrypt_1024_1_1_256_sp(data, scratchbuf, ohash);
+	scrypt_1024_1_1_256_sp(data, scrypt_get_arena()->buf, ohash);
 	flip32(ohash, ohash);
 }
 
@@ -426,12 +625,10 @@ int scrypt_test(unsigned char *pdata, const unsigned char *ptarget, uint32_t non
 {
 	uint32_t tmp_hash7, Htarg = le32toh(((const uint32_t *)ptarget)[7]);
 	uint32_t data[20], ohash[8];
-	char *scratchbuf;
 
 	be32enc_vect(data, (const uint32_t *)pdata, 19);
 	data[19] = htobe32(nonce);
-	scratchbuf = alloca(SCRATCHBUF_SIZE);
-	scrypt_1024_1_1_256_sp(data, scratchbuf, ohash);
+	scrypt_1024_1_1_256_sp(data, scrypt_get_arena()->buf, ohash);
 	tmp_hash7 = be32toh(ohash[7]);
 
 	applog(LOG_DEBUG, "htarget %08lx diff1 %08lx hash %08lx",
@@ -445,47 +642,47 @@ int scrypt_test(unsigned char *pdata, const unsigned char *ptarget, uint32_t non
 	return 1;
 }
 
-bool scanhash_scrypt(struct thr_info *thr, const unsigned char __maybe_unused *pmidstate,
-		     unsigned char *pdata, unsigned char __maybe_unused *phash1,
-		     unsigned char __maybe_unused *phash, const unsigned char *ptarget,
-		     uint32_t max_nonce, uint32_t *last_nonce, uint32_t n)
-{
-	uint32_t *nonce = (uint32_t *)(pdata + 76);
-	char *scratchbuf;
-	uint32_t data[20];
-	uint32_t tmp_hash7;
-	uint32_t Htarg = le32toh(((const uint32_t *)ptarget)[7]);
-	bool ret = false;
-
-	be32enc_vect(data, (const uint32_t *)pdata, 19);
-
-	scratchbuf = malloc(SCRATCHBUF_SIZE);
-	if (unlikely(!scratchbuf)) {
-		applog(LOG_ERR, "Failed to malloc scratchbuf in scanhash_scrypt");
-		return ret;
-	}
-
-	while(1) {
-		uint32_t ostate[8];
-
-		*nonce = ++n;
-		data[19] = htobe32(n);
-		scrypt_1024_1_1_256_sp(data, scratchbuf, ostate);
-		tmp_hash7 = be32toh(ostate[7]);
-
-		if (unlikely(tmp_hash7 <= Htarg)) {
-			((uint32_t *)pdata)[19] = htobe32(n);
-			*last_nonce = n;
-			ret = true;
-			break;
-		}
+#define SCRYPT_BENCH_SECS 3
 
-		if (unlikely((n >= max_nonce) || thr->work_restart)) {
-			*last_nonce = n;
-			break;
-		}
+/* Compare the single and multi lane code on this cpu, checking they agree */
+void scrypt_benchmark(void)
+{
+	struct scrypt_arena *arena = scrypt_get_arena();
+	uint32_t data[SCRYPT_LANES][20], ostate[SCRYPT_LANES][8], ohash[8];
+	struct timeval tv_start, tv_now;
+	uint64_t single = 0, multi = 0;
+	double single_secs, multi_secs;
+	int i, l;
+
+	for (i = 0; i < 20; i++)
+		data[0][i] = rand();
+	for (l = 1; l < SCRYPT_LANES; l++)
+		memcpy(data[l], data[0], sizeof(data[0]));
+
+	cgtime(&tv_start);
+	do {
+		data[0][19] = single++;
+		scrypt_1024_1_1_256_sp(data[0], arena->buf, ohash);
+		cgtime(&tv_now);
+	} while ((single_secs = tdiff(&tv_now, &tv_start)) < SCRYPT_BENCH_SECS);
+
+	cgtime(&tv_start);
+	do {
+		for (l = 0; l < SCRYPT_LANES; l++)
+			data[l][19] = multi++;
+		scrypt_1024_1_1_256_sp_lanes(data[0], arena->buf, ostate);
+		cgtime(&tv_now);
+	} while ((multi_secs = tdiff(&tv_now, &tv_start)) < SCRYPT_BENCH_SECS);
+
+	for (l = 0; l < SCRYPT_LANES; l++) {
+		data[0][19] = data[l][19];
+		scrypt_1024_1_1_256_sp(data[0], arena->buf, ohash);
+		if (memcmp(ohash, ostate[l], sizeof(ohash)))
+			quit(1, "Scrypt benchmark lane %d hash does not match", l);
 	}
 
-	free(scratchbuf);;
-	return ret;
+	applog(LOG_WARNING, "Scrypt single lane: %.1f nonces/s", single / single_secs);
+	applog(LOG_WARNING, "Scrypt %d lanes: %.1f nonces/s (%.2fx)%s", SCRYPT_LANES,
+	       multi / multi_secs, (multi / multi_secs) / (single / single_secs),
+	       arena->huge ? " using huge pages" : "");
 }
@@ -7,6 +7,7 @@
 extern int scrypt_test(unsigned char *pdata, const unsigned char *ptarget,
 			uint32_t nonce);
 extern void scrypt_regenhash(struct work *work);
+extern void scrypt_benchmark(void);
 
 #else /* USE_SCRYPT */
 static inline int scrypt_test(__maybe_unused unsigned char *pdata,
@@ -19,6 +20,10 @@ static inline int scrypt_test(__maybe_unused unsigned char *pdata,
 static inline void scrypt_regenhash(__maybe_unused struct work *work)
 {
 }
+
+static inline void scrypt_benchmark(void)
+{
+}
 #endif /* USE_SCRYPT */
 
 #endif /* SCRYPT_H */
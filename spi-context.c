@@ -10,6 +10,7 @@
  */
 
 #include "spi-context.h"
+#include "spi-emu.h"
 
 #include "logging.h"
 #include "miner.h"
@@ -19,20 +20,17 @@
 #include <assert.h>
 #include <unistd.h>
 
-struct spi_ctx *spi_init(struct spi_config *config)
+static bool spidev_open(struct spi_ctx *ctx)
 {
+	struct spi_config *config = &ctx->config;
 	char dev_fname[PATH_MAX];
-	struct spi_ctx *ctx;
-
-	if (config == NULL)
-		return NULL;
 
 	sprintf(dev_fname, SPI_DEVICE_TEMPLATE, config->bus, config->cs_line);
 
 	int fd = open(dev_fname, O_RDWR);
 	if (fd < 0) {
 		applog(LOG_ERR, "SPI: Can not open SPI device %s", dev_fname);
-		return NULL;
+		return false;
 	}
 
 	if ((ioctl(fd, SPI_IOC_WR_MODE, &config->mode) < 0) ||
@@ -43,31 +41,20 @@ struct spi_ctx *spi_init(struct spi_config *config)
 	    (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &config->speed) < 0)) {
 		applog(LOG_ERR, "SPI: ioctl error on SPI device %s", dev_fname);
 		close(fd);
-		return NULL;
+		return false;
 	}
 
-	ctx = malloc(sizeof(*ctx));
-	assert(ctx != NULL);
-
 	ctx->fd = fd;
-	ctx->config = *config;
-	applog(LOG_WARNING, "SPI '%s': mode=%hhu, bits=%hhu, speed=%u",
-	       dev_fname, ctx->config.mode, ctx->config.bits,
-	       ctx->config.speed);
-	return ctx;
+	return true;
 }
 
-extern void spi_exit(struct spi_ctx *ctx)
+static void spidev_close(struct spi_ctx *ctx)
 {
-	if (NULL == ctx)
-		return;
-
 	close(ctx->fd);
-	free(ctx);
 }
 
-extern bool spi_transfer(struct spi_ctx *ctx, uint8_t *txbuf,
-			 uint8_t *rxbuf, int len)
+static bool spidev_transfer(struct spi_ctx *ctx, uint8_t *txbuf,
+			    uint8_t *rxbuf, int len)
 {
 	struct spi_ioc_transfer xfr;
 	int ret;
@@ -92,3 +79,90 @@ extern bool spi_transfer(struct spi_ctx *ctx, uint8_t *txbuf,
 
 	return ret > 0;
 }
+
+const struct spi_backend spidev_backend = {
+	.name = "spidev",
+	.open = spidev_open,
+	.close = spidev_close,
+	.transfer = spidev_transfer,
+};
+
+struct spi_ctx *spi_init(struct spi_config *config)
+{
+	const struct spi_backend *backend = &spidev_backend;
+	struct spi_ctx *ctx;
+
+	if (config == NULL)
+		return NULL;
+
+	if (opt_spi_emu != NULL)
+		backend = &spi_emu_backend;
+
+	ctx = malloc(sizeof(*ctx));
+	assert(ctx != NULL);
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->fd = -1;
+	ctx->config = *config;
+	ctx->backend = backend;
+	if (!backend->open(ctx)) {
+		free(ctx);
+		return NULL;
+	}
+
+	cgtime(&ctx->tv_start);
+	applog(LOG_WARNING, "SPI '" SPI_DEVICE_TEMPLATE "' (%s): mode=%hhu, "
+	       "bits=%hhu, speed=%u", ctx->config.bus, ctx->config.cs_line,
+	       backend->name, ctx->config.mode, ctx->config.bits,
+	       ctx->config.speed);
+	return ctx;
+}
+
+extern void spi_exit(struct spi_ctx *ctx)
+{
+	if (NULL == ctx)
+		return;
+
+	ctx->backend->close(ctx);
+	free(ctx);
+}
+
+extern bool spi_transfer(struct spi_ctx *ctx, uint8_t *txbuf,
+			 uint8_t *rxbuf, int len)
+{
+	struct timeval start, finish;
+	bool ret;
+
+	cgtime(&start);
+	ret = ctx->backend->transfer(ctx, txbuf, rxbuf, len);
+	cgtime(&finish);
+
+	ctx->transfers++;
+	ctx->bytes += len;
+	ctx->busy += tdiff(&finish, &start);
+	return ret;
+}
+
+extern struct api_data *spi_api_stats(struct spi_ctx *ctx,
+				      struct api_data *root)
+{
+	struct timeval now;
+	double elapsed, busy, wire;
+
+	cgtime(&now);
+	elapsed = tdiff(&now, &ctx->tv_start);
+	busy = wire = 0;
+	if (elapsed > 0) {
+		busy = ctx->busy / elapsed;
+		// Time the bytes take at the SPI clock
+		if (ctx->config.speed)
+			wire = (double)(ctx->bytes) * 8.0 /
+			       (double)(ctx->config.speed) / elapsed;
+	}
+
+	root = api_add_uint64(root, "SPI Transfers", &(ctx->transfers), true);
+	root = api_add_uint64(root, "SPI Bytes", &(ctx->bytes), true);
+	root = api_add_percent(root, "SPI Busy", &busy, true);
+	root = api_add_percent(root, "SPI Wire", &wire, true);
+	return root;
+}
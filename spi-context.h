@@ -5,6 +5,7 @@
 #include <linux/spi/spidev.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/time.h>
 
 #define SPI_DEVICE_TEMPLATE		"/dev/spidev%d.%d"
 #define DEFAULT_SPI_BUS			0
@@ -32,9 +33,32 @@ static const struct spi_config default_spi_config = {
 	.delay		= DEFAULT_SPI_DELAY_USECS,
 };
 
+struct spi_ctx;
+
+/* low level SPI access, spidev ioctl()s unless --spi-emu selects another */
+struct spi_backend {
+	const char *name;
+	/* open the device for ctx->config, returns false on failure */
+	bool (*open)(struct spi_ctx *ctx);
+	void (*close)(struct spi_ctx *ctx);
+	bool (*transfer)(struct spi_ctx *ctx, uint8_t *txbuf,
+			 uint8_t *rxbuf, int len);
+};
+
+extern const struct spi_backend spidev_backend;
+
 struct spi_ctx {
 	int fd;
 	struct spi_config config;
+	const struct spi_backend *backend;
+	/* backend private data */
+	void *priv;
+
+	/* bus usage since spi_init() */
+	struct timeval tv_start;
+	uint64_t transfers;
+	uint64_t bytes;
+	double busy;
 };
 
 /* create SPI context with given configuration, returns NULL on failure */
@@ -44,5 +68,9 @@ extern void spi_exit(struct spi_ctx *ctx);
 /* process RX/TX transfer, ensure buffers are long enough */
 extern bool spi_transfer(struct spi_ctx *ctx, uint8_t *txbuf,
 			 uint8_t *rxbuf, int len);
+struct api_data;
+/* add the bus usage stats to an API stats reply */
+extern struct api_data *spi_api_stats(struct spi_ctx *ctx,
+				      struct api_data *root);
 
 #endif /* SPI_CONTEXT_H */
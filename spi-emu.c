@@ -0,0 +1,567 @@
+/*
+ * SPI backend emulating a chain of Bitmine A1 chips
+ *
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+/*
+ This replaces the spidev ioctl()s of an SPI context with a chain of A1 chips
+ so the driver's detection, job queueing, result polling and flush code can
+ be load tested without a board.
+
+ Every command the driver sends is answered with the bytes the real chain
+ would shift back, at the same offsets (4 bytes per chip of chain delay) so
+ the driver's own ACK checks apply. Each chip has the A1's active and queued
+ job slot and hashes the active job at the configured rate, moving the
+ queued job up when it has done a full nonce range.
+ While a chip has a job it finds nonces for it at the diff 1 nonce rate of
+ its hashrate. The nonces are real solutions brute forced from the job's
+ midstate to the low emulator difficulty, which test_nonce() then uses, and
+ are only returned by READ_RESULT after the configured latency.
+ A RESET drops the jobs of every chip but, like the hardware, results
+ already found are still returned.
+*/
+
+#include "config.h"
+
+#include <ctype.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miner.h"
+#include "sha2.h"
+#include "spi-emu.h"
+
+#define EMU_MAX_CHIPS 64
+#define EMU_MAX_RESULTS 256
+
+#define EMU_DEF_CHIPS 8
+#define EMU_DEF_GHS 8.0
+#define EMU_DEF_LATENCY_mS 0
+#define EMU_DEF_HWERR 0.0
+// Roughly 4k sha256d per nonce found
+#define EMU_DEF_DIFF 0.000001
+
+// Cores reported by each chip, at least WEAK_CHIP_THRESHOLD
+#define EMU_CORES 32
+
+// Nonces owed to a chip beyond this are dropped and counted as overrun
+#define EMU_MAX_DUE 64.0
+
+#define EMU_NONCE_RANGE 4294967296.0
+
+// A1 commands, the same as enum A1_command in the driver
+#define EMU_BIST_START 0x01
+#define EMU_BIST_FIX 0x03
+#define EMU_RESET 0x04
+#define EMU_WRITE_JOB 0x07
+#define EMU_READ_RESULT 0x08
+#define EMU_WRITE_REG 0x09
+#define EMU_READ_REG 0x0a
+#define EMU_READ_REG_RESP 0x1a
+
+#define EMU_JOB_LENGTH 58
+
+// Largest command plus the delay of a full chain both ways
+#define EMU_STREAM (EMU_JOB_LENGTH + EMU_MAX_CHIPS * 8 + 16)
+
+double spi_emu_diff;
+
+struct emu_job {
+	bool valid;
+	uint8_t job_id;
+	uint32_t midstate[8];
+	// the last 12 bytes of the header as hashed
+	uint8_t tail[12];
+};
+
+struct emu_chip {
+	struct emu_job job[2];
+	uint8_t reg[6];
+	uint32_t nonce;
+	double hashes;
+	double nonces_due;
+};
+
+struct emu_result {
+	uint8_t chip;
+	uint8_t job_id;
+	uint32_t nonce;
+	struct timeval tv_due;
+};
+
+struct spi_emu {
+	int chips;
+	double chip_hashrate;
+	int latency_ms;
+	double hwerr;
+	double diff;
+
+	struct emu_chip chip[EMU_MAX_CHIPS];
+	uint8_t bcast_reg[6];
+
+	// Bytes shifted back by the chain for the current command
+	uint8_t stream[EMU_STREAM];
+	int stream_pos;
+
+	struct emu_result result[EMU_MAX_RESULTS];
+	int result_head;
+	int result_count;
+
+	struct timeval tv_last;
+	unsigned int seed;
+
+	uint64_t transfers;
+	uint64_t bytes;
+	uint64_t jobs;
+	uint64_t jobs_done;
+	uint64_t jobs_overwritten;
+	uint64_t resets;
+	uint64_t nonces;
+	uint64_t nonces_overrun;
+	uint64_t results_dropped;
+	uint64_t hw_injected;
+	uint64_t bf_hashes;
+};
+
+static char *emu_options[] = {
+	"Chips",
+	"ChipGHs",
+	"LatencymS",
+	"HWErrorPercent",
+	"Difficulty"
+};
+
+#define INVOP " Invalid Option "
+
+static void emu_get_options(struct spi_emu *emu)
+{
+	char *buf, *ptr, *colon;
+	int which, val;
+	double fval;
+
+	emu->chips = EMU_DEF_CHIPS;
+	emu->chip_hashrate = EMU_DEF_GHS * 1000000000.0;
+	emu->latency_ms = EMU_DEF_LATENCY_mS;
+	emu->hwerr = EMU_DEF_HWERR;
+	emu->diff = EMU_DEF_DIFF;
+
+	buf = strdup(opt_spi_emu);
+	if (unlikely(!buf))
+		quit(1, "Failed to strdup spi emu options");
+
+	which = 0;
+	ptr = buf;
+	while (ptr && *ptr) {
+		colon = strchr(ptr, ':');
+		if (colon)
+			*(colon++) = '\0';
+
+		if (*ptr && tolower(*ptr) != 'd') {
+			switch (which) {
+				case 0:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 1 || val > EMU_MAX_CHIPS) {
+						quit(1, "SPI EMU"INVOP"%s '%s' must be 1 <= %s <= %d",
+							emu_options[which], ptr,
+							emu_options[which], EMU_MAX_CHIPS);
+					}
+					emu->chips = val;
+					break;
+				case 1:
+					fval = atof(ptr);
+					if (fval <= 0.0) {
+						quit(1, "SPI EMU"INVOP"%s '%s' must be > 0",
+							emu_options[which], ptr);
+					}
+					emu->chip_hashrate = fval * 1000000000.0;
+					break;
+				case 2:
+					val = atoi(ptr);
+					if (!isdigit(*ptr) || val < 0 || val > 60000) {
+						quit(1, "SPI EMU"INVOP"%s '%s' must be 0 <= %s <= 60000",
+							emu_options[which], ptr,
+							emu_options[which]);
+					}
+					emu->latency_ms = val;
+					break;
+				case 3:
+					fval = atof(ptr);
+					if (fval < 0.0 || fval > 100.0) {
+						quit(1, "SPI EMU"INVOP"%s '%s' must be 0 <= %s <= 100",
+							emu_options[which], ptr,
+							emu_options[which]);
+					}
+					emu->hwerr = fval / 100.0;
+					break;
+				case 4:
+					fval = atof(ptr);
+					if (fval <= 0.0 || fval > 1.0) {
+						quit(1, "SPI EMU"INVOP"%s '%s' must be 0 < %s <= 1",
+							emu_options[which], ptr,
+							emu_options[which]);
+					}
+					emu->diff = fval;
+					break;
+				default:
+					break;
+			}
+		}
+		ptr = colon;
+		which++;
+	}
+	free(buf);
+}
+
+static bool emu_open(struct spi_ctx *ctx)
+{
+	struct spi_emu *emu;
+
+	emu = calloc(1, sizeof(*emu));
+	if (unlikely(!emu))
+		quit(1, "Failed to calloc spi emu");
+
+	emu_get_options(emu);
+	emu->seed = (unsigned int)time(NULL);
+	cgtime(&emu->tv_last);
+	spi_emu_diff = emu->diff;
+
+	applog(LOG_WARNING, "SPI EMU: Emulating %d A1 chips at %.3fGH/s each "
+	       "latency %dms hw %.2f%% diff %g", emu->chips,
+	       emu->chip_hashrate / 1000000000.0, emu->latency_ms,
+	       emu->hwerr * 100.0, emu->diff);
+
+	ctx->priv = emu;
+	return true;
+}
+
+static void emu_close(struct spi_ctx *ctx)
+{
+	free(ctx->priv);
+	ctx->priv = NULL;
+}
+
+/* Test nonce against the job, hashing on from the midstate as the chip does */
+static bool emu_test_nonce(struct spi_emu *emu, struct emu_job *job, uint32_t nonce)
+{
+	uint8_t tail[16], hash1[32], hash[32];
+	uint64_t *hash64 = (uint64_t *)(hash + 24), diff64;
+	sha256_ctx ctx;
+
+	memcpy(ctx.h, job->midstate, sizeof(ctx.h));
+	ctx.len = 0;
+	ctx.tot_len = 64;
+	memcpy(tail, job->tail, sizeof(job->tail));
+	tail[12] = nonce >> 24;
+	tail[13] = nonce >> 16;
+	tail[14] = nonce >> 8;
+	tail[15] = nonce;
+	sha256_update(&ctx, tail, sizeof(tail));
+	sha256_final(&ctx, hash1);
+	sha256(hash1, sizeof(hash1), hash);
+
+	diff64 = 0x00000000ffff0000ULL;
+	diff64 /= emu->diff;
+	return (le64toh(*hash64) <= diff64);
+}
+
+static void emu_find_nonce(struct spi_emu *emu, int chip, struct timeval *now)
+{
+	struct emu_chip *ch = &emu->chip[chip];
+	struct emu_result *result;
+	uint32_t nonce;
+
+	do {
+		nonce = ch->nonce++;
+		emu->bf_hashes++;
+	} while (!emu_test_nonce(emu, &ch->job[0], nonce));
+
+	emu->nonces++;
+	if (emu->result_count >= EMU_MAX_RESULTS) {
+		emu->results_dropped++;
+		return;
+	}
+
+	if (emu->hwerr > 0.0 &&
+	    (double)rand_r(&emu->seed) / (double)RAND_MAX < emu->hwerr) {
+		nonce ^= 1 << (rand_r(&emu->seed) % 32);
+		emu->hw_injected++;
+	}
+
+	result = &emu->result[(emu->result_head + emu->result_count) % EMU_MAX_RESULTS];
+	result->chip = chip + 1;
+	result->job_id = ch->job[0].job_id;
+	result->nonce = nonce;
+	copy_time(&result->tv_due, now);
+	result->tv_due.tv_sec += emu->latency_ms / 1000;
+	result->tv_due.tv_usec += (emu->latency_ms % 1000) * 1000;
+	if (result->tv_due.tv_usec >= 1000000) {
+		result->tv_due.tv_sec++;
+		result->tv_due.tv_usec -= 1000000;
+	}
+	emu->result_count++;
+}
+
+/* Hash the time since the last transfer on every chip */
+static void emu_update(struct spi_emu *emu)
+{
+	struct timeval now;
+	double elapsed;
+	int i;
+
+	cgtime(&now);
+	elapsed = tdiff(&now, &emu->tv_last);
+	copy_time(&emu->tv_last, &now);
+	if (elapsed <= 0)
+		return;
+
+	for (i = 0; i < emu->chips; i++) {
+		struct emu_chip *ch = &emu->chip[i];
+
+		if (!ch->job[0].valid)
+			continue;
+
+		ch->hashes += elapsed * emu->chip_hashrate;
+		ch->nonces_due += elapsed * emu->chip_hashrate / EMU_NONCE_RANGE;
+		if (ch->nonces_due > EMU_MAX_DUE) {
+			emu->nonces_overrun += (uint64_t)(ch->nonces_due - EMU_MAX_DUE);
+			ch->nonces_due = EMU_MAX_DUE;
+		}
+		while (ch->job[0].valid && ch->nonces_due >= 1.0) {
+			emu_find_nonce(emu, i, &now);
+			ch->nonces_due -= 1.0;
+		}
+
+		while (ch->job[0].valid && ch->hashes >= EMU_NONCE_RANGE) {
+			ch->hashes -= EMU_NONCE_RANGE;
+			ch->job[0] = ch->job[1];
+			ch->job[1].valid = false;
+			ch->nonce = 0;
+			emu->jobs_done++;
+		}
+		if (!ch->job[0].valid) {
+			ch->hashes = 0;
+			ch->nonces_due = 0;
+		}
+	}
+}
+
+static void emu_reset(struct spi_emu *emu)
+{
+	int i;
+
+	for (i = 0; i < emu->chips; i++) {
+		emu->chip[i].job[0].valid = false;
+		emu->chip[i].job[1].valid = false;
+		emu->chip[i].hashes = 0;
+		emu->chip[i].nonces_due = 0;
+	}
+	emu->resets++;
+}
+
+static void emu_write_job(struct spi_emu *emu, uint8_t *tx)
+{
+	struct emu_chip *ch = &emu->chip[tx[1] - 1];
+	struct emu_job *job;
+	uint8_t midstate[32];
+
+	if (!ch->job[0].valid)
+		job = &ch->job[0];
+	else {
+		if (ch->job[1].valid)
+			emu->jobs_overwritten++;
+		job = &ch->job[1];
+	}
+
+	job->valid = true;
+	job->job_id = tx[0] >> 4;
+	swab256(midstate, tx + 2);
+	memcpy(job->midstate, midstate, sizeof(job->midstate));
+	memcpy(job->tail, tx + 34, sizeof(job->tail));
+	if (job == &ch->job[0])
+		ch->nonce = 0;
+	emu->jobs++;
+}
+
+/* Bytes set by chip 'chip' are shifted back after 4 bytes per chip */
+#define EMU_ACK(_chip) ((_chip) ? 4 * (_chip) - 2 : 4 * emu->chips)
+
+/* Set up the stream of bytes the chain returns for the command in tx */
+static void emu_command(struct spi_emu *emu, uint8_t *tx, int len)
+{
+	uint8_t *out = emu->stream;
+	uint8_t cmd = tx[0] & 0x0f, chip = tx[1];
+	struct emu_result *result;
+	struct timeval now;
+	int off;
+
+	memset(emu->stream, 0, sizeof(emu->stream));
+	emu->stream_pos = 0;
+
+	if (chip > emu->chips)
+		return;
+
+	switch (cmd) {
+		case EMU_BIST_START:
+			/*
+			 * The driver only looks at the first 2 bytes of the
+			 * 6 it sends, then 2 bytes at a time for the echo
+			 * followed by the number of chips
+			 */
+			off = (emu->chips == 1) ? 0 : 4 * emu->chips - 2;
+			out[off] = EMU_BIST_START;
+			out[off + 1] = 0;
+			off = (off == 0) ? 6 : off + 2;
+			out[off + 1] = emu->chips;
+			break;
+		case EMU_BIST_FIX:
+		case EMU_RESET:
+			if (cmd == EMU_RESET)
+				emu_reset(emu);
+			off = EMU_ACK(0);
+			out[off] = cmd;
+			out[off + 1] = 0;
+			break;
+		case EMU_WRITE_REG:
+			if (len < 8)
+				return;
+			if (chip == 0) {
+				int i;
+
+				memcpy(emu->bcast_reg, tx + 2, sizeof(emu->bcast_reg));
+				for (i = 0; i < emu->chips; i++)
+					memcpy(emu->chip[i].reg, tx + 2, sizeof(emu->chip[i].reg));
+			} else
+				memcpy(emu->chip[chip - 1].reg, tx + 2, sizeof(emu->chip[0].reg));
+			off = EMU_ACK(chip);
+			out[off] = cmd;
+			out[off + 1] = chip;
+			break;
+		case EMU_READ_REG:
+			off = EMU_ACK(chip);
+			out[off] = EMU_READ_REG_RESP;
+			out[off + 1] = chip;
+			if (chip == 0) {
+				out[off + 2] = emu->bcast_reg[0];
+				out[off + 3] = emu->bcast_reg[1];
+			} else {
+				struct emu_chip *ch = &emu->chip[chip - 1];
+
+				out[off + 2] = ch->reg[0];
+				out[off + 3] = ch->reg[1];
+				// Job slot states and ids
+				out[off + 5] = (ch->job[0].valid ? 1 : 0) |
+					       (ch->job[1].valid ? 2 : 0);
+				out[off + 6] = (ch->job[1].valid ? ch->job[1].job_id << 4 : 0) |
+					       (ch->job[0].valid ? ch->job[0].job_id : 0);
+			}
+			// PLL locked
+			out[off + 4] = 0x01;
+			out[off + 7] = EMU_CORES;
+			break;
+		case EMU_WRITE_JOB:
+			if (chip == 0 || len < EMU_JOB_LENGTH)
+				return;
+			emu_write_job(emu, tx);
+			off = EMU_ACK(chip);
+			out[off] = tx[0];
+			out[off + 1] = tx[1];
+			break;
+		case EMU_READ_RESULT:
+			off = EMU_ACK(0);
+			out[off] = EMU_READ_RESULT;
+			if (!emu->result_count)
+				break;
+			result = &emu->result[emu->result_head];
+			cgtime(&now);
+			if (tdiff(&now, &result->tv_due) < 0)
+				break;
+			out[off] |= result->job_id << 4;
+			out[off + 1] = result->chip;
+			out[off + 2] = result->nonce >> 24;
+			out[off + 3] = result->nonce >> 16;
+			out[off + 4] = result->nonce >> 8;
+			out[off + 5] = result->nonce;
+			emu->result_head = (emu->result_head + 1) % EMU_MAX_RESULTS;
+			emu->result_count--;
+			break;
+		default:
+			break;
+	}
+}
+
+static bool emu_transfer(struct spi_ctx *ctx, uint8_t *txbuf,
+			 uint8_t *rxbuf, int len)
+{
+	struct spi_emu *emu = ctx->priv;
+	int i;
+
+	emu->transfers++;
+	emu->bytes += len;
+
+	emu_update(emu);
+
+	// Any write starts a new command, all zeros being a flush
+	if (txbuf != NULL)
+		emu_command(emu, txbuf, len);
+
+	if (rxbuf != NULL) {
+		for (i = 0; i < len; i++) {
+			if (emu->stream_pos < EMU_STREAM)
+				rxbuf[i] = emu->stream[emu->stream_pos++];
+			else
+				rxbuf[i] = 0;
+		}
+	} else
+		emu->stream_pos += len;
+
+	return true;
+}
+
+const struct spi_backend spi_emu_backend = {
+	.name = "emu",
+	.open = emu_open,
+	.close = emu_close,
+	.transfer = emu_transfer,
+};
+
+struct api_data *spi_emu_api_stats(struct spi_ctx *ctx, struct api_data *root)
+{
+	struct spi_emu *emu;
+	double ghs, wire;
+
+	if (ctx == NULL || ctx->backend != &spi_emu_backend)
+		return root;
+
+	emu = ctx->priv;
+	ghs = emu->chip_hashrate / 1000000000.0;
+	// Time the bytes would have taken on the SPI clock
+	wire = ctx->config.speed ? (double)(emu->bytes) * 8.0 / (double)(ctx->config.speed) : 0;
+
+	root = api_add_int(root, "Emu Chips", &(emu->chips), true);
+	root = api_add_double(root, "Emu Chip GHs", &ghs, true);
+	root = api_add_int(root, "Emu Latency mS", &(emu->latency_ms), true);
+	root = api_add_double(root, "Emu HW Error Rate", &(emu->hwerr), true);
+	root = api_add_diff(root, "Emu Diff", &(emu->diff), true);
+	root = api_add_uint64(root, "Emu Transfers", &(emu->transfers), true);
+	root = api_add_uint64(root, "Emu Bytes", &(emu->bytes), true);
+	root = api_add_double(root, "Emu Wire Secs", &wire, true);
+	root = api_add_uint64(root, "Emu Jobs", &(emu->jobs), true);
+	root = api_add_uint64(root, "Emu Jobs Done", &(emu->jobs_done), true);
+	root = api_add_uint64(root, "Emu Jobs Overwritten", &(emu->jobs_overwritten), true);
+	root = api_add_uint64(root, "Emu Resets", &(emu->resets), true);
+	root = api_add_uint64(root, "Emu Nonces", &(emu->nonces), true);
+	root = api_add_uint64(root, "Emu Nonces Overrun", &(emu->nonces_overrun), true);
+	root = api_add_uint64(root, "Emu Results Dropped", &(emu->results_dropped), true);
+	root = api_add_int(root, "Emu Results Pending", &(emu->result_count), true);
+	root = api_add_uint64(root, "Emu HW Injected", &(emu->hw_injected), true);
+	root = api_add_uint64(root, "Emu BF Hashes", &(emu->bf_hashes), true);
+
+	return root;
+}
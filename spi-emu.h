@@ -0,0 +1,19 @@
+#ifndef SPI_EMU_H
+#define SPI_EMU_H
+
+#include "spi-context.h"
+
+/*
+ * In process emulation of a chain of Bitmine A1 chips behind the SPI
+ * context, selected with --spi-emu instead of /dev/spidev*
+ */
+extern const struct spi_backend spi_emu_backend;
+
+/* nonces from emulated chips are only valid at this diff, 0 if unused */
+extern double spi_emu_diff;
+
+/* add the emulator stats to an API stats reply */
+extern struct api_data *spi_emu_api_stats(struct spi_ctx *ctx,
+					  struct api_data *root);
+
+#endif /* SPI_EMU_H */
@@ -0,0 +1,709 @@
+#!/usr/bin/env python3
+
+# Copyright 2026 agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 3 of the License, or (at your option) any later
+# version.  See COPYING for more details.
+
+# A local stratum pool stand-in for testing and benchmarking the cgminer
+# stratum code without a live pool.
+#
+# It issues mining.notify at a configurable rate with a new block (clean jobs)
+# every so often, validates every submitted share (sha256d against the job and
+# the difficulty that was in force when the job was sent), and can inject
+# mining.set_difficulty changes, client.reconnect requests and dropped
+# connections.
+#
+# Server only:
+#	./stratum-sim.py --port 3333 --diff 0.000001 --notify 5 --block 60
+#	./cgminer --sha256 -o stratum+tcp://127.0.0.1:3333 -u x -p x ...
+#
+# Benchmark, drive a cgminer built with --enable-sim against it and report the
+# work generation rate, share latency and stale percentage:
+#	./stratum-sim.py --bench 60 --cgminer ./cgminer --sim-options 4:32:2
+#
+# With --gbt it is instead a bitcoind stand-in for GBT solo mining serving
+# getblocktemplate with --txns synthetic transactions and a new block every
+# --block seconds, replacing --churn percent of the transactions every --notify
+# seconds. Submitted blocks are fully checked (merkle root from the coinbase
+# and the template's transactions, and the target) but don't extend the chain:
+#	./stratum-sim.py --gbt --txns 3000 --bench 60 --sim-options 2:8:2
+#
+# Record a series of templates for cgminer --gbt-benchmark:
+#	./stratum-sim.py --gbt --txns 3000 --churn 5 --record templates.json
+#
+# Use --help for all the options
+
+import argparse
+import hashlib
+import http.server
+import json
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+DIFF1 = 0x00000000ffff0000000000000000000000000000000000000000000000000000
+
+def dsha(data):
+	return hashlib.sha256(hashlib.sha256(data).digest()).digest()
+
+# Byte swap each 32 bit word, the stratum header fields are sent this way
+def swap32(data):
+	return b''.join(data[i:i+4][::-1] for i in range(0, len(data), 4))
+
+def hexs(data):
+	return data.hex()
+
+class Job:
+	def __init__(self, job_id, prevhash, diff, clean):
+		self.job_id = job_id
+		self.prevhash = prevhash
+		self.diff = diff
+		self.clean = clean
+		self.sent = time.time()
+		self.version = struct.pack('>I', 2)
+		self.nbits = bytes.fromhex('1900896c')
+		self.ntime = struct.pack('>I', int(self.sent))
+		tag = os.urandom(8)
+		self.coinb1 = bytes.fromhex('01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff20') + tag
+		self.coinb2 = bytes.fromhex('ffffffff0100f2052a010000001976a914') + os.urandom(20) + bytes.fromhex('88ac00000000')
+		self.branches = [os.urandom(32) for i in range(random.randint(2, 12))]
+
+	def notify(self):
+		return {'id': None, 'method': 'mining.notify', 'params': [
+			self.job_id, hexs(swap32(self.prevhash)), hexs(self.coinb1),
+			hexs(self.coinb2), [hexs(b) for b in self.branches],
+			hexs(self.version), hexs(self.nbits), hexs(self.ntime),
+			self.clean]}
+
+	def check(self, nonce1, nonce2, ntime, nonce):
+		coinbase = self.coinb1 + nonce1 + nonce2 + self.coinb2
+		root = dsha(coinbase)
+		for branch in self.branches:
+			root = dsha(root + branch)
+		header = swap32(self.version) + self.prevhash + root + \
+			 swap32(ntime) + swap32(self.nbits) + swap32(nonce)
+		return int.from_bytes(dsha(header), 'little')
+
+class Stats:
+	def __init__(self):
+		self.lock = threading.Lock()
+		self.notifies = 0
+		self.blocks = 0
+		self.submits = 0
+		self.accepted = 0
+		self.stale = 0
+		self.dup = 0
+		self.lowdiff = 0
+		self.invalid = 0
+		self.job_age = 0.0
+		self.job_age_max = 0.0
+		self.reconnects = 0
+		self.drops = 0
+		self.diff_changes = 0
+		self.clients = 0
+		self.start = time.time()
+
+	def add(self, name, val=1):
+		with self.lock:
+			setattr(self, name, getattr(self, name) + val)
+
+	def line(self):
+		el = max(time.time() - self.start, 0.001)
+		with self.lock:
+			sub = max(self.submits, 1)
+			return ('%.0fs clients %d notify %d (%.2f/s) blocks %d submits %d (%.1f/s)'
+				' accepted %d stale %d (%.2f%%) dup %d lowdiff %d invalid %d'
+				' job age av %.3fs max %.3fs reconnects %d drops %d diffs %d' %
+				(el, self.clients, self.notifies, self.notifies / el, self.blocks,
+				 self.submits, self.submits / el, self.accepted, self.stale,
+				 100.0 * self.stale / sub, self.dup, self.lowdiff, self.invalid,
+				 self.job_age / sub, self.job_age_max, self.reconnects,
+				 self.drops, self.diff_changes))
+
+class Pool:
+	def __init__(self, args):
+		self.args = args
+		self.stats = Stats()
+		self.lock = threading.Lock()
+		self.clients = []
+		self.jobs = {}
+		self.job = None
+		self.next_job = 1
+		self.next_nonce1 = random.randint(0, 0xffffff)
+		self.diffs = [float(d) for d in args.diff.split(',')]
+		self.diff_idx = 0
+		self.new_job(True)
+
+	def diff(self):
+		return self.diffs[self.diff_idx]
+
+	def new_job(self, clean):
+		with self.lock:
+			if clean or self.job is None:
+				prevhash = os.urandom(28) + b'\0\0\0\0'
+				self.jobs = {}
+				self.stats.add('blocks')
+			else:
+				prevhash = self.job.prevhash
+			job = Job('%x' % self.next_job, prevhash, self.diff(), clean)
+			self.next_job += 1
+			self.jobs[job.job_id] = job
+			self.job = job
+			# Keep the job history bounded like a real pool
+			if len(self.jobs) > 32:
+				del self.jobs[min(self.jobs, key=lambda j: self.jobs[j].sent)]
+			clients = list(self.clients)
+		for client in clients:
+			client.send_job(job)
+
+	def change_diff(self):
+		with self.lock:
+			self.diff_idx = (self.diff_idx + 1) % len(self.diffs)
+			clients = list(self.clients)
+		self.stats.add('diff_changes')
+		for client in clients:
+			client.send_diff()
+		self.new_job(False)
+
+	def alloc_nonce1(self):
+		with self.lock:
+			self.next_nonce1 = (self.next_nonce1 + 1) & 0xffffffff
+			return struct.pack('>I', self.next_nonce1)
+
+	def add(self, client):
+		with self.lock:
+			self.clients.append(client)
+		self.stats.add('clients')
+
+	def remove(self, client):
+		with self.lock:
+			if client in self.clients:
+				self.clients.remove(client)
+				self.stats.add('clients', -1)
+
+	def find_job(self, job_id):
+		with self.lock:
+			return self.jobs.get(job_id)
+
+	def random_client(self):
+		with self.lock:
+			if not self.clients:
+				return None
+			return random.choice(self.clients)
+
+class Client(threading.Thread):
+	def __init__(self, pool, sock):
+		threading.Thread.__init__(self)
+		self.daemon = True
+		self.pool = pool
+		self.sock = sock
+		self.wlock = threading.Lock()
+		self.nonce1 = pool.alloc_nonce1()
+		self.subscribed = False
+		self.seen = set()
+		self.jobs = set()
+
+	def send(self, msg):
+		data = (json.dumps(msg) + '\n').encode()
+		try:
+			with self.wlock:
+				self.sock.sendall(data)
+		except OSError:
+			self.close()
+
+	def send_diff(self):
+		if self.subscribed:
+			self.send({'id': None, 'method': 'mining.set_difficulty', 'params': [self.pool.diff()]})
+
+	def send_job(self, job):
+		if self.subscribed:
+			self.jobs.add(job.job_id)
+			self.send(job.notify())
+			self.pool.stats.add('notifies')
+
+	def reconnect(self):
+		self.send({'id': None, 'method': 'client.reconnect', 'params': []})
+		self.pool.stats.add('reconnects')
+
+	def close(self):
+		self.pool.remove(self)
+		try:
+			self.sock.shutdown(socket.SHUT_RDWR)
+		except OSError:
+			pass
+		self.sock.close()
+
+	def reply(self, msg_id, result, error=None):
+		self.send({'id': msg_id, 'result': result, 'error': error})
+
+	def submit(self, msg_id, params):
+		stats = self.pool.stats
+		stats.add('submits')
+		try:
+			job_id, nonce2, ntime, nonce = params[1], bytes.fromhex(params[2]), \
+				bytes.fromhex(params[3]), bytes.fromhex(params[4])
+		except (IndexError, ValueError, TypeError):
+			stats.add('invalid')
+			return self.reply(msg_id, None, [20, 'Invalid params', None])
+
+		# Jobs are only valid on the connection they were sent to
+		job = self.pool.find_job(job_id)
+		if job is None or job_id not in self.jobs:
+			stats.add('stale')
+			return self.reply(msg_id, None, [21, 'Stale', None])
+
+		age = time.time() - job.sent
+		with stats.lock:
+			stats.job_age += age
+			if age > stats.job_age_max:
+				stats.job_age_max = age
+
+		key = (job_id, nonce2, ntime, nonce)
+		if key in self.seen:
+			stats.add('dup')
+			return self.reply(msg_id, None, [22, 'Duplicate share', None])
+		self.seen.add(key)
+
+		if len(nonce2) != self.pool.args.n2size or len(ntime) != 4 or len(nonce) != 4:
+			stats.add('invalid')
+			return self.reply(msg_id, None, [20, 'Invalid share size', None])
+
+		value = job.check(self.nonce1, nonce2, ntime, nonce)
+		# Accept a share that meets either the job diff or the current diff
+		if value > DIFF1 / job.diff and value > DIFF1 / self.pool.diff():
+			stats.add('lowdiff')
+			return self.reply(msg_id, None, [23, 'Low difficulty share', None])
+
+		stats.add('accepted')
+		self.reply(msg_id, True)
+
+	def handle(self, msg):
+		method = msg.get('method')
+		msg_id = msg.get('id')
+		params = msg.get('params') or []
+
+		if method == 'mining.subscribe':
+			self.reply(msg_id, [[['mining.set_difficulty', 'b4b6693b72a50c7116db18d6497cac52'],
+					     ['mining.notify', 'ae6812eb4cd7735a302a8a9dd95cf71f']],
+					    hexs(self.nonce1), self.pool.args.n2size])
+			self.subscribed = True
+			self.send_diff()
+			with self.pool.lock:
+				job = self.pool.job
+			self.send_job(job)
+		elif method == 'mining.authorize':
+			self.reply(msg_id, True)
+		elif method == 'mining.submit':
+			self.submit(msg_id, params)
+		elif msg_id is not None and method is not None:
+			self.reply(msg_id, None, [20, 'Unsupported method', None])
+
+	def run(self):
+		self.pool.add(self)
+		buf = b''
+		try:
+			while True:
+				data = self.sock.recv(65536)
+				if not data:
+					break
+				buf += data
+				while b'\n' in buf:
+					line, buf = buf.split(b'\n', 1)
+					if not line.strip():
+						continue
+					try:
+						msg = json.loads(line.decode())
+					except ValueError:
+						continue
+					self.handle(msg)
+		except OSError:
+			pass
+		self.close()
+
+def every(interval, func, stop):
+	if interval <= 0:
+		return
+	def loop():
+		while not stop.wait(interval):
+			func()
+	thread = threading.Thread(target=loop)
+	thread.daemon = True
+	thread.start()
+
+def varint(data, pos):
+	val = data[pos]
+	if val < 0xfd:
+		return val, pos + 1
+	size = {0xfd: 2, 0xfe: 4, 0xff: 8}[val]
+	return int.from_bytes(data[pos + 1:pos + 1 + size], 'little'), pos + 1 + size
+
+# Returns the length of the serialised transaction at pos
+def txn_len(data, pos):
+	start = pos
+	pos += 4
+	count, pos = varint(data, pos)
+	for i in range(count):
+		pos += 36
+		size, pos = varint(data, pos)
+		pos += size + 4
+	count, pos = varint(data, pos)
+	for i in range(count):
+		pos += 8
+		size, pos = varint(data, pos)
+		pos += size
+	return pos + 4 - start
+
+def merkle_root(hashes):
+	while len(hashes) > 1:
+		if len(hashes) % 2:
+			hashes.append(hashes[-1])
+		hashes = [dsha(hashes[i] + hashes[i + 1]) for i in range(0, len(hashes), 2)]
+	return hashes[0]
+
+class Node:
+	def __init__(self, args):
+		self.args = args
+		self.stats = Stats()
+		self.lock = threading.Lock()
+		self.height = 300000
+		self.target = int(DIFF1 / float(args.diff.split(',')[0]))
+		self.new_block()
+
+	def new_txn(self):
+		data = os.urandom(random.randint(150, 400))
+		return (data, dsha(data))
+
+	def new_block(self):
+		txns = [self.new_txn() for i in range(self.args.txns)]
+		with self.lock:
+			self.height += 1
+			self.prevhash = os.urandom(28) + b'\0\0\0\0'
+			self.txns = txns
+			self.txn_data = b''.join(t[0] for t in txns)
+			self.mempools = {self.txn_data: txns}
+		self.stats.add('blocks')
+
+	# Like a mempool, some transactions leave and new ones arrive anywhere in
+	# the template's fee order
+	def churn(self):
+		with self.lock:
+			txns = list(self.txns)
+		count = min(int(len(txns) * self.args.churn / 100.0), len(txns))
+		for i in range(count):
+			del txns[random.randrange(len(txns))]
+		for i in range(count):
+			txns.insert(random.randint(0, len(txns)), self.new_txn())
+		with self.lock:
+			self.txns = txns
+			self.txn_data = b''.join(t[0] for t in txns)
+			self.mempools[self.txn_data] = txns
+
+	def txn_json(self, txn):
+		if self.args.no_txids:
+			return {'data': hexs(txn[0])}
+		return {'data': hexs(txn[0]), 'txid': hexs(txn[1][::-1]), 'hash': hexs(txn[1][::-1])}
+
+	def template(self):
+		with self.lock:
+			txns = self.txns
+			tmpl = {'version': 2, 'previousblockhash': hexs(self.prevhash[::-1]),
+				'transactions': [self.txn_json(t) for t in txns],
+				'coinbaseaux': {'flags': ''}, 'coinbasevalue': 2500000000,
+				'target': '%064x' % self.target, 'mintime': int(time.time()) - 600,
+				'mutable': ['time', 'transactions', 'prevblock'],
+				'noncerange': '00000000ffffffff', 'sigoplimit': 20000,
+				'sizelimit': 1000000, 'curtime': int(time.time()),
+				'bits': '1d00ffff', 'height': self.height}
+		self.stats.add('notifies')
+		return tmpl
+
+	def submitblock(self, block):
+		stats = self.stats
+		stats.add('submits')
+		header = block[:80]
+		with self.lock:
+			prevhash, mempools = self.prevhash, self.mempools
+		if header[4:36] != prevhash:
+			stats.add('stale')
+			return 'stale-prevblk'
+		try:
+			count, pos = varint(block, 80)
+			cblen = txn_len(block, pos)
+		except (IndexError, KeyError):
+			stats.add('invalid')
+			return 'bad-txns'
+		coinbase = block[pos:pos + cblen]
+		# Any template issued since the last block is still valid
+		txns = mempools.get(block[pos + cblen:])
+		if txns is None or count != len(txns) + 1:
+			stats.add('invalid')
+			return 'bad-txns'
+		if merkle_root([dsha(coinbase)] + [t[1] for t in txns]) != header[36:68]:
+			stats.add('invalid')
+			return 'bad-txnmrklroot'
+		if int.from_bytes(dsha(header), 'little') > self.target:
+			stats.add('lowdiff')
+			return 'high-hash'
+		stats.add('accepted')
+		return None
+
+	def call(self, method, params):
+		if method == 'getblocktemplate':
+			return self.template()
+		if method == 'validateaddress':
+			return {'isvalid': True, 'address': params[0]}
+		if method == 'getblockcount':
+			return self.height - 1
+		if method == 'getblockhash':
+			return hexs(self.prevhash[::-1])
+		if method == 'submitblock':
+			return self.submitblock(bytes.fromhex(params[0]))
+		raise KeyError(method)
+
+class RPCHandler(http.server.BaseHTTPRequestHandler):
+	# cgminer's libcurl sends its requests chunked
+	def body(self):
+		if self.headers.get('Transfer-Encoding', '').lower() != 'chunked':
+			return self.rfile.read(int(self.headers['Content-Length']))
+		data = b''
+		while True:
+			size = int(self.rfile.readline().split(b';')[0], 16)
+			data += self.rfile.read(size)
+			self.rfile.readline()
+			if not size:
+				return data
+
+	def do_POST(self):
+		node = self.server.node
+		try:
+			req = json.loads(self.body().decode())
+			reply = {'id': req.get('id'), 'error': None,
+				 'result': node.call(req['method'], req.get('params') or [])}
+		except (ValueError, KeyError, IndexError, TypeError):
+			reply = {'id': None, 'result': None,
+				 'error': {'code': -32601, 'message': 'Method not found'}}
+		data = json.dumps(reply).encode()
+		self.send_response(200)
+		self.send_header('Content-Type', 'application/json')
+		self.send_header('Content-Length', str(len(data)))
+		self.end_headers()
+		self.wfile.write(data)
+
+	def log_message(self, *args):
+		pass
+
+def serve_gbt(args, stop):
+	node = Node(args)
+	server = http.server.ThreadingHTTPServer((args.host, args.port), RPCHandler)
+	server.daemon_threads = True
+	server.node = node
+
+	every(args.block, node.new_block, stop)
+	every(args.notify, node.churn, stop)
+	if not args.quiet:
+		every(args.report, lambda: sys.stderr.write(node.stats.line() + '\n'), stop)
+
+	thread = threading.Thread(target=server.serve_forever)
+	thread.daemon = True
+	thread.start()
+	return node
+
+def record_gbt(args):
+	node = Node(args)
+	with open(args.record, 'w') as f:
+		for i in range(args.templates):
+			if i:
+				node.churn()
+			f.write(json.dumps(node.template()) + '\n')
+	sys.stderr.write('Recorded %d templates of %d transactions to %s\n' %
+			 (args.templates, args.txns, args.record))
+
+def inject_reconnect(pool):
+	client = pool.random_client()
+	if client:
+		client.reconnect()
+
+def inject_drop(pool):
+	client = pool.random_client()
+	if client:
+		pool.stats.add('drops')
+		client.close()
+
+def serve(args, stop):
+	pool = Pool(args)
+	listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	listener.bind((args.host, args.port))
+	listener.listen(64)
+	listener.settimeout(0.5)
+
+	every(args.notify, lambda: pool.new_job(False), stop)
+	every(args.block, lambda: pool.new_job(True), stop)
+	every(args.diff_change, pool.change_diff, stop)
+	every(args.reconnect, lambda: inject_reconnect(pool), stop)
+	every(args.drop, lambda: inject_drop(pool), stop)
+	if not args.quiet:
+		every(args.report, lambda: sys.stderr.write(pool.stats.line() + '\n'), stop)
+
+	def accept():
+		while not stop.is_set():
+			try:
+				sock, addr = listener.accept()
+			except socket.timeout:
+				continue
+			except OSError:
+				break
+			sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+			Client(pool, sock).start()
+		listener.close()
+
+	thread = threading.Thread(target=accept)
+	thread.daemon = True
+	thread.start()
+	return pool
+
+def api(port, command, parameter='', reply=True):
+	sock = socket.create_connection(('127.0.0.1', port), timeout=10)
+	sock.sendall(json.dumps({'command': command, 'parameter': parameter}).encode())
+	data = b''
+	while True:
+		more = sock.recv(65536)
+		if not more:
+			break
+		data += more
+	sock.close()
+	if not reply:
+		return None
+	return json.loads(data.decode().rstrip('\0'))
+
+def bench(args):
+	stop = threading.Event()
+	args.quiet = True
+	if args.gbt:
+		pool = serve_gbt(args, stop)
+		url = 'http://%s:%d' % (args.host, args.port)
+	else:
+		pool = serve(args, stop)
+		url = 'stratum+tcp://%s:%d' % (args.host, args.port)
+
+	cmd = [args.cgminer, '--sha256', '-T', '--real-quiet',
+	       '-o', url, '-u', 'bench', '-p', 'x',
+	       '--api-listen', '--api-port', str(args.api_port), '--api-allow', 'W:127.0.0.1']
+	if args.gbt:
+		cmd += ['--btc-address', args.btc_address]
+	if args.sim_options:
+		cmd += ['--sim-options', args.sim_options]
+	cmd += args.cgminer_args
+	sys.stderr.write('Running %s for %ds\n' % (' '.join(cmd), args.bench))
+	miner = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+	try:
+		time.sleep(args.bench)
+		summary = api(args.api_port, 'summary')['SUMMARY'][0]
+		stats = api(args.api_port, 'stats')['STATS']
+		pools = api(args.api_port, 'pools')['POOLS']
+		api(args.api_port, 'quit', reply=False)
+	finally:
+		stop.set()
+		try:
+			miner.wait(timeout=10)
+		except subprocess.TimeoutExpired:
+			miner.kill()
+
+	pool_stats = [s for s in stats if s.get('ID', '').startswith('POOL')]
+	elapsed = max(summary['Elapsed'], 1)
+	print('Server: ' + pool.stats.line())
+	print('Elapsed %ds hashrate %.2f GH/s' % (elapsed, summary['MHS av'] / 1000.0))
+	print('Work generated %d (%.1f/s) notifies received %d' %
+	      (summary['Local Work'], summary['Local Work'] / float(elapsed), summary['Getworks']))
+	print('Shares accepted %d rejected %d stale discarded %d HW errors %d' %
+	      (summary['Accepted'], summary['Rejected'], summary['Stale'],
+	       summary['Hardware Errors']))
+	print('Pool stale %.2f%% pool rejected %.2f%%' %
+	      (summary['Pool Stale%'], summary['Pool Rejected%']))
+	for ps in pool_stats:
+		print('%s share latency av %.4fs max %.4fs over %d results' %
+		      (ps['ID'], ps['Share Latency Av'], ps['Share Latency Max'], ps['Share Results']))
+		if ps['Templates']:
+			print('%s %d templates of %d txns processed av %.3fms max %.3fms' %
+			      (ps['ID'], ps['Templates'], ps['Template Txns'],
+			       ps['Template Time Av'] * 1000.0, ps['Template Time Max'] * 1000.0))
+	for p in pools:
+		print('Pool %d stratum active %s last share diff %s accepted %d stale %d' %
+		      (p['POOL'], p['Stratum Active'], p['Last Share Difficulty'],
+		       p['Accepted'], p['Stale']))
+
+def main():
+	parser = argparse.ArgumentParser(description='Local stratum pool simulator')
+	parser.add_argument('--host', default='127.0.0.1')
+	parser.add_argument('--port', type=int, default=3333)
+	parser.add_argument('--diff', default='0.000001',
+			    help='share difficulty, or a comma list cycled by --diff-change')
+	parser.add_argument('--n2size', type=int, default=4, help='nonce2 size in bytes')
+	parser.add_argument('--notify', type=float, default=5.0,
+			    help='seconds between non clean notifies, 0 for none')
+	parser.add_argument('--block', type=float, default=60.0,
+			    help='seconds between new blocks (clean notifies), 0 for none')
+	parser.add_argument('--diff-change', type=float, default=0.0,
+			    help='seconds between difficulty changes, 0 for none')
+	parser.add_argument('--reconnect', type=float, default=0.0,
+			    help='seconds between client.reconnect requests, 0 for none')
+	parser.add_argument('--drop', type=float, default=0.0,
+			    help='seconds between dropping a connection, 0 for none')
+	parser.add_argument('--report', type=float, default=10.0,
+			    help='seconds between stats lines on stderr')
+	parser.add_argument('--quiet', action='store_true')
+	parser.add_argument('--bench', type=int, default=0,
+			    help='run cgminer against the simulator for this many seconds and report')
+	parser.add_argument('--cgminer', default='./cgminer')
+	parser.add_argument('--sim-options', default='d',
+			    help='cgminer --sim-options for the simulated devices')
+	parser.add_argument('--api-port', type=int, default=4029)
+	parser.add_argument('--gbt', action='store_true',
+			    help='be a bitcoind stand-in for GBT solo mining instead of a stratum pool')
+	parser.add_argument('--txns', type=int, default=3000,
+			    help='transactions in each GBT template')
+	parser.add_argument('--churn', type=float, default=5.0,
+			    help='percent of GBT transactions replaced every --notify seconds')
+	parser.add_argument('--no-txids', action='store_true',
+			    help='send GBT transactions without txids so they must be hashed')
+	parser.add_argument('--record', default=None,
+			    help='write --templates successive GBT templates to this file and exit')
+	parser.add_argument('--templates', type=int, default=20)
+	parser.add_argument('--btc-address', default='1BitcoinEaterAddressDontSendf59kuE',
+			    help='cgminer --btc-address for GBT solo mining')
+	parser.add_argument('cgminer_args', nargs='*',
+			    help='extra cgminer arguments, after --')
+	args = parser.parse_args()
+
+	if args.record:
+		record_gbt(args)
+		return
+
+	if args.bench:
+		bench(args)
+		return
+
+	stop = threading.Event()
+	if args.gbt:
+		serve_gbt(args, stop)
+		sys.stderr.write('GBT node simulator listening on %s:%d\n' % (args.host, args.port))
+	else:
+		serve(args, stop)
+		sys.stderr.write('Stratum simulator listening on %s:%d\n' % (args.host, args.port))
+	try:
+		while True:
+			time.sleep(1)
+	except KeyboardInterrupt:
+		stop.set()
+
+if __name__ == '__main__':
+	main()
@@ -919,11 +919,20 @@ struct cg_usb_stats_item {
 #define CMD_TIMEOUT 1
 #define CMD_ERROR 2
 
+/* Log2 latency histogram buckets - bucket N counts transfers that took
+ * less than USB_HIST_BASE_US << N microseconds, the last bucket counts
+ * everything slower than that */
+#define USB_HIST_BASE_US 64
+#define USB_HIST_BUCKETS 16
+
 // One for each C_CMD
 struct cg_usb_stats_details {
 	int seq;
 	uint32_t modes;
 	struct cg_usb_stats_item item[CMD_ERROR+1];
+	uint64_t hist[USB_HIST_BUCKETS];
+	uint64_t bytes;
+	uint64_t retries;
 };
 
 // One for each device
@@ -938,15 +947,17 @@ static int next_stat = USB_NOSTAT;
 
 #define SECTOMS(s) ((int)((s) * 1000))
 
-#define USB_STATS(sgpu_, sta_, fin_, err_, mode_, cmd_, seq_, tmo_) \
-		stats(sgpu_, sta_, fin_, err_, mode_, cmd_, seq_, tmo_)
+#define USB_STATS(sgpu_, sta_, fin_, err_, mode_, cmd_, seq_, tmo_, amt_) \
+		stats(sgpu_, sta_, fin_, err_, mode_, cmd_, seq_, tmo_, amt_)
 #define STATS_TIMEVAL(tv_) cgtime(tv_)
 #define USB_REJECT(sgpu_, mode_) rejected_inc(sgpu_, mode_)
+#define USB_RETRY(sgpu_, cmd_, seq_) retry_inc(sgpu_, cmd_, seq_)
 
 #else
-#define USB_STATS(sgpu_, sta_, fin_, err_, mode_, cmd_, seq_, tmo_)
+#define USB_STATS(sgpu_, sta_, fin_, err_, mode_, cmd_, seq_, tmo_, amt_)
 #define STATS_TIMEVAL(tv_)
 #define USB_REJECT(sgpu_, mode_)
+#define USB_RETRY(sgpu_, cmd_, seq_)
 
 #endif // DO_USB_STATS
 
@@ -2541,6 +2552,8 @@ void __usb_detect(struct device_drv *drv, struct cgpu_info *(*device_detect)(str
 }
 
 #if DO_USB_STATS
+static int usb_hist_base = USB_HIST_BASE_US;
+
 static void modes_str(char *buf, uint32_t modes)
 {
 	bool first;
@@ -2594,6 +2607,10 @@ struct api_data *api_usb_stats(__maybe_unused int *count)
 	int device;
 	int cmdseq;
 	char modes_s[32];
+	char hist_s[USB_HIST_BUCKETS * 21 + 1];
+	double rate, total;
+	size_t len;
+	int i;
 
 	if (next_stat == USB_NOSTAT)
 		return NULL;
@@ -2655,6 +2672,21 @@ struct api_data *api_usb_stats(__maybe_unused int *count)
 					&(details->item[CMD_ERROR].first), true);
 		root = api_add_timeval(root, "Last Error",
 					&(details->item[CMD_ERROR].last), true);
+		root = api_add_uint64(root, "Bytes", &(details->bytes), true);
+		total = details->item[CMD_CMD].total_delay +
+			details->item[CMD_TIMEOUT].total_delay +
+			details->item[CMD_ERROR].total_delay;
+		rate = total > 0 ? (double)(details->bytes) / total : 0;
+		root = api_add_double(root, "Bytes/s", &rate, true);
+		root = api_add_uint64(root, "Retries", &(details->retries), true);
+		root = api_add_int(root, "Hist Base us", &usb_hist_base, false);
+		len = 0;
+		hist_s[0] = '\0';
+		for (i = 0; i < USB_HIST_BUCKETS; i++) {
+			len += snprintf(hist_s + len, sizeof(hist_s) - len, "%s%"PRIu64,
+					i ? "/" : "", details->hist[i]);
+		}
+		root = api_add_string(root, "Hist", hist_s, true);
 
 		return root;
 	}
@@ -2701,12 +2733,64 @@ void update_usb_stats(__maybe_unused struct cgpu_info *cgpu)
 #endif
 }
 
+/* Average seconds a successful cmd transfer has taken on this device so far,
+ * or 0 if there have been none, so drivers can allow for the USB delay */
+double usb_cmd_delay(__maybe_unused struct cgpu_info *cgpu, __maybe_unused enum usb_cmds cmd)
+{
+	double delay = 0;
+#if DO_USB_STATS
+	struct cg_usb_stats_item *item;
+
+	mutex_lock(&cgusb_lock);
+	if (cgpu->usbinfo.usbstat > 0) {
+		item = &(usb_stats[cgpu->usbinfo.usbstat - 1].details[cmd * 2].item[CMD_CMD]);
+		if (item->count > 0)
+			delay = item->total_delay / (double)(item->count);
+	}
+	mutex_unlock(&cgusb_lock);
+#endif
+	return delay;
+}
+
+/* Like api_usb_stats() this doesn't lock the stats, so a transfer completing
+ * at the same time may leave a partial result behind */
+void zero_usb_stats(void)
+{
+#if DO_USB_STATS
+	struct cg_usb_stats_details *details;
+	int device, cmdseq, i;
+
+	mutex_lock(&cgusb_lock);
+	for (device = 0; device < next_stat; device++) {
+		for (cmdseq = 0; cmdseq < C_MAX * 2; cmdseq++) {
+			details = &(usb_stats[device].details[cmdseq]);
+			details->modes = MODE_NONE;
+			memset(details->item, 0, sizeof(details->item));
+			memset(details->hist, 0, sizeof(details->hist));
+			details->bytes = 0;
+			details->retries = 0;
+		}
+	}
+	mutex_unlock(&cgusb_lock);
+
+	for (i = 0; i < total_devices; i++) {
+		struct cgpu_info *cgpu = get_devices(i);
+
+		if (cgpu->usbinfo.usbstat < 1)
+			continue;
+		cgpu->usbinfo.tmo_count = 0;
+		memset(cgpu->usbinfo.usb_tmo, 0, sizeof(cgpu->usbinfo.usb_tmo));
+	}
+#endif
+}
+
 #if DO_USB_STATS
-static void stats(struct cgpu_info *cgpu, struct timeval *tv_start, struct timeval *tv_finish, int err, int mode, enum usb_cmds cmd, int seq, int timeout)
+static void stats(struct cgpu_info *cgpu, struct timeval *tv_start, struct timeval *tv_finish, int err, int mode, enum usb_cmds cmd, int seq, int timeout, int amt)
 {
 	struct cg_usb_stats_details *details;
+	uint64_t us, bound;
 	double diff;
-	int item, extrams;
+	int item, extrams, bucket;
 
 	if (cgpu->usbinfo.usbstat < 1)
 		newstats(cgpu);
@@ -2746,6 +2830,10 @@ static void stats(struct cgpu_info *cgpu, struct timeval *tv_start, struct timev
 
 	diff = tdiff(tv_finish, tv_start);
 
+	// Control transfers return the byte count on success
+	if (err > 0)
+		err = LIBUSB_SUCCESS;
+
 	switch (err) {
 		case LIBUSB_SUCCESS:
 			item = CMD_CMD;
@@ -2770,6 +2858,26 @@ static void stats(struct cgpu_info *cgpu, struct timeval *tv_start, struct timev
 	details->item[item].total_delay += diff;
 	cg_memcpy(&(details->item[item].last), tv_start, sizeof(*tv_start));
 	details->item[item].count++;
+
+	us = (uint64_t)(diff * 1000000.0);
+	bound = USB_HIST_BASE_US;
+	for (bucket = 0; bucket < USB_HIST_BUCKETS - 1; bucket++) {
+		if (us < bound)
+			break;
+		bound <<= 1;
+	}
+	details->hist[bucket]++;
+
+	if (amt > 0)
+		details->bytes += amt;
+}
+
+static void retry_inc(struct cgpu_info *cgpu, enum usb_cmds cmd, int seq)
+{
+	if (cgpu->usbinfo.usbstat < 1)
+		newstats(cgpu);
+
+	usb_stats[cgpu->usbinfo.usbstat - 1].details[cmd * 2 + seq].retries++;
 }
 
 static void rejected_inc(struct cgpu_info *cgpu, uint32_t mode)
@@ -2999,6 +3107,7 @@ err_retry:
 		libusb_fill_bulk_transfer(ut.transfer, dev_handle, endpoint, buf,
 					  length, transfer_callback, &ut, bulk_timeout);
 	}
+	*transferred = 0;
 	STATS_TIMEVAL(&tv_start);
 	err = usb_submit_transfer(&ut, ut.transfer, cancellable, tt);
 	errn = errno;
@@ -3009,7 +3118,7 @@ err_retry:
 	complete_usb_transfer(&ut);
 
 	STATS_TIMEVAL(&tv_finish);
-	USB_STATS(cgpu, &tv_start, &tv_finish, err, mode, cmd, seq, timeout);
+	USB_STATS(cgpu, &tv_start, &tv_finish, err, mode, cmd, seq, timeout, *transferred);
 
 	if (err < 0) {
 		applog(LOG_DEBUG, "%s%i: %s (amt=%d err=%d ern=%d)",
@@ -3032,11 +3141,15 @@ err_retry:
 			if (pipeerr)
 				cgpu->usbinfo.clear_fail_count++;
 		} while (pipeerr && ++retries < USB_RETRY_MAX);
-		if (!pipeerr && ++err_retries < USB_RETRY_MAX)
+		if (!pipeerr && ++err_retries < USB_RETRY_MAX) {
+			USB_RETRY(cgpu, cmd, seq);
 			goto err_retry;
+		}
 	}
-	if (err == LIBUSB_ERROR_IO && ++err_retries < USB_RETRY_MAX)
+	if (err == LIBUSB_ERROR_IO && ++err_retries < USB_RETRY_MAX) {
+		USB_RETRY(cgpu, cmd, seq);
 		goto err_retry;
+	}
 	if (NODEV(err))
 		*transferred = 0;
 	else if ((endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN && *transferred)
@@ -3045,6 +3158,222 @@ err_retry:
 	return err;
 }
 
+struct usb_async {
+	struct usb_transfer ut;
+	struct cgpu_info *cgpu;
+	int intinfo;
+	int epinfo;
+	usb_async_cb callback;
+	void *userdata;
+	enum usb_cmds cmd;
+	int mode;
+	int length;
+	bool busy;
+	struct timeval tv_start;
+	unsigned char buf[512];
+};
+
+static void LIBUSB_CALL async_transfer_callback(struct libusb_transfer *transfer)
+{
+	struct usb_async *ua = transfer->user_data;
+
+	ua->ut.cancellable = false;
+	ua->callback(ua, ua->userdata);
+}
+
+struct usb_async *usb_async_init(struct cgpu_info *cgpu, int intinfo, int epinfo,
+				 usb_async_cb callback, void *userdata)
+{
+	struct usb_async *ua = calloc(1, sizeof(*ua));
+
+	if (unlikely(!ua))
+		quit(1, "Failed to calloc usb_async");
+	ua->ut.transfer = libusb_alloc_transfer(0);
+	if (unlikely(!ua->ut.transfer))
+		quit(1, "Failed to libusb_alloc_transfer");
+	ua->ut.transfer->user_data = ua;
+	INIT_LIST_HEAD(&ua->ut.list);
+	ua->cgpu = cgpu;
+	ua->intinfo = intinfo;
+	ua->epinfo = epinfo;
+	ua->callback = callback;
+	ua->userdata = userdata;
+
+	return ua;
+}
+
+/* Submit a single transfer and return without waiting for it. Writes send at
+ * most bufsiz bytes and reads return at most one transfer's worth of data, so
+ * the caller resubmits for the rest. Reads are flagged cancellable so they
+ * are aborted on a work restart or at shutdown, as they are with
+ * usb_read_cancellable, and also have no timeout of their own; the caller
+ * cancels them when it gives up waiting. */
+int usb_async_submit(struct usb_async *ua, const char *buf, size_t bufsiz, enum usb_cmds cmd)
+{
+	struct cgpu_info *cgpu = ua->cgpu;
+	struct libusb_transfer *transfer = ua->ut.transfer;
+	struct cg_usb_device *usbdev;
+	struct usb_epinfo *usb_epinfo;
+	unsigned char endpoint;
+	unsigned int timeout = 0;
+	int err, pstate;
+	bool out, tt;
+
+	if (unlikely(ua->busy))
+		quit(1, "%s%i: usb_async_submit with a transfer in flight",
+		     cgpu->drv->name, cgpu->device_id);
+
+	DEVRLOCK(cgpu, pstate);
+	if (cgpu->usbinfo.nodev) {
+		err = LIBUSB_ERROR_NO_DEVICE;
+		goto out_unlock;
+	}
+
+	usbdev = cgpu->usbdev;
+	usb_epinfo = &(usbdev->found->intinfos[ua->intinfo].epinfos[ua->epinfo]);
+	endpoint = usb_epinfo->ep;
+	out = ((endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT);
+
+	if (bufsiz > sizeof(ua->buf))
+		bufsiz = sizeof(ua->buf);
+	if (out) {
+		/* As in _usb_write, don't end a usb1.1 write on a full packet */
+		if (usbdev->usb11 && (int)bufsiz == usb_epinfo->wMaxPacketSize && bufsiz > 1)
+			bufsiz >>= 1;
+		cg_memcpy(ua->buf, buf, bufsiz);
+		ua->mode = MODE_BULK_WRITE;
+	} else {
+		if (usb_epinfo->att != LIBUSB_TRANSFER_TYPE_INTERRUPT)
+			bufsiz = sizeof(ua->buf);
+		ua->mode = MODE_BULK_READ;
+	}
+#ifdef WIN32
+	timeout = usbdev->found->timeout + WIN_CALLBACK_EXTRA;
+#endif
+
+	if (usb_epinfo->att == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+		libusb_fill_interrupt_transfer(transfer, usbdev->handle, endpoint, ua->buf,
+					       bufsiz, async_transfer_callback, ua, timeout);
+	} else {
+		libusb_fill_bulk_transfer(transfer, usbdev->handle, endpoint, ua->buf,
+					  bufsiz, async_transfer_callback, ua, timeout);
+	}
+	transfer->flags = 0;
+#ifndef HAVE_LIBUSB
+	if (out && usb_epinfo->att != LIBUSB_TRANSFER_TYPE_INTERRUPT)
+		transfer->flags |= LIBUSB_TRANSFER_ADD_ZERO_PACKET;
+#endif
+	ua->cmd = cmd;
+	ua->length = bufsiz;
+	tt = out && usbdev->tt;
+
+	cgtime(&ua->tv_start);
+	err = usb_submit_transfer(&ua->ut, transfer, !out, tt);
+	if (unlikely(err)) {
+		cg_wlock(&cgusb_fd_lock);
+		list_del_init(&ua->ut.list);
+		cg_wunlock(&cgusb_fd_lock);
+		err = usb_transfer_toerr(err);
+		applog(LOG_DEBUG, "%s%i: %s async submit err=%d",
+		       cgpu->drv->name, cgpu->device_id, usb_cmdname(cmd), err);
+	} else
+		ua->busy = true;
+
+out_unlock:
+	if (NODEV(err)) {
+		cg_ruwlock(&cgpu->usbinfo.devlock);
+		release_cgpu(cgpu);
+		DEVWUNLOCK(cgpu, pstate);
+	} else
+		DEVRUNLOCK(cgpu, pstate);
+
+	return err;
+}
+
+void usb_async_cancel(struct usb_async *ua)
+{
+	if (ua->busy)
+		libusb_cancel_transfer(ua->ut.transfer);
+}
+
+/* Collect the result of a transfer once its callback has been run. A
+ * cancelled read completes with LIBUSB_ERROR_TIMEOUT and whatever data had
+ * already arrived. The FTDI status bytes are stripped from reads. */
+int usb_async_complete(struct usb_async *ua, char *buf, size_t bufsiz, int *processed)
+{
+	struct cgpu_info *cgpu = ua->cgpu;
+	struct libusb_transfer *transfer = ua->ut.transfer;
+	struct timeval tv_finish;
+	unsigned char *ptr = ua->buf;
+	int err, got, pstate;
+
+	*processed = 0;
+	if (unlikely(!ua->busy))
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	cg_wlock(&cgusb_fd_lock);
+	list_del_init(&ua->ut.list);
+	cg_wunlock(&cgusb_fd_lock);
+	ua->busy = false;
+
+	cgtime(&tv_finish);
+	err = usb_transfer_toerr(transfer->status);
+	got = transfer->actual_length;
+	USB_STATS(cgpu, &ua->tv_start, &tv_finish, err, ua->mode, ua->cmd, SEQ0,
+		  (int)(tdiff(&tv_finish, &ua->tv_start) * 1000), got);
+
+	DEVRLOCK(cgpu, pstate);
+	if (err == LIBUSB_ERROR_PIPE && !cgpu->usbinfo.nodev) {
+		cgpu->usbinfo.last_pipe = time(NULL);
+		cgpu->usbinfo.pipe_count++;
+		applog(LOG_INFO, "%s%i: libusb pipe error, trying to clear",
+		       cgpu->drv->name, cgpu->device_id);
+		if (libusb_clear_halt(cgpu->usbdev->handle, transfer->endpoint))
+			cgpu->usbinfo.clear_fail_count++;
+	}
+
+	if (NODEV(err) || cgpu->usbinfo.nodev)
+		got = 0;
+	else if (ua->mode == MODE_BULK_READ) {
+		if (cgpu->usbdev->usb_type == USB_TYPE_FTDI) {
+			// first 2 bytes returned are an FTDI status
+			if (got > 2) {
+				got -= 2;
+				ptr += 2;
+			} else
+				got = 0;
+		}
+		if (got > (int)bufsiz)
+			got = bufsiz;
+		if (got)
+			cg_memcpy(buf, ptr, got);
+	}
+	*processed = got;
+
+	if (err < 0 && err != LIBUSB_ERROR_TIMEOUT) {
+		applog(LOG_DEBUG, "%s%i: %s async (amt=%d err=%d)",
+		       cgpu->drv->name, cgpu->device_id, usb_cmdname(ua->cmd), got, err);
+	}
+
+	if (err == LIBUSB_ERROR_NO_DEVICE && !cgpu->usbinfo.nodev) {
+		cg_ruwlock(&cgpu->usbinfo.devlock);
+		release_cgpu(cgpu);
+		DEVWUNLOCK(cgpu, pstate);
+	} else
+		DEVRUNLOCK(cgpu, pstate);
+
+	return err;
+}
+
+void usb_async_free(struct usb_async *ua)
+{
+	if (unlikely(ua->busy))
+		quit(1, "%s%i: usb_async_free with a transfer in flight",
+		     ua->cgpu->drv->name, ua->cgpu->device_id);
+	libusb_free_transfer(ua->ut.transfer);
+	free(ua);
+}
+
 void usb_reset(struct cgpu_info *cgpu)
 {
 	int pstate, err = 0;
@@ -3393,7 +3722,7 @@ int __usb_transfer(struct cgpu_info *cgpu, uint8_t request_type, uint8_t bReques
 	err = usb_control_transfer(cgpu, usbdev->handle, request_type, bRequest,
 				   wValue, wIndex, buf, (uint16_t)siz, timeout);
 	STATS_TIMEVAL(&tv_finish);
-	USB_STATS(cgpu, &tv_start, &tv_finish, err, MODE_CTRL_WRITE, cmd, SEQ0, timeout);
+	USB_STATS(cgpu, &tv_start, &tv_finish, err, MODE_CTRL_WRITE, cmd, SEQ0, timeout, err);
 
 	USBDEBUG("USB debug: @_usb_transfer(%s (nodev=%s)) err=%d%s", cgpu->drv->name, bool_str(cgpu->usbinfo.nodev), err, isnodev(err));
 
@@ -3455,7 +3784,7 @@ int _usb_transfer_read(struct cgpu_info *cgpu, uint8_t request_type, uint8_t bRe
 	err = usb_control_transfer(cgpu, usbdev->handle, request_type, bRequest,
 				   wValue, wIndex, tbuf, (uint16_t)bufsiz, timeout);
 	STATS_TIMEVAL(&tv_finish);
-	USB_STATS(cgpu, &tv_start, &tv_finish, err, MODE_CTRL_READ, cmd, SEQ0, timeout);
+	USB_STATS(cgpu, &tv_start, &tv_finish, err, MODE_CTRL_READ, cmd, SEQ0, timeout, err);
 	cg_memcpy(buf, tbuf, bufsiz);
 
 	USBDEBUG("USB debug: @_usb_transfer_read(%s (nodev=%s)) amt/err=%d%s%s%s", cgpu->drv->name, bool_str(cgpu->usbinfo.nodev), err, isnodev(err), err > 0 ? " = " : BLANK, err > 0 ? bin2hex((unsigned char *)buf, (size_t)err) : BLANK);
@@ -482,9 +482,22 @@ void __usb_detect(struct device_drv *drv, struct cgpu_info *(*device_detect)(str
 #define usb_detect_one(drv, cgpu) __usb_detect(drv, cgpu, true)
 struct api_data *api_usb_stats(int *count);
 void update_usb_stats(struct cgpu_info *cgpu);
+void zero_usb_stats(void);
+double usb_cmd_delay(struct cgpu_info *cgpu, enum usb_cmds cmd);
 void usb_reset(struct cgpu_info *cgpu);
 int _usb_read(struct cgpu_info *cgpu, int intinfo, int epinfo, char *buf, size_t bufsiz, int *processed, int timeout, const char *end, enum usb_cmds cmd, bool readonce, bool cancellable);
 int _usb_write(struct cgpu_info *cgpu, int intinfo, int epinfo, char *buf, size_t bufsiz, int *processed, int timeout, enum usb_cmds);
+/* One asynchronous bulk transfer at a time on an endpoint, for drivers that
+ * run many devices from their own event loop rather than a thread each. The
+ * callback is run in the libusb polling thread and must only hand the
+ * transfer back to the event loop, which then calls usb_async_complete() */
+struct usb_async;
+typedef void (*usb_async_cb)(struct usb_async *ua, void *userdata);
+struct usb_async *usb_async_init(struct cgpu_info *cgpu, int intinfo, int epinfo, usb_async_cb callback, void *userdata);
+int usb_async_submit(struct usb_async *ua, const char *buf, size_t bufsiz, enum usb_cmds cmd);
+void usb_async_cancel(struct usb_async *ua);
+int usb_async_complete(struct usb_async *ua, char *buf, size_t bufsiz, int *processed);
+void usb_async_free(struct usb_async *ua);
 int _usb_transfer(struct cgpu_info *cgpu, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint32_t *data, int siz, unsigned int timeout, enum usb_cmds cmd);
 int _usb_transfer_read(struct cgpu_info *cgpu, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, char *buf, int bufsiz, int *amount, unsigned int timeout, enum usb_cmds cmd);
 int usb_ftdi_cts(struct cgpu_info *cgpu);
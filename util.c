@@ -348,30 +348,39 @@ c_out:
 	return val;
 }
 
-json_t *json_rpc_call(CURL *curl, const char *url,
-		      const char *userpass, const char *rpc_req,
-		      bool probe, bool longpoll, int *rolltime,
-		      struct pool *pool, bool share)
+/* A JSON-RPC request set up on a curl easy handle, to be performed by
+ * json_rpc_call() or by a curl multi handle, and completed by
+ * json_rpc_finish() */
+struct json_rpc {
+	CURL *curl;
+	struct pool *pool;
+	bool probing;
+	struct data_buffer all_data;
+	struct header_info hi;
+	struct curl_slist *headers;
+	struct upload_buffer upload_data;
+	char curl_err_str[CURL_ERROR_SIZE];
+};
+
+/* rpc_req must remain valid until json_rpc_finish() */
+struct json_rpc *json_rpc_start(CURL *curl, const char *url,
+				const char *userpass, const char *rpc_req,
+				bool probe, bool longpoll, struct pool *pool, bool share)
 {
 	long timeout = longpoll ? (60 * 60) : 60;
-	struct data_buffer all_data = {NULL, 0};
-	struct header_info hi = {NULL, 0, NULL, NULL, false, false, false};
 	char len_hdr[64], user_agent_hdr[128];
-	char curl_err_str[CURL_ERROR_SIZE];
-	struct curl_slist *headers = NULL;
-	struct upload_buffer upload_data;
-	json_t *val, *err_val, *res_val;
-	bool probing = false;
-	double byte_count;
-	json_error_t err;
-	int rc;
+	struct json_rpc *rpc;
 
-	memset(&err, 0, sizeof(err));
+	rpc = calloc(sizeof(struct json_rpc), 1);
+	if (unlikely(!rpc))
+		quithere(1, "Failed to calloc json_rpc");
+	rpc->curl = curl;
+	rpc->pool = pool;
 
 	/* it is assumed that 'curl' is freshly [re]initialized at this pt */
 
 	if (probe)
-		probing = !pool->probed;
+		rpc->probing = !pool->probed;
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
 
 	// CURLOPT_VERBOSE won't write to stderr if we use CURLOPT_DEBUGFUNCTION
@@ -389,13 +398,13 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 	if (!opt_delaynet || share)
 		curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, all_data_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &all_data);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &rpc->all_data);
 	curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_data_cb);
-	curl_easy_setopt(curl, CURLOPT_READDATA, &upload_data);
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_err_str);
+	curl_easy_setopt(curl, CURLOPT_READDATA, &rpc->upload_data);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, rpc->curl_err_str);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, resp_hdr_cb);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &hi);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &rpc->hi);
 	curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
 	if (pool->rpc_proxy) {
 		curl_easy_setopt(curl, CURLOPT_PROXY, pool->rpc_proxy);
@@ -415,29 +424,29 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 	if (opt_protocol)
 		applog(LOG_DEBUG, "JSON protocol request:\n%s", rpc_req);
 
-	upload_data.buf = rpc_req;
-	upload_data.len = strlen(rpc_req);
+	rpc->upload_data.buf = rpc_req;
+	rpc->upload_data.len = strlen(rpc_req);
 	sprintf(len_hdr, "Content-Length: %lu",
-		(unsigned long) upload_data.len);
+		(unsigned long) rpc->upload_data.len);
 	sprintf(user_agent_hdr, "User-Agent: %s", PACKAGE_STRING);
 
-	headers = curl_slist_append(headers,
+	rpc->headers = curl_slist_append(rpc->headers,
 		"Content-type: application/json");
-	headers = curl_slist_append(headers,
+	rpc->headers = curl_slist_append(rpc->headers,
 		"X-Mining-Extensions: longpoll midstate rollntime submitold");
 
 	if (likely(global_hashrate)) {
 		char ghashrate[255];
 
 		sprintf(ghashrate, "X-Mining-Hashrate: %llu", global_hashrate);
-		headers = curl_slist_append(headers, ghashrate);
+		rpc->headers = curl_slist_append(rpc->headers, ghashrate);
 	}
 
-	headers = curl_slist_append(headers, len_hdr);
-	headers = curl_slist_append(headers, user_agent_hdr);
-	headers = curl_slist_append(headers, "Expect:"); /* disable Expect hdr*/
+	rpc->headers = curl_slist_append(rpc->headers, len_hdr);
+	rpc->headers = curl_slist_append(rpc->headers, user_agent_hdr);
+	rpc->headers = curl_slist_append(rpc->headers, "Expect:"); /* disable Expect hdr*/
 
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, rpc->headers);
 
 	if (opt_delaynet) {
 		/* Don't delay share submission, but still track the nettime */
@@ -462,13 +471,28 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 		set_nettime();
 	}
 
-	rc = curl_easy_perform(curl);
+	return rpc;
+}
+
+/* Parses the response to a request performed with result rc, frees rpc and
+ * resets its curl handle for reuse. */
+json_t *json_rpc_finish(struct json_rpc *rpc, int rc, int *rolltime)
+{
+	struct header_info *hi = &rpc->hi;
+	struct pool *pool = rpc->pool;
+	CURL *curl = rpc->curl;
+	json_t *val, *err_val, *res_val;
+	double byte_count;
+	json_error_t err;
+
+	memset(&err, 0, sizeof(err));
+
 	if (rc) {
-		applog(LOG_INFO, "HTTP request failed: %s", curl_err_str);
+		applog(LOG_INFO, "HTTP request failed: %s", rpc->curl_err_str);
 		goto err_out;
 	}
 
-	if (!all_data.buf) {
+	if (!rpc->all_data.buf) {
 		applog(LOG_DEBUG, "Empty data received in json_rpc_call.");
 		goto err_out;
 	}
@@ -480,42 +504,42 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 	if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &byte_count) == CURLE_OK)
 		pool->cgminer_pool_stats.bytes_received += byte_count;
 
-	if (probing) {
+	if (rpc->probing) {
 		pool->probed = true;
 		/* If X-Long-Polling was found, activate long polling */
-		if (hi.lp_path) {
+		if (hi->lp_path) {
 			if (pool->hdr_path != NULL)
 				free(pool->hdr_path);
-			pool->hdr_path = hi.lp_path;
+			pool->hdr_path = hi->lp_path;
 		} else
 			pool->hdr_path = NULL;
-		if (hi.stratum_url) {
-			pool->stratum_url = hi.stratum_url;
-			hi.stratum_url = NULL;
+		if (hi->stratum_url) {
+			pool->stratum_url = hi->stratum_url;
+			hi->stratum_url = NULL;
 		}
 	} else {
-		if (hi.lp_path) {
-			free(hi.lp_path);
-			hi.lp_path = NULL;
+		if (hi->lp_path) {
+			free(hi->lp_path);
+			hi->lp_path = NULL;
 		}
-		if (hi.stratum_url) {
-			free(hi.stratum_url);
-			hi.stratum_url = NULL;
+		if (hi->stratum_url) {
+			free(hi->stratum_url);
+			hi->stratum_url = NULL;
 		}
 	}
 
-	*rolltime = hi.rolltime;
-	pool->cgminer_pool_stats.rolltime = hi.rolltime;
-	pool->cgminer_pool_stats.hadrolltime = hi.hadrolltime;
-	pool->cgminer_pool_stats.canroll = hi.canroll;
-	pool->cgminer_pool_stats.hadexpire = hi.hadexpire;
+	*rolltime = hi->rolltime;
+	pool->cgminer_pool_stats.rolltime = hi->rolltime;
+	pool->cgminer_pool_stats.hadrolltime = hi->hadrolltime;
+	pool->cgminer_pool_stats.canroll = hi->canroll;
+	pool->cgminer_pool_stats.hadexpire = hi->hadexpire;
 
-	val = JSON_LOADS(all_data.buf, &err);
+	val = JSON_LOADS(rpc->all_data.buf, &err);
 	if (!val) {
 		applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
 
 		if (opt_protocol)
-			applog(LOG_DEBUG, "JSON protocol response:\n%s", (char *)(all_data.buf));
+			applog(LOG_DEBUG, "JSON protocol response:\n%s", (char *)(rpc->all_data.buf));
 
 		goto err_out;
 	}
@@ -548,26 +572,39 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 		goto err_out;
 	}
 
-	if (hi.reason) {
-		json_object_set_new(val, "reject-reason", json_string(hi.reason));
-		free(hi.reason);
-		hi.reason = NULL;
+	if (hi->reason) {
+		json_object_set_new(val, "reject-reason", json_string(hi->reason));
+		free(hi->reason);
+		hi->reason = NULL;
 	}
 	successful_connect = true;
-	databuf_free(&all_data);
-	curl_slist_free_all(headers);
+	databuf_free(&rpc->all_data);
+	curl_slist_free_all(rpc->headers);
 	curl_easy_reset(curl);
+	free(rpc);
 	return val;
 
 err_out:
-	databuf_free(&all_data);
-	curl_slist_free_all(headers);
+	databuf_free(&rpc->all_data);
+	curl_slist_free_all(rpc->headers);
 	curl_easy_reset(curl);
 	if (!successful_connect)
 		applog(LOG_DEBUG, "Failed to connect in json_rpc_call");
 	curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1);
+	free(rpc);
 	return NULL;
 }
+
+json_t *json_rpc_call(CURL *curl, const char *url,
+		      const char *userpass, const char *rpc_req,
+		      bool probe, bool longpoll, int *rolltime,
+		      struct pool *pool, bool share)
+{
+	struct json_rpc *rpc;
+
+	rpc = json_rpc_start(curl, url, userpass, rpc_req, probe, longpoll, pool, share);
+	return json_rpc_finish(rpc, curl_easy_perform(curl), rolltime);
+}
 #define PROXY_HTTP	CURLPROXY_HTTP
 #define PROXY_HTTP_1_0	CURLPROXY_HTTP_1_0
 #define PROXY_SOCKS4	CURLPROXY_SOCKS4
@@ -1766,6 +1803,9 @@ static bool parse_notify(struct pool *pool, json_t *val)
 	}
 
 	cg_wlock(&pool->data_lock);
+	pool->swork_seq++;
+	if (!pool->swork.job_id || strcmp(pool->swork.job_id, job_id))
+		pool->job_gen++;
 	free(pool->swork.job_id);
 	pool->swork.job_id = job_id;
 	snprintf(pool->prev_hash, 65, "%s", prev_hash);
@@ -1888,6 +1928,7 @@ static bool parse_diff(struct pool *pool, json_t *val)
 	cg_wlock(&pool->data_lock);
 	old_diff = pool->sdiff;
 	pool->sdiff = diff;
+	pool->swork_seq++;
 	cg_wunlock(&pool->data_lock);
 
 	if (old_diff != diff) {
@@ -1932,6 +1973,7 @@ static bool parse_extranonce(struct pool *pool, json_t *val)
 		quithere(1, "Failed to calloc pool->nonce1bin");
 	hex2bin(pool->nonce1bin, pool->nonce1, pool->n1_len);
 	pool->n2size = n2size;
+	pool->swork_seq++;
 	applog(LOG_NOTICE, "Pool %d confirmed mining.extranonce.subscribe with extranonce1 %s extran2size %d",
 				pool->pool_no, pool->nonce1, pool->n2size);
 	cg_wunlock(&pool->data_lock);
@@ -2693,6 +2735,7 @@ resend:
 		quithere(1, "Failed to calloc pool->nonce1bin");
 	hex2bin(pool->nonce1bin, pool->nonce1, pool->n1_len);
 	pool->n2size = n2size;
+	pool->swork_seq++;
 	cg_wunlock(&pool->data_lock);
 
 	if (sessionid)